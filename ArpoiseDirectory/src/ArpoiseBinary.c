@@ -0,0 +1,749 @@
+/*
+ArpoiseBinary.c - binary response format of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+/*
+* The binary format is produced by transcoding the hotspots json after the directory service rewrote it,
+* so that responses of porpoise and responses of native layers are encoded the same way.
+* The json is parsed once, the values are written while parsing and the string table is prepended.
+*
+* A response that is not valid json or that nests too deep is not encoded, the json is sent instead.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "pblCgi.h"
+#include "ArpoiseBinary.h"
+
+/*
+* A growing buffer of bytes.
+*/
+typedef struct ArpoiseBuffer
+{
+	unsigned char* data;
+	size_t length;
+	size_t size;
+} ArpoiseBuffer;
+
+/*
+* An entry of the hash table of the strings in the string table.
+*/
+typedef struct ArpoiseStringSlot
+{
+	size_t offset;              /* offset of the bytes of the string in the string table, 0 for a free slot */
+	size_t length;
+	unsigned int hash;
+	unsigned int index;
+} ArpoiseStringSlot;
+
+typedef struct ArpoiseBinaryEncoder
+{
+	char* ptr;                  /* the json not parsed yet */
+	ArpoiseBuffer values;
+	ArpoiseBuffer table;        /* the strings of the string table */
+	ArpoiseBuffer text;         /* the string being parsed, unescaped */
+	ArpoiseStringSlot* slots;   /* open addressing, the number of slots is a power of two */
+	unsigned int nSlots;
+	unsigned long nStrings;
+} ArpoiseBinaryEncoder;
+
+static void bufferReserve(ArpoiseBuffer* buffer, size_t n)
+{
+	static char* tag = "bufferReserve";
+
+	if (buffer->length + n > buffer->size)
+	{
+		size_t newSize = buffer->size ? 2 * buffer->size : 1024;
+		while (buffer->length + n > newSize)
+		{
+			newSize *= 2;
+		}
+		unsigned char* newData = realloc(buffer->data, newSize);
+		if (!newData)
+		{
+			pblCgiExitOnError("%s: Out of memory, %lu bytes\n", tag, (unsigned long)newSize);
+		}
+		buffer->data = newData;
+		buffer->size = newSize;
+	}
+}
+
+static void bufferAppend(ArpoiseBuffer* buffer, void* data, size_t n)
+{
+	bufferReserve(buffer, n);
+	memcpy(buffer->data + buffer->length, data, n);
+	buffer->length += n;
+}
+
+static void bufferAppendByte(ArpoiseBuffer* buffer, int byte)
+{
+	unsigned char c = (unsigned char)byte;
+	bufferAppend(buffer, &c, 1);
+}
+
+static void bufferAppendNumber(ArpoiseBuffer* buffer, unsigned long value)
+{
+	bufferReserve(buffer, 5);
+	buffer->length += pbl_LongToVarBuf(buffer->data + buffer->length, value);
+}
+
+static void skipWhiteSpace(ArpoiseBinaryEncoder* encoder)
+{
+	while (*encoder->ptr == ' ' || *encoder->ptr == '\t' || *encoder->ptr == '\n' || *encoder->ptr == '\r')
+	{
+		encoder->ptr++;
+	}
+}
+
+static int hexValue(char* ptr)
+{
+	int value = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		char c = ptr[i];
+		value *= 16;
+		if (c >= '0' && c <= '9')
+		{
+			value += c - '0';
+		}
+		else if (c >= 'a' && c <= 'f')
+		{
+			value += c - 'a' + 10;
+		}
+		else if (c >= 'A' && c <= 'F')
+		{
+			value += c - 'A' + 10;
+		}
+		else
+		{
+			return -1;
+		}
+	}
+	return value;
+}
+
+static void appendUtf8(ArpoiseBuffer* buffer, int codePoint)
+{
+	if (codePoint < 0x80)
+	{
+		bufferAppendByte(buffer, codePoint);
+	}
+	else if (codePoint < 0x800)
+	{
+		bufferAppendByte(buffer, 0xC0 | (codePoint >> 6));
+		bufferAppendByte(buffer, 0x80 | (codePoint & 0x3F));
+	}
+	else if (codePoint < 0x10000)
+	{
+		bufferAppendByte(buffer, 0xE0 | (codePoint >> 12));
+		bufferAppendByte(buffer, 0x80 | ((codePoint >> 6) & 0x3F));
+		bufferAppendByte(buffer, 0x80 | (codePoint & 0x3F));
+	}
+	else
+	{
+		bufferAppendByte(buffer, 0xF0 | (codePoint >> 18));
+		bufferAppendByte(buffer, 0x80 | ((codePoint >> 12) & 0x3F));
+		bufferAppendByte(buffer, 0x80 | ((codePoint >> 6) & 0x3F));
+		bufferAppendByte(buffer, 0x80 | (codePoint & 0x3F));
+	}
+}
+
+static void addSlot(ArpoiseBinaryEncoder* encoder, size_t offset, size_t length, unsigned int hash, unsigned int index)
+{
+	static char* tag = "addSlot";
+
+	if (2 * (encoder->nStrings + 1) > encoder->nSlots)
+	{
+		ArpoiseStringSlot* oldSlots = encoder->slots;
+		unsigned int nOldSlots = encoder->nSlots;
+
+		encoder->nSlots = nOldSlots ? 2 * nOldSlots : 256;
+		encoder->slots = pbl_malloc0(tag, encoder->nSlots * sizeof(ArpoiseStringSlot));
+		if (!encoder->slots)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		for (unsigned int i = 0; i < nOldSlots; i++)
+		{
+			if (oldSlots[i].offset)
+			{
+				unsigned int j = oldSlots[i].hash & (encoder->nSlots - 1);
+				while (encoder->slots[j].offset)
+				{
+					j = (j + 1) & (encoder->nSlots - 1);
+				}
+				encoder->slots[j] = oldSlots[i];
+			}
+		}
+		PBL_FREE(oldSlots);
+	}
+
+	unsigned int i = hash & (encoder->nSlots - 1);
+	while (encoder->slots[i].offset)
+	{
+		i = (i + 1) & (encoder->nSlots - 1);
+	}
+	encoder->slots[i].offset = offset;
+	encoder->slots[i].length = length;
+	encoder->slots[i].hash = hash;
+	encoder->slots[i].index = index;
+}
+
+/*
+* Parse a json string and return its index in the string table, -1 if the string is not valid.
+*/
+static long encodeString(ArpoiseBinaryEncoder* encoder)
+{
+	char* ptr = encoder->ptr + 1;
+	encoder->text.length = 0;
+	for (;;)
+	{
+		char* start = ptr;
+		while (*ptr != '"' && *ptr != '\\' && (unsigned char)*ptr >= 0x20)
+		{
+			ptr++;
+		}
+		bufferAppend(&encoder->text, start, ptr - start);
+		if (*ptr == '"')
+		{
+			break;
+		}
+		if (*ptr != '\\')
+		{
+			return -1;
+		}
+		ptr++;
+		switch (*ptr++)
+		{
+		case '"': bufferAppendByte(&encoder->text, '"'); break;
+		case '\\': bufferAppendByte(&encoder->text, '\\'); break;
+		case '/': bufferAppendByte(&encoder->text, '/'); break;
+		case 'b': bufferAppendByte(&encoder->text, '\b'); break;
+		case 'f': bufferAppendByte(&encoder->text, '\f'); break;
+		case 'n': bufferAppendByte(&encoder->text, '\n'); break;
+		case 'r': bufferAppendByte(&encoder->text, '\r'); break;
+		case 't': bufferAppendByte(&encoder->text, '\t'); break;
+		case 'u':
+		{
+			int codePoint = hexValue(ptr);
+			if (codePoint < 0)
+			{
+				return -1;
+			}
+			ptr += 4;
+			if (codePoint >= 0xD800 && codePoint <= 0xDBFF)
+			{
+				int low = ptr[0] == '\\' && ptr[1] == 'u' ? hexValue(ptr + 2) : -1;
+				if (low < 0xDC00 || low > 0xDFFF)
+				{
+					return -1;
+				}
+				codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+				ptr += 6;
+			}
+			else if (codePoint >= 0xDC00 && codePoint <= 0xDFFF)
+			{
+				return -1;
+			}
+			appendUtf8(&encoder->text, codePoint);
+			break;
+		}
+		default:
+			return -1;
+		}
+	}
+	encoder->ptr = ptr + 1;
+
+	size_t length = encoder->text.length;
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = (hash ^ encoder->text.data[i]) * 16777619u;
+	}
+
+	unsigned int mask = encoder->nSlots - 1;
+	for (unsigned int i = hash & mask; encoder->slots[i].offset; i = (i + 1) & mask)
+	{
+		ArpoiseStringSlot* slot = encoder->slots + i;
+		if (slot->hash == hash && slot->length == length && !memcmp(encoder->table.data + slot->offset, encoder->text.data, length))
+		{
+			return slot->index;
+		}
+	}
+
+	unsigned long index = encoder->nStrings++;
+	bufferAppendNumber(&encoder->table, (unsigned long)length);
+	addSlot(encoder, encoder->table.length, length, hash, (unsigned int)index);
+	bufferAppend(&encoder->table, encoder->text.data, length);
+	return (long)index;
+}
+
+static int encodeNumber(ArpoiseBinaryEncoder* encoder)
+{
+	char* ptr = encoder->ptr;
+	int isInteger = 1;
+
+	if (*ptr == '-')
+	{
+		ptr++;
+	}
+	if (*ptr < '0' || *ptr > '9')
+	{
+		return -1;
+	}
+	while (*ptr >= '0' && *ptr <= '9')
+	{
+		ptr++;
+	}
+	if (*ptr == '.' || *ptr == 'e' || *ptr == 'E')
+	{
+		isInteger = 0;
+	}
+
+	char* end = NULL;
+	if (isInteger)
+	{
+		long long value = strtoll(encoder->ptr, &end, 10);
+		if (end == ptr && value >= INT_MIN && value <= INT_MAX)
+		{
+			unsigned int zigzag = ((unsigned int)value << 1) ^ (unsigned int)((int)value >> 31);
+			bufferAppendByte(&encoder->values, ARPOISE_BINARY_INTEGER);
+			bufferAppendNumber(&encoder->values, zigzag);
+			encoder->ptr = ptr;
+			return 0;
+		}
+	}
+
+	double value = strtod(encoder->ptr, &end);
+	if (end == encoder->ptr)
+	{
+		return -1;
+	}
+	unsigned long long bits;
+	memcpy(&bits, &value, sizeof(bits));
+	unsigned char bytes[8];
+	for (int i = 0; i < 8; i++)
+	{
+		bytes[i] = (unsigned char)(bits >> (8 * i));
+	}
+	bufferAppendByte(&encoder->values, ARPOISE_BINARY_DOUBLE);
+	bufferAppend(&encoder->values, bytes, sizeof(bytes));
+	encoder->ptr = end;
+	return 0;
+}
+
+static int encodeValue(ArpoiseBinaryEncoder* encoder, int depth)
+{
+	if (depth > ARPOISE_BINARY_MAX_DEPTH)
+	{
+		return -1;
+	}
+
+	skipWhiteSpace(encoder);
+	char c = *encoder->ptr;
+	if (c == '{' || c == '[')
+	{
+		char close = c == '{' ? '}' : ']';
+		bufferAppendByte(&encoder->values, c == '{' ? ARPOISE_BINARY_OBJECT : ARPOISE_BINARY_ARRAY);
+		encoder->ptr++;
+		skipWhiteSpace(encoder);
+		if (*encoder->ptr != close)
+		{
+			for (;;)
+			{
+				if (c == '{')
+				{
+					skipWhiteSpace(encoder);
+					if (*encoder->ptr != '"')
+					{
+						return -1;
+					}
+					long key = encodeString(encoder);
+					if (key < 0)
+					{
+						return -1;
+					}
+					bufferAppendNumber(&encoder->values, (unsigned long)key + 1);
+					skipWhiteSpace(encoder);
+					if (*encoder->ptr++ != ':')
+					{
+						return -1;
+					}
+				}
+				if (encodeValue(encoder, depth + 1))
+				{
+					return -1;
+				}
+				skipWhiteSpace(encoder);
+				if (*encoder->ptr != ',')
+				{
+					break;
+				}
+				encoder->ptr++;
+			}
+			if (*encoder->ptr != close)
+			{
+				return -1;
+			}
+		}
+		encoder->ptr++;
+		bufferAppendByte(&encoder->values, c == '{' ? 0 : ARPOISE_BINARY_END);
+		return 0;
+	}
+	if (c == '"')
+	{
+		long index = encodeString(encoder);
+		if (index < 0)
+		{
+			return -1;
+		}
+		bufferAppendByte(&encoder->values, ARPOISE_BINARY_STRING);
+		bufferAppendNumber(&encoder->values, (unsigned long)index);
+		return 0;
+	}
+	if (!strncmp(encoder->ptr, "null", 4))
+	{
+		bufferAppendByte(&encoder->values, ARPOISE_BINARY_NULL);
+		encoder->ptr += 4;
+		return 0;
+	}
+	if (!strncmp(encoder->ptr, "false", 5))
+	{
+		bufferAppendByte(&encoder->values, ARPOISE_BINARY_FALSE);
+		encoder->ptr += 5;
+		return 0;
+	}
+	if (!strncmp(encoder->ptr, "true", 4))
+	{
+		bufferAppendByte(&encoder->values, ARPOISE_BINARY_TRUE);
+		encoder->ptr += 4;
+		return 0;
+	}
+	return encodeNumber(encoder);
+}
+
+/*
+* Encode a json document in the binary format.
+*
+* Returns the malloced binary and sets its length, NULL if the json is not valid.
+*/
+unsigned char* arpoiseJsonToBinary(char* json, size_t* length)
+{
+	ArpoiseBinaryEncoder encoder;
+	memset(&encoder, 0, sizeof(encoder));
+	encoder.ptr = json;
+
+	// The empty string is the first string of the table, so that no string starts at offset 0
+	bufferAppendNumber(&encoder.table, 0);
+	addSlot(&encoder, encoder.table.length, 0, 2166136261u, 0);
+	encoder.nStrings = 1;
+
+	int rc = encodeValue(&encoder, 0);
+	if (!rc)
+	{
+		skipWhiteSpace(&encoder);
+		rc = *encoder.ptr ? -1 : 0;
+	}
+
+	ArpoiseBuffer result = { NULL, 0, 0 };
+	if (!rc)
+	{
+		bufferAppend(&result, ARPOISE_BINARY_MAGIC, 4);
+		bufferAppendByte(&result, ARPOISE_BINARY_VERSION);
+		bufferAppendNumber(&result, encoder.nStrings);
+		bufferAppend(&result, encoder.table.data, encoder.table.length);
+		bufferAppend(&result, encoder.values.data, encoder.values.length);
+		*length = result.length;
+	}
+
+	PBL_FREE(encoder.slots);
+	PBL_FREE(encoder.values.data);
+	PBL_FREE(encoder.table.data);
+	PBL_FREE(encoder.text.data);
+	return result.data;
+}
+
+typedef struct ArpoiseBinaryDecoder
+{
+	unsigned char* ptr;
+	unsigned char* end;
+	unsigned long nStrings;
+	unsigned char** strings;    /* the start of each string of the table */
+	unsigned long* lengths;
+	ArpoiseBuffer json;
+} ArpoiseBinaryDecoder;
+
+static int decodeNumber(ArpoiseBinaryDecoder* decoder, unsigned long* value)
+{
+	if (decoder->ptr >= decoder->end)
+	{
+		return -1;
+	}
+	int c = *decoder->ptr;
+	int size = !(c & 0x80) ? 1 : !(c & 0x40) ? 2 : !(c & 0x20) ? 3 : !(c & 0x10) ? 4 : 5;
+	if (decoder->end - decoder->ptr < size)
+	{
+		return -1;
+	}
+	decoder->ptr += pbl_VarBufToLong(decoder->ptr, value);
+	return 0;
+}
+
+static void jsonAppend(ArpoiseBinaryDecoder* decoder, char* data, size_t n)
+{
+	bufferAppend(&decoder->json, data, n);
+}
+
+/*
+* Append a string of the table as json string, escaped the way porpoise escapes.
+*/
+static int decodeString(ArpoiseBinaryDecoder* decoder, unsigned long index)
+{
+	if (index >= decoder->nStrings)
+	{
+		return -1;
+	}
+
+	char* ptr = (char*)decoder->strings[index];
+	char* end = ptr + decoder->lengths[index];
+	jsonAppend(decoder, "\"", 1);
+	while (ptr < end)
+	{
+		char* start = ptr;
+		while (ptr < end && *ptr != '"' && *ptr != '\\' && *ptr != '/' && (unsigned char)*ptr >= 0x20)
+		{
+			ptr++;
+		}
+		jsonAppend(decoder, start, ptr - start);
+		if (ptr >= end)
+		{
+			break;
+		}
+		char escape[8];
+		switch (*ptr)
+		{
+		case '"': strcpy(escape, "\\\""); break;
+		case '\\': strcpy(escape, "\\\\"); break;
+		case '/': strcpy(escape, "\\/"); break;
+		case '\b': strcpy(escape, "\\b"); break;
+		case '\f': strcpy(escape, "\\f"); break;
+		case '\n': strcpy(escape, "\\n"); break;
+		case '\r': strcpy(escape, "\\r"); break;
+		case '\t': strcpy(escape, "\\t"); break;
+		default: snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)*ptr); break;
+		}
+		jsonAppend(decoder, escape, strlen(escape));
+		ptr++;
+	}
+	jsonAppend(decoder, "\"", 1);
+	return 0;
+}
+
+static int decodeValue(ArpoiseBinaryDecoder* decoder, int depth)
+{
+	if (depth > ARPOISE_BINARY_MAX_DEPTH || decoder->ptr >= decoder->end)
+	{
+		return -1;
+	}
+
+	int type = *decoder->ptr++;
+	switch (type)
+	{
+	case ARPOISE_BINARY_NULL:
+		jsonAppend(decoder, "null", 4);
+		return 0;
+
+	case ARPOISE_BINARY_FALSE:
+		jsonAppend(decoder, "false", 5);
+		return 0;
+
+	case ARPOISE_BINARY_TRUE:
+		jsonAppend(decoder, "true", 4);
+		return 0;
+
+	case ARPOISE_BINARY_INTEGER:
+	{
+		unsigned long zigzag;
+		if (decodeNumber(decoder, &zigzag))
+		{
+			return -1;
+		}
+		char buffer[16];
+		int value = (int)((unsigned int)zigzag >> 1) ^ -(int)(zigzag & 1);
+		jsonAppend(decoder, buffer, snprintf(buffer, sizeof(buffer), "%d", value));
+		return 0;
+	}
+
+	case ARPOISE_BINARY_DOUBLE:
+	{
+		if (decoder->end - decoder->ptr < 8)
+		{
+			return -1;
+		}
+		unsigned long long bits = 0;
+		for (int i = 7; i >= 0; i--)
+		{
+			bits = (bits << 8) | decoder->ptr[i];
+		}
+		decoder->ptr += 8;
+		double value;
+		memcpy(&value, &bits, sizeof(value));
+
+		// The shortest of the two precisions that gives back the same double, always with a fraction or an exponent
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%.15g", value);
+		if (strtod(buffer, NULL) != value)
+		{
+			snprintf(buffer, sizeof(buffer), "%.17g", value);
+		}
+		if (!strpbrk(buffer, ".en"))
+		{
+			strcat(buffer, ".0");
+		}
+		jsonAppend(decoder, buffer, strlen(buffer));
+		return 0;
+	}
+
+	case ARPOISE_BINARY_STRING:
+	{
+		unsigned long index;
+		return decodeNumber(decoder, &index) ? -1 : decodeString(decoder, index);
+	}
+
+	case ARPOISE_BINARY_ARRAY:
+	case ARPOISE_BINARY_OBJECT:
+		jsonAppend(decoder, type == ARPOISE_BINARY_ARRAY ? "[" : "{", 1);
+		for (int i = 0; ; i++)
+		{
+			unsigned long key = 0;
+			if (type == ARPOISE_BINARY_OBJECT)
+			{
+				if (decodeNumber(decoder, &key))
+				{
+					return -1;
+				}
+			}
+			else if (decoder->ptr < decoder->end && *decoder->ptr == ARPOISE_BINARY_END)
+			{
+				decoder->ptr++;
+				break;
+			}
+			if (type == ARPOISE_BINARY_OBJECT && key == 0)
+			{
+				break;
+			}
+			if (i > 0)
+			{
+				jsonAppend(decoder, ",", 1);
+			}
+			if (type == ARPOISE_BINARY_OBJECT)
+			{
+				if (decodeString(decoder, key - 1))
+				{
+					return -1;
+				}
+				jsonAppend(decoder, ":", 1);
+			}
+			if (decodeValue(decoder, depth + 1))
+			{
+				return -1;
+			}
+		}
+		jsonAppend(decoder, type == ARPOISE_BINARY_ARRAY ? "]" : "}", 1);
+		return 0;
+	}
+	return -1;
+}
+
+/*
+* Decode a binary response to json.
+*
+* Returns the malloced json, NULL if the data is not a binary response.
+*/
+char* arpoiseBinaryToJson(unsigned char* data, size_t length)
+{
+	static char* tag = "arpoiseBinaryToJson";
+
+	if (length < 5 || memcmp(data, ARPOISE_BINARY_MAGIC, 4) || data[4] != ARPOISE_BINARY_VERSION)
+	{
+		return NULL;
+	}
+
+	ArpoiseBinaryDecoder decoder;
+	memset(&decoder, 0, sizeof(decoder));
+	decoder.ptr = data + 5;
+	decoder.end = data + length;
+
+	int rc = decodeNumber(&decoder, &decoder.nStrings);
+	if (!rc && decoder.nStrings > length)
+	{
+		rc = -1;
+	}
+	if (!rc)
+	{
+		decoder.strings = pbl_malloc0(tag, (decoder.nStrings + 1) * sizeof(unsigned char*));
+		decoder.lengths = pbl_malloc0(tag, (decoder.nStrings + 1) * sizeof(unsigned long));
+		if (!decoder.strings || !decoder.lengths)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+	}
+	for (unsigned long i = 0; !rc && i < decoder.nStrings; i++)
+	{
+		rc = decodeNumber(&decoder, &decoder.lengths[i]);
+		if (!rc && decoder.lengths[i] > (unsigned long)(decoder.end - decoder.ptr))
+		{
+			rc = -1;
+		}
+		decoder.strings[i] = decoder.ptr;
+		decoder.ptr += rc ? 0 : decoder.lengths[i];
+	}
+	if (!rc)
+	{
+		rc = decodeValue(&decoder, 0);
+	}
+	if (!rc && decoder.ptr != decoder.end)
+	{
+		rc = -1;
+	}
+
+	if (rc)
+	{
+		PBL_FREE(decoder.json.data);
+	}
+	else
+	{
+		bufferAppendByte(&decoder.json, '\0');
+	}
+	PBL_FREE(decoder.strings);
+	PBL_FREE(decoder.lengths);
+	return (char*)decoder.json.data;
+}
@@ -0,0 +1,82 @@
+#ifndef _ARPOISE_BINARY_H_
+#define _ARPOISE_BINARY_H_
+/*
+ArpoiseBinary.h - include file for the binary response format of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+
+	/*****************************************************************************/
+	/* #defines                                                                  */
+	/*****************************************************************************/
+
+#define ARPOISE_BINARY_MAGIC                   "ARPB"
+#define ARPOISE_BINARY_VERSION                 1
+#define ARPOISE_BINARY_CONTENT_TYPE            "application/x-arpoise-binary"
+
+	/*
+	* A binary response is the magic, one byte of version, the string table and one value.
+	*
+	* The string table is the number of strings followed by the length and the UTF-8 bytes of each string.
+	* Each object key and each string value is stored once in the table and referenced by its index.
+	* Counts, lengths, indices and integers are variable length numbers as written by pbl_LongToVarBuf,
+	* integers are zigzag encoded first, so that small negative numbers are short too.
+	*
+	* Each value starts with a byte of type. Arrays are followed by their values and a byte ARPOISE_BINARY_END.
+	* Objects are followed by pairs of the index of a key plus one and a value, and a 0 instead of a key.
+	*/
+#define ARPOISE_BINARY_NULL                    0
+#define ARPOISE_BINARY_FALSE                   1
+#define ARPOISE_BINARY_TRUE                    2
+#define ARPOISE_BINARY_INTEGER                 3 /* zigzag encoded 32 bit integer */
+#define ARPOISE_BINARY_DOUBLE                  4 /* 8 bytes IEEE 754, little endian */
+#define ARPOISE_BINARY_STRING                  5 /* index into the string table */
+#define ARPOISE_BINARY_ARRAY                   6
+#define ARPOISE_BINARY_OBJECT                  7
+#define ARPOISE_BINARY_END                     8
+
+#define ARPOISE_BINARY_MAX_DEPTH               64
+
+	/*****************************************************************************/
+	/* Function declarations                                                     */
+	/*****************************************************************************/
+
+	extern unsigned char* arpoiseJsonToBinary(char* json, size_t* length);
+	extern char* arpoiseBinaryToJson(unsigned char* data, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ArpoiseBinaryTool.c - decodes and measures the binary responses of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+/*
+* Usage: ArpoiseBinaryTool -d <binary response>
+*        ArpoiseBinaryTool -e <json response> <binary response>
+*        ArpoiseBinaryTool -b <json response> [iterations]
+*
+* -d prints the json of a binary response, -e encodes a json response as the directory service does.
+* -b encodes the json response and decodes it again, checks that the round trip gives the same binary
+* and prints the sizes of both formats, gzip compressed too, and the time encoding and decoding take.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef ARPOISE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "pblCgi.h"
+#include "ArpoiseBinary.h"
+
+static char* readFile(char* path, size_t* length)
+{
+	FILE* stream = fopen(path, "rb");
+	if (!stream)
+	{
+		fprintf(stderr, "%s: cannot be read\n", path);
+		return NULL;
+	}
+	fseek(stream, 0, SEEK_END);
+	long size = ftell(stream);
+	fseek(stream, 0, SEEK_SET);
+
+	char* data = pbl_malloc0("readFile", size + 1);
+	if (!data)
+	{
+		pblCgiExitOnError("readFile: pbl_errno = %d, message='%s'\n", pbl_errno, pbl_errstr);
+	}
+	*length = fread(data, 1, size, stream);
+	fclose(stream);
+	return data;
+}
+
+static unsigned long gzipLength(void* data, size_t length)
+{
+#ifdef ARPOISE_ZLIB
+	uLongf size = compressBound(length) + 32;
+	Bytef* buffer = malloc(size);
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (!buffer || deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		free(buffer);
+		return 0;
+	}
+	stream.next_in = data;
+	stream.avail_in = (uInt)length;
+	stream.next_out = buffer;
+	stream.avail_out = (uInt)size;
+	deflate(&stream, Z_FINISH);
+	unsigned long result = stream.total_out;
+	deflateEnd(&stream);
+	free(buffer);
+	return result;
+#else
+	return 0;
+#endif
+}
+
+static double microSeconds(clock_t start, int iterations)
+{
+	return (double)(clock() - start) * 1000000.0 / CLOCKS_PER_SEC / iterations;
+}
+
+static int benchmark(char* path, int iterations)
+{
+	size_t jsonLength = 0;
+	char* json = readFile(path, &jsonLength);
+	if (!json)
+	{
+		return 1;
+	}
+
+	size_t length = 0;
+	unsigned char* binary = arpoiseJsonToBinary(json, &length);
+	if (!binary)
+	{
+		fprintf(stderr, "%s: is not valid json\n", path);
+		return 1;
+	}
+	char* decoded = arpoiseBinaryToJson(binary, length);
+	size_t roundTripLength = 0;
+	unsigned char* roundTrip = decoded ? arpoiseJsonToBinary(decoded, &roundTripLength) : NULL;
+	if (!roundTrip || roundTripLength != length || memcmp(roundTrip, binary, length))
+	{
+		fprintf(stderr, "%s: the round trip does not give the same binary\n", path);
+		return 1;
+	}
+
+	clock_t start = clock();
+	for (int i = 0; i < iterations; i++)
+	{
+		size_t n;
+		unsigned char* data = arpoiseJsonToBinary(json, &n);
+		PBL_FREE(data);
+	}
+	double encode = microSeconds(start, iterations);
+
+	start = clock();
+	for (int i = 0; i < iterations; i++)
+	{
+		char* data = arpoiseBinaryToJson(binary, length);
+		PBL_FREE(data);
+	}
+	double decode = microSeconds(start, iterations);
+
+	printf("%s: round trip ok\n", path);
+	printf("json   %8lu bytes, %8lu gzip bytes\n", (unsigned long)jsonLength, gzipLength(json, jsonLength));
+	printf("binary %8lu bytes, %8lu gzip bytes\n", (unsigned long)length, gzipLength(binary, length));
+	printf("encode %10.1f us, decode to json %10.1f us, %d iterations\n", encode, decode, iterations);
+
+	PBL_FREE(roundTrip);
+	PBL_FREE(decoded);
+	PBL_FREE(binary);
+	PBL_FREE(json);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc >= 3 && !strcmp(argv[1], "-d"))
+	{
+		size_t length = 0;
+		char* data = readFile(argv[2], &length);
+		char* json = data ? arpoiseBinaryToJson((unsigned char*)data, length) : NULL;
+		if (!json)
+		{
+			fprintf(stderr, "%s: is not a binary response\n", argv[2]);
+			return 1;
+		}
+		puts(json);
+		return 0;
+	}
+	if (argc >= 4 && !strcmp(argv[1], "-e"))
+	{
+		size_t length = 0;
+		char* json = readFile(argv[2], &length);
+		unsigned char* binary = json ? arpoiseJsonToBinary(json, &length) : NULL;
+		if (!binary)
+		{
+			fprintf(stderr, "%s: is not valid json\n", argv[2]);
+			return 1;
+		}
+		FILE* stream = fopen(argv[3], "wb");
+		if (!stream || fwrite(binary, 1, length, stream) != length)
+		{
+			fprintf(stderr, "%s: cannot be written\n", argv[3]);
+			return 1;
+		}
+		fclose(stream);
+		return 0;
+	}
+	if (argc >= 3 && !strcmp(argv[1], "-b"))
+	{
+		int iterations = argc >= 4 ? atoi(argv[3]) : 1000;
+		return benchmark(argv[2], iterations > 0 ? iterations : 1);
+	}
+
+	fprintf(stderr, "Usage: %s -d <binary response>\n       %s -e <json response> <binary response>\n       %s -b <json response> [iterations]\n",
+		argv[0], argv[0], argv[0]);
+	return 1;
+}
@@ -0,0 +1,727 @@
+/*
+ArpoiseConfig.c - configuration of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+/*
+* The configuration text is read with pblCgiFileToMap, so that the values are the ones the text always gave.
+* ArpoiseConfigCompiler writes the configuration read to a compiled file next to the text.
+* The directory service maps the compiled file instead of reading the text on every request,
+* a compiled file older than its text is ignored and the text is read instead.
+*
+* Besides the values, the areas and the device positions are kept split and parsed.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#endif
+
+#include "ArpoiseConfig.h"
+
+#define ARPOISE_ALIGN8(n) (((n) + 7) & ~((long long)7))
+
+#define ARPOISE_CONFIG_MAX_SEED                (1 << 16)
+
+static void* configMalloc(char* tag, size_t size)
+{
+	void* result = pbl_malloc0(tag, size);
+	if (!result)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	return result;
+}
+
+/*
+* Return the modification time and the size of a file, -1 if the file does not exist.
+*/
+static int configFileVersion(char* path, long* version, long* size)
+{
+	struct stat statBuffer;
+	if (stat(path, &statBuffer))
+	{
+		return -1;
+	}
+	*version = (long)statBuffer.st_mtime;
+	*size = (long)statBuffer.st_size;
+	return 0;
+}
+
+/*
+* FNV-1a of the key with the seed mixed into the offset basis and a final avalanche,
+* so that the low bits used to select a slot depend on all bytes of the key.
+*/
+static unsigned int configHash(char* key, unsigned int seed)
+{
+	unsigned int hash = (2166136261u ^ seed) * 16777619u;
+	for (unsigned char* ptr = (unsigned char*)key; *ptr; ptr++)
+	{
+		hash ^= *ptr;
+		hash *= 16777619u;
+	}
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	return hash;
+}
+
+static ArpoiseConfigEntry* configEntry(ArpoiseConfig* config, char* key)
+{
+	unsigned int seed = config->seeds[configHash(key, 0) % config->nBuckets];
+	ArpoiseConfigEntry* entry = config->slots + (configHash(key, seed) & (config->nSlots - 1));
+	if (entry->key == ARPOISE_CONFIG_FREE_SLOT || strcmp(config->strings + entry->key, key))
+	{
+		return NULL;
+	}
+	return entry;
+}
+
+/*****************************************************************************/
+/* Reading the configuration text                                            */
+/*****************************************************************************/
+
+typedef struct ConfigStringPool
+{
+	char* data;
+	size_t length;
+	size_t size;
+} ConfigStringPool;
+
+static unsigned int configAddString(ConfigStringPool* pool, char* string)
+{
+	size_t n = strlen(string) + 1;
+	if (pool->length + n > pool->size)
+	{
+		size_t newSize = pool->size ? 2 * pool->size : 1024;
+		while (newSize < pool->length + n)
+		{
+			newSize *= 2;
+		}
+		char* newData = configMalloc("configAddString", newSize);
+		if (pool->length)
+		{
+			memcpy(newData, pool->data, pool->length);
+		}
+		PBL_FREE(pool->data);
+		pool->data = newData;
+		pool->size = newSize;
+	}
+	memcpy(pool->data + pool->length, string, n);
+	unsigned int offset = (unsigned int)pool->length;
+	pool->length += n;
+	return offset;
+}
+
+static int configIsInteger(char* value, int* integer)
+{
+	if (!*value)
+	{
+		return 0;
+	}
+	char* end = NULL;
+	errno = 0;
+	long number = strtol(value, &end, 10);
+	if (*end || errno || number < INT_MIN || number > INT_MAX)
+	{
+		return 0;
+	}
+	*integer = (int)number;
+	return 1;
+}
+
+static void configFreeList(PblList* list)
+{
+	while (!pblListIsEmpty(list))
+	{
+		char* item = pblListPop(list);
+		PBL_FREE(item);
+	}
+	pblListFree(list);
+}
+
+typedef struct ConfigBucket
+{
+	unsigned int bucket;
+	int nEntries;
+	int first;                  /* index of the first entry of the bucket in the entries ordered by bucket */
+} ConfigBucket;
+
+static int compareBuckets(const void* left, const void* right)
+{
+	const ConfigBucket* leftBucket = left;
+	const ConfigBucket* rightBucket = right;
+	if (leftBucket->nEntries != rightBucket->nEntries)
+	{
+		return rightBucket->nEntries - leftBucket->nEntries;
+	}
+	return leftBucket->bucket < rightBucket->bucket ? -1 : leftBucket->bucket > rightBucket->bucket;
+}
+
+/*
+* Place the entries into the slots, largest buckets first, trying seeds until the entries of a bucket
+* all get free slots. Returns 0 if a bucket cannot be placed, the caller retries with more slots.
+*/
+static int configPlaceEntries(ArpoiseConfig* config, ArpoiseConfigEntry* entries, int nEntries)
+{
+	static char* tag = "configPlaceEntries";
+
+	for (unsigned int i = 0; i < config->nSlots; i++)
+	{
+		config->slots[i].key = ARPOISE_CONFIG_FREE_SLOT;
+	}
+	memset(config->seeds, 0, config->nBuckets * sizeof(unsigned int));
+
+	ConfigBucket* buckets = configMalloc(tag, config->nBuckets * sizeof(ConfigBucket));
+	unsigned int* entryBuckets = configMalloc(tag, (nEntries + 1) * sizeof(unsigned int));
+	unsigned int* bucketSlots = configMalloc(tag, (nEntries + 1) * sizeof(unsigned int));
+	ArpoiseConfigEntry** orderedEntries = configMalloc(tag, (nEntries + 1) * sizeof(ArpoiseConfigEntry*));
+
+	for (unsigned int i = 0; i < config->nBuckets; i++)
+	{
+		buckets[i].bucket = i;
+	}
+	for (int i = 0; i < nEntries; i++)
+	{
+		entryBuckets[i] = configHash(config->strings + entries[i].key, 0) % config->nBuckets;
+		buckets[entryBuckets[i]].nEntries++;
+	}
+	int first = 0;
+	for (unsigned int i = 0; i < config->nBuckets; i++)
+	{
+		buckets[i].first = first;
+		first += buckets[i].nEntries;
+		buckets[i].nEntries = 0;
+	}
+	for (int i = 0; i < nEntries; i++)
+	{
+		ConfigBucket* bucket = buckets + entryBuckets[i];
+		orderedEntries[bucket->first + bucket->nEntries++] = entries + i;
+	}
+	qsort(buckets, config->nBuckets, sizeof(ConfigBucket), compareBuckets);
+
+	int rc = 1;
+	for (unsigned int i = 0; rc && i < config->nBuckets && buckets[i].nEntries > 0; i++)
+	{
+		int n = buckets[i].nEntries;
+		ArpoiseConfigEntry** bucketEntries = orderedEntries + buckets[i].first;
+
+		unsigned int seed = 1;
+		for (; seed < ARPOISE_CONFIG_MAX_SEED; seed++)
+		{
+			int j = 0;
+			for (; j < n; j++)
+			{
+				bucketSlots[j] = configHash(config->strings + bucketEntries[j]->key, seed) & (config->nSlots - 1);
+				if (config->slots[bucketSlots[j]].key != ARPOISE_CONFIG_FREE_SLOT)
+				{
+					break;
+				}
+				int k = 0;
+				while (k < j && bucketSlots[k] != bucketSlots[j])
+				{
+					k++;
+				}
+				if (k < j)
+				{
+					break;
+				}
+			}
+			if (j == n)
+			{
+				break;
+			}
+		}
+		if (seed == ARPOISE_CONFIG_MAX_SEED)
+		{
+			rc = 0;
+			break;
+		}
+		config->seeds[buckets[i].bucket] = seed;
+		for (int j = 0; j < n; j++)
+		{
+			config->slots[bucketSlots[j]] = *bucketEntries[j];
+		}
+	}
+
+	PBL_FREE(buckets);
+	PBL_FREE(entryBuckets);
+	PBL_FREE(bucketSlots);
+	PBL_FREE(orderedEntries);
+	return rc;
+}
+
+/*
+* Read a configuration text, exits if it cannot be read.
+*/
+ArpoiseConfig* arpoiseParseConfig(char* source)
+{
+	static char* tag = "arpoiseParseConfig";
+
+	PblMap* map = pblCgiFileToMap(NULL, source);
+
+	ArpoiseConfig* config = configMalloc(tag, sizeof(ArpoiseConfig));
+	config->source = pblCgiStrDup(source);
+	configFileVersion(source, &config->version, &config->size);
+
+	ConfigStringPool pool = { NULL, 0, 0 };
+	configAddString(&pool, "");
+
+	int nEntries = 0;
+	ArpoiseConfigEntry* entries = configMalloc(tag, (pblMapSize(map) + 1) * sizeof(ArpoiseConfigEntry));
+
+	PblIterator* iterator = pblMapIteratorNew(map);
+	if (!iterator)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	while (pblIteratorHasNext(iterator) > 0)
+	{
+		PblMapEntry* mapEntry = pblIteratorNext(iterator);
+		ArpoiseConfigEntry* entry = entries + nEntries++;
+		char* value = pblMapEntryValue(mapEntry);
+
+		entry->key = configAddString(&pool, pblMapEntryKey(mapEntry));
+		entry->value = configAddString(&pool, value);
+		entry->isInteger = configIsInteger(value, &entry->integer);
+	}
+	pblIteratorFree(iterator);
+
+	ArpoiseConfigArea* areas = configMalloc(tag, ARPOISE_CONFIG_MAX_AREAS * sizeof(ArpoiseConfigArea));
+	for (int i = 1; i <= ARPOISE_CONFIG_MAX_AREAS; i++)
+	{
+		char number[PBL_CGI_INT_STRING_SIZE];
+		char* areaKey = pblCgiStrConcat("Area_", pblCgiIntToStr(number, i), NULL);
+		char* areaValue = pblMapGetStr(map, areaKey);
+		PBL_FREE(areaKey);
+
+		if (pblCgiStrIsNullOrWhiteSpace(areaValue))
+		{
+			break;
+		}
+		PblList* locationList = pblCgiStrSplitToList(areaValue, ",");
+		if (pblListSize(locationList) == 4)
+		{
+			ArpoiseConfigArea* area = areas + config->nAreas++;
+			area->number = i;
+			area->minLatE6 = atoi(pblListGet(locationList, 0));
+			area->minLonE6 = atoi(pblListGet(locationList, 1));
+			area->maxLatE6 = atoi(pblListGet(locationList, 2));
+			area->maxLonE6 = atoi(pblListGet(locationList, 3));
+		}
+		configFreeList(locationList);
+	}
+	config->areas = areas;
+
+	char* devicePositionValue = pblMapGetStr(map, "DevicePosition");
+	if (!pblCgiStrIsNullOrWhiteSpace(devicePositionValue))
+	{
+		PblList* devicePositionList = pblCgiStrSplitToList(devicePositionValue, ",");
+		int listSize = pblListSize(devicePositionList);
+
+		config->devices = configMalloc(tag, (listSize / 3 + 1) * sizeof(ArpoiseConfigDevice));
+		for (int i = 0; i < listSize - 2; i += 3)
+		{
+			ArpoiseConfigDevice* device = config->devices + config->nDevices++;
+			device->device = configAddString(&pool, pblListGet(devicePositionList, i));
+			device->lat = configAddString(&pool, pblListGet(devicePositionList, i + 1));
+			device->lon = configAddString(&pool, pblListGet(devicePositionList, i + 2));
+		}
+		configFreeList(devicePositionList);
+	}
+	else
+	{
+		config->devices = configMalloc(tag, sizeof(ArpoiseConfigDevice));
+	}
+	pblMapFree(map);
+
+	config->strings = pool.data;
+	config->stringsLength = (unsigned int)pool.length;
+
+	config->nEntries = nEntries;
+	config->nBuckets = nEntries / 2 + 1;
+	config->seeds = configMalloc(tag, config->nBuckets * sizeof(unsigned int));
+	for (config->nSlots = 16; config->nSlots < 2 * (unsigned int)nEntries; config->nSlots *= 2)
+	{
+	}
+	for (;;)
+	{
+		config->slots = configMalloc(tag, config->nSlots * sizeof(ArpoiseConfigEntry));
+		if (configPlaceEntries(config, entries, nEntries))
+		{
+			break;
+		}
+		PBL_FREE(config->slots);
+		config->nSlots *= 2;
+	}
+	PBL_FREE(entries);
+	return config;
+}
+
+/*****************************************************************************/
+/* Compiled configuration files                                              */
+/*****************************************************************************/
+
+/*
+* Compute the offsets of the sections of a compiled configuration file, returns the size of the file.
+*/
+static long long configFileLayout(ArpoiseConfigFileHeader* header, unsigned int* offsets)
+{
+	long long sizes[ARPOISE_CONFIG_FILE_SECTIONS] = {
+		(long long)header->nBuckets * sizeof(unsigned int),
+		(long long)header->nSlots * sizeof(ArpoiseConfigEntry),
+		(long long)header->nAreas * sizeof(ArpoiseConfigArea),
+		(long long)header->nDevices * sizeof(ArpoiseConfigDevice),
+		header->stringsLength };
+
+	long long offset = ARPOISE_ALIGN8((long long)sizeof(ArpoiseConfigFileHeader));
+	for (int i = 0; i < ARPOISE_CONFIG_FILE_SECTIONS; i++)
+	{
+		offsets[i] = (unsigned int)offset;
+		offset = ARPOISE_ALIGN8(offset + sizes[i]);
+	}
+	return offset;
+}
+
+/*
+* Write a configuration as compiled configuration file, returns 0 on success and -1 on error.
+*/
+int arpoiseWriteConfig(ArpoiseConfig* config, char* path)
+{
+	ArpoiseConfigFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ARPOISE_CONFIG_FILE_MAGIC, 4);
+	header.byteOrder = ARPOISE_CONFIG_FILE_BYTE_ORDER;
+	header.formatVersion = ARPOISE_CONFIG_FILE_VERSION;
+	header.headerSize = sizeof(header);
+	header.sourceVersion = config->version;
+	header.sourceSize = config->size;
+	header.nEntries = config->nEntries;
+	header.nSlots = config->nSlots;
+	header.nBuckets = config->nBuckets;
+	header.nAreas = config->nAreas;
+	header.nDevices = config->nDevices;
+	header.stringsLength = config->stringsLength;
+	header.fileSize = configFileLayout(&header, header.offsets);
+
+	FILE* stream = pblCgiTryFopen(path, "wb");
+	if (!stream)
+	{
+		return -1;
+	}
+
+	void* sections[ARPOISE_CONFIG_FILE_SECTIONS] = { config->seeds, config->slots, config->areas, config->devices, config->strings };
+	size_t sizes[ARPOISE_CONFIG_FILE_SECTIONS] = { config->nBuckets * sizeof(unsigned int),
+		config->nSlots * sizeof(ArpoiseConfigEntry), config->nAreas * sizeof(ArpoiseConfigArea),
+		config->nDevices * sizeof(ArpoiseConfigDevice), config->stringsLength };
+
+	int rc = fwrite(&header, sizeof(header), 1, stream) == 1 ? 0 : -1;
+	long long offset = sizeof(header);
+	static char padding[8];
+	for (int i = 0; rc == 0 && i < ARPOISE_CONFIG_FILE_SECTIONS; i++)
+	{
+		if (header.offsets[i] > offset && fwrite(padding, header.offsets[i] - offset, 1, stream) != 1)
+		{
+			rc = -1;
+			break;
+		}
+		if (sizes[i] > 0 && fwrite(sections[i], sizes[i], 1, stream) != 1)
+		{
+			rc = -1;
+			break;
+		}
+		offset = header.offsets[i] + sizes[i];
+	}
+	if (rc == 0 && header.fileSize > offset && fwrite(padding, header.fileSize - offset, 1, stream) != 1)
+	{
+		rc = -1;
+	}
+	if (fclose(stream))
+	{
+		rc = -1;
+	}
+	return rc;
+}
+
+/*
+* Check the sections of a compiled configuration file that index the string pool,
+* so that a damaged file is rejected when it is mapped and not read out of bounds per request.
+*/
+static int configFileIndexesValid(char* data, ArpoiseConfigFileHeader* header)
+{
+	ArpoiseConfigEntry* slots = (ArpoiseConfigEntry*)(data + header->offsets[1]);
+	ArpoiseConfigDevice* devices = (ArpoiseConfigDevice*)(data + header->offsets[3]);
+
+	// The strings are '\0' terminated, the pool ends with a '\0', so each offset into the pool is a valid string
+	for (unsigned int i = 0; i < header->nSlots; i++)
+	{
+		if (slots[i].key != ARPOISE_CONFIG_FREE_SLOT
+			&& (slots[i].key >= header->stringsLength || slots[i].value >= header->stringsLength))
+		{
+			return 0;
+		}
+	}
+	for (unsigned int i = 0; i < header->nDevices; i++)
+	{
+		if (devices[i].device >= header->stringsLength || devices[i].lat >= header->stringsLength
+			|| devices[i].lon >= header->stringsLength)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+* Map a compiled configuration file read only.
+*
+* Returns NULL if the file does not exist, is not valid or was not compiled from the current configuration text.
+*/
+ArpoiseConfig* arpoiseMapConfig(char* path, char* source)
+{
+	static char* tag = "arpoiseMapConfig";
+
+	long sourceVersion = 0;
+	long sourceSize = 0;
+	if (configFileVersion(source, &sourceVersion, &sourceSize))
+	{
+		return NULL;
+	}
+
+	char* data = NULL;
+	size_t size = 0;
+
+#ifdef _WIN32
+
+	FILE* stream = pblCgiTryFopen(path, "rb");
+	if (!stream)
+	{
+		return NULL;
+	}
+	fseek(stream, 0, SEEK_END);
+	size = ftell(stream);
+	fseek(stream, 0, SEEK_SET);
+	data = configMalloc(tag, size + 1);
+	if (fread(data, 1, size, stream) != size)
+	{
+		size = 0;
+	}
+	fclose(stream);
+
+#else
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	struct stat statBuffer;
+	if (fstat(fd, &statBuffer) || statBuffer.st_size < (off_t)sizeof(ArpoiseConfigFileHeader))
+	{
+		close(fd);
+		PBL_CGI_TRACE("Compiled configuration file '%s' is too short", path);
+		return NULL;
+	}
+	size = statBuffer.st_size;
+	data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		PBL_CGI_TRACE("Cannot map compiled configuration file '%s', errno %d", path, errno);
+		return NULL;
+	}
+
+#endif
+
+	ArpoiseConfigFileHeader* header = (ArpoiseConfigFileHeader*)data;
+	unsigned int offsets[ARPOISE_CONFIG_FILE_SECTIONS];
+	char* error = NULL;
+
+	if (size < sizeof(ArpoiseConfigFileHeader) || memcmp(header->magic, ARPOISE_CONFIG_FILE_MAGIC, 4)
+		|| header->byteOrder != ARPOISE_CONFIG_FILE_BYTE_ORDER || header->formatVersion != ARPOISE_CONFIG_FILE_VERSION
+		|| header->headerSize != sizeof(ArpoiseConfigFileHeader))
+	{
+		error = "is not a compiled configuration file of this version";
+	}
+	else if (header->fileSize != (long long)size
+		|| configFileLayout(header, offsets) != header->fileSize
+		|| memcmp(offsets, header->offsets, sizeof(offsets))
+		|| header->nSlots < 1 || (header->nSlots & (header->nSlots - 1)) || header->nBuckets < 1
+		|| header->stringsLength < 1 || data[header->offsets[ARPOISE_CONFIG_FILE_SECTIONS - 1] + header->stringsLength - 1]
+		|| !configFileIndexesValid(data, header))
+	{
+		error = "is damaged";
+	}
+	else if (header->sourceVersion != sourceVersion || header->sourceSize != sourceSize)
+	{
+		error = "was not compiled from the current configuration text";
+	}
+	if (error)
+	{
+		PBL_CGI_TRACE("Compiled configuration file '%s' %s", path, error);
+#ifdef _WIN32
+		PBL_FREE(data);
+#else
+		munmap(data, size);
+#endif
+		return NULL;
+	}
+
+	ArpoiseConfig* config = configMalloc(tag, sizeof(ArpoiseConfig));
+	config->source = pblCgiStrDup(source);
+	config->version = (long)header->sourceVersion;
+	config->size = (long)header->sourceSize;
+	config->mapping = data;
+	config->mappingSize = size;
+
+	config->nEntries = header->nEntries;
+	config->nSlots = header->nSlots;
+	config->nBuckets = header->nBuckets;
+	config->nAreas = header->nAreas;
+	config->nDevices = header->nDevices;
+	config->stringsLength = header->stringsLength;
+	config->seeds = (unsigned int*)(data + header->offsets[0]);
+	config->slots = (ArpoiseConfigEntry*)(data + header->offsets[1]);
+	config->areas = (ArpoiseConfigArea*)(data + header->offsets[2]);
+	config->devices = (ArpoiseConfigDevice*)(data + header->offsets[3]);
+	config->strings = data + header->offsets[4];
+	return config;
+}
+
+/*
+* Map the compiled configuration if it is current, read the configuration text otherwise.
+*/
+ArpoiseConfig* arpoiseLoadConfig(char* source)
+{
+	char* path = pblCgiStrCat(source, ARPOISE_CONFIG_FILE_EXTENSION);
+	ArpoiseConfig* config = arpoiseMapConfig(path, source);
+	PBL_FREE(path);
+
+	return config ? config : arpoiseParseConfig(source);
+}
+
+void arpoiseFreeConfig(ArpoiseConfig* config)
+{
+	if (!config)
+	{
+		return;
+	}
+	if (config->mapping)
+	{
+#ifdef _WIN32
+		PBL_FREE(config->mapping);
+#else
+		munmap(config->mapping, config->mappingSize);
+#endif
+	}
+	else
+	{
+		PBL_FREE(config->seeds);
+		PBL_FREE(config->slots);
+		PBL_FREE(config->areas);
+		PBL_FREE(config->devices);
+		PBL_FREE(config->strings);
+	}
+	PBL_FREE(config->source);
+	PBL_FREE(config);
+}
+
+/*****************************************************************************/
+/* Looking up values                                                         */
+/*****************************************************************************/
+
+/*
+* Get the value given for the key, NULL if there is none.
+*/
+char* arpoiseConfigValue(ArpoiseConfig* config, char* key)
+{
+	ArpoiseConfigEntry* entry = configEntry(config, key);
+	return entry ? config->strings + entry->value : NULL;
+}
+
+/*
+* Get the value given for the key as integer, parsed like atoi does if it is not an integer only.
+*/
+int arpoiseConfigInteger(ArpoiseConfig* config, char* key, int defaultValue)
+{
+	ArpoiseConfigEntry* entry = configEntry(config, key);
+	if (!entry)
+	{
+		return defaultValue;
+	}
+	return entry->isInteger ? entry->integer : atoi(config->strings + entry->value);
+}
+
+/*
+* Get the number N of the first area Area_N containing the position, 0 if no area contains it.
+*/
+int arpoiseConfigArea(ArpoiseConfig* config, int latE6, int lonE6)
+{
+	for (int i = 0; i < config->nAreas; i++)
+	{
+		ArpoiseConfigArea* area = config->areas + i;
+		if (latE6 < area->minLatE6 || lonE6 < area->minLonE6 || latE6 > area->maxLatE6 || lonE6 > area->maxLonE6)
+		{
+			continue;
+		}
+		PBL_CGI_TRACE("Area_%d, lat %d, lon %d is inside area %d,%d,%d,%d", area->number, latE6, lonE6,
+			area->minLatE6, area->minLonE6, area->maxLatE6, area->maxLonE6);
+		return area->number;
+	}
+	PBL_CGI_TRACE("No area for lat %d, lon %d", latE6, lonE6);
+	return 0;
+}
+
+/*
+* Get the position given for a device, returns 0 if there is none.
+*/
+int arpoiseConfigDevicePosition(ArpoiseConfig* config, char* device, char** lat, char** lon)
+{
+	for (int i = 0; i < config->nDevices; i++)
+	{
+		ArpoiseConfigDevice* devicePosition = config->devices + i;
+		if (!strcmp(config->strings + devicePosition->device, device))
+		{
+			*lat = config->strings + devicePosition->lat;
+			*lon = config->strings + devicePosition->lon;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,164 @@
+#ifndef _ARPOISE_CONFIG_H_
+#define _ARPOISE_CONFIG_H_
+/*
+ArpoiseConfig.h - include file for the configuration of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "pblCgi.h"
+
+	/*****************************************************************************/
+	/* #defines                                                                  */
+	/*****************************************************************************/
+
+#define ARPOISE_CONFIG_FREE_SLOT               0xFFFFFFFF /* key of a slot of the hash table without value */
+#define ARPOISE_CONFIG_MAX_AREAS               1000
+
+#define ARPOISE_CONFIG_FILE_MAGIC              "ARPC"
+#define ARPOISE_CONFIG_FILE_VERSION            1
+#define ARPOISE_CONFIG_FILE_BYTE_ORDER         0x01020304
+#define ARPOISE_CONFIG_FILE_EXTENSION          ".bin"     /* a compiled configuration is stored next to its text */
+#define ARPOISE_CONFIG_FILE_SECTIONS           5
+
+	/*****************************************************************************/
+	/* Type definitions                                                          */
+	/*****************************************************************************/
+
+	/*
+	* A value of the configuration, lines repeating a key are joined by ", " as pblCgiFileToMap does.
+	*/
+	typedef struct ArpoiseConfigEntry
+	{
+		unsigned int key;           /* offset of the key in the string pool, ARPOISE_CONFIG_FREE_SLOT for a free slot */
+		unsigned int value;         /* offset of the value in the string pool */
+		int integer;                /* the value if it is an integer */
+		int isInteger;
+	} ArpoiseConfigEntry;
+
+	/*
+	* An area given as Area_N lat min, lon min, lat max, lon max in micro degrees.
+	*/
+	typedef struct ArpoiseConfigArea
+	{
+		int number;
+		int minLatE6;
+		int minLonE6;
+		int maxLatE6;
+		int maxLonE6;
+	} ArpoiseConfigArea;
+
+	/*
+	* A position given for a device by DevicePosition device, lat, lon.
+	*/
+	typedef struct ArpoiseConfigDevice
+	{
+		unsigned int device;        /* offsets in the string pool */
+		unsigned int lat;
+		unsigned int lon;
+	} ArpoiseConfigDevice;
+
+	/*
+	* The configuration of the directory service.
+	*
+	* The values are found by a perfect hash, the hash of a key selects a bucket and the seed of the bucket
+	* selects the slot of the key. The seeds are chosen when the configuration is read,
+	* so that no two keys share a slot. Looking up a key is two hashes and one string compare.
+	*/
+	typedef struct ArpoiseConfig
+	{
+		char* source;               /* path of the configuration text */
+		long version;               /* modification time of the source */
+		long size;                  /* size of the source */
+
+		int nEntries;
+		unsigned int nSlots;        /* a power of two */
+		unsigned int nBuckets;
+		unsigned int* seeds;        /* seed of the hash of each bucket */
+		ArpoiseConfigEntry* slots;
+
+		int nAreas;                 /* the areas up to the first Area_N not given, ignoring areas not having 4 values */
+		ArpoiseConfigArea* areas;
+		int nDevices;
+		ArpoiseConfigDevice* devices;
+
+		char* strings;              /* the string pool */
+		unsigned int stringsLength;
+
+		void* mapping;              /* the compiled configuration file if the configuration was mapped */
+		size_t mappingSize;
+	} ArpoiseConfig;
+
+	/*
+	* Header of a compiled configuration file.
+	*
+	* The header is followed by the seeds, the slots, the areas, the devices and the string pool,
+	* each starting 8 byte aligned at the offset given in the header.
+	* The file is written for the byte order of the machine compiling it.
+	*/
+	typedef struct ArpoiseConfigFileHeader
+	{
+		char magic[4];
+		unsigned int byteOrder;
+		unsigned int formatVersion;
+		unsigned int headerSize;
+		long long fileSize;
+		long long sourceVersion;    /* modification time of the configuration text compiled */
+		long long sourceSize;       /* size of the configuration text compiled */
+		unsigned int nEntries;
+		unsigned int nSlots;
+		unsigned int nBuckets;
+		unsigned int nAreas;
+		unsigned int nDevices;
+		unsigned int stringsLength;
+		unsigned int offsets[ARPOISE_CONFIG_FILE_SECTIONS];
+	} ArpoiseConfigFileHeader;
+
+	/*****************************************************************************/
+	/* Function declarations                                                     */
+	/*****************************************************************************/
+
+	extern ArpoiseConfig* arpoiseLoadConfig(char* source);
+	extern ArpoiseConfig* arpoiseParseConfig(char* source);
+	extern ArpoiseConfig* arpoiseMapConfig(char* path, char* source);
+	extern int arpoiseWriteConfig(ArpoiseConfig* config, char* path);
+	extern void arpoiseFreeConfig(ArpoiseConfig* config);
+	extern char* arpoiseConfigValue(ArpoiseConfig* config, char* key);
+	extern int arpoiseConfigInteger(ArpoiseConfig* config, char* key, int defaultValue);
+	extern int arpoiseConfigArea(ArpoiseConfig* config, int latE6, int lonE6);
+	extern int arpoiseConfigDevicePosition(ArpoiseConfig* config, char* device, char** lat, char** lon);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ArpoiseConfigCompiler.c - compiles the configuration of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+/*
+* Usage: ArpoiseConfigCompiler <config txt> ...
+*
+* Each configuration text given is compiled to <config txt>.bin, the file the directory service maps
+* instead of reading the text. Run it again whenever the configuration changes, a compiled file
+* that is older than its configuration text is ignored by the directory service.
+*
+* The compiled file is written under a temporary name and renamed, so that processes
+* having the old file mapped keep a consistent view of it.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "ArpoiseConfig.h"
+
+static int compileConfig(char* source)
+{
+	ArpoiseConfig* config = arpoiseParseConfig(source);
+
+	char* path = pblCgiStrCat(source, ARPOISE_CONFIG_FILE_EXTENSION);
+	// the process id keeps compilers running at the same time from writing the same temporary file
+	char* temporaryPath = pblCgiSprintf("%s.%d", path, (int)getpid());
+
+	int rc = arpoiseWriteConfig(config, temporaryPath);
+	if (rc)
+	{
+		fprintf(stderr, "%s: cannot write %s\n", source, temporaryPath);
+	}
+	else if (rename(temporaryPath, path))
+	{
+		fprintf(stderr, "%s: cannot rename %s to %s\n", source, temporaryPath, path);
+		rc = -1;
+	}
+	else
+	{
+		// make sure the directory service accepts the file
+		ArpoiseConfig* mappedConfig = arpoiseMapConfig(path, source);
+		if (!mappedConfig)
+		{
+			fprintf(stderr, "%s: the configuration changed while it was compiled, run again\n", source);
+			rc = -1;
+		}
+		else
+		{
+			printf("%s: %d values, %d areas, %d device positions, written to %s\n", source, mappedConfig->nEntries,
+				mappedConfig->nAreas, mappedConfig->nDevices, path);
+			arpoiseFreeConfig(mappedConfig);
+		}
+	}
+	if (rc)
+	{
+		remove(temporaryPath);
+	}
+
+	PBL_FREE(temporaryPath);
+	PBL_FREE(path);
+	arpoiseFreeConfig(config);
+	return rc;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <config txt> ...\n", argv[0]);
+		return 1;
+	}
+
+	int rc = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (compileConfig(argv[i]))
+		{
+			rc = 1;
+		}
+	}
+	return rc;
+}
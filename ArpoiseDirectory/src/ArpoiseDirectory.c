@@ -1,1589 +1,3312 @@
-/*
-ArpoiseDirectory.c - main for Arpoise Directory front end service.
-
-Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
-
-ARPOISE - Augmented Reality Point Of Interest Service
-
-This file is part of Arpoise.
-
-	Arpoise is free software: you can redistribute it and/or modify
-	it under the terms of the GNU General Public License as published by
-	the Free Software Foundation, either version 3 of the License, or
-	(at your option) any later version.
-
-	Arpoise is distributed in the hope that it will be useful,
-	but WITHOUT ANY WARRANTY; without even the implied warranty of
-	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-	GNU General Public License for more details.
-
-	You should have received a copy of the GNU General Public License
-	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
-
-For more information on
-
-Tamiko Thiel, see www.TamikoThiel.com/
-Peter Graf, see www.mission-base.com/peter/
-Arpoise, see www.Arpoise.com/
-
-$Log: ArpoiseDirectory.c,v $
-Revision 1.43  2020/03/18 22:37:22  peter
-handle inner layer request for a default layer
-
-Revision 1.41  2020/03/18 00:23:26  peter
-Cleanup of getAreaConfigValue()
-
-Revision 1.40  2020/03/17 22:11:00  peter
-No caching
-
-Revision 1.39  2020/03/17 22:01:30  peter
-Made sure the directory server does not cache
-
-Revision 1.38  2020/03/17 20:50:03  peter
-Working on hidden histories version
-
-Revision 1.37  2020/03/16 11:43:13  peter
-Working on version for hidden histories
-
-Revision 1.36  2020/03/15 23:29:25  peter
-Working on areas for the directory
-
-Revision 1.35  2020/02/23 12:29:21  peter
-Added layer name to location statistics
-
-Revision 1.34  2020/01/10 11:06:06  peter
-Layer lists for AR-vos also for Android
-
-Revision 1.33  2019/11/15 21:50:03  peter
-Layer lists for AR-vos on iOs
-
-Revision 1.32  2019/11/15 19:32:26  peter
-Allowing the menu button in AR-vos
-
-Revision 1.31  2019/10/07 14:46:18  peter
-Allowing menu button for default layers
-
-Revision 1.30  2019/09/02 20:29:34  peter
-Some cleanup
-
-Revision 1.29  2019/08/13 21:23:02  peter
-Removed potential null reference crash.
-
-Revision 1.28  2019/08/10 19:31:55  peter
-Added Arslam handling
-
-Revision 1.27  2019/07/23 21:54:34  peter
-Separated version and location logs
-
-Revision 1.26  2019/05/18 18:31:13  peter
-Special default layer for AB EoF
-
-Revision 1.25  2019/04/04 21:54:53  peter
-Added the default layer handling for Arvos
-
-Revision 1.24  2019/02/22 20:28:01  peter
-Removed a compiler warning
-
-Revision 1.23  2019/02/22 19:06:22  peter
-Added the handling of the DefaultLayerName
-
-Revision 1.22  2019/02/22 15:04:21  peter
-Handling of showMenuButton for default layer
-
-Revision 1.21  2019/02/18 20:22:18  peter
-Directory requests with one hotspot as result are not sent to the client as list anymore
-
-Revision 1.20  2019/02/17 17:07:12  peter
-Handling of clients that can handle arpoise directory responses
-
-Revision 1.19  2019/02/05 13:29:21  peter
-Code simplyfication and refactoring
-
-Revision 1.18  2019/02/05 11:14:22  peter
-Refactoring of networking code
-
-Revision 1.17  2019/02/04 19:44:53  peter
-Improved the device position handling with the default layer
-
-Revision 1.16  2019/02/04 12:29:03  peter
-Improved the version statistics
-
-Revision 1.15  2019/02/04 12:00:03  peter
-Improved default layer handling
-
-Revision 1.14  2019/02/03 23:22:28  peter
-Some cleanup
-
-Revision 1.13  2019/02/03 23:19:02  peter
-Changed the directory structure of the hit count mechanism
-
-Revision 1.12  2019/02/03 17:00:02  peter
-Improved handling of redirections
-
-Revision 1.11  2019/02/03 15:20:53  peter
-Moved redirection to the client
-
-Revision 1.10  2019/02/03 13:05:47  peter
-Improved bundle handling
-
-Revision 1.9  2019/02/03 12:52:47  peter
-Fixed the count handling
-
-Revision 1.8  2019/02/03 12:47:08  peter
-Do not create statistics hits for refreshes
-
-Revision 1.7  2019/02/03 12:03:06  peter
-Creating the versions and layer names files for the hits
-
-Revision 1.6  2019/02/03 01:30:41  peter
-Versions file handling
-
-Revision 1.5  2019/02/02 16:53:49  peter
-Default layer is reign of gold
-
-Revision 1.4  2019/01/30 23:45:24  peter
-Fixed a bug with longer responses
-
-Revision 1.3  2019/01/20 16:13:33  peter
-Cleanup of traces
-
-Revision 1.2  2019/01/19 15:50:38  peter
-Improved the user agent string
-
-Revision 1.1  2019/01/19 00:03:31  peter
-Working on arpoise directory service
-
-
-*/
-
-/*
-* Make sure "strings <exe> | grep Id | sort -u" shows the source file versions
-*/
-char* ArpoiseDirectory_c_id = "$Id: ArpoiseDirectory.c,v 1.43 2020/03/18 22:37:22 peter Exp $";
-
-#include <stdio.h>
-#include <memory.h>
-
-#ifndef __APPLE__
-#include <malloc.h>
-#endif
-
-#include <assert.h>
-#include <stdlib.h>
-
-#ifdef _WIN32
-
-#include <winsock2.h>
-#include <direct.h>
-#include <windows.h> 
-#include <process.h>
-
-#define socket_close closesocket
-
-#else
-
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <unistd.h>
-#include <netdb.h>
-#include <netinet/in.h>
-#include <dirent.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-
-#define socket_close close
-
-#ifndef h_addr
-#define h_addr h_addr_list[0] /* for backward compatibility */
-#endif
-
-#endif
-
-#include "pblCgi.h"
-
-/*
- * Receive some bytes from a socket
- */
-static int receiveBytesFromTcp(int socket, char* buffer, int bufferSize, struct timeval* timeout)
-{
-	char* tag = "readTcp";
-	int    rc = 0;
-	int    socketError = 0;
-	unsigned int optlen = sizeof(socketError);
-
-	errno = 0;
-	if (getsockopt(socket, SOL_SOCKET, SO_ERROR, (char*)&socketError, &optlen))
-	{
-		pblCgiExitOnError("%s: getsockopt(%d) error, errno %d\n", tag, socket, errno);
-	}
-
-	int nBytesRead = 0;
-	while (nBytesRead < bufferSize)
-	{
-		fd_set readFds;
-		FD_ZERO(&readFds);
-		FD_SET(socket, &readFds);
-
-		errno = 0;
-		rc = select(socket + 1, &readFds, (fd_set*)NULL, (fd_set*)NULL, timeout);
-		switch (rc)
-		{
-		case 0:
-			return (-1);
-
-		case -1:
-			if (errno == EINTR)
-			{
-				pblCgiExitOnError("%s: select(%d) EINTR error, errno %d\n", tag, socket, errno);
-			}
-			pblCgiExitOnError("%s: select(%d) error, errno %d\n", tag, socket, errno);
-			break;
-
-		default:
-			errno = 0;
-			if (getsockopt(socket, SOL_SOCKET, SO_ERROR, (char*)&socketError, &optlen))
-			{
-				pblCgiExitOnError("%s: getsockopt(%d) error, errno %d\n", tag, socket, errno);
-			}
-
-			if (socketError)
-			{
-				continue;
-			}
-
-			errno = 0;
-			rc = recvfrom(socket, buffer + nBytesRead, bufferSize - nBytesRead, 0, NULL, NULL);
-			if (rc < 0)
-			{
-				if (errno == EINTR)
-				{
-					pblCgiExitOnError("%s: recvfrom(%d) EINTR error, errno %d\n", tag, socket, errno);
-				}
-				pblCgiExitOnError("%s: recvfrom(%d) error, errno %d\n", tag, socket, errno);
-			}
-			else if (rc == 0)
-			{
-				return nBytesRead;
-			}
-			nBytesRead += rc;
-		}
-	}
-	return nBytesRead;
-}
-
-static char receiveBuffer[64 * 1024];
-/*
-* Receive some string bytes and return the result in a malloced buffer.
-*/
-static char* receiveStringFromTcp(int socket, int timeoutSeconds)
-{
-	static char* tag = "receiveStringFromTcp";
-
-	char* result = NULL;
-	PblStringBuilder* stringBuilder = NULL;
-
-	struct timeval timeoutValue;
-	timeoutValue.tv_sec = timeoutSeconds;
-	timeoutValue.tv_usec = 0;
-
-	receiveBuffer[0] = '\0';
-
-	for (;;)
-	{
-		int rc = receiveBytesFromTcp(socket, receiveBuffer, sizeof(receiveBuffer) - 1, &timeoutValue);
-		if (rc < 0)
-		{
-			return NULL;
-		}
-		if (rc < 0 || rc > sizeof(receiveBuffer) - 1)
-		{
-			pblCgiExitOnError("%s: readTcp failed! rc %d\n", tag, rc);
-		}
-		else if (rc == 0)
-		{
-			break;
-		}
-		else
-		{
-			receiveBuffer[rc] = '\0';
-		}
-
-		if (rc < sizeof(receiveBuffer) - 1 && stringBuilder == NULL)
-		{
-			result = pblCgiStrDup(receiveBuffer);
-			break;
-		}
-
-		if (stringBuilder == NULL)
-		{
-			stringBuilder = pblStringBuilderNew();
-			if (!stringBuilder)
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-		}
-		if (pblStringBuilderAppendStr(stringBuilder, receiveBuffer) == ((size_t)-1))
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-	}
-
-	if (result == NULL)
-	{
-		if (stringBuilder == NULL)
-		{
-			pblCgiExitOnError("%s: socket %d received 0 bytes as response\n", tag, socket);
-		}
-
-		result = pblStringBuilderToString(stringBuilder);
-		if (!result)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-	}
-	if (stringBuilder)
-	{
-		pblStringBuilderFree(stringBuilder);
-	}
-	return result;
-}
-
-/*
-* Send some bytes to a tcp socket
-*/
-static void sendBytesToTcp(int socket, char* buffer, int nBytesToSend)
-{
-	static char* tag = "sendBytesToTcp";
-
-	char* ptr = buffer;
-	while (nBytesToSend > 0)
-	{
-		errno = 0;
-		int rc = send(socket, ptr, nBytesToSend, 0);
-		if (rc > 0)
-		{
-			ptr += rc;
-			nBytesToSend -= rc;
-		}
-		else
-		{
-			pblCgiExitOnError("%s: send(%d) error, rc %d, errno %d\n", tag, socket, rc, errno);
-		}
-	}
-}
-
-/*
-* Connect to a tcp socket on machine with hostname and port
-*/
-static int connectToTcp(char* hostname, int port)
-{
-	static char* tag = "connectToTcp";
-
-	errno = 0;
-	struct hostent* hostInfo = gethostbyname(hostname);
-	if (!hostInfo)
-	{
-		pblCgiExitOnError("%s: gethostbyname(%s) error, errno %d.\n", tag, hostname, errno);
-		return -1;
-	}
-
-	short shortPort = 80;
-	if (port > 0)
-	{
-		shortPort = port;
-	}
-
-	struct sockaddr_in serverAddress;
-	memset((char*)&serverAddress, 0, sizeof(struct sockaddr_in));
-	serverAddress.sin_family = AF_INET;
-	serverAddress.sin_port = htons(shortPort);
-	memcpy(&(serverAddress.sin_addr.s_addr), hostInfo->h_addr, sizeof(serverAddress.sin_addr.s_addr));
-
-	errno = 0;
-	int socketFd = socket(AF_INET, SOCK_STREAM, 0);
-	if (socketFd < 0)
-	{
-		pblCgiExitOnError("%s: socket() error, errno %d\n", tag, errno);
-	}
-
-	errno = 0;
-	if (connect(socketFd, (struct sockaddr*) & serverAddress, sizeof(struct sockaddr_in)) < 0)
-	{
-		pblCgiExitOnError("%s: connect(%d) error, host '%s' on port %d, errno %d\n", tag, socketFd, hostname, shortPort, errno);
-		socket_close(socketFd);
-	}
-	return socketFd;
-}
-
-/*
-* Make a HTTP request with the given uri to the given host/port
-* and return the result content in a malloced buffer.
-*/
-static char* getHttpResponse(char* hostname, int port, char* uri, int timeoutSeconds, char* agent)
-{
-	char* response = NULL;
-	for (int n = 0; n < 2; n++)
-	{
-		int socketFd = connectToTcp(hostname, port);
-
-		char* sendBuffer = pblCgiSprintf("GET %s HTTP/1.0\r\nUser-Agent: %s\r\nHost: %s\r\n\r\n", uri, agent, hostname);
-		PBL_CGI_TRACE("HttpRequest=%s", sendBuffer);
-
-		sendBytesToTcp(socketFd, sendBuffer, strlen(sendBuffer));
-		PBL_FREE(sendBuffer);
-
-		response = receiveStringFromTcp(socketFd, timeoutSeconds);
-		socket_close(socketFd);
-		if (!response)
-		{
-			PBL_CGI_TRACE("HttpResponse=NULL, n=%d", n);
-			continue;
-		}
-		PBL_CGI_TRACE("HttpResponse=%s", response);
-		break;
-	}
-	if (!response)
-	{
-		pblCgiExitOnError("getHttpResponse: receiveStringFromTcp returned NULL\n");
-	}
-	return response;
-}
-
-static char* getMatchingString(char* string, char start, char end, char** nextPtr)
-{
-	char* tag = "getMatchingString";
-	char* ptr = string;
-	if (start != *ptr)
-	{
-		pblCgiExitOnError("%s: expected %c at start of string '%s'\n", tag, start, string);
-	}
-
-	int level = 1;
-	int c;
-	while ((c = *++ptr))
-	{
-		if (c == start)
-		{
-			level++;
-		}
-		if (c == end)
-		{
-			level--;
-			if (level < 1)
-			{
-				if (nextPtr)
-				{
-					*nextPtr = ptr + 1;
-				}
-				return pblCgiStrRangeDup(string + 1, ptr);
-			}
-		}
-	}
-	pblCgiExitOnError("%s: unexpected end of string in '%s'\n", tag, string);
-	return NULL;
-}
-
-static char* getStringBetween(char* string, char* start, char* end)
-{
-	char* tag = "getStringBetween";
-	char* ptr = *start ? strstr(string, start) : string;
-	if (!ptr)
-	{
-		pblCgiExitOnError("%s: expected starting tag '%s' in string '%s'\n", tag, start, string);
-		return NULL;
-	}
-	ptr += strlen(start);
-	char* ptr2 = strstr(ptr, end);
-	if (!ptr2)
-	{
-		pblCgiExitOnError("%s: expected ending '%s' in string '%s'\n", tag, end, ptr);
-	}
-	return pblCgiStrRangeDup(ptr, ptr2);
-}
-
-static char* getNumberString(char* string, char* start)
-{
-	char* tag = "getNumberString";
-	char* ptr = strstr(string, start);
-	if (!ptr)
-	{
-		pblCgiExitOnError("%s: expected starting tag '%s' in string '%s'\n", tag, start, string);
-	}
-	ptr += strlen(start);
-
-	char* ptr2 = ptr;
-	while (ptr2 && *ptr2)
-	{
-		if (isdigit(*ptr2) || '.' == *ptr2 || '-' == *ptr2 || '+' == *ptr2)
-		{
-			ptr2++;
-			continue;
-		}
-		break;
-	}
-	if (!ptr2)
-	{
-		pblCgiExitOnError("%s: expected number ending in string '%s'\n", tag, ptr);
-	}
-	return pblCgiStrRangeDup(ptr, ptr2);
-}
-
-static char* getHttpResponseBody(char* response, char** cookiePtr)
-{
-	static char* tag = "getHttpResponseBody";
-
-	// check for HTTP error code like HTTP/1.1 500 Server Error
-	//
-	if (cookiePtr && strstr(response, "Set-Cookie: "))
-	{
-		*cookiePtr = getStringBetween(response, "Set-Cookie: ", "\r\n");
-	}
-
-	char* ptr = strstr(response, "HTTP/");
-	if (ptr)
-	{
-		ptr = strstr(ptr, " ");
-		if (ptr)
-		{
-			ptr++;
-			if (strncmp(ptr, "200", 3))
-			{
-				pblCgiExitOnError("%s: Bad HTTP response\n%s\n", tag, response);
-			}
-		}
-	}
-
-	if (ptr)
-	{
-		char* end = strstr(ptr, "\r\n\r\n");
-		if (!end)
-		{
-			end = strstr(ptr, "\n\n");
-			if (!end)
-			{
-				pblCgiExitOnError("%s: Illegal HTTP response, no separator.\n%s\n", tag, response);
-			}
-			else
-			{
-				end += 2;
-			}
-		}
-		else
-		{
-			end += 4;
-		}
-		return end;
-	}
-
-	pblCgiExitOnError("%s: Expecting HTTP response\n%s\n", tag, response);
-	return NULL;
-}
-
-static void putString(char* string, PblStringBuilder* stringBuilder)
-{
-	char* tag = "putString";
-
-	if (pblStringBuilderAppendStr(stringBuilder, string) == ((size_t)-1))
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-	fputs(string, stdout);
-}
-
-static char* changeLat(char* string, int i, int difference)
-{
-	if (!strstr(string, "\"lat\":"))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	int factor = 1 + (i - 1) / 8;
-	int modulo = (i - 1) % 8;
-
-	switch (modulo)
-	{
-	case 0:
-		difference *= factor;
-		break;
-	case 1:
-		difference *= -factor;
-		break;
-	case 4:
-	case 5:
-		difference *= factor;
-		break;
-	case 6:
-	case 7:
-		difference *= -factor;
-		break;
-	default:
-		return pblCgiStrDup(string);
-	}
-
-	char* lat = getNumberString(string, "\"lat\":");
-	//PBL_CGI_TRACE("lat=%s", lat);
-
-	char* oldLat = pblCgiSprintf("\"lat\":%s,", lat);
-	//PBL_CGI_TRACE("oldLat=%s", oldLat);
-
-	char* newLat = pblCgiSprintf("\"lat\":%d,", atoi(lat) + difference);
-	//PBL_CGI_TRACE("newLat=%s", newLat);
-
-	char* replacedLat = pblCgiStrReplace(string, oldLat, newLat);
-
-	PBL_FREE(lat);
-	PBL_FREE(oldLat);
-	PBL_FREE(newLat);
-
-	return replacedLat;
-}
-
-static char* changeLon(char* string, int i, int difference)
-{
-	if (!strstr(string, "\"lon\":"))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	int factor = 1 + (i - 1) / 8;
-	int modulo = (i - 1) % 8;
-
-	switch (modulo)
-	{
-	case 2:
-		difference *= factor;
-		break;
-	case 3:
-		difference *= -factor;
-		break;
-	case 4:
-	case 6:
-		difference *= factor;
-		break;
-	case 5:
-	case 7:
-		difference *= -factor;
-		break;
-	default:
-		return pblCgiStrDup(string);
-	}
-
-	char* lon = getNumberString(string, "\"lon\":");
-	//PBL_CGI_TRACE("lon=%s", lon);
-
-	char* oldLon = pblCgiSprintf("\"lon\":%s,", lon);
-	//PBL_CGI_TRACE("oldLon=%s", oldLon);
-
-	char* newLon = pblCgiSprintf("\"lon\":%d,", atoi(lon) + difference);
-	//PBL_CGI_TRACE("newLon=%s", newLon);
-
-	char* replacedLon = pblCgiStrReplace(string, oldLon, newLon);
-
-	PBL_FREE(lon);
-	PBL_FREE(oldLon);
-	PBL_FREE(newLon);
-
-	return replacedLon;
-}
-
-static char* changeLatAndLon(char* queryString, char* lat, char* lon, int* latDifference, int* lonDifference)
-{
-	if (!pblCgiStrIsNullOrWhiteSpace(lat) && !pblCgiStrIsNullOrWhiteSpace(lon))
-	{
-		char* replacementLat = pblCgiStrCat("lat=", lat);
-		char* replacementLon = pblCgiStrCat("lon=", lon);
-		double latDouble = strtod(replacementLat + 4, NULL);
-		int replacementLatInteger = (int)(1000000.0 * latDouble);
-		double lonDouble = strtod(replacementLon + 4, NULL);
-		int replacementLonInteger = (int)(1000000.0 * lonDouble);
-		int latPtrInteger = 0;
-		int lonPtrInteger = 0;
-
-		char* latPtr = strstr(queryString, "lat=");
-		if (latPtr)
-		{
-			char* ptr = strstr(latPtr, "&");
-			if (ptr)
-			{
-				latPtr = pblCgiStrRangeDup(latPtr, ptr);
-			}
-			else
-			{
-				latPtr = pblCgiStrDup(latPtr);
-			}
-			latPtrInteger = (int)(1000000.0 * strtod(latPtr + 4, NULL));
-			queryString = pblCgiStrReplace(queryString, latPtr, replacementLat);
-		}
-		char* lonPtr = strstr(queryString, "lon=");
-		if (lonPtr)
-		{
-			char* ptr = strstr(lonPtr, "&");
-			if (ptr)
-			{
-				lonPtr = pblCgiStrRangeDup(lonPtr, ptr);
-			}
-			else
-			{
-				lonPtr = pblCgiStrDup(lonPtr);
-			}
-			lonPtrInteger = (int)(1000000.0 * strtod(lonPtr + 4, NULL));
-			queryString = pblCgiStrReplace(queryString, lonPtr, replacementLon);
-		}
-		if (latDifference && lonDifference && latPtrInteger != 0 && lonPtrInteger != 0)
-		{
-			*latDifference = replacementLatInteger - latPtrInteger;
-			*lonDifference = replacementLonInteger - lonPtrInteger;
-		}
-		return queryString;
-	}
-	return NULL;
-}
-
-static char* changeRedirectionUrl(char* string, char* redirectionUrl)
-{
-	if (!strstr(string, "\"redirectionUrl\":"))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	char* oldValue = getStringBetween(string, "\"redirectionUrl\":", ",\"");
-
-	char* oldValueStr = pblCgiSprintf("\"redirectionUrl\":%s", oldValue);
-	char* newValueStr = pblCgiSprintf("\"redirectionUrl\":\"%s\"", redirectionUrl);
-
-	char* replacedString = pblCgiStrReplace(string, oldValueStr, newValueStr);
-
-	PBL_FREE(oldValue);
-	PBL_FREE(oldValueStr);
-	PBL_FREE(newValueStr);
-
-	return replacedString;
-}
-
-static char* changeRedirectionLayer(char* string, char* redirectionLayer)
-{
-	if (!strstr(string, "\"redirectionLayer\":"))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	char* oldValue = getStringBetween(string, "\"redirectionLayer\":", ",\"");
-
-	char* oldValueStr = pblCgiSprintf("\"redirectionLayer\":%s", oldValue);
-	char* newValueStr = pblCgiSprintf("\"redirectionLayer\":\"%s\"", redirectionLayer);
-
-	char* replacedString = pblCgiStrReplace(string, oldValueStr, newValueStr);
-
-	PBL_FREE(oldValue);
-	PBL_FREE(oldValueStr);
-	PBL_FREE(newValueStr);
-
-	return replacedString;
-}
-
-static char* changeLayerName(char* string, char* layerName)
-{
-	if (!strstr(string, "layerName="))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	char* oldLayerName = getStringBetween(string, "layerName=", "&");
-
-	char* oldLayerNameStr = pblCgiSprintf("layerName=%s", oldLayerName);
-	char* newLayerNameStr = pblCgiSprintf("layerName=%s", layerName);
-
-	char* replacedString = pblCgiStrReplace(string, oldLayerNameStr, newLayerNameStr);
-
-	PBL_FREE(oldLayerName);
-	PBL_FREE(oldLayerNameStr);
-	PBL_FREE(newLayerNameStr);
-
-	return replacedString;
-}
-
-static char* changeShowMenuOption(char* string, char* value)
-{
-	if (!strstr(string, "\"showMenuButton\":"))
-	{
-		return pblCgiStrDup(string);
-	}
-
-	char* oldValue = getStringBetween(string, "\"showMenuButton\":", ",\"");
-
-	char* oldValueStr = pblCgiSprintf("\"showMenuButton\":%s", oldValue);
-	char* newValueStr = pblCgiSprintf("\"showMenuButton\":\"%s\"", value);
-
-	char* replacedString = pblCgiStrReplace(string, oldValueStr, newValueStr);
-
-	PBL_FREE(oldValue);
-	PBL_FREE(oldValueStr);
-	PBL_FREE(newValueStr);
-
-	return replacedString;
-}
-
-static PblList* devicePositionList = NULL;
-
-static char* handleDevicePosition(char* deviceId, char* client, char* queryString, int* latDifference, int* lonDifference)
-{
-	if (pblCgiStrIsNullOrWhiteSpace(deviceId))
-	{
-		return NULL;
-	}
-
-	char* lat = NULL;
-	char* lon = NULL;
-
-	if (!devicePositionList)
-	{
-		char* devicePositionValue = pblCgiConfigValue("DevicePosition", NULL);
-		if (pblCgiStrIsNullOrWhiteSpace(devicePositionValue))
-		{
-			return NULL;
-		}
-		devicePositionList = pblCgiStrSplitToList(devicePositionValue, ",");
-		if (pblListIsEmpty(devicePositionList))
-		{
-			PBL_CGI_TRACE("DevicePositionList is empty");
-			return NULL;
-		}
-	}
-
-	int listSize = pblListSize(devicePositionList);
-
-	for (int i = 0; i < listSize - 2; i += 3)
-	{
-		char* device = pblListGet(devicePositionList, i);
-
-		if (pblCgiStrEquals(deviceId, device))
-		{
-			lat = pblListGet(devicePositionList, i + 1);
-			lon = pblListGet(devicePositionList, i + 2);
-			break;
-		}
-	}
-	return changeLatAndLon(queryString, lat, lon, latDifference, lonDifference);
-}
-
-static void traceDuration()
-{
-	struct timeval now;
-	gettimeofday(&now, NULL);
-
-	unsigned long duration = now.tv_sec * 1000000 + now.tv_usec;
-	duration -= pblCgiStartTime.tv_sec * 1000000 + pblCgiStartTime.tv_usec;
-	char* string = pblCgiSprintf("%lu", duration);
-	PBL_CGI_TRACE("Duration=%s microseconds", string);
-}
-
-static void printHeader(char* cookie)
-{
-	fputs("Content-Type: application/json\r\n", stdout);
-	if (cookie)
-	{
-		fputs("Set-Cookie: ", stdout);
-		fputs(cookie, stdout);
-		fputs("\r\n", stdout);
-	}
-	fputs("\r\n", stdout);
-}
-
-static void handleResponse(char* response, int latDifference, int lonDifference)
-{
-	static char* tag = "handleResponse";
-	char* cookie = NULL;
-	response = getHttpResponseBody(response, &cookie);
-
-	char* start = "{\"hotspots\":";
-	int length = strlen(start);
-
-	if (strncmp(start, response, length))
-	{
-		printHeader(cookie);
-		fputs(response, stdout);
-		PBL_CGI_TRACE("Response does not start with %s, no handling", start);
-		return;
-	}
-
-	PblStringBuilder* stringBuilder = pblStringBuilderNew();
-	if (!stringBuilder)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-
-	char* rest = NULL;
-	char* hotspotsString = getMatchingString(response + length, '[', ']', &rest);
-
-	PblList* list = pblListNewArrayList();
-	if (!list)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-
-	char* ptr = hotspotsString;
-	while (*ptr == '{')
-	{
-		char* ptr2 = NULL;
-		char* hotspot = getMatchingString(ptr, '{', '}', &ptr2);
-
-		if (pblListAdd(list, hotspot) < 0)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-		if (*ptr2 != ',')
-		{
-			break;
-		}
-		ptr = ptr2 + 1;
-	}
-
-	printHeader(cookie);
-	putString(start, stringBuilder);
-	putString("[", stringBuilder);
-
-	int nPois = pblListSize(list);
-	PBL_CGI_TRACE("Number of pois=%d", nPois);
-
-	for (int j = 0; j < nPois; j++)
-	{
-		if (j > 0)
-		{
-			putString(",", stringBuilder);
-		}
-		putString("{", stringBuilder);
-
-		char* hotspot = pblListGet(list, j);
-
-		char* ptr = hotspot;
-		if (latDifference != 0 || lonDifference != 0)
-		{
-			char* replacedLat = changeLat(hotspot, 1, -1 * latDifference);
-			ptr = changeLon(replacedLat, 5, -1 * lonDifference);
-			PBL_CGI_TRACE("Applied latDifference=%d and lonDifference=%d", latDifference, lonDifference);
-		}
-		putString(ptr, stringBuilder);
-		putString("}", stringBuilder);
-	}
-
-	putString("]", stringBuilder);
-
-	putString(rest, stringBuilder);
-	PBL_CGI_TRACE("output=%s", pblStringBuilderToString(stringBuilder));
-	pblStringBuilderFree(stringBuilder);
-}
-
-static void createStatisticsFile(char* directory, char* fileName)
-{
-	char* filePath = pblCgiSprintf("%s/%s", directory, fileName);
-
-	FILE* stream = NULL;
-
-#ifdef WIN32
-	errno_t err = fopen_s(&stream, filePath, "r");
-	if (err != 0)
-	{
-		stream = NULL;
-	}
-#else
-	stream = fopen(filePath, "r");
-#endif
-	if (!stream)
-	{
-		stream = pblCgiFopen(filePath, "a");
-		if (stream)
-		{
-			fputs("<title>Arpoise</title>\n<body>copyright  2019, Tamiko Thiel and Peter Graf</body>\n", stream);
-		}
-	}
-	if (stream)
-	{
-		fclose(stream);
-	}
-	PBL_FREE(filePath);
-	}
-
-static char* getVersion()
-{
-	return getStringBetween(ArpoiseDirectory_c_id, "ArpoiseDirectory.c,v ", " ");
-}
-
-static void createStatisticsHits(int layer, char* layerName, int layerServed)
-{
-	char* count = pblCgiQueryValue("count");
-	if (pblCgiStrEquals("1", count))
-	{
-		PBL_CGI_TRACE("-------> Statistics Request\n");
-
-		// Create a web hit for the os and bundle, so that web stats can be used to count hits
-
-		char* versionsDirectory = pblCgiConfigValue("VersionsDirectory", "");
-		if (versionsDirectory && *versionsDirectory)
-		{
-			char* os = pblCgiQueryValue("os");
-			if (!os || !*os || strstr(os, ".."))
-			{
-				os = "UnknownOperatingSystem";
-			}
-
-			char* bundle = pblCgiQueryValue("bundle");
-			if (!bundle || !*bundle || strstr(bundle, ".."))
-			{
-				bundle = "UnknownBundle";
-			}
-
-			char* fileName = pblCgiSprintf("%s_%s.htm", os, bundle);
-			createStatisticsFile(versionsDirectory, fileName);
-			char* uri = pblCgiSprintf("/ArpoiseDirectory/AppVersions/%s", fileName);
-			getHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/AppVersions");
-		}
-
-		// Create a web hit for the location, so that web stats can be used to count hits
-
-		char* locationsDirectory = pblCgiConfigValue("LocationsDirectory", "");
-		if (locationsDirectory && *locationsDirectory)
-		{
-			char* queryLat = pblCgiQueryValue("lat");
-			if (!queryLat || !*queryLat || strstr(queryLat, ".."))
-			{
-				queryLat = "UnknownLat";
-			}
-			else
-			{
-				queryLat = pblCgiStrDup(queryLat);
-			}
-			char* ptr = strstr(queryLat, ".");
-			if (ptr && strlen(ptr) > 4)
-			{
-				ptr[4] = '\0'; // truncate latitude to 3 digits after the '.'
-			}
-
-			char* queryLon = pblCgiQueryValue("lon");
-			if (!queryLon || !*queryLon || strstr(queryLon, ".."))
-			{
-				queryLon = "UnknownLon";
-			}
-			else
-			{
-				queryLon = pblCgiStrDup(queryLon);
-			}
-			ptr = strstr(queryLon, ".");
-			if (ptr && strlen(ptr) > 4)
-			{
-				ptr[4] = '\0'; // truncate longitude to 3 digits after the '.'
-			}
-
-			char* fileName = pblCgiSprintf("%s_%s-%s.htm", queryLon, queryLat, layerName);
-			createStatisticsFile(locationsDirectory, fileName);
-			char* uri = pblCgiSprintf("/ArpoiseDirectory/Locations/%s", fileName);
-			getHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/Locations");
-		}
-
-		// Create a web hit for the layer, so that web stats can be used to count hits
-
-		char* layersDirectory = pblCgiConfigValue("LayersDirectory", "");
-		if (layer && layersDirectory && *layersDirectory && layerName && *layerName)
-		{
-			if (!layerName || !*layerName || strstr(layerName, ".."))
-			{
-				layerName = "UnknownLayer";
-			}
-
-			char* fileName = pblCgiSprintf("%s.htm", layerName);
-			createStatisticsFile(layersDirectory, fileName);
-			char* uri = pblCgiSprintf("/ArpoiseDirectory/Layers/%s", fileName);
-			getHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/Layers");
-		}
-
-		// Create a web hit for the layer served, so that web stats can be used to count hits
-
-		char* layersServedDirectory = pblCgiConfigValue("LayersServedDirectory", "");
-		if (layerServed && layersServedDirectory && *layersServedDirectory && layerName && *layerName)
-		{
-			if (!layerName || !*layerName || strstr(layerName, ".."))
-			{
-				layerName = "UnknownLayer";
-			}
-
-			char* fileName = pblCgiSprintf("%s.htm", layerName);
-			createStatisticsFile(layersServedDirectory, fileName);
-			char* uri = pblCgiSprintf("/ArpoiseDirectory/LayersServed/%s", fileName);
-			getHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/LayersServed");
-		}
-	}
-}
-
-static void freeStringList(PblList* list)
-{
-	while (!pblListIsEmpty(list))
-	{
-		free(pblListPop(list));
-	}
-	pblListFree(list);
-}
-
-static char* getArea(char* queryString)
-{
-	int lat = 0;
-	int lon = 0;
-	char* latPtr = strstr(queryString, "lat=");
-	if (latPtr)
-	{
-		char* ptr = strstr(latPtr, "&");
-		if (ptr)
-		{
-			latPtr = pblCgiStrRangeDup(latPtr, ptr);
-		}
-		else
-		{
-			latPtr = pblCgiStrDup(latPtr);
-		}
-		double latDouble = strtod(latPtr + 4, NULL);
-		lat = (int)(1000000.0 * latDouble);
-	}
-	char* lonPtr = strstr(queryString, "lon=");
-	if (lonPtr)
-	{
-		char* ptr = strstr(lonPtr, "&");
-		if (ptr)
-		{
-			lonPtr = pblCgiStrRangeDup(lonPtr, ptr);
-		}
-		else
-		{
-			lonPtr = pblCgiStrDup(lonPtr);
-		}
-		double lonDouble = strtod(lonPtr + 4, NULL);
-		lon = (int)(1000000.0 * lonDouble);
-	}
-	for (int i = 1; i <= 1000; i++)
-	{
-		char* areaKey = pblCgiSprintf("Area_%d", i);
-		char* areaValue = pblCgiConfigValue(areaKey, NULL);
-
-		if (pblCgiStrIsNullOrWhiteSpace(areaValue))
-		{
-			PBL_CGI_TRACE("No value for area %s", areaKey);
-			PBL_FREE(areaKey);
-			return NULL;
-		}
-
-		PblList* locationList = pblCgiStrSplitToList(areaValue, ",");
-		int size = pblListSize(locationList);
-		if (size != 4)
-		{
-			PBL_CGI_TRACE("%s, expecting 4 location values, current value is %s", areaKey, areaValue);
-
-			freeStringList(locationList);
-			PBL_FREE(areaKey);
-			continue;
-		}
-
-		int list0 = atoi(pblListGet(locationList, 0));
-		int list1 = atoi(pblListGet(locationList, 1));
-		int list2 = atoi(pblListGet(locationList, 2));
-		int list3 = atoi(pblListGet(locationList, 3));
-
-		if (lat < list0 || lon < list1 || lat > list2 || lon > list3)
-		{
-			PBL_CGI_TRACE("%s, lat %d, lon %d is outside area value %s", areaKey, lat, lon, areaValue);
-
-			freeStringList(locationList);
-			PBL_FREE(areaKey);
-			continue;
-		}
-		PBL_CGI_TRACE("%s, lat %d, lon %d is inside area value %s", areaKey, lat, lon, areaValue);
-
-		freeStringList(locationList);
-		return areaKey;
-	}
-	return NULL;
-}
-
-static char* getAreaConfigValue(char* area, char* key, char* defaultValue)
-{
-	char* valueString = NULL;
-	if (!pblCgiStrIsNullOrWhiteSpace(area))
-	{
-		char* areaKey = pblCgiSprintf("%s_%s", area, key);
-		valueString = pblCgiConfigValue(areaKey, NULL);
-		PBL_FREE(areaKey);
-	}
-	if (pblCgiStrIsNullOrWhiteSpace(valueString))
-	{
-		valueString = pblCgiConfigValue(key, defaultValue);
-	}
-	if (pblCgiStrIsNullOrWhiteSpace(valueString))
-	{
-		PBL_CGI_TRACE("No value for %s", key);
-	}
-	return valueString;
-}
-
-int showDefaultLayer = 1;
-
-static int arpoiseDirectory(int argc, char* argv[])
-{
-	char* tag = "ArpoiseDirectory";
-	int layerServed = 0;
-	int layer = 0;
-
-	struct timeval startTime;
-	gettimeofday(&startTime, NULL);
-
-#ifdef _WIN32
-
-	pblCgiConfigMap = pblCgiFileToMap(NULL, "../config/Win32ArpoiseDirectory.txt");
-
-#else
-
-	pblCgiConfigMap = pblCgiFileToMap(NULL, "../config/ArpoiseDirectory.txt");
-
-#endif
-
-	char* traceFile = pblCgiConfigValue(PBL_CGI_TRACE_FILE, "/tmp/ArpoiseDirectory.txt");
-	pblCgiInitTrace(&startTime, traceFile);
-	PBL_CGI_TRACE("argc %d argv[0] = %s", argc, argv[0]);
-
-	pblCgiParseQuery(argc, argv);
-	char* queryString = pblCgiQueryString;
-
-#ifdef _WIN32
-
-	// Initialize Winsock
-	WSADATA wsaData;
-	int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
-	if (result != 0)
-	{
-		pblCgiExitOnError("%s: WSAStartup failed: %d\n", tag, result);
-	}
-
-#endif
-
-	// read query values
-	//
-	char* client = pblCgiQueryValue("client");
-	char* userId = pblCgiQueryValue("userId");
-	if (!userId || !*userId)
-	{
-		userId = "UnknownUserId";
-	}
-
-	// handle fixed device positions
-	//
-	int latDifference = 0;
-	int lonDifference = 0;
-	char* deviceQueryString = handleDevicePosition(userId, client, queryString, &latDifference, &lonDifference);
-	if (deviceQueryString != NULL)
-	{
-		queryString = deviceQueryString;
-	}
-
-	char* layerName = pblCgiQueryValue("layerName");
-	char* layerUrl = "";
-	char* uri = "";
-	char* area = getArea(queryString);
-
-	if (pblCgiStrEquals("true", pblCgiQueryValue("innerLayer"))
-		&& pblCgiStrEquals("0.000000", pblCgiQueryValue("lat"))
-		&& pblCgiStrEquals("0.000000", pblCgiQueryValue("lon")))
-	{
-		// an inner layer request for a default layer
-		//
-		queryString = pblCgiQueryString;
-	}
-
-	// Read config values
-	//
-	char* hostName = getAreaConfigValue(area, "HostName", "www.arpoise.com");
-	if (pblCgiStrIsNullOrWhiteSpace(hostName))
-	{
-		pblCgiExitOnError("%s: HostName must be given.\n", tag);
-	}
-	PBL_CGI_TRACE("HostName=%s", hostName);
-
-	int port = 80;
-	char* portString = getAreaConfigValue(area, "Port", "80");
-	if (!pblCgiStrIsNullOrWhiteSpace(portString))
-	{
-		int givenPort = atoi(portString);
-		if (givenPort < 1)
-		{
-			pblCgiExitOnError("%s: Bad port %d.\n", tag, givenPort);
-		}
-		port = givenPort;
-	}
-	PBL_CGI_TRACE("Port=%d", port);
-
-	char* directoryUri = getAreaConfigValue(area, "DirectoryUri", "/php/dir/web/porpoise.php");
-	if (pblCgiStrIsNullOrWhiteSpace(directoryUri))
-	{
-		pblCgiExitOnError("%s: DirectoryUri must be given.\n", tag);
-	}
-
-	int isDirectoryRequest = pblCgiStrEquals(layerName, "Arpoise-Directory");
-	if (isDirectoryRequest)
-	{
-		// See what operating system it is
-		char* os = pblCgiQueryValue("os");
-		if (!os || !*os)
-		{
-			os = "UnknownOperatingSystem";
-		}
-
-		int bundleInteger = 0;
-		char* bundle = pblCgiQueryValue("bundle");
-		if (bundle && isdigit(*bundle))
-		{
-			bundleInteger = atoi(bundle);
-		}
-
-		// This is a request for the Arpoise-Directory layer
-
-		PBL_CGI_TRACE("-------> Directory Request\n");
-
-		// See what client it is
-		if (pblCgiStrEquals("Arvos", client))
-		{
-			if (pblCgiStrEquals("Android", os) && bundleInteger < 200101)
-			{
-				// Request the default layer from porpoise and return it to the client
-
-				layerUrl = getAreaConfigValue(area, "ArvosDefaultLayerUrl", "/php/porpoise/web/porpoise.php");
-				layerName = getAreaConfigValue(area, "ArvosDefaultLayerName", "Default-ImageTrigger");
-
-				layerServed = 1;
-				PBL_CGI_TRACE("-------> Arvos Default Layer Request: '%s' '%s'\n", layerUrl, layerName);
-
-				char* ptr = changeLayerName(queryString, layerName);
-
-				int myLatDifference = 0;
-				int myLonDifference = 0;
-				ptr = changeLatAndLon(ptr, "0.000000", "0.000000", &myLatDifference, &myLonDifference);
-				latDifference += myLatDifference;
-				lonDifference += myLonDifference;
-
-				uri = pblCgiSprintf("%s?p=%d&%s", layerUrl, getpid(), ptr);
-				char* agent = pblCgiSprintf("ArpoiseDirectory/%s", getVersion());
-				char* response = getHttpResponse(hostName, port, uri, 16, agent);
-				handleResponse(response, latDifference, lonDifference);
-
-				createStatisticsHits(layer, layerName, layerServed);
-				return 0;
-			}
-
-			// Request the AR-vos-Directory
-
-			queryString = changeLayerName(queryString, "AR-vos-Directory");
-		}
-		if (pblCgiStrEquals("Arslam", client))
-		{
-			// Request the default layer from porpoise and return it to the client
-
-			layerUrl = getAreaConfigValue(area, "ArslamDefaultLayerUrl", "/php/porpoise/web/porpoise.php");
-			layerName = getAreaConfigValue(area, "ArslamDefaultLayerName", "Default-Slam");
-
-			layerServed = 1;
-			PBL_CGI_TRACE("-------> Arslam Default Layer Request: '%s' '%s'\n", layerUrl, layerName);
-
-			char* ptr = changeLayerName(queryString, layerName);
-
-			int myLatDifference = 0;
-			int myLonDifference = 0;
-			ptr = changeLatAndLon(ptr, "0.000000", "0.000000", &myLatDifference, &myLonDifference);
-			latDifference += myLatDifference;
-			lonDifference += myLonDifference;
-
-			uri = pblCgiSprintf("%s?p=%d&%s", layerUrl, getpid(), ptr);
-			char* agent = pblCgiSprintf("ArpoiseDirectory/%s", getVersion());
-			char* response = getHttpResponse(hostName, port, uri, 16, agent);
-			response = changeShowMenuOption(response, "false");
-			handleResponse(response, latDifference, lonDifference);
-
-			createStatisticsHits(layer, layerName, layerServed);
-			return 0;
-		}
-
-		uri = pblCgiSprintf("%s?p=%d&%s", directoryUri, getpid(), queryString);
-		char* cookie = NULL;
-
-		char* httpResponse = getHttpResponse(hostName, port, uri, 16, pblCgiSprintf("ArpoiseClient %s", userId));
-		char* response = getHttpResponseBody(httpResponse, &cookie);
-
-		char* start = "{\"hotspots\":";
-		int length = strlen(start);
-
-		if (strncmp(start, response, length))
-		{
-			// There is nothing at the location the client is at
-
-			if (!showDefaultLayer)
-			{
-				printHeader(cookie);
-				fputs(response, stdout);
-				PBL_CGI_TRACE("Response does not start with %s, no handling", start);
-			}
-			else if (pblCgiStrEquals("Arvos", client))
-			{
-				// Request the default layer from porpoise and return it to the client
-
-				layerUrl = getAreaConfigValue(area, "ArvosDefaultLayerUrl", "/php/porpoise/web/porpoise.php");
-				layerName = getAreaConfigValue(area, "ArvosDefaultLayerName", "Default-ImageTrigger");
-
-				layerServed = 1;
-				PBL_CGI_TRACE("-------> Arvos Default Layer Request: '%s' '%s'\n", layerUrl, layerName);
-
-				char* ptr = changeLayerName(queryString, layerName);
-
-				int myLatDifference = 0;
-				int myLonDifference = 0;
-				ptr = changeLatAndLon(ptr, "0.000000", "0.000000", &myLatDifference, &myLonDifference);
-				latDifference += myLatDifference;
-				lonDifference += myLonDifference;
-
-				uri = pblCgiSprintf("%s?p=%d&%s", layerUrl, getpid(), ptr);
-				char* agent = pblCgiSprintf("ArpoiseDirectory/%s", getVersion());
-				char* response = getHttpResponse(hostName, port, uri, 16, agent);
-				handleResponse(response, latDifference, lonDifference);
-
-				createStatisticsHits(layer, layerName, layerServed);
-				return 0;
-			}
-			else
-			{
-				// Request the default layer from porpoise and return it to the client
-
-				layerUrl = getAreaConfigValue(area, "DefaultLayerUrl", "/php/porpoise/web/porpoise.php");
-				layerName = getAreaConfigValue(area, "DefaultLayerName", "Default-Layer-Reign-of-Gold");
-
-				if ((pblCgiStrEquals("Android", os) && bundleInteger >= 190310)
-					|| (pblCgiStrEquals("iOS", os) && bundleInteger >= 20190310)
-					)
-				{
-					char* layername190310 = getAreaConfigValue(area, "DefaultLayerName190310", "");
-					if (layername190310 && *layername190310)
-					{
-						layerName = layername190310;
-					}
-				}
-
-				layerServed = 1;
-				PBL_CGI_TRACE("-------> Default Layer Request: '%s' '%s'\n", layerUrl, layerName);
-
-				char* ptr = changeLayerName(queryString, layerName);
-
-				int myLatDifference = 0;
-				int myLonDifference = 0;
-				ptr = changeLatAndLon(ptr, "0.000000", "0.000000", &myLatDifference, &myLonDifference);
-				latDifference += myLatDifference;
-				lonDifference += myLonDifference;
-
-				uri = pblCgiSprintf("%s?p=%d&%s", layerUrl, getpid(), ptr);
-				char* agent = pblCgiSprintf("ArpoiseDirectory/%s", getVersion());
-				char* response = getHttpResponse(hostName, port, uri, 16, agent);
-				//response = changeShowMenuOption(response, "false");
-				handleResponse(response, latDifference, lonDifference);
-			}
-		}
-		else
-		{
-			// There is at least one layer at the location the client is at
-
-			// If there is more than one layer,
-			// and the client can handle the response of the directory request,
-			// send the response back to the client
-
-			int numberOfHotspots = 0;
-			char* numberOfHotspotsString = getStringBetween(response, "\"numberOfHotspots\":", ",\"");
-			if (numberOfHotspotsString && isdigit(*numberOfHotspotsString))
-			{
-				numberOfHotspots = atoi(numberOfHotspotsString);
-			}
-
-			if (numberOfHotspots > 1
-				&& (
-				(
-					pblCgiStrEquals("Android", os) && bundleInteger >= 190208)
-					|| (pblCgiStrEquals("iOS", os) && bundleInteger >= 20190208)
-					)
-				)
-			{
-				PBL_CGI_TRACE("-------> Client response");
-
-				handleResponse(httpResponse, latDifference, lonDifference);
-			}
-			else
-			{
-				char* baseUrlStart = "\"baseURL\":\"";
-				char* ptr = strstr(response, baseUrlStart);
-				if (ptr)
-				{
-					layerUrl = getStringBetween(ptr, baseUrlStart, "\"");
-					while (strchr(layerUrl, '\\'))
-					{
-						layerUrl = pblCgiStrReplace(layerUrl, "\\", "");
-					}
-				}
-
-				if (!layerUrl || !*layerUrl)
-				{
-					printHeader(cookie);
-					fputs(response, stdout);
-					PBL_CGI_TRACE("Response does not contain proper 'baseURL' value, no handling");
-					return 0;
-				}
-
-				char* titleStart = "\"title\":\"";
-				ptr = strstr(response, titleStart);
-				if (ptr)
-				{
-					layerName = getStringBetween(ptr, titleStart, "\"");
-				}
-
-				if (!layerName || !*layerName)
-				{
-					printHeader(cookie);
-					fputs(response, stdout);
-					PBL_CGI_TRACE("Response does not contain proper 'title' value, no handling");
-					return 0;
-				}
-
-				// Redirect the client to the url and layer specified
-
-				layer = 1;
-				ptr = changeRedirectionUrl(response, layerUrl);
-				ptr = changeRedirectionLayer(ptr, layerName);
-
-				printHeader(cookie);
-				fputs(ptr, stdout);
-				PBL_CGI_TRACE("-------> Client redirect: '%s' '%s'", layerUrl, layerName);
-			}
-		}
-	}
-	else
-	{
-		// This is a request for a specific layer, request the layer from porpoise and return it to the client
-		char* porpoiseUri = getAreaConfigValue(area, "PorpoiseUri", "/php/porpoise/web/porpoise.php");
-		if (pblCgiStrIsNullOrWhiteSpace(porpoiseUri))
-		{
-			pblCgiExitOnError("%s: PorpoiseUri must be given.\n", tag);
-		}
-
-		layerServed = 1;
-		PBL_CGI_TRACE("-------> Layer Request: '%s' '%s'\n", porpoiseUri, layerName);
-
-		uri = pblCgiSprintf("%s?p=%d&%s", porpoiseUri, getpid(), queryString);
-		char* agent = pblCgiSprintf("ArpoiseFilter/%s", getVersion());
-		handleResponse(getHttpResponse(hostName, port, uri, 16, agent), latDifference, lonDifference);
-	}
-
-	createStatisticsHits(layer, layerName, layerServed);
-	return 0;
-}
-
-int main(int argc, char* argv[])
-{
-	int rc = arpoiseDirectory(argc, argv);
-	traceDuration();
-	return rc;
-}
+/*
+ArpoiseDirectory.c - main for Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+$Log: ArpoiseDirectory.c,v $
+Revision 1.43  2020/03/18 22:37:22  peter
+handle inner layer request for a default layer
+
+Revision 1.41  2020/03/18 00:23:26  peter
+Cleanup of getAreaConfigValue()
+
+Revision 1.40  2020/03/17 22:11:00  peter
+No caching
+
+Revision 1.39  2020/03/17 22:01:30  peter
+Made sure the directory server does not cache
+
+Revision 1.38  2020/03/17 20:50:03  peter
+Working on hidden histories version
+
+Revision 1.37  2020/03/16 11:43:13  peter
+Working on version for hidden histories
+
+Revision 1.36  2020/03/15 23:29:25  peter
+Working on areas for the directory
+
+Revision 1.35  2020/02/23 12:29:21  peter
+Added layer name to location statistics
+
+Revision 1.34  2020/01/10 11:06:06  peter
+Layer lists for AR-vos also for Android
+
+Revision 1.33  2019/11/15 21:50:03  peter
+Layer lists for AR-vos on iOs
+
+Revision 1.32  2019/11/15 19:32:26  peter
+Allowing the menu button in AR-vos
+
+Revision 1.31  2019/10/07 14:46:18  peter
+Allowing menu button for default layers
+
+Revision 1.30  2019/09/02 20:29:34  peter
+Some cleanup
+
+Revision 1.29  2019/08/13 21:23:02  peter
+Removed potential null reference crash.
+
+Revision 1.28  2019/08/10 19:31:55  peter
+Added Arslam handling
+
+Revision 1.27  2019/07/23 21:54:34  peter
+Separated version and location logs
+
+Revision 1.26  2019/05/18 18:31:13  peter
+Special default layer for AB EoF
+
+Revision 1.25  2019/04/04 21:54:53  peter
+Added the default layer handling for Arvos
+
+Revision 1.24  2019/02/22 20:28:01  peter
+Removed a compiler warning
+
+Revision 1.23  2019/02/22 19:06:22  peter
+Added the handling of the DefaultLayerName
+
+Revision 1.22  2019/02/22 15:04:21  peter
+Handling of showMenuButton for default layer
+
+Revision 1.21  2019/02/18 20:22:18  peter
+Directory requests with one hotspot as result are not sent to the client as list anymore
+
+Revision 1.20  2019/02/17 17:07:12  peter
+Handling of clients that can handle arpoise directory responses
+
+Revision 1.19  2019/02/05 13:29:21  peter
+Code simplyfication and refactoring
+
+Revision 1.18  2019/02/05 11:14:22  peter
+Refactoring of networking code
+
+Revision 1.17  2019/02/04 19:44:53  peter
+Improved the device position handling with the default layer
+
+Revision 1.16  2019/02/04 12:29:03  peter
+Improved the version statistics
+
+Revision 1.15  2019/02/04 12:00:03  peter
+Improved default layer handling
+
+Revision 1.14  2019/02/03 23:22:28  peter
+Some cleanup
+
+Revision 1.13  2019/02/03 23:19:02  peter
+Changed the directory structure of the hit count mechanism
+
+Revision 1.12  2019/02/03 17:00:02  peter
+Improved handling of redirections
+
+Revision 1.11  2019/02/03 15:20:53  peter
+Moved redirection to the client
+
+Revision 1.10  2019/02/03 13:05:47  peter
+Improved bundle handling
+
+Revision 1.9  2019/02/03 12:52:47  peter
+Fixed the count handling
+
+Revision 1.8  2019/02/03 12:47:08  peter
+Do not create statistics hits for refreshes
+
+Revision 1.7  2019/02/03 12:03:06  peter
+Creating the versions and layer names files for the hits
+
+Revision 1.6  2019/02/03 01:30:41  peter
+Versions file handling
+
+Revision 1.5  2019/02/02 16:53:49  peter
+Default layer is reign of gold
+
+Revision 1.4  2019/01/30 23:45:24  peter
+Fixed a bug with longer responses
+
+Revision 1.3  2019/01/20 16:13:33  peter
+Cleanup of traces
+
+Revision 1.2  2019/01/19 15:50:38  peter
+Improved the user agent string
+
+Revision 1.1  2019/01/19 00:03:31  peter
+Working on arpoise directory service
+
+
+*/
+
+/*
+* Make sure "strings <exe> | grep Id | sort -u" shows the source file versions
+*/
+char* ArpoiseDirectory_c_id = "$Id: ArpoiseDirectory.c,v 1.43 2020/03/18 22:37:22 peter Exp $";
+
+#ifdef __linux__
+#define _POSIX_C_SOURCE 200809L /* O_NOFOLLOW is not declared with -std=c99 */
+#endif
+
+#include <stdio.h>
+#include <memory.h>
+
+#ifndef __APPLE__
+#include <malloc.h>
+#endif
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+
+#ifdef _WIN32
+
+#include <winsock2.h>
+#include <direct.h>
+#include <windows.h> 
+#include <process.h>
+
+#define socket_close closesocket
+
+#else
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#define socket_close close
+
+#ifndef h_addr
+#define h_addr h_addr_list[0] /* for backward compatibility */
+#endif
+
+#endif
+
+#include "pblCgi.h"
+#include "ArpoisePoi.h"
+#include "ArpoiseBinary.h"
+#include "ArpoiseConfig.h"
+#include "ArpoiseHttp.h"
+
+/*
+* Build with ARPOISE_ZLIB defined and link with -lz for gzip compression
+* of the responses from porpoise and of the responses to the clients.
+*/
+#ifdef ARPOISE_ZLIB
+#include <zlib.h>
+#endif
+
+static char receiveBuffer[64 * 1024];
+
+static long millisecondsSince(struct timeval* start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_usec - start->tv_usec) / 1000;
+}
+
+/*
+* The milliseconds left until the deadline, 0 if it has passed.
+*/
+static long millisecondsUntil(struct timeval* deadline)
+{
+	long milliseconds = -millisecondsSince(deadline);
+	return milliseconds > 0 ? milliseconds : 0;
+}
+
+/*
+* Receive a HTTP response from a socket, the response must be complete by the deadline.
+*
+* Reading stops as soon as the response is complete, the connection does not have to be closed by the server.
+* Returns NULL on timeout, on a receive error or if the response is malformed or incomplete.
+*/
+static HttpResponse* receiveHttpResponseUntil(int socket, struct timeval* deadline)
+{
+	static char* tag = "receiveHttpResponseUntil";
+
+	HttpResponse* response = arpoiseHttpResponseNew();
+	for (;;)
+	{
+		fd_set readFds;
+		FD_ZERO(&readFds);
+		FD_SET(socket, &readFds);
+
+		long milliseconds = millisecondsUntil(deadline);
+		struct timeval timeout;
+		timeout.tv_sec = milliseconds / 1000;
+		timeout.tv_usec = (milliseconds % 1000) * 1000;
+
+		errno = 0;
+		int rc = select(socket + 1, &readFds, (fd_set*)NULL, (fd_set*)NULL, &timeout);
+		if (rc <= 0)
+		{
+			PBL_CGI_TRACE("%s: select(%d) rc %d, errno %d", tag, socket, rc, errno);
+			break;
+		}
+
+		errno = 0;
+		rc = recv(socket, receiveBuffer, sizeof(receiveBuffer), 0);
+		if (rc < 0)
+		{
+			PBL_CGI_TRACE("%s: recv(%d) error, errno %d", tag, socket, errno);
+			break;
+		}
+		if (rc == 0)
+		{
+			if (arpoiseHttpResponseFinish(response) < 0)
+			{
+				PBL_CGI_TRACE("%s: socket %d closed before the response was complete", tag, socket);
+				break;
+			}
+			return response;
+		}
+		if (arpoiseHttpResponseParse(response, receiveBuffer, rc) < 0)
+		{
+			PBL_CGI_TRACE("%s: socket %d received a malformed response", tag, socket);
+			break;
+		}
+		if (response->state == ARPOISE_HTTP_DONE)
+		{
+			return response;
+		}
+	}
+	arpoiseHttpResponseFree(response);
+	return NULL;
+}
+
+static HttpResponse* receiveHttpResponseFromTcp(int socket, int timeoutSeconds)
+{
+	struct timeval deadline;
+	gettimeofday(&deadline, NULL);
+	deadline.tv_sec += timeoutSeconds;
+	return receiveHttpResponseUntil(socket, &deadline);
+}
+
+/*
+* Replace the body of a response, a compressed body received is no longer valid.
+*/
+static void setHttpResponseBody(HttpResponse* response, char* body)
+{
+	response->body = body;
+	response->bodyLength = strlen(body);
+	response->bodySize = response->bodyLength + 1;
+	PBL_FREE(response->encodedBody);
+	response->encodedBodyLength = 0;
+	response->encodedBodySize = 0;
+}
+
+/*
+* Wrap a body created locally, e.g. by the native POI engine, as a 200 OK response.
+*/
+static HttpResponse* httpResponseFromBody(char* body)
+{
+	HttpResponse* response = arpoiseHttpResponseNew();
+	response->status = 200;
+	response->state = ARPOISE_HTTP_DONE;
+	setHttpResponseBody(response, body);
+	return response;
+}
+
+static int traceBodyLength = 4096; /* at most this many bytes of bodies are traced */
+
+static void traceHttpResponse(HttpResponse* response)
+{
+	PBL_CGI_TRACE("HttpResponse=%d, %d headers, %lu bytes, %lu bytes encoded\n%.*s", response->status, response->nHeaders,
+		(unsigned long)response->bodyLength, (unsigned long)response->encodedBodyLength, traceBodyLength, response->body);
+}
+
+/*
+* Return the body of a response, all responses except 200 OK are errors.
+*/
+static char* getHttpResponseBody(HttpResponse* response)
+{
+	static char* tag = "getHttpResponseBody";
+
+	if (response->status != 200)
+	{
+		pblCgiExitOnError("%s: Bad HTTP response %d\n%s\n", tag, response->status, response->body ? response->body : "");
+	}
+	return response->body;
+}
+
+/*
+* Try to send some bytes to a tcp socket, returns -1 on error
+*/
+static int trySendBytesToTcp(int socket, char* buffer, int nBytesToSend)
+{
+	static char* tag = "trySendBytesToTcp";
+
+	char* ptr = buffer;
+	while (nBytesToSend > 0)
+	{
+		errno = 0;
+		int rc = send(socket, ptr, nBytesToSend, 0);
+		if (rc > 0)
+		{
+			ptr += rc;
+			nBytesToSend -= rc;
+		}
+		else
+		{
+			PBL_CGI_TRACE("%s: send(%d) error, rc %d, errno %d", tag, socket, rc, errno);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+* Send some bytes to a tcp socket
+*/
+static void sendBytesToTcp(int socket, char* buffer, int nBytesToSend)
+{
+	static char* tag = "sendBytesToTcp";
+
+	if (trySendBytesToTcp(socket, buffer, nBytesToSend) < 0)
+	{
+		pblCgiExitOnError("%s: send(%d) error, errno %d\n", tag, socket, errno);
+	}
+}
+
+/*
+* Try to connect to a tcp socket on machine with hostname and port.
+*
+* Returns -1 if the host cannot be resolved or the connect fails.
+*/
+static int tryConnectToTcp(char* hostname, int port)
+{
+	static char* tag = "tryConnectToTcp";
+
+	errno = 0;
+	struct hostent* hostInfo = gethostbyname(hostname);
+	if (!hostInfo)
+	{
+		PBL_CGI_TRACE("%s: gethostbyname(%s) error, errno %d.", tag, hostname, errno);
+		return -1;
+	}
+
+	short shortPort = 80;
+	if (port > 0)
+	{
+		shortPort = port;
+	}
+
+	struct sockaddr_in serverAddress;
+	memset((char*)&serverAddress, 0, sizeof(struct sockaddr_in));
+	serverAddress.sin_family = AF_INET;
+	serverAddress.sin_port = htons(shortPort);
+	memcpy(&(serverAddress.sin_addr.s_addr), hostInfo->h_addr, sizeof(serverAddress.sin_addr.s_addr));
+
+	errno = 0;
+	int socketFd = socket(AF_INET, SOCK_STREAM, 0);
+	if (socketFd < 0)
+	{
+		pblCgiExitOnError("%s: socket() error, errno %d\n", tag, errno);
+	}
+
+	errno = 0;
+	if (connect(socketFd, (struct sockaddr*) & serverAddress, sizeof(struct sockaddr_in)) < 0)
+	{
+		PBL_CGI_TRACE("%s: connect(%d) error, host '%s' on port %d, errno %d", tag, socketFd, hostname, shortPort, errno);
+		socket_close(socketFd);
+		return -1;
+	}
+	return socketFd;
+}
+
+/*
+* Connect to a tcp socket on machine with hostname and port
+*/
+static int connectToTcp(char* hostname, int port)
+{
+	static char* tag = "connectToTcp";
+
+	int socketFd = tryConnectToTcp(hostname, port);
+	if (socketFd < 0)
+	{
+		pblCgiExitOnError("%s: cannot connect to host '%s' on port %d, errno %d\n", tag, hostname, port, errno);
+	}
+	return socketFd;
+}
+
+/*
+* Make a HTTP request with the given uri to the given host/port
+* and return the result content in a malloced buffer.
+*/
+static HttpResponse* getHttpResponse(char* hostname, int port, char* uri, int timeoutSeconds, char* agent)
+{
+	HttpResponse* response = NULL;
+	for (int n = 0; n < 2; n++)
+	{
+		int socketFd = connectToTcp(hostname, port);
+
+		char* sendBuffer = pblCgiStrConcat("GET ", uri, " HTTP/1.1\r\nUser-Agent: ", agent, "\r\nHost: ", hostname,
+			"\r\nConnection: close\r\n\r\n", NULL);
+		PBL_CGI_TRACE("HttpRequest=%s", sendBuffer);
+
+		sendBytesToTcp(socketFd, sendBuffer, strlen(sendBuffer));
+		PBL_FREE(sendBuffer);
+
+		response = receiveHttpResponseFromTcp(socketFd, timeoutSeconds);
+		socket_close(socketFd);
+		if (!response)
+		{
+			PBL_CGI_TRACE("HttpResponse=NULL, n=%d", n);
+			continue;
+		}
+		traceHttpResponse(response);
+		break;
+	}
+	if (!response)
+	{
+		pblCgiExitOnError("getHttpResponse: receiveHttpResponseFromTcp returned NULL\n");
+	}
+	return response;
+}
+
+/*
+* Return the character following the end matching the start the string begins with.
+*/
+static char* getMatchingEnd(char* string, char start, char end)
+{
+	char* tag = "getMatchingEnd";
+	char* ptr = string;
+	if (start != *ptr)
+	{
+		pblCgiExitOnError("%s: expected %c at start of string '%s'\n", tag, start, string);
+	}
+
+	int level = 1;
+	int c;
+	while ((c = *++ptr))
+	{
+		if (c == start)
+		{
+			level++;
+		}
+		if (c == end)
+		{
+			level--;
+			if (level < 1)
+			{
+				return ptr + 1;
+			}
+		}
+	}
+	pblCgiExitOnError("%s: unexpected end of string in '%s'\n", tag, string);
+	return NULL;
+}
+
+static char* getStringBetween(char* string, char* start, char* end)
+{
+	char* tag = "getStringBetween";
+	char* ptr = *start ? strstr(string, start) : string;
+	if (!ptr)
+	{
+		pblCgiExitOnError("%s: expected starting tag '%s' in string '%s'\n", tag, start, string);
+		return NULL;
+	}
+	ptr += strlen(start);
+	char* ptr2 = strstr(ptr, end);
+	if (!ptr2)
+	{
+		pblCgiExitOnError("%s: expected ending '%s' in string '%s'\n", tag, end, ptr);
+	}
+	return pblCgiStrRangeDup(ptr, ptr2);
+}
+
+static char* getNumberString(char* string, char* start)
+{
+	char* tag = "getNumberString";
+	char* ptr = strstr(string, start);
+	if (!ptr)
+	{
+		pblCgiExitOnError("%s: expected starting tag '%s' in string '%s'\n", tag, start, string);
+	}
+	ptr += strlen(start);
+
+	char* ptr2 = ptr;
+	while (ptr2 && *ptr2)
+	{
+		if (isdigit(*ptr2) || '.' == *ptr2 || '-' == *ptr2 || '+' == *ptr2)
+		{
+			ptr2++;
+			continue;
+		}
+		break;
+	}
+	if (!ptr2)
+	{
+		pblCgiExitOnError("%s: expected number ending in string '%s'\n", tag, ptr);
+	}
+	return pblCgiStrRangeDup(ptr, ptr2);
+}
+
+static int binaryOutput = 0; /* the response with hotspots is sent in the binary format */
+static char* outputETag = NULL; /* the ETag of the response with hotspots */
+
+#ifdef ARPOISE_ZLIB
+static z_stream* outputStream = NULL;
+
+static void deflateOutput(char* data, size_t length, int flush)
+{
+	outputStream->next_in = (Bytef*)data;
+	outputStream->avail_in = (uInt)length;
+	do
+	{
+		char buffer[16 * 1024];
+		outputStream->next_out = (Bytef*)buffer;
+		outputStream->avail_out = sizeof(buffer);
+		deflate(outputStream, flush);
+		pblCgiPut(buffer, sizeof(buffer) - outputStream->avail_out);
+		pblCgiPutFlush();
+	} while (outputStream->avail_out == 0);
+}
+#endif
+
+/*
+* Write bytes of the body of the response to the client, compressed if the client accepts it.
+*
+* Uncompressed bytes are gathered, they must not change before the output is flushed.
+*/
+static void putOutput(char* data, size_t length)
+{
+#ifdef ARPOISE_ZLIB
+	if (outputStream)
+	{
+		deflateOutput(data, length, Z_NO_FLUSH);
+		return;
+	}
+#endif
+	pblCgiPut(data, length);
+}
+
+/*
+* Complete the compressed response to the client.
+*/
+static void finishOutput()
+{
+#ifdef ARPOISE_ZLIB
+	if (outputStream)
+	{
+		deflateOutput("", 0, Z_FINISH);
+		deflateEnd(outputStream);
+		PBL_FREE(outputStream);
+	}
+#endif
+	pblCgiPutFlush();
+}
+
+/*
+* A batch of replacements, the rules are applied to the string in one pass.
+*/
+#define REPLACE_RULES_MAX 4
+
+typedef struct ReplaceRules
+{
+	int nRules;
+	char* patterns[REPLACE_RULES_MAX];
+	char* replacements[REPLACE_RULES_MAX];
+} ReplaceRules;
+
+static void addReplaceRule(ReplaceRules* rules, char* pattern, char* replacement)
+{
+	if (rules->nRules >= REPLACE_RULES_MAX)
+	{
+		pblCgiExitOnError("addReplaceRule: more than %d rules\n", REPLACE_RULES_MAX);
+	}
+	rules->patterns[rules->nRules] = pattern;
+	rules->replacements[rules->nRules++] = replacement;
+}
+
+/*
+* Apply the rules to the string and free them, the result is a malloced string.
+*/
+static char* applyReplaceRules(char* string, ReplaceRules* rules)
+{
+	if (!rules->nRules)
+	{
+		return pblCgiStrDup(string);
+	}
+
+	char* replacedString = pblCgiStrReplaceAll(string, rules->nRules, rules->patterns, rules->replacements);
+
+	for (int i = 0; i < rules->nRules; i++)
+	{
+		PBL_FREE(rules->patterns[i]);
+		PBL_FREE(rules->replacements[i]);
+	}
+	rules->nRules = 0;
+
+	return replacedString;
+}
+
+static void addLatRule(ReplaceRules* rules, char* string, int i, int difference)
+{
+	if (!strstr(string, "\"lat\":"))
+	{
+		return;
+	}
+
+	int factor = 1 + (i - 1) / 8;
+	int modulo = (i - 1) % 8;
+
+	switch (modulo)
+	{
+	case 0:
+		difference *= factor;
+		break;
+	case 1:
+		difference *= -factor;
+		break;
+	case 4:
+	case 5:
+		difference *= factor;
+		break;
+	case 6:
+	case 7:
+		difference *= -factor;
+		break;
+	default:
+		return;
+	}
+
+	char* lat = getNumberString(string, "\"lat\":");
+	//PBL_CGI_TRACE("lat=%s", lat);
+
+	char number[PBL_CGI_INT_STRING_SIZE];
+	addReplaceRule(rules, pblCgiStrConcat("\"lat\":", lat, ",", NULL),
+		pblCgiStrConcat("\"lat\":", pblCgiIntToStr(number, atoi(lat) + difference), ",", NULL));
+
+	PBL_FREE(lat);
+}
+
+static void addLonRule(ReplaceRules* rules, char* string, int i, int difference)
+{
+	if (!strstr(string, "\"lon\":"))
+	{
+		return;
+	}
+
+	int factor = 1 + (i - 1) / 8;
+	int modulo = (i - 1) % 8;
+
+	switch (modulo)
+	{
+	case 2:
+		difference *= factor;
+		break;
+	case 3:
+		difference *= -factor;
+		break;
+	case 4:
+	case 6:
+		difference *= factor;
+		break;
+	case 5:
+	case 7:
+		difference *= -factor;
+		break;
+	default:
+		return;
+	}
+
+	char* lon = getNumberString(string, "\"lon\":");
+	//PBL_CGI_TRACE("lon=%s", lon);
+
+	char number[PBL_CGI_INT_STRING_SIZE];
+	addReplaceRule(rules, pblCgiStrConcat("\"lon\":", lon, ",", NULL),
+		pblCgiStrConcat("\"lon\":", pblCgiIntToStr(number, atoi(lon) + difference), ",", NULL));
+
+	PBL_FREE(lon);
+}
+
+static char* changeLatAndLonOfHotspot(char* hotspot, int latDifference, int lonDifference)
+{
+	ReplaceRules rules = { 0 };
+	addLatRule(&rules, hotspot, 1, latDifference);
+	addLonRule(&rules, hotspot, 5, lonDifference);
+	return applyReplaceRules(hotspot, &rules);
+}
+
+static char* getQueryParameter(char* queryString, char* start)
+{
+	char* ptr = strstr(queryString, start);
+	if (!ptr)
+	{
+		return NULL;
+	}
+	char* ptr2 = strstr(ptr, "&");
+	return ptr2 ? pblCgiStrRangeDup(ptr, ptr2) : pblCgiStrDup(ptr);
+}
+
+static void addLatAndLonRules(ReplaceRules* rules, char* queryString, char* lat, char* lon, int* latDifference, int* lonDifference)
+{
+	int replacementLatInteger = (int)(1000000.0 * strtod(lat, NULL));
+	int replacementLonInteger = (int)(1000000.0 * strtod(lon, NULL));
+	int latPtrInteger = 0;
+	int lonPtrInteger = 0;
+
+	char* latPtr = getQueryParameter(queryString, "lat=");
+	if (latPtr)
+	{
+		latPtrInteger = (int)(1000000.0 * strtod(latPtr + 4, NULL));
+		addReplaceRule(rules, latPtr, pblCgiStrCat("lat=", lat));
+	}
+	char* lonPtr = getQueryParameter(queryString, "lon=");
+	if (lonPtr)
+	{
+		lonPtrInteger = (int)(1000000.0 * strtod(lonPtr + 4, NULL));
+		addReplaceRule(rules, lonPtr, pblCgiStrCat("lon=", lon));
+	}
+	if (latDifference && lonDifference && latPtrInteger != 0 && lonPtrInteger != 0)
+	{
+		*latDifference = replacementLatInteger - latPtrInteger;
+		*lonDifference = replacementLonInteger - lonPtrInteger;
+	}
+}
+
+static char* changeLatAndLon(char* queryString, char* lat, char* lon, int* latDifference, int* lonDifference)
+{
+	if (!pblCgiStrIsNullOrWhiteSpace(lat) && !pblCgiStrIsNullOrWhiteSpace(lon))
+	{
+		ReplaceRules rules = { 0 };
+		addLatAndLonRules(&rules, queryString, lat, lon, latDifference, lonDifference);
+		return applyReplaceRules(queryString, &rules);
+	}
+	return NULL;
+}
+
+/*
+* Add the rule replacing the value following the json key given, by the value given as a string.
+*/
+static void addJsonValueRule(ReplaceRules* rules, char* string, char* key, char* value)
+{
+	if (!strstr(string, key))
+	{
+		return;
+	}
+
+	char* oldValue = getStringBetween(string, key, ",\"");
+
+	addReplaceRule(rules, pblCgiStrConcat(key, oldValue, NULL), pblCgiStrConcat(key, "\"", value, "\"", NULL));
+
+	PBL_FREE(oldValue);
+}
+
+static char* changeRedirection(char* string, char* redirectionUrl, char* redirectionLayer)
+{
+	ReplaceRules rules = { 0 };
+	addJsonValueRule(&rules, string, "\"redirectionUrl\":", redirectionUrl);
+	addJsonValueRule(&rules, string, "\"redirectionLayer\":", redirectionLayer);
+	return applyReplaceRules(string, &rules);
+}
+
+static void addLayerNameRule(ReplaceRules* rules, char* string, char* layerName)
+{
+	if (!strstr(string, "layerName="))
+	{
+		return;
+	}
+
+	char* oldLayerName = getStringBetween(string, "layerName=", "&");
+
+	addReplaceRule(rules, pblCgiStrConcat("layerName=", oldLayerName, NULL), pblCgiStrConcat("layerName=", layerName, NULL));
+
+	PBL_FREE(oldLayerName);
+}
+
+static char* changeLayerName(char* string, char* layerName)
+{
+	ReplaceRules rules = { 0 };
+	addLayerNameRule(&rules, string, layerName);
+	return applyReplaceRules(string, &rules);
+}
+
+static char* changeShowMenuOption(char* string, char* value)
+{
+	ReplaceRules rules = { 0 };
+	addJsonValueRule(&rules, string, "\"showMenuButton\":", value);
+	return applyReplaceRules(string, &rules);
+}
+
+/*
+* The configuration, mapped from its compiled file or read from the text.
+*/
+static ArpoiseConfig* directoryConfig = NULL;
+
+static char* configLookup(char* key)
+{
+	return arpoiseConfigValue(directoryConfig, key);
+}
+
+static char* handleDevicePosition(char* deviceId, char* queryString, int* latDifference, int* lonDifference)
+{
+	if (pblCgiStrIsNullOrWhiteSpace(deviceId) || !directoryConfig->nDevices)
+	{
+		return NULL;
+	}
+
+	char* lat = NULL;
+	char* lon = NULL;
+	arpoiseConfigDevicePosition(directoryConfig, deviceId, &lat, &lon);
+
+	return changeLatAndLon(queryString, lat, lon, latDifference, lonDifference);
+}
+
+static void traceDuration()
+{
+	if (!pblCgiTraceFile)
+	{
+		return;
+	}
+
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	unsigned long duration = now.tv_sec * 1000000 + now.tv_usec;
+	duration -= pblCgiStartTime.tv_sec * 1000000 + pblCgiStartTime.tv_usec;
+	PBL_CGI_TRACE("Duration=%lu microseconds", duration);
+}
+
+/*
+* Decide whether a request is traced, the trace file must exist in any case.
+*
+* TraceSampleRate N traces one of N requests, 1 traces all requests, 0 none.
+* Requests of the user ids listed in TraceUserIds and of the test devices having a DevicePosition are always traced.
+* TraceUserIds is split into a list once.
+*/
+static PblList* traceUserIdList = NULL;
+
+static int isTraced(char* userId, struct timeval* startTime)
+{
+	char* lat = NULL;
+	char* lon = NULL;
+	if (arpoiseConfigDevicePosition(directoryConfig, userId, &lat, &lon))
+	{
+		return 1;
+	}
+
+	if (!traceUserIdList)
+	{
+		char* userIds = pblCgiConfigValue("TraceUserIds", NULL);
+		if (!pblCgiStrIsNullOrWhiteSpace(userIds))
+		{
+			traceUserIdList = pblCgiStrSplitToList(userIds, ",");
+		}
+	}
+	for (int i = 0; traceUserIdList && i < pblListSize(traceUserIdList); i++)
+	{
+		if (pblCgiStrEquals(pblListGet(traceUserIdList, i), userId))
+		{
+			return 1;
+		}
+	}
+
+	int sampleRate = arpoiseConfigInteger(directoryConfig, "TraceSampleRate", 1);
+	if (sampleRate <= 1)
+	{
+		return sampleRate == 1;
+	}
+	unsigned int hash = ((unsigned int)startTime->tv_usec ^ ((unsigned int)getpid() << 16)) * 2654435761u;
+	return (hash >> 8) % sampleRate == 0;
+}
+
+#ifdef ARPOISE_ZLIB
+/*
+* Get the q-value an Accept-Encoding header gives a content coding, in thousandths.
+*
+* A coding listed without q-value gets 1000, a coding not listed gets the q-value of "*", 0 if there is none.
+*/
+static int getAcceptEncodingQuality(char* acceptEncoding, char* coding)
+{
+	int quality = -1;
+	int anyQuality = 0;
+
+	char* ptr = acceptEncoding;
+	while (*ptr)
+	{
+		while (*ptr == ' ' || *ptr == '\t' || *ptr == ',')
+		{
+			ptr++;
+		}
+		char* name = ptr;
+		while (*ptr && *ptr != ';' && *ptr != ',' && *ptr != ' ' && *ptr != '\t')
+		{
+			ptr++;
+		}
+		size_t nameLength = ptr - name;
+
+		int value = 1000;
+		while (*ptr && *ptr != ',')
+		{
+			while (*ptr == ' ' || *ptr == '\t' || *ptr == ';')
+			{
+				ptr++;
+			}
+			if (*ptr == 'q' || *ptr == 'Q')
+			{
+				char* qValue = ptr + 1;
+				while (*qValue == ' ' || *qValue == '\t')
+				{
+					qValue++;
+				}
+				if (*qValue++ == '=')
+				{
+					while (*qValue == ' ' || *qValue == '\t')
+					{
+						qValue++;
+					}
+					// 0, 0.5, 1 or 1.000, at most three decimals
+					value = *qValue == '1' ? 1000 : 0;
+					if (*qValue == '0' || *qValue == '1')
+					{
+						if (*++qValue == '.')
+						{
+							for (int scale = 100; scale > 0 && isdigit((unsigned char)*++qValue); scale /= 10)
+							{
+								value += value < 1000 ? (*qValue - '0') * scale : 0;
+							}
+						}
+					}
+					ptr = qValue;
+				}
+			}
+			while (*ptr && *ptr != ';' && *ptr != ',')
+			{
+				ptr++;
+			}
+		}
+
+		if (nameLength == 1 && *name == '*')
+		{
+			anyQuality = value;
+		}
+		else if (nameLength == strlen(coding))
+		{
+			size_t i = 0;
+			while (i < nameLength && tolower((unsigned char)name[i]) == coding[i])
+			{
+				i++;
+			}
+			if (i == nameLength)
+			{
+				quality = value;
+			}
+		}
+	}
+	return quality >= 0 ? quality : anyQuality;
+}
+
+/*
+* Return 1 if the response to the client is to be gzip compressed.
+*
+* The client has to accept gzip with a q-value above 0 and the config value ClientCompression must not be 0.
+*/
+static int isClientCompression()
+{
+	char* acceptEncoding = pblCgiGetEnv("HTTP_ACCEPT_ENCODING");
+	return acceptEncoding && getAcceptEncodingQuality(acceptEncoding, "gzip") > 0
+		&& !pblCgiStrEquals("0", pblCgiConfigValue("ClientCompression", "1"));
+}
+
+static void startCompressedOutput()
+{
+	static char* tag = "startCompressedOutput";
+
+	outputStream = pbl_malloc0(tag, sizeof(z_stream));
+	if (!outputStream)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	// 16 + MAX_WBITS writes a gzip header
+	if (deflateInit2(outputStream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		pblCgiExitOnError("%s: deflateInit2 failed\n", tag);
+	}
+}
+#endif
+
+/*
+* Return 1 if the client asks for the binary format, with the query parameter format=binary or in its Accept header.
+*
+* Only responses with hotspots are sent in the binary format, clients asking for it have to check the Content-Type.
+*/
+static int isBinaryClient()
+{
+	char* accept = pblCgiGetEnv("HTTP_ACCEPT");
+	return pblCgiStrEquals("binary", pblCgiQueryValue("format")) || (accept && strstr(accept, ARPOISE_BINARY_CONTENT_TYPE));
+}
+
+/*
+* Get the ETag of the bytes of a response, a hash over the bytes before compression.
+*
+* Compressed responses are different bytes, so their ETag is different too.
+*/
+#define ETAG_HASH_START 14695981039346656037ULL
+
+static unsigned long long hashBytes(unsigned long long hash, char* data, size_t length)
+{
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/*
+* Print a number in hexadecimal with at least the digits given into a buffer of at least 17 bytes, returns the buffer.
+*/
+static char* hexToStr(char* buffer, unsigned long long value, int minDigits)
+{
+	char digits[16];
+	int n = 0;
+	do
+	{
+		digits[n++] = "0123456789abcdef"[value & 15];
+		value >>= 4;
+	} while (value || n < minDigits);
+
+	for (int i = 0; i < n; i++)
+	{
+		buffer[i] = digits[n - 1 - i];
+	}
+	buffer[n] = '\0';
+	return buffer;
+}
+
+static char* getETag(unsigned long long hash, size_t length)
+{
+	char hashDigits[PBL_CGI_INT_STRING_SIZE];
+	char lengthDigits[PBL_CGI_INT_STRING_SIZE];
+	hexToStr(hashDigits, hash, 16);
+	hexToStr(lengthDigits, length, 1);
+#ifdef ARPOISE_ZLIB
+	if (isClientCompression())
+	{
+		return pblCgiStrConcat("\"", hashDigits, "-", lengthDigits, "-gzip\"", NULL);
+	}
+#endif
+	return pblCgiStrConcat("\"", hashDigits, "-", lengthDigits, "\"", NULL);
+}
+
+/*
+* Return 1 if the client sent the ETag given in its If-None-Match header.
+*
+* The config value ClientETag 0 turns conditional requests off.
+*/
+static int isNotModified(char* eTag)
+{
+	char* ifNoneMatch = pblCgiGetEnv("HTTP_IF_NONE_MATCH");
+	if (!ifNoneMatch || !*ifNoneMatch || pblCgiStrEquals("0", pblCgiConfigValue("ClientETag", "1")))
+	{
+		return 0;
+	}
+
+	size_t length = strlen(eTag);
+	char* ptr = ifNoneMatch;
+	while (*ptr)
+	{
+		while (*ptr == ' ' || *ptr == '\t' || *ptr == ',')
+		{
+			ptr++;
+		}
+		if (*ptr == '*')
+		{
+			return 1;
+		}
+		if (!strncmp(ptr, "W/", 2))
+		{
+			ptr += 2;
+		}
+		if (!strncmp(ptr, eTag, length))
+		{
+			return 1;
+		}
+		while (*ptr && *ptr != ',')
+		{
+			ptr++;
+		}
+	}
+	return 0;
+}
+
+static void printCookies(HttpResponse* httpResponse)
+{
+	int index = 0;
+	char* cookie;
+	while ((cookie = arpoiseHttpResponseHeader(httpResponse, "Set-Cookie", &index)))
+	{
+		pblCgiPutString("Set-Cookie: ");
+		pblCgiPutString(cookie);
+		pblCgiPutString("\r\n");
+	}
+}
+
+static void printHeader(HttpResponse* httpResponse)
+{
+	pblCgiPutString(binaryOutput ? "Content-Type: " ARPOISE_BINARY_CONTENT_TYPE "\r\n" : "Content-Type: application/json\r\n");
+#ifdef ARPOISE_ZLIB
+	if (isClientCompression())
+	{
+		startCompressedOutput();
+		pblCgiPutString("Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n");
+	}
+#endif
+	if (outputETag)
+	{
+		pblCgiPutString("ETag: ");
+		pblCgiPutString(outputETag);
+		pblCgiPutString("\r\n");
+	}
+	printCookies(httpResponse);
+	pblCgiPutString("\r\n");
+}
+
+/*
+* Write the body of a response from porpoise unchanged to the client.
+*
+* If porpoise sent the body gzip compressed and the client accepts gzip,
+* the compressed bytes are passed through without compressing them again.
+*/
+static void printBody(HttpResponse* httpResponse)
+{
+#ifdef ARPOISE_ZLIB
+	if (outputStream && outputStream->total_in == 0
+		&& httpResponse->contentEncoding == ARPOISE_HTTP_GZIP && httpResponse->encodedBody)
+	{
+		deflateEnd(outputStream);
+		PBL_FREE(outputStream);
+		pblCgiPut(httpResponse->encodedBody, httpResponse->encodedBodyLength);
+		pblCgiPutFlush();
+		PBL_CGI_TRACE("Passed %lu gzip bytes through", (unsigned long)httpResponse->encodedBodyLength);
+		return;
+	}
+#endif
+	putOutput(httpResponse->body, httpResponse->bodyLength);
+	pblCgiPutFlush();
+}
+
+/*
+* The rewritten response, gathered as the pieces of the strings it is made of, the strings are not copied.
+* A piece following the previous piece in memory is joined with it.
+*/
+typedef struct ResponsePiece
+{
+	char* data;
+	size_t length;
+	int isOwned; /* the data is malloced for the response and freed with it */
+} ResponsePiece;
+
+typedef struct ResponsePieces
+{
+	ResponsePiece* pieces;
+	int count;
+	int size;
+	size_t length;
+} ResponsePieces;
+
+static void addPiece(ResponsePieces* pieces, char* data, size_t length, int isOwned)
+{
+	static char* tag = "addPiece";
+
+	pieces->length += length;
+	if (pieces->count > 0 && !isOwned)
+	{
+		ResponsePiece* last = pieces->pieces + pieces->count - 1;
+		if (!last->isOwned && last->data + last->length == data)
+		{
+			last->length += length;
+			return;
+		}
+	}
+	if (pieces->count == pieces->size)
+	{
+		int newSize = pieces->size ? 2 * pieces->size : 64;
+		ResponsePiece* newPieces = realloc(pieces->pieces, newSize * sizeof(ResponsePiece));
+		if (!newPieces)
+		{
+			pblCgiExitOnError("%s: Out of memory\n", tag);
+		}
+		pieces->pieces = newPieces;
+		pieces->size = newSize;
+	}
+	ResponsePiece* piece = pieces->pieces + pieces->count++;
+	piece->data = data;
+	piece->length = length;
+	piece->isOwned = isOwned;
+}
+
+/*
+* Copy at most maxLength bytes of the pieces into a malloced string, for the binary format and the trace.
+*/
+static char* joinPieces(ResponsePieces* pieces, size_t maxLength)
+{
+	size_t length = pieces->length < maxLength ? pieces->length : maxLength;
+	char* string = pbl_malloc("joinPieces", length + 1);
+	if (!string)
+	{
+		pblCgiExitOnError("joinPieces: pbl_errno = %d, message='%s'\n", pbl_errno, pbl_errstr);
+	}
+	char* ptr = string;
+	for (int i = 0; i < pieces->count && ptr < string + length; i++)
+	{
+		size_t n = pieces->pieces[i].length < (size_t)(string + length - ptr) ? pieces->pieces[i].length : (size_t)(string + length - ptr);
+		memcpy(ptr, pieces->pieces[i].data, n);
+		ptr += n;
+	}
+	*ptr = '\0';
+	return string;
+}
+
+static void freePieces(ResponsePieces* pieces)
+{
+	for (int i = 0; i < pieces->count; i++)
+	{
+		if (pieces->pieces[i].isOwned)
+		{
+			PBL_FREE(pieces->pieces[i].data);
+		}
+	}
+	free(pieces->pieces);
+}
+
+/*
+* Write the rewritten response to the client, in the binary format if the client asks for it.
+*
+* If the client already has the response, as its If-None-Match header says, 304 is sent without a body.
+* Headers and body are written with one writev, unless the body is compressed.
+*/
+static void printResponse(HttpResponse* httpResponse, ResponsePieces* pieces)
+{
+	size_t length = pieces->length;
+	unsigned char* binary = NULL;
+
+	if (isBinaryClient())
+	{
+		char* json = joinPieces(pieces, pieces->length);
+		binary = arpoiseJsonToBinary(json, &length);
+		if (binary)
+		{
+			binaryOutput = 1;
+			PBL_CGI_TRACE("Binary response of %lu bytes, %lu bytes as json", (unsigned long)length, (unsigned long)pieces->length);
+		}
+		else
+		{
+			length = pieces->length;
+			PBL_CGI_TRACE("Response cannot be encoded in the binary format, sent as json");
+		}
+		PBL_FREE(json);
+	}
+
+	unsigned long long hash = ETAG_HASH_START;
+	if (binary)
+	{
+		hash = hashBytes(hash, (char*)binary, length);
+	}
+	else
+	{
+		for (int i = 0; i < pieces->count; i++)
+		{
+			hash = hashBytes(hash, pieces->pieces[i].data, pieces->pieces[i].length);
+		}
+	}
+
+	outputETag = getETag(hash, length);
+	if (isNotModified(outputETag))
+	{
+		pblCgiPutString("Status: 304 Not Modified\r\nETag: ");
+		pblCgiPutString(outputETag);
+		pblCgiPutString("\r\n");
+		printCookies(httpResponse);
+		pblCgiPutString("\r\n");
+		PBL_CGI_TRACE("Not modified, ETag %s", outputETag);
+	}
+	else
+	{
+		printHeader(httpResponse);
+		if (binary)
+		{
+			putOutput((char*)binary, length);
+		}
+		else
+		{
+			for (int i = 0; i < pieces->count; i++)
+			{
+				putOutput(pieces->pieces[i].data, pieces->pieces[i].length);
+			}
+		}
+	}
+	pblCgiPutFlush();
+	PBL_FREE(binary);
+}
+
+static void handleResponse(HttpResponse* httpResponse, int latDifference, int lonDifference)
+{
+	char* response = getHttpResponseBody(httpResponse);
+
+	char* start = "{\"hotspots\":";
+	int length = strlen(start);
+
+	if (strncmp(start, response, length))
+	{
+		printHeader(httpResponse);
+		printBody(httpResponse);
+		PBL_CGI_TRACE("Response does not start with %s, no handling", start);
+		return;
+	}
+
+	char* rest = getMatchingEnd(response + length, '[', ']');
+
+	// The response is written once it is complete, the header carries its ETag.
+	// Hotspots not changed are not copied, the pieces point into the response
+	ResponsePieces pieces = { 0 };
+	addPiece(&pieces, response, length + 1, 0);
+
+	int nPois = 0;
+	char* ptr = response + length + 1;
+	while (*ptr == '{')
+	{
+		char* ptr2 = getMatchingEnd(ptr, '{', '}');
+		if (nPois++ > 0)
+		{
+			addPiece(&pieces, ptr - 1, 1, 0);
+		}
+
+		if (latDifference != 0 || lonDifference != 0)
+		{
+			char* hotspot = pblCgiStrRangeDup(ptr + 1, ptr2 - 1);
+			char* changedHotspot = changeLatAndLonOfHotspot(hotspot, -1 * latDifference, -1 * lonDifference);
+			PBL_FREE(hotspot);
+			PBL_CGI_TRACE("Applied latDifference=%d and lonDifference=%d", latDifference, lonDifference);
+
+			addPiece(&pieces, ptr, 1, 0);
+			addPiece(&pieces, changedHotspot, strlen(changedHotspot), 1);
+			addPiece(&pieces, ptr2 - 1, 1, 0);
+		}
+		else
+		{
+			addPiece(&pieces, ptr, ptr2 - ptr, 0);
+		}
+
+		if (*ptr2 != ',')
+		{
+			break;
+		}
+		ptr = ptr2 + 1;
+	}
+	PBL_CGI_TRACE("Number of pois=%d", nPois);
+
+	addPiece(&pieces, rest - 1, strlen(rest) + 1, 0);
+
+	printResponse(httpResponse, &pieces);
+	if (pblCgiTraceFile)
+	{
+		char* output = joinPieces(&pieces, traceBodyLength < 0 ? pieces.length : (size_t)traceBodyLength);
+		PBL_CGI_TRACE("output=%s", output);
+		PBL_FREE(output);
+	}
+	freePieces(&pieces);
+}
+
+static void createStatisticsFile(char* directory, char* fileName)
+{
+	char* filePath = pblCgiStrConcat(directory, "/", fileName, NULL);
+
+	FILE* stream = NULL;
+
+#ifdef WIN32
+	errno_t err = fopen_s(&stream, filePath, "r");
+	if (err != 0)
+	{
+		stream = NULL;
+	}
+#else
+	stream = fopen(filePath, "r");
+#endif
+	if (!stream)
+	{
+		stream = pblCgiFopen(filePath, "a");
+		if (stream)
+		{
+			fputs("<title>Arpoise</title>\n<body>copyright  2019, Tamiko Thiel and Peter Graf</body>\n", stream);
+		}
+	}
+	if (stream)
+	{
+		fclose(stream);
+	}
+	PBL_FREE(filePath);
+	}
+
+static char* getVersion()
+{
+	return getStringBetween(ArpoiseDirectory_c_id, "ArpoiseDirectory.c,v ", " ");
+}
+
+static void createStatisticsHits(int layer, char* layerName, int layerServed)
+{
+	char* count = pblCgiQueryValue("count");
+	if (pblCgiStrEquals("1", count))
+	{
+		PBL_CGI_TRACE("-------> Statistics Request\n");
+
+		// Create a web hit for the os and bundle, so that web stats can be used to count hits
+
+		char* versionsDirectory = pblCgiConfigValue("VersionsDirectory", "");
+		if (versionsDirectory && *versionsDirectory)
+		{
+			char* os = pblCgiQueryValue("os");
+			if (!os || !*os || strstr(os, ".."))
+			{
+				os = "UnknownOperatingSystem";
+			}
+
+			char* bundle = pblCgiQueryValue("bundle");
+			if (!bundle || !*bundle || strstr(bundle, ".."))
+			{
+				bundle = "UnknownBundle";
+			}
+
+			char* fileName = pblCgiStrConcat(os, "_", bundle, ".htm", NULL);
+			createStatisticsFile(versionsDirectory, fileName);
+			char* uri = pblCgiStrConcat("/ArpoiseDirectory/AppVersions/", fileName, NULL);
+			getHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/AppVersions");
+		}
+
+		// Create a web hit for the location, so that web stats can be used to count hits
+
+		char* locationsDirectory = pblCgiConfigValue("LocationsDirectory", "");
+		if (locationsDirectory && *locationsDirectory)
+		{
+			char* queryLat = pblCgiQueryValue("lat");
+			if (!queryLat || !*queryLat || strstr(queryLat, ".."))
+			{
+				queryLat = "UnknownLat";
+			}
+			else
+			{
+				queryLat = pblCgiStrDup(queryLat);
+			}
+			char* ptr = strstr(queryLat, ".");
+			if (ptr && strlen(ptr) > 4)
+			{
+				ptr[4] = '\0'; // truncate latitude to 3 digits after the '.'
+			}
+
+			char* queryLon = pblCgiQueryValue("lon");
+			if (!queryLon || !*queryLon || strstr(queryLon, ".."))
+			{
+				queryLon = "UnknownLon";
+			}
+			else
+			{
+				queryLon = pblCgiStrDup(queryLon);
+			}
+			ptr = strstr(queryLon, ".");
+			if (ptr && strlen(ptr) > 4)
+			{
+				ptr[4] = '\0'; // truncate longitude to 3 digits after the '.'
+			}
+
+			char* fileName = pblCgiStrConcat(queryLon, "_", queryLat, "-", layerName, ".htm", NULL);
+			createStatisticsFile(locationsDirectory, fileName);
+			char* uri = pblCgiStrConcat("/ArpoiseDirectory/Locations/", fileName, NULL);
+			getHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/Locations");
+		}
+
+		// Create a web hit for the layer, so that web stats can be used to count hits
+
+		char* layersDirectory = pblCgiConfigValue("LayersDirectory", "");
+		if (layer && layersDirectory && *layersDirectory && layerName && *layerName)
+		{
+			if (!layerName || !*layerName || strstr(layerName, ".."))
+			{
+				layerName = "UnknownLayer";
+			}
+
+			char* fileName = pblCgiStrConcat(layerName, ".htm", NULL);
+			createStatisticsFile(layersDirectory, fileName);
+			char* uri = pblCgiStrConcat("/ArpoiseDirectory/Layers/", fileName, NULL);
+			getHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/Layers");
+		}
+
+		// Create a web hit for the layer served, so that web stats can be used to count hits
+
+		char* layersServedDirectory = pblCgiConfigValue("LayersServedDirectory", "");
+		if (layerServed && layersServedDirectory && *layersServedDirectory && layerName && *layerName)
+		{
+			if (!layerName || !*layerName || strstr(layerName, ".."))
+			{
+				layerName = "UnknownLayer";
+			}
+
+			char* fileName = pblCgiStrConcat(layerName, ".htm", NULL);
+			createStatisticsFile(layersServedDirectory, fileName);
+			char* uri = pblCgiStrConcat("/ArpoiseDirectory/LayersServed/", fileName, NULL);
+			getHttpResponse("www.arpoise.com", 80, uri, 16, "ArpoiseDirectory/LayersServed");
+		}
+	}
+}
+
+static char* getArea(char* queryString)
+{
+	int lat = 0;
+	int lon = 0;
+	char* latPtr = strstr(queryString, "lat=");
+	if (latPtr)
+	{
+		char* ptr = strstr(latPtr, "&");
+		if (ptr)
+		{
+			latPtr = pblCgiStrRangeDup(latPtr, ptr);
+		}
+		else
+		{
+			latPtr = pblCgiStrDup(latPtr);
+		}
+		double latDouble = strtod(latPtr + 4, NULL);
+		lat = (int)(1000000.0 * latDouble);
+	}
+	char* lonPtr = strstr(queryString, "lon=");
+	if (lonPtr)
+	{
+		char* ptr = strstr(lonPtr, "&");
+		if (ptr)
+		{
+			lonPtr = pblCgiStrRangeDup(lonPtr, ptr);
+		}
+		else
+		{
+			lonPtr = pblCgiStrDup(lonPtr);
+		}
+		double lonDouble = strtod(lonPtr + 4, NULL);
+		lon = (int)(1000000.0 * lonDouble);
+	}
+	int area = arpoiseConfigArea(directoryConfig, lat, lon);
+	char number[PBL_CGI_INT_STRING_SIZE];
+	return area ? pblCgiStrConcat("Area_", pblCgiIntToStr(number, area), NULL) : NULL;
+}
+
+static char* getAreaConfigValue(char* area, char* key, char* defaultValue)
+{
+	char* valueString = NULL;
+	if (!pblCgiStrIsNullOrWhiteSpace(area))
+	{
+		char* areaKey = pblCgiStrConcat(area, "_", key, NULL);
+		valueString = pblCgiConfigValue(areaKey, NULL);
+		PBL_FREE(areaKey);
+	}
+	if (pblCgiStrIsNullOrWhiteSpace(valueString))
+	{
+		valueString = pblCgiConfigValue(key, defaultValue);
+	}
+	if (pblCgiStrIsNullOrWhiteSpace(valueString))
+	{
+		PBL_CGI_TRACE("No value for %s", key);
+	}
+	return valueString;
+}
+
+/*
+* Porpoise back ends.
+*
+* HostName and Port (and their Area_N_ overrides) can name a comma separated list
+* of back ends, each entry is either "host" or "host:port", Port is used for entries without a port.
+*
+* The state of the back ends, outstanding requests, failures and ejections,
+* is shared between the cgi processes via a memory mapped BackendStateFile.
+* The file must be in a directory only the cgi user can write to, it is created readable
+* and writable by its owner only, a symbolic link or a file owned by another user is not used.
+* There is no default, without a BackendStateFile each cgi process only knows its own requests.
+* A BackendStateFile that is configured but cannot be used is an error.
+*/
+#define ARPOISE_MAX_BACKENDS                64
+#define ARPOISE_BACKEND_NAME_LENGTH         128
+#define ARPOISE_BACKEND_STATE_MAGIC         0x41524232
+
+#define ARPOISE_BALANCING_LEAST_OUTSTANDING 0
+#define ARPOISE_BALANCING_POWER_OF_TWO      1
+
+typedef struct BackendState
+{
+	volatile long key;
+	volatile long outstanding;
+	volatile long failures;
+	volatile long ejectedUntil;
+	volatile long lastProbe;
+	volatile long lastUsed;
+	char name[ARPOISE_BACKEND_NAME_LENGTH];
+} BackendState;
+
+#define ARPOISE_LATENCY_HISTORY             256
+
+typedef struct BackendStateTable
+{
+	volatile long magic;
+	BackendState states[ARPOISE_MAX_BACKENDS];
+
+	// Accounting of the hedged requests
+	volatile long nRequests;
+	volatile long nHedgedRequests;
+
+	// Recent times to first byte in milliseconds
+	volatile long latencyIndex;
+	volatile long latencies[ARPOISE_LATENCY_HISTORY];
+} BackendStateTable;
+
+typedef struct Backend
+{
+	char* hostName;
+	int port;
+	BackendState* state;
+} Backend;
+
+typedef struct BackendPool
+{
+	int nBackends;
+	Backend* backends;
+	int balancing;
+	int maxFailures;
+	int ejectSeconds;
+	int probeSeconds;
+	char* probeUri;
+
+	int hedgeRequests;
+	int hedgePercentile;
+	int hedgeMaxPercent;
+	long hedgeMinDelay;
+	long hedgeMaxDelay;
+
+	char* acceptEncoding;
+} BackendPool;
+
+#ifdef _WIN32
+
+#define arpoiseAtomicAdd(ptr, value) InterlockedExchangeAdd((volatile LONG*)(ptr), (value))
+#define arpoiseAtomicCompareAndSwap(ptr, oldValue, newValue) (InterlockedCompareExchange((volatile LONG*)(ptr), (newValue), (oldValue)) == (oldValue))
+
+#else
+
+#define arpoiseAtomicAdd(ptr, value) __sync_fetch_and_add((ptr), (value))
+#define arpoiseAtomicCompareAndSwap(ptr, oldValue, newValue) __sync_bool_compare_and_swap((ptr), (oldValue), (newValue))
+
+#endif
+
+static BackendStateTable localBackendStateTable;
+static BackendStateTable* backendStateTable = NULL;
+
+/*
+* Map the shared back end state file, uses process local state if no file is configured.
+*
+* Exits with an error if the file configured cannot be used.
+*/
+static BackendStateTable* getBackendStateTable()
+{
+	static char* tag = "getBackendStateTable";
+
+	if (backendStateTable)
+	{
+		return backendStateTable;
+	}
+	backendStateTable = &localBackendStateTable;
+
+	char* filePath = pblCgiConfigValue("BackendStateFile", "");
+	if (pblCgiStrIsNullOrWhiteSpace(filePath))
+	{
+		PBL_CGI_TRACE("No BackendStateFile configured, the state of the back ends is process local");
+		return backendStateTable;
+	}
+
+#ifdef _WIN32
+
+	pblCgiExitOnError("%s: BackendStateFile %s cannot be used, shared back end state is not available on this system\n", tag, filePath);
+
+#else
+
+	int fd = open(filePath, O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+	if (fd < 0)
+	{
+		pblCgiExitOnError("%s: cannot open BackendStateFile %s, errno %d\n", tag, filePath, errno);
+	}
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) || !S_ISREG(fileStat.st_mode) || fileStat.st_uid != geteuid()
+		|| (fileStat.st_mode & (S_IWGRP | S_IWOTH)))
+	{
+		close(fd);
+		pblCgiExitOnError("%s: BackendStateFile %s is not a regular file owned and only writable by the cgi user\n", tag, filePath);
+	}
+
+	// Make sure the file is big enough for the table
+	if (fileStat.st_size < (off_t)sizeof(BackendStateTable)
+		&& (lseek(fd, sizeof(BackendStateTable) - 1, SEEK_SET) < 0 || write(fd, "", 1) != 1))
+	{
+		int error = errno;
+		close(fd);
+		pblCgiExitOnError("%s: cannot size BackendStateFile %s, errno %d\n", tag, filePath, error);
+	}
+
+	void* map = mmap(NULL, sizeof(BackendStateTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	int error = errno;
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		pblCgiExitOnError("%s: cannot map BackendStateFile %s, errno %d\n", tag, filePath, error);
+	}
+	backendStateTable = map;
+
+	long magic = backendStateTable->magic;
+	if (magic != ARPOISE_BACKEND_STATE_MAGIC && arpoiseAtomicCompareAndSwap(&backendStateTable->magic, magic, 0))
+	{
+		// A new file or a file of an older version
+		memset((char*)backendStateTable->states, 0, sizeof(BackendStateTable) - offsetof(BackendStateTable, states));
+		backendStateTable->magic = ARPOISE_BACKEND_STATE_MAGIC;
+		PBL_CGI_TRACE("Initialized BackendStateFile %s", filePath);
+	}
+	if (backendStateTable->magic != ARPOISE_BACKEND_STATE_MAGIC)
+	{
+		pblCgiExitOnError("%s: BackendStateFile %s has a bad magic number\n", tag, filePath);
+	}
+
+#endif
+
+	return backendStateTable;
+}
+
+static long hashBackendName(char* name)
+{
+	unsigned long hash = 5381;
+	for (unsigned char* ptr = (unsigned char*)name; *ptr; ptr++)
+	{
+		hash = hash * 33 + *ptr;
+	}
+	return (long)(hash & 0x7fffffff) | 1;
+}
+
+/*
+* Find or create the shared state of a back end.
+*/
+static BackendState* getBackendState(char* hostName, int port)
+{
+	BackendStateTable* table = getBackendStateTable();
+
+	char number[PBL_CGI_INT_STRING_SIZE];
+	char* name = pblCgiStrConcat(hostName, ":", pblCgiIntToStr(number, port), NULL);
+	if (strlen(name) >= ARPOISE_BACKEND_NAME_LENGTH)
+	{
+		name[ARPOISE_BACKEND_NAME_LENGTH - 1] = '\0';
+	}
+	long key = hashBackendName(name);
+
+	BackendState* result = NULL;
+	for (int n = 0; n < ARPOISE_MAX_BACKENDS && !result; n++)
+	{
+		BackendState* state = &table->states[(key + n) % ARPOISE_MAX_BACKENDS];
+		if (state->key == 0 && arpoiseAtomicCompareAndSwap(&state->key, 0, key))
+		{
+			pblCgiStrNCpy(state->name, name, sizeof(state->name));
+			result = state;
+		}
+		else if (state->key == key && (!state->name[0] || !strcmp(state->name, name)))
+		{
+			result = state;
+		}
+	}
+	if (!result)
+	{
+		// The table is full, use an unshared state for this request
+		PBL_CGI_TRACE("BackendStateFile is full, cannot track %s", name);
+		result = pbl_malloc0("getBackendState", sizeof(BackendState));
+		if (!result)
+		{
+			pblCgiExitOnError("getBackendState: pbl_errno = %d, message='%s'\n", pbl_errno, pbl_errstr);
+		}
+	}
+	PBL_FREE(name);
+	return result;
+}
+
+/*
+* Create the pool of porpoise back ends configured for the area.
+*/
+static BackendPool* getBackendPool(char* area, char* probeUri)
+{
+	static char* tag = "getBackendPool";
+
+	char* hostNames = getAreaConfigValue(area, "HostName", "www.arpoise.com");
+	if (pblCgiStrIsNullOrWhiteSpace(hostNames))
+	{
+		pblCgiExitOnError("%s: HostName must be given.\n", tag);
+	}
+	PBL_CGI_TRACE("HostName=%s", hostNames);
+
+	PblList* hostList = pblCgiStrSplitToList(hostNames, ",");
+	PblList* portList = pblCgiStrSplitToList(getAreaConfigValue(area, "Port", "80"), ",");
+
+	BackendPool* pool = pbl_malloc0(tag, sizeof(BackendPool));
+	if (!pool || !(pool->backends = pbl_malloc0(tag, (pblListSize(hostList) + 1) * sizeof(Backend))))
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	for (int i = 0; i < pblListSize(hostList); i++)
+	{
+		char* hostName = pblListGet(hostList, i);
+		if (pblCgiStrIsNullOrWhiteSpace(hostName))
+		{
+			continue;
+		}
+
+		char* portString = pblListGet(portList, i < pblListSize(portList) ? i : 0);
+		char* ptr = strchr(hostName, ':');
+		if (ptr)
+		{
+			*ptr++ = '\0';
+			portString = ptr;
+		}
+
+		int port = 80;
+		if (!pblCgiStrIsNullOrWhiteSpace(portString))
+		{
+			port = atoi(portString);
+			if (port < 1)
+			{
+				pblCgiExitOnError("%s: Bad port %d for host %s.\n", tag, port, hostName);
+			}
+		}
+
+		if (pool->nBackends >= ARPOISE_MAX_BACKENDS)
+		{
+			pblCgiExitOnError("%s: At most %d back ends can be given in HostName.\n", tag, ARPOISE_MAX_BACKENDS);
+		}
+		Backend* backend = &pool->backends[pool->nBackends++];
+		backend->hostName = hostName;
+		backend->port = port;
+		backend->state = getBackendState(hostName, port);
+		PBL_CGI_TRACE("Backend=%s:%d", hostName, port);
+	}
+	if (pool->nBackends < 1)
+	{
+		pblCgiExitOnError("%s: HostName must be given.\n", tag);
+	}
+
+	pool->balancing = ARPOISE_BALANCING_LEAST_OUTSTANDING;
+	if (pblCgiStrEquals("PowerOfTwoChoices", getAreaConfigValue(area, "BackendBalancing", "LeastOutstanding")))
+	{
+		pool->balancing = ARPOISE_BALANCING_POWER_OF_TWO;
+	}
+	pool->maxFailures = arpoiseConfigInteger(directoryConfig, "BackendMaxFailures", 2);
+	pool->ejectSeconds = arpoiseConfigInteger(directoryConfig, "BackendEjectSeconds", 30);
+	pool->probeSeconds = arpoiseConfigInteger(directoryConfig, "BackendProbeSeconds", 10);
+	pool->probeUri = probeUri;
+
+	pool->hedgeRequests = arpoiseConfigInteger(directoryConfig, "HedgeRequests", 0);
+	pool->hedgePercentile = arpoiseConfigInteger(directoryConfig, "HedgePercentile", 95);
+	if (pool->hedgePercentile < 1 || pool->hedgePercentile > 100)
+	{
+		pool->hedgePercentile = 95;
+	}
+	pool->hedgeMaxPercent = arpoiseConfigInteger(directoryConfig, "HedgeMaxPercent", 10);
+	if (pool->hedgeMaxPercent < 0 || pool->hedgeMaxPercent > 100)
+	{
+		// Hedging must never more than double the back end load
+		pool->hedgeMaxPercent = 10;
+	}
+	pool->hedgeMinDelay = atol(pblCgiConfigValue("HedgeMinDelayMilliseconds", "50"));
+	pool->hedgeMaxDelay = atol(pblCgiConfigValue("HedgeMaxDelayMilliseconds", "2000"));
+
+	// Ask porpoise for gzip compressed responses, unless BackendCompression is 0
+	pool->acceptEncoding = "";
+#ifdef ARPOISE_ZLIB
+	if (!pblCgiStrEquals("0", pblCgiConfigValue("BackendCompression", "1")))
+	{
+		pool->acceptEncoding = "Accept-Encoding: gzip\r\n";
+	}
+#endif
+
+	srand((unsigned int)(time(NULL) ^ getpid()));
+	return pool;
+}
+
+static int isBackendEjected(Backend* backend, long now)
+{
+	return backend->state->ejectedUntil > now;
+}
+
+/*
+* Release the outstanding count of an unused state after a crash,
+* a request never takes longer than a minute.
+*/
+static long getBackendOutstanding(Backend* backend, long now)
+{
+	BackendState* state = backend->state;
+	long outstanding = state->outstanding;
+	if (outstanding > 0 && state->lastUsed < now - 60)
+	{
+		arpoiseAtomicCompareAndSwap(&state->outstanding, outstanding, 0);
+		return 0;
+	}
+	return outstanding;
+}
+
+/*
+* Actively probe an ejected back end in a detached child process,
+* the back end is taken back into the pool once it answers the probe.
+*/
+static void probeBackend(BackendPool* pool, Backend* backend, long now)
+{
+	BackendState* state = backend->state;
+	long lastProbe = state->lastProbe;
+
+	if (pool->probeSeconds < 1 || !pool->probeUri || lastProbe > now - pool->probeSeconds
+		|| !arpoiseAtomicCompareAndSwap(&state->lastProbe, lastProbe, now))
+	{
+		return;
+	}
+
+#ifndef _WIN32
+
+	pblCgiPutFlush();
+	pblCgiTraceFlush();
+	if (fork() != 0)
+	{
+		return;
+	}
+
+	// The child must not hold on to the cgi output of the parent
+	close(0);
+	close(1);
+	close(2);
+
+	int socketFd = tryConnectToTcp(backend->hostName, backend->port);
+	if (socketFd >= 0)
+	{
+		char* sendBuffer = pblCgiStrConcat("GET ", pool->probeUri, " HTTP/1.1\r\nUser-Agent: ArpoiseDirectory/Probe\r\nHost: ",
+			backend->hostName, "\r\nConnection: close\r\n\r\n", NULL);
+		if (trySendBytesToTcp(socketFd, sendBuffer, strlen(sendBuffer)) >= 0)
+		{
+			HttpResponse* response = receiveHttpResponseFromTcp(socketFd, 5);
+			if (response && response->status == 200)
+			{
+				state->failures = 0;
+				state->ejectedUntil = 0;
+				PBL_CGI_TRACE("Probe of %s:%d succeeded", backend->hostName, backend->port);
+			}
+			arpoiseHttpResponseFree(response);
+		}
+		socket_close(socketFd);
+	}
+	pblCgiTraceFlush();
+	_exit(0);
+
+#endif
+}
+
+/*
+* Choose a back end that was not tried yet.
+*
+* For a hedge NULL is returned if all back ends are ejected or tried,
+* otherwise the back end that is back soonest is taken then.
+*/
+static Backend* chooseBackend(BackendPool* pool, int* tried, int isHedge)
+{
+	long now = time(NULL);
+	Backend* result = NULL;
+	int nCandidates = 0;
+	int candidates[ARPOISE_MAX_BACKENDS];
+
+	for (int i = 0; i < pool->nBackends && nCandidates < ARPOISE_MAX_BACKENDS; i++)
+	{
+		Backend* backend = &pool->backends[i];
+		if (isBackendEjected(backend, now))
+		{
+			probeBackend(pool, backend, now);
+			continue;
+		}
+		if (!tried[i])
+		{
+			candidates[nCandidates++] = i;
+		}
+	}
+
+	if (nCandidates < 1)
+	{
+		if (isHedge)
+		{
+			return NULL;
+		}
+
+		// All back ends are ejected or tried, take the one that is back soonest
+		for (int i = 0; i < pool->nBackends; i++)
+		{
+			Backend* backend = &pool->backends[i];
+			if (!result || (tried[result - pool->backends] && !tried[i])
+				|| backend->state->ejectedUntil < result->state->ejectedUntil)
+			{
+				result = backend;
+			}
+		}
+		return result;
+	}
+
+	if (pool->balancing == ARPOISE_BALANCING_POWER_OF_TWO)
+	{
+		Backend* first = &pool->backends[candidates[rand() % nCandidates]];
+		Backend* second = &pool->backends[candidates[rand() % nCandidates]];
+		return getBackendOutstanding(second, now) < getBackendOutstanding(first, now) ? second : first;
+	}
+
+	int offset = rand();
+	for (int i = 0; i < nCandidates; i++)
+	{
+		Backend* backend = &pool->backends[candidates[(i + offset) % nCandidates]];
+		if (!result || getBackendOutstanding(backend, now) < getBackendOutstanding(result, now))
+		{
+			result = backend;
+		}
+	}
+	return result;
+}
+
+#define ARPOISE_MAX_OUTSTANDING 4
+
+static Backend* outstandingBackends[ARPOISE_MAX_OUTSTANDING];
+
+/*
+* Make sure requests that exit on an error do not stay outstanding.
+*/
+static void releaseOutstandingBackends()
+{
+	for (int i = 0; i < ARPOISE_MAX_OUTSTANDING; i++)
+	{
+		if (outstandingBackends[i])
+		{
+			arpoiseAtomicAdd(&outstandingBackends[i]->state->outstanding, -1);
+			outstandingBackends[i] = NULL;
+		}
+	}
+}
+
+static void releaseOutstandingBackend(Backend* backend)
+{
+	for (int i = 0; i < ARPOISE_MAX_OUTSTANDING; i++)
+	{
+		if (outstandingBackends[i] == backend)
+		{
+			arpoiseAtomicAdd(&backend->state->outstanding, -1);
+			outstandingBackends[i] = NULL;
+			return;
+		}
+	}
+}
+
+static void startBackendRequest(Backend* backend)
+{
+	static int atExitRegistered = 0;
+	if (!atExitRegistered)
+	{
+		atExitRegistered = 1;
+		atexit(releaseOutstandingBackends);
+	}
+	backend->state->lastUsed = time(NULL);
+
+	for (int i = 0; i < ARPOISE_MAX_OUTSTANDING; i++)
+	{
+		if (!outstandingBackends[i])
+		{
+			arpoiseAtomicAdd(&backend->state->outstanding, 1);
+			outstandingBackends[i] = backend;
+			return;
+		}
+	}
+}
+
+static void finishBackendRequest(BackendPool* pool, Backend* backend, int failed)
+{
+	releaseOutstandingBackend(backend);
+
+	BackendState* state = backend->state;
+	if (!failed)
+	{
+		if (state->failures)
+		{
+			state->failures = 0;
+		}
+		return;
+	}
+
+	long failures = arpoiseAtomicAdd(&state->failures, 1) + 1;
+	if (pool->maxFailures > 0 && failures >= pool->maxFailures)
+	{
+		state->ejectedUntil = time(NULL) + pool->ejectSeconds;
+		PBL_CGI_TRACE("Ejected backend %s:%d for %d seconds after %ld failures",
+			backend->hostName, backend->port, pool->ejectSeconds, failures);
+	}
+}
+
+/*
+* Return 1 if the response is a HTTP server error.
+*/
+static int isHttpServerError(HttpResponse* response)
+{
+	return response->status >= 500;
+}
+
+/*
+* Connect to the back end and send the GET request for the uri.
+*
+* Returns the socket or -1 if the back end failed.
+*/
+static int startBackendHttpRequest(BackendPool* pool, Backend* backend, char* uri, char* agent)
+{
+	startBackendRequest(backend);
+
+	int socketFd = tryConnectToTcp(backend->hostName, backend->port);
+	if (socketFd < 0)
+	{
+		finishBackendRequest(pool, backend, 1);
+		return -1;
+	}
+
+	char* sendBuffer = pblCgiStrConcat("GET ", uri, " HTTP/1.1\r\nUser-Agent: ", agent, "\r\nHost: ", backend->hostName,
+		"\r\n", pool->acceptEncoding, "Connection: close\r\n\r\n", NULL);
+	PBL_CGI_TRACE("HttpRequest=%s", sendBuffer);
+
+	int rc = trySendBytesToTcp(socketFd, sendBuffer, strlen(sendBuffer));
+	PBL_FREE(sendBuffer);
+	if (rc < 0)
+	{
+		socket_close(socketFd);
+		finishBackendRequest(pool, backend, 1);
+		return -1;
+	}
+	return socketFd;
+}
+
+/*
+* Wait until one of the sockets has data to read.
+*
+* Returns the index of the first readable socket, -1 on timeout.
+*/
+static int waitForReadableSocket(int* sockets, int nSockets, long timeoutMilliseconds)
+{
+	static char* tag = "waitForReadableSocket";
+
+	fd_set readFds;
+	FD_ZERO(&readFds);
+	int maxSocket = 0;
+	for (int i = 0; i < nSockets; i++)
+	{
+		FD_SET(sockets[i], &readFds);
+		if (sockets[i] > maxSocket)
+		{
+			maxSocket = sockets[i];
+		}
+	}
+
+	struct timeval timeout;
+	timeout.tv_sec = timeoutMilliseconds / 1000;
+	timeout.tv_usec = (timeoutMilliseconds % 1000) * 1000;
+
+	errno = 0;
+	int rc = select(maxSocket + 1, &readFds, (fd_set*)NULL, (fd_set*)NULL, &timeout);
+	if (rc < 0)
+	{
+		pblCgiExitOnError("%s: select() error, errno %d\n", tag, errno);
+	}
+	for (int i = 0; rc > 0 && i < nSockets; i++)
+	{
+		if (FD_ISSET(sockets[i], &readFds))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/*
+* Remember the time to first byte of a back end response.
+*/
+static void addFirstByteLatency(long milliseconds)
+{
+	BackendStateTable* table = getBackendStateTable();
+	long index = arpoiseAtomicAdd(&table->latencyIndex, 1);
+	table->latencies[(unsigned long)index % ARPOISE_LATENCY_HISTORY] = milliseconds > 0 ? milliseconds : 1;
+}
+
+static int compareLongs(const void* left, const void* right)
+{
+	long l = *(const long*)left;
+	long r = *(const long*)right;
+	return l < r ? -1 : l > r ? 1 : 0;
+}
+
+/*
+* The hedge delay is the configured percentile of the recent times to first byte.
+*/
+static long getHedgeDelay(BackendPool* pool)
+{
+	BackendStateTable* table = getBackendStateTable();
+	long latencies[ARPOISE_LATENCY_HISTORY];
+	int nLatencies = 0;
+
+	for (int i = 0; i < ARPOISE_LATENCY_HISTORY; i++)
+	{
+		long latency = table->latencies[i];
+		if (latency > 0)
+		{
+			latencies[nLatencies++] = latency;
+		}
+	}
+
+	long delay = pool->hedgeMaxDelay;
+	if (nLatencies >= 16)
+	{
+		qsort(latencies, nLatencies, sizeof(long), compareLongs);
+		delay = latencies[(nLatencies - 1) * pool->hedgePercentile / 100];
+	}
+	if (delay < pool->hedgeMinDelay)
+	{
+		delay = pool->hedgeMinDelay;
+	}
+	if (delay > pool->hedgeMaxDelay)
+	{
+		delay = pool->hedgeMaxDelay;
+	}
+	return delay;
+}
+
+/*
+* Count the request and decide whether it may be hedged,
+* hedges are limited to HedgeMaxPercent of all requests.
+*/
+static int countBackendRequest(BackendPool* pool, int hedge)
+{
+	BackendStateTable* table = getBackendStateTable();
+	if (!hedge)
+	{
+		long nRequests = arpoiseAtomicAdd(&table->nRequests, 1) + 1;
+		if (nRequests > 1000000)
+		{
+			// Keep the accounting to the recent past
+			table->nRequests = nRequests / 2;
+			table->nHedgedRequests = table->nHedgedRequests / 2;
+		}
+		return 1;
+	}
+
+	long nHedged = table->nHedgedRequests;
+	if ((nHedged + 1) * 100 > table->nRequests * pool->hedgeMaxPercent)
+	{
+		PBL_CGI_TRACE("Hedge budget exhausted, %ld hedges for %ld requests", nHedged, table->nRequests);
+		return 0;
+	}
+	arpoiseAtomicAdd(&table->nHedgedRequests, 1);
+	return 1;
+}
+
+/*
+* Make a HTTP request with the given uri to one of the back ends of the pool
+* and return the result content in a malloced buffer.
+*
+* If a back end cannot be connected, times out or reports a server error,
+* the request is repeated on another back end.
+*
+* With HedgeRequests enabled, an identical request is sent to a second back end
+* if the first one has not answered within the hedge delay, the first to answer wins.
+* The hedge does not extend the timeout, an attempt and its hedge share one deadline.
+*/
+static HttpResponse* getBackendResponse(BackendPool* pool, char* uri, int timeoutSeconds, char* agent)
+{
+	HttpResponse* response = NULL;
+	int tried[ARPOISE_MAX_BACKENDS + 1];
+	memset(tried, 0, sizeof(tried));
+
+	int nAttempts = pool->nBackends < 2 ? 2 : pool->nBackends;
+	if (nAttempts > ARPOISE_MAX_BACKENDS)
+	{
+		nAttempts = ARPOISE_MAX_BACKENDS;
+	}
+
+	countBackendRequest(pool, 0);
+	int hedged = 0;
+
+	for (int n = 0; n < nAttempts; n++)
+	{
+		Backend* backend = chooseBackend(pool, tried, 0);
+		tried[backend - pool->backends] = 1;
+
+		struct timeval startTime;
+		gettimeofday(&startTime, NULL);
+		struct timeval deadline = startTime;
+		deadline.tv_sec += timeoutSeconds;
+
+		int socketFd = startBackendHttpRequest(pool, backend, uri, agent);
+		if (socketFd < 0)
+		{
+			continue;
+		}
+
+		int readable = -1;
+		if (pool->hedgeRequests && !hedged && pool->nBackends > 1)
+		{
+			long hedgeDelay = getHedgeDelay(pool);
+			if (hedgeDelay > millisecondsUntil(&deadline))
+			{
+				hedgeDelay = millisecondsUntil(&deadline);
+			}
+			readable = waitForReadableSocket(&socketFd, 1, hedgeDelay);
+
+			// A hedge needs a back end that is neither ejected nor busy with this request
+			Backend* hedgeBackend = readable < 0 && millisecondsUntil(&deadline) > 0 ? chooseBackend(pool, tried, 1) : NULL;
+			if (hedgeBackend && countBackendRequest(pool, 1))
+			{
+				hedged = 1;
+				tried[hedgeBackend - pool->backends] = 1;
+				PBL_CGI_TRACE("Hedging after %ld ms to backend %s:%d", hedgeDelay, hedgeBackend->hostName, hedgeBackend->port);
+
+				struct timeval hedgeStartTime;
+				gettimeofday(&hedgeStartTime, NULL);
+
+				int sockets[2];
+				sockets[0] = socketFd;
+				sockets[1] = startBackendHttpRequest(pool, hedgeBackend, uri, agent);
+				if (sockets[1] >= 0)
+				{
+					readable = waitForReadableSocket(sockets, 2, millisecondsUntil(&deadline));
+					if (readable == 1)
+					{
+						// The first back end did not fail, it was just slower
+						socket_close(socketFd);
+						finishBackendRequest(pool, backend, 0);
+
+						socketFd = sockets[1];
+						backend = hedgeBackend;
+						startTime = hedgeStartTime;
+						PBL_CGI_TRACE("Hedge won by backend %s:%d", backend->hostName, backend->port);
+					}
+					else
+					{
+						socket_close(sockets[1]);
+						finishBackendRequest(pool, hedgeBackend, readable < 0);
+					}
+				}
+			}
+		}
+		if (readable < 0)
+		{
+			readable = waitForReadableSocket(&socketFd, 1, millisecondsUntil(&deadline));
+		}
+		if (readable >= 0)
+		{
+			addFirstByteLatency(millisecondsSince(&startTime));
+		}
+
+		response = receiveHttpResponseUntil(socketFd, &deadline);
+		socket_close(socketFd);
+		if (!response)
+		{
+			PBL_CGI_TRACE("HttpResponse=NULL, backend=%s:%d, n=%d", backend->hostName, backend->port, n);
+			finishBackendRequest(pool, backend, 1);
+			continue;
+		}
+		traceHttpResponse(response);
+
+		if (isHttpServerError(response))
+		{
+			finishBackendRequest(pool, backend, 1);
+			if (n < nAttempts - 1)
+			{
+				arpoiseHttpResponseFree(response);
+				response = NULL;
+				continue;
+			}
+			// The last back end failed as well, its response is passed on
+			break;
+		}
+		finishBackendRequest(pool, backend, 0);
+		break;
+	}
+	if (!response)
+	{
+		pblCgiExitOnError("getBackendResponse: no backend returned a response\n");
+	}
+	return response;
+}
+
+/*
+* A request started on a back end whose response is read later.
+*/
+typedef struct BackendRequest
+{
+	Backend* backend;
+	int socket;
+} BackendRequest;
+
+/*
+* Start a request on a back end without waiting for the response.
+*/
+static void startBackendRequestAsync(BackendPool* pool, char* uri, char* agent, BackendRequest* request)
+{
+	int tried[ARPOISE_MAX_BACKENDS + 1];
+	memset(tried, 0, sizeof(tried));
+
+	request->backend = chooseBackend(pool, tried, 0);
+	request->socket = startBackendHttpRequest(pool, request->backend, uri, agent);
+}
+
+/*
+* Read the response of a request started with startBackendRequestAsync.
+*
+* Returns NULL if the back end failed, the caller then has to repeat the request.
+*/
+static HttpResponse* receiveBackendResponse(BackendPool* pool, BackendRequest* request, int timeoutSeconds)
+{
+	if (request->socket < 0)
+	{
+		return NULL;
+	}
+
+	HttpResponse* response = receiveHttpResponseFromTcp(request->socket, timeoutSeconds);
+	socket_close(request->socket);
+	request->socket = -1;
+
+	if (!response || isHttpServerError(response))
+	{
+		PBL_CGI_TRACE("HttpResponse=%d, backend=%s:%d", response ? response->status : 0, request->backend->hostName, request->backend->port);
+		finishBackendRequest(pool, request->backend, 1);
+		arpoiseHttpResponseFree(response);
+		return NULL;
+	}
+	traceHttpResponse(response);
+	finishBackendRequest(pool, request->backend, 0);
+	return response;
+}
+
+/*
+* Discard a request started with startBackendRequestAsync.
+*/
+static void cancelBackendRequest(BackendPool* pool, BackendRequest* request)
+{
+	if (request->socket >= 0)
+	{
+		socket_close(request->socket);
+		request->socket = -1;
+		finishBackendRequest(pool, request->backend, 0);
+	}
+}
+
+/*
+* Client routing of directory requests.
+*
+* The rules are given as ClientRoute config values, one rule per line
+*
+*   ClientRoute <client> <os> <from bundle> <to bundle> <area> <action> [<arguments>]
+*
+* A '*' matches any client, os or area, a '*' bundle leaves the range open, the to bundle is excluded.
+* The actions are
+*
+*   DefaultLayer <url key> <name key> <name>  send the default layer given by the config values instead
+*   SlamLayer <url key> <name key> <name>     the same, with the menu button hidden
+*   Directory <layer name> [<url key> <name key> <name>]
+*                                             request this directory layer, the optional config values
+*                                             give the layer shown if the directory has nothing
+*   DefaultLayerName <name key>               the config value naming the layer shown if the directory has nothing
+*   List <0 or 1>                             whether the client is sent the list of the layers at its location
+*
+* DefaultLayer, SlamLayer and Directory are one kind of action. For each kind of action the first rule
+* matching a request applies. The configured rules come before the built-in rules below, the built-in rules
+* route the clients the way the directory always did.
+*
+* The rules are compiled into a decision table the first time a directory request is routed. The table has a cell
+* for each combination of the clients, operating systems and areas named in the rules, plus one for any other,
+* each cell has the route of each range of bundles. Routing a request is an index lookup and a binary search.
+*/
+#define ARPOISE_ROUTE_DIRECTORY             0
+#define ARPOISE_ROUTE_DEFAULT_LAYER         1
+#define ARPOISE_ROUTE_SLAM_LAYER            2
+
+#define ARPOISE_ROUTE_MAX_FIELDS            10
+
+static char* builtInClientRoutes[] =
+{
+	"Arvos Android * 200101 * DefaultLayer ArvosDefaultLayerUrl ArvosDefaultLayerName Default-ImageTrigger",
+	"Arvos * * * * Directory AR-vos-Directory ArvosDefaultLayerUrl ArvosDefaultLayerName Default-ImageTrigger",
+	"Arslam * * * * SlamLayer ArslamDefaultLayerUrl ArslamDefaultLayerName Default-Slam",
+	"* Android 190310 * * DefaultLayerName DefaultLayerName190310",
+	"* iOS 20190310 * * DefaultLayerName DefaultLayerName190310",
+	"* Android 190208 * * List 1",
+	"* iOS 20190208 * * List 1",
+	NULL
+};
+
+typedef struct ClientRoute
+{
+	int action;
+	char* directoryLayer;       /* the directory layer to request, NULL for the one requested */
+	char* layerUrlKey;          /* config keys and default name of the layer sent instead of the directory */
+	char* layerNameKey;         /* or, for a directory, of the layer shown if it has nothing */
+	char* layerName;
+	char* defaultLayerNameKey;  /* config key of the name of the layer shown if the directory has nothing */
+	int isListClient;
+} ClientRoute;
+
+typedef struct ClientRouteRule
+{
+	char* client;               /* NULL matches any */
+	char* os;
+	char* area;
+	int fromBundle;
+	int toBundle;
+	int nFields;
+	char* fields[ARPOISE_ROUTE_MAX_FIELDS]; /* the action and its arguments */
+} ClientRouteRule;
+
+typedef struct ClientRouteCell
+{
+	int nRanges;
+	int* fromBundle;            /* the first bundle of each range, ascending */
+	ClientRoute* routes;
+} ClientRouteCell;
+
+typedef struct ClientRouteTable
+{
+	PblList* clients;           /* the names in the rules, the index after the last name is any other */
+	PblList* oses;
+	PblList* areas;
+	ClientRouteCell* cells;
+} ClientRouteTable;
+
+static ClientRouteTable* clientRouteTable = NULL;
+
+static int parseBundle(char* value, int openValue)
+{
+	return pblCgiStrEquals("*", value) ? openValue : atoi(value);
+}
+
+static char* parseRouteName(char* value)
+{
+	return pblCgiStrEquals("*", value) ? NULL : value;
+}
+
+/*
+* Parse a rule, returns 0 if the rule is not valid.
+*/
+static int parseClientRouteRule(char* value, ClientRouteRule* rule)
+{
+	char* fields[ARPOISE_ROUTE_MAX_FIELDS + 6];
+	int nFields = 0;
+
+	char* ptr = pblCgiStrDup(value);
+	while (*ptr && nFields < ARPOISE_ROUTE_MAX_FIELDS + 6)
+	{
+		ptr += strspn(ptr, " \t");
+		if (!*ptr)
+		{
+			break;
+		}
+		fields[nFields++] = ptr;
+		ptr += strcspn(ptr, " \t");
+		if (*ptr)
+		{
+			*ptr++ = '\0';
+		}
+	}
+	if (nFields < 6 || nFields > ARPOISE_ROUTE_MAX_FIELDS + 5)
+	{
+		PBL_CGI_TRACE("ClientRoute %s, expecting client, os, bundles, area and action", value);
+		return 0;
+	}
+
+	char* action = fields[5];
+	int nArguments = pblCgiStrEquals("DefaultLayer", action) || pblCgiStrEquals("SlamLayer", action) ? 3
+		: pblCgiStrEquals("Directory", action) || pblCgiStrEquals("DefaultLayerName", action) || pblCgiStrEquals("List", action) ? 1 : -1;
+	if (pblCgiStrEquals("Directory", action) && nFields - 6 == 4)
+	{
+		nArguments = 4;
+	}
+	if (nFields - 6 != nArguments)
+	{
+		PBL_CGI_TRACE("ClientRoute %s, unknown action or wrong number of arguments", value);
+		return 0;
+	}
+
+	rule->client = parseRouteName(fields[0]);
+	rule->os = parseRouteName(fields[1]);
+	rule->fromBundle = parseBundle(fields[2], INT_MIN);
+	rule->toBundle = parseBundle(fields[3], INT_MAX);
+	rule->area = parseRouteName(fields[4]);
+	rule->nFields = nFields - 5;
+	memcpy(rule->fields, fields + 5, rule->nFields * sizeof(char*));
+	return 1;
+}
+
+static int routeNameIndex(PblList* list, char* name)
+{
+	int size = pblListSize(list);
+	for (int i = 0; i < size; i++)
+	{
+		if (pblCgiStrEquals(name, pblListGet(list, i)))
+		{
+			return i;
+		}
+	}
+	return size;
+}
+
+static void addRouteName(PblList* list, char* name)
+{
+	if (name && routeNameIndex(list, name) == pblListSize(list) && pblListAdd(list, name) < 0)
+	{
+		pblCgiExitOnError("addRouteName: pbl_errno = %d, message='%s'\n", pbl_errno, pbl_errstr);
+	}
+}
+
+static int matchesRouteName(char* ruleName, PblList* list, int index)
+{
+	return !ruleName || (index < pblListSize(list) && pblCgiStrEquals(ruleName, pblListGet(list, index)));
+}
+
+static int compareBundles(const void* left, const void* right)
+{
+	int a = *(const int*)left;
+	int b = *(const int*)right;
+	return a < b ? -1 : a > b;
+}
+
+/*
+* Apply the first rule of each kind of action that matches the bundle.
+*/
+static void resolveClientRoute(ClientRouteRule** rules, int nRules, int bundle, ClientRoute* route)
+{
+	int hasAction = 0;
+	int hasDefaultLayerName = 0;
+	int hasList = 0;
+
+	memset(route, 0, sizeof(ClientRoute));
+	for (int i = 0; i < nRules; i++)
+	{
+		ClientRouteRule* rule = rules[i];
+		if (bundle < rule->fromBundle || bundle >= rule->toBundle)
+		{
+			continue;
+		}
+
+		char* action = rule->fields[0];
+		if (pblCgiStrEquals("DefaultLayerName", action))
+		{
+			if (!hasDefaultLayerName++)
+			{
+				route->defaultLayerNameKey = rule->fields[1];
+			}
+		}
+		else if (pblCgiStrEquals("List", action))
+		{
+			if (!hasList++)
+			{
+				route->isListClient = pblCgiStrEquals("1", rule->fields[1]);
+			}
+		}
+		else if (!hasAction++)
+		{
+			if (pblCgiStrEquals("Directory", action))
+			{
+				route->action = ARPOISE_ROUTE_DIRECTORY;
+				route->directoryLayer = rule->fields[1];
+				if (rule->nFields == 5)
+				{
+					route->layerUrlKey = rule->fields[2];
+					route->layerNameKey = rule->fields[3];
+					route->layerName = rule->fields[4];
+				}
+			}
+			else
+			{
+				route->action = pblCgiStrEquals("SlamLayer", action) ? ARPOISE_ROUTE_SLAM_LAYER : ARPOISE_ROUTE_DEFAULT_LAYER;
+				route->layerUrlKey = rule->fields[1];
+				route->layerNameKey = rule->fields[2];
+				route->layerName = rule->fields[3];
+			}
+		}
+	}
+}
+
+/*
+* Compile the configured and the built-in rules into the decision table.
+*/
+static ClientRouteTable* compileClientRoutes()
+{
+	static char* tag = "compileClientRoutes";
+
+	PblList* values = pblListNewArrayList();
+	if (!values)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	char* configValue = pblCgiConfigValue("ClientRoute", NULL);
+	if (!pblCgiStrIsNullOrWhiteSpace(configValue))
+	{
+		// Multiple lines of a config value are comma separated
+		PblList* configured = pblCgiStrSplitToList(configValue, ",");
+		pblListAddAll(values, configured);
+		pblListFree(configured);
+	}
+	for (int i = 0; builtInClientRoutes[i]; i++)
+	{
+		pblListAdd(values, builtInClientRoutes[i]);
+	}
+
+	int nValues = pblListSize(values);
+	ClientRouteRule* rules = pbl_malloc0(tag, (nValues + 1) * sizeof(ClientRouteRule));
+	ClientRouteRule** cellRules = pbl_malloc0(tag, (nValues + 1) * sizeof(ClientRouteRule*));
+	int* bundles = pbl_malloc0(tag, (2 * nValues + 1) * sizeof(int));
+	ClientRouteTable* table = pbl_malloc0(tag, sizeof(ClientRouteTable));
+	if (!rules || !cellRules || !bundles || !table)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	table->clients = pblListNewArrayList();
+	table->oses = pblListNewArrayList();
+	table->areas = pblListNewArrayList();
+	if (!table->clients || !table->oses || !table->areas)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	int nRules = 0;
+	for (int i = 0; i < nValues; i++)
+	{
+		if (parseClientRouteRule(pblListGet(values, i), &rules[nRules]))
+		{
+			addRouteName(table->clients, rules[nRules].client);
+			addRouteName(table->oses, rules[nRules].os);
+			addRouteName(table->areas, rules[nRules].area);
+			nRules++;
+		}
+	}
+	pblListFree(values);
+
+	int nClients = pblListSize(table->clients) + 1;
+	int nOses = pblListSize(table->oses) + 1;
+	int nAreas = pblListSize(table->areas) + 1;
+	table->cells = pbl_malloc0(tag, nClients * nOses * nAreas * sizeof(ClientRouteCell));
+	if (!table->cells)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	for (int client = 0; client < nClients; client++)
+	{
+		for (int os = 0; os < nOses; os++)
+		{
+			for (int area = 0; area < nAreas; area++)
+			{
+				// The rules matching the cell and the bundles where their ranges start and end
+				int nCellRules = 0;
+				int nBundles = 0;
+				bundles[nBundles++] = INT_MIN;
+				for (int i = 0; i < nRules; i++)
+				{
+					ClientRouteRule* rule = &rules[i];
+					if (matchesRouteName(rule->client, table->clients, client)
+						&& matchesRouteName(rule->os, table->oses, os)
+						&& matchesRouteName(rule->area, table->areas, area))
+					{
+						cellRules[nCellRules++] = rule;
+						bundles[nBundles++] = rule->fromBundle;
+						if (rule->toBundle != INT_MAX)
+						{
+							bundles[nBundles++] = rule->toBundle;
+						}
+					}
+				}
+				qsort(bundles, nBundles, sizeof(int), compareBundles);
+
+				ClientRouteCell* cell = &table->cells[(client * nOses + os) * nAreas + area];
+				cell->fromBundle = pbl_malloc0(tag, nBundles * sizeof(int));
+				cell->routes = pbl_malloc0(tag, nBundles * sizeof(ClientRoute));
+				if (!cell->fromBundle || !cell->routes)
+				{
+					pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+				}
+				for (int i = 0; i < nBundles; i++)
+				{
+					if (i > 0 && bundles[i] == bundles[i - 1])
+					{
+						continue;
+					}
+					cell->fromBundle[cell->nRanges] = bundles[i];
+					resolveClientRoute(cellRules, nCellRules, bundles[i], &cell->routes[cell->nRanges]);
+					cell->nRanges++;
+				}
+			}
+		}
+	}
+
+	PBL_FREE(cellRules);
+	PBL_FREE(bundles);
+	PBL_CGI_TRACE("ClientRoute %d rules, %d cells", nRules, nClients * nOses * nAreas);
+	return table;
+}
+
+/*
+* Get the route of a directory request of a client.
+*/
+static ClientRoute* getClientRoute(char* client, char* os, int bundle, char* area)
+{
+	if (!clientRouteTable)
+	{
+		clientRouteTable = compileClientRoutes();
+	}
+	ClientRouteTable* table = clientRouteTable;
+
+	int nOses = pblListSize(table->oses) + 1;
+	int nAreas = pblListSize(table->areas) + 1;
+	ClientRouteCell* cell = &table->cells[(routeNameIndex(table->clients, client) * nOses
+		+ routeNameIndex(table->oses, os)) * nAreas + routeNameIndex(table->areas, area)];
+
+	// The last range starting at or before the bundle, the first range starts at INT_MIN
+	int low = 0;
+	int high = cell->nRanges - 1;
+	while (low < high)
+	{
+		int middle = (low + high + 1) / 2;
+		if (cell->fromBundle[middle] <= bundle)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+	return &cell->routes[low];
+}
+
+/*
+* Get url and name of the default layer that is shown if there is nothing at the location the client is at.
+*
+* A directory route naming its own default layer, as the one of Arvos does, takes precedence over DefaultLayerName.
+*/
+static void getDefaultLayer(char* area, ClientRoute* route, char** layerUrlPtr, char** layerNamePtr)
+{
+	if (route->action == ARPOISE_ROUTE_DIRECTORY && route->layerUrlKey)
+	{
+		*layerUrlPtr = getAreaConfigValue(area, route->layerUrlKey, "/php/porpoise/web/porpoise.php");
+		*layerNamePtr = getAreaConfigValue(area, route->layerNameKey, route->layerName);
+		return;
+	}
+
+	*layerUrlPtr = getAreaConfigValue(area, "DefaultLayerUrl", "/php/porpoise/web/porpoise.php");
+	*layerNamePtr = getAreaConfigValue(area, "DefaultLayerName", "Default-Layer-Reign-of-Gold");
+
+	if (route->defaultLayerNameKey)
+	{
+		char* layerName = getAreaConfigValue(area, route->defaultLayerNameKey, "");
+		if (layerName && *layerName)
+		{
+			*layerNamePtr = layerName;
+		}
+	}
+}
+
+/*
+* Get the maximum number of layers a directory response lists, 0 lists all layers at the location.
+*
+* MaxDirectoryLayers can be given per operating system of the client, e.g. as MaxDirectoryLayersiOS.
+*/
+static int getMaxDirectoryLayers(char* area, char* os)
+{
+	char* key = pblCgiStrConcat("MaxDirectoryLayers", os, NULL);
+	char* value = getAreaConfigValue(area, key, "");
+	PBL_FREE(key);
+	if (pblCgiStrIsNullOrWhiteSpace(value))
+	{
+		value = getAreaConfigValue(area, "MaxDirectoryLayers", "0");
+	}
+	return value && isdigit(*value) ? atoi(value) : 0;
+}
+
+/*
+* Get the uri of a default layer request, the default layer is requested at lat 0 and lon 0.
+*/
+static char* getDefaultLayerUri(char* queryString, char* layerUrl, char* layerName, int* latDifference, int* lonDifference)
+{
+	ReplaceRules rules = { 0 };
+	addLayerNameRule(&rules, queryString, layerName);
+
+	int myLatDifference = 0;
+	int myLonDifference = 0;
+	addLatAndLonRules(&rules, queryString, "0.000000", "0.000000", &myLatDifference, &myLonDifference);
+	*latDifference += myLatDifference;
+	*lonDifference += myLonDifference;
+
+	char* ptr = applyReplaceRules(queryString, &rules);
+	char pid[PBL_CGI_INT_STRING_SIZE];
+	char* uri = pblCgiStrConcat(layerUrl, "?p=", pblCgiIntToStr(pid, getpid()), "&", ptr, NULL);
+	PBL_FREE(ptr);
+	return uri;
+}
+
+int showDefaultLayer = 1;
+
+static int arpoiseDirectory(int argc, char* argv[])
+{
+	char* tag = "ArpoiseDirectory";
+	int layerServed = 0;
+	int layer = 0;
+
+	struct timeval startTime;
+	gettimeofday(&startTime, NULL);
+
+#ifdef _WIN32
+
+	directoryConfig = arpoiseLoadConfig("../config/Win32ArpoiseDirectory.txt");
+
+#else
+
+	directoryConfig = arpoiseLoadConfig("../config/ArpoiseDirectory.txt");
+
+#endif
+	pblCgiConfigLookup = configLookup;
+
+	pblCgiParseQuery(argc, argv);
+	char* queryString = pblCgiQueryString;
+
+	// read query values
+	//
+	char* client = pblCgiQueryValue("client");
+	char* userId = pblCgiQueryValue("userId");
+	if (!userId || !*userId)
+	{
+		userId = "UnknownUserId";
+	}
+
+	// the query is parsed before the trace is started, requests not sampled are not traced at all
+	//
+	char* traceFile = pblCgiConfigValue(PBL_CGI_TRACE_FILE, "/tmp/ArpoiseDirectory.txt");
+	pblCgiInitTrace(&startTime, isTraced(userId, &startTime) ? traceFile : NULL);
+	traceBodyLength = arpoiseConfigInteger(directoryConfig, "TraceBodyLength", traceBodyLength);
+	PBL_CGI_TRACE("argc %d argv[0] = %s", argc, argv[0]);
+	PBL_CGI_TRACE("Config %s %s", directoryConfig->source, directoryConfig->mapping ? "mapped from its compiled file" : "read");
+	PBL_CGI_TRACE("In %s", pblCgiQueryString);
+
+#ifdef _WIN32
+
+	// Initialize Winsock
+	WSADATA wsaData;
+	int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
+	if (result != 0)
+	{
+		pblCgiExitOnError("%s: WSAStartup failed: %d\n", tag, result);
+	}
+
+#endif
+
+	// handle fixed device positions
+	//
+	int latDifference = 0;
+	int lonDifference = 0;
+	char* deviceQueryString = handleDevicePosition(userId, queryString, &latDifference, &lonDifference);
+	if (deviceQueryString != NULL)
+	{
+		queryString = deviceQueryString;
+	}
+
+	char* layerName = pblCgiQueryValue("layerName");
+	char* layerUrl = "";
+	char* uri = "";
+	char* area = getArea(queryString);
+
+	if (pblCgiStrEquals("true", pblCgiQueryValue("innerLayer"))
+		&& pblCgiStrEquals("0.000000", pblCgiQueryValue("lat"))
+		&& pblCgiStrEquals("0.000000", pblCgiQueryValue("lon")))
+	{
+		// an inner layer request for a default layer
+		//
+		queryString = pblCgiQueryString;
+	}
+
+	// Read config values
+	//
+	char* directoryUri = getAreaConfigValue(area, "DirectoryUri", "/php/dir/web/porpoise.php");
+	if (pblCgiStrIsNullOrWhiteSpace(directoryUri))
+	{
+		pblCgiExitOnError("%s: DirectoryUri must be given.\n", tag);
+	}
+
+	BackendPool* backends = getBackendPool(area, directoryUri);
+
+	int isDirectoryRequest = pblCgiStrEquals(layerName, "Arpoise-Directory");
+	if (isDirectoryRequest)
+	{
+		// See what operating system it is
+		char* os = pblCgiQueryValue("os");
+		if (!os || !*os)
+		{
+			os = "UnknownOperatingSystem";
+		}
+
+		int bundleInteger = 0;
+		char* bundle = pblCgiQueryValue("bundle");
+		if (bundle && isdigit(*bundle))
+		{
+			bundleInteger = atoi(bundle);
+		}
+
+		// This is a request for the Arpoise-Directory layer
+
+		PBL_CGI_TRACE("-------> Directory Request\n");
+
+		// See what client it is
+		ClientRoute* route = getClientRoute(client, os, bundleInteger, area);
+		if (route->action != ARPOISE_ROUTE_DIRECTORY)
+		{
+			// Request the default layer of the client from porpoise and return it to the client
+
+			layerUrl = getAreaConfigValue(area, route->layerUrlKey, "/php/porpoise/web/porpoise.php");
+			layerName = getAreaConfigValue(area, route->layerNameKey, route->layerName);
+
+			layerServed = 1;
+			PBL_CGI_TRACE("-------> %s Default Layer Request: '%s' '%s'\n", client, layerUrl, layerName);
+
+			uri = getDefaultLayerUri(queryString, layerUrl, layerName, &latDifference, &lonDifference);
+			char* agent = pblCgiStrConcat("ArpoiseDirectory/", getVersion(), NULL);
+			HttpResponse* response = getBackendResponse(backends, uri, 16, agent);
+			if (route->action == ARPOISE_ROUTE_SLAM_LAYER)
+			{
+				setHttpResponseBody(response, changeShowMenuOption(response->body, "false"));
+			}
+			handleResponse(response, latDifference, lonDifference);
+
+			createStatisticsHits(layer, layerName, layerServed);
+			return 0;
+		}
+		if (route->directoryLayer)
+		{
+			queryString = changeLayerName(queryString, route->directoryLayer);
+		}
+
+		// If the porpoise configuration of the directory is given, a read only directory layer
+		// is answered from its spatial index without asking the directory's porpoise,
+		// listing the nearest layers only if MaxDirectoryLayers is given
+		//
+		ArpoiseLayer* directoryLayer = arpoiseLoadLayer(getAreaConfigValue(area, "DirectoryConfigFile", ""),
+			arpoiseQueryValue(queryString, "layerName"));
+
+		// If the directory has nothing at the location, the default layer is shown.
+		// With SpeculativeDefaultLayer the default layer request is started
+		// before the directory request to porpoise, so that both run concurrently.
+		// A directory answered natively needs no backend, unless the default layer is shown.
+		// The uri of the default layer is only built once it is requested.
+		//
+		char* defaultLayerUrl = "";
+		char* defaultLayerName = "";
+		char* defaultLayerUri = NULL;
+		char* defaultLayerAgent = pblCgiStrConcat("ArpoiseDirectory/", getVersion(), NULL);
+		int defaultLatDifference = latDifference;
+		int defaultLonDifference = lonDifference;
+		BackendRequest defaultLayerRequest;
+		defaultLayerRequest.socket = -1;
+
+		if (showDefaultLayer)
+		{
+			getDefaultLayer(area, route, &defaultLayerUrl, &defaultLayerName);
+
+			if (!directoryLayer && pblCgiStrEquals("1", getAreaConfigValue(area, "SpeculativeDefaultLayer", "0")))
+			{
+				defaultLayerUri = getDefaultLayerUri(queryString, defaultLayerUrl, defaultLayerName, &defaultLatDifference, &defaultLonDifference);
+				PBL_CGI_TRACE("-------> Speculative Default Layer Request: '%s' '%s'\n", defaultLayerUrl, defaultLayerName);
+				startBackendRequestAsync(backends, defaultLayerUri, defaultLayerAgent, &defaultLayerRequest);
+			}
+		}
+
+		HttpResponse* httpResponse = NULL;
+		if (directoryLayer)
+		{
+			PBL_CGI_TRACE("-------> Native Directory Request: '%s'\n", directoryLayer->source);
+			httpResponse = httpResponseFromBody(arpoiseLayerResponse(directoryLayer, queryString, getMaxDirectoryLayers(area, os)));
+			arpoiseFreeLayer(directoryLayer);
+		}
+		else
+		{
+			char pid[PBL_CGI_INT_STRING_SIZE];
+			uri = pblCgiStrConcat(directoryUri, "?p=", pblCgiIntToStr(pid, getpid()), "&", queryString, NULL);
+			httpResponse = getBackendResponse(backends, uri, 16, pblCgiStrConcat("ArpoiseClient ", userId, NULL));
+		}
+		char* response = getHttpResponseBody(httpResponse);
+
+		char* start = "{\"hotspots\":";
+		int length = strlen(start);
+
+		if (strncmp(start, response, length))
+		{
+			// There is nothing at the location the client is at
+
+			if (!showDefaultLayer)
+			{
+				printHeader(httpResponse);
+				printBody(httpResponse);
+				PBL_CGI_TRACE("Response does not start with %s, no handling", start);
+			}
+			else
+			{
+				// Request the default layer from porpoise and return it to the client
+
+				layerUrl = defaultLayerUrl;
+				layerName = defaultLayerName;
+
+				layerServed = 1;
+				PBL_CGI_TRACE("-------> Default Layer Request: '%s' '%s'\n", layerUrl, layerName);
+
+				if (!defaultLayerUri)
+				{
+					defaultLayerUri = getDefaultLayerUri(queryString, defaultLayerUrl, defaultLayerName, &defaultLatDifference, &defaultLonDifference);
+				}
+				HttpResponse* response = receiveBackendResponse(backends, &defaultLayerRequest, 16);
+				if (!response)
+				{
+					response = getBackendResponse(backends, defaultLayerUri, 16, defaultLayerAgent);
+				}
+				handleResponse(response, defaultLatDifference, defaultLonDifference);
+			}
+		}
+		else
+		{
+			// There is at least one layer at the location the client is at
+			cancelBackendRequest(backends, &defaultLayerRequest);
+
+			// If there is more than one layer,
+			// and the client can handle the response of the directory request,
+			// send the response back to the client
+
+			int numberOfHotspots = 0;
+			char* numberOfHotspotsString = getStringBetween(response, "\"numberOfHotspots\":", ",\"");
+			if (numberOfHotspotsString && isdigit(*numberOfHotspotsString))
+			{
+				numberOfHotspots = atoi(numberOfHotspotsString);
+			}
+
+			if (numberOfHotspots > 1 && route->isListClient)
+			{
+				PBL_CGI_TRACE("-------> Client response");
+
+				handleResponse(httpResponse, latDifference, lonDifference);
+			}
+			else
+			{
+				char* baseUrlStart = "\"baseURL\":\"";
+				char* ptr = strstr(response, baseUrlStart);
+				if (ptr)
+				{
+					layerUrl = getStringBetween(ptr, baseUrlStart, "\"");
+					if (strchr(layerUrl, '\\'))
+					{
+						layerUrl = pblCgiStrReplace(layerUrl, "\\", "");
+					}
+				}
+
+				if (!layerUrl || !*layerUrl)
+				{
+					printHeader(httpResponse);
+					printBody(httpResponse);
+					PBL_CGI_TRACE("Response does not contain proper 'baseURL' value, no handling");
+					return 0;
+				}
+
+				char* titleStart = "\"title\":\"";
+				ptr = strstr(response, titleStart);
+				if (ptr)
+				{
+					layerName = getStringBetween(ptr, titleStart, "\"");
+				}
+
+				if (!layerName || !*layerName)
+				{
+					printHeader(httpResponse);
+					printBody(httpResponse);
+					PBL_CGI_TRACE("Response does not contain proper 'title' value, no handling");
+					return 0;
+				}
+
+				// Redirect the client to the url and layer specified
+
+				layer = 1;
+				ptr = changeRedirection(response, layerUrl, layerName);
+
+				printHeader(httpResponse);
+				putOutput(ptr, strlen(ptr));
+				PBL_CGI_TRACE("-------> Client redirect: '%s' '%s'", layerUrl, layerName);
+			}
+		}
+	}
+	else
+	{
+		// This is a request for a specific layer, request the layer from porpoise and return it to the client
+		char* porpoiseUri = getAreaConfigValue(area, "PorpoiseUri", "/php/porpoise/web/porpoise.php");
+		if (pblCgiStrIsNullOrWhiteSpace(porpoiseUri))
+		{
+			pblCgiExitOnError("%s: PorpoiseUri must be given.\n", tag);
+		}
+
+		layerServed = 1;
+
+		// Read only layers of porpoise's XMLPOIConnector can be served without asking porpoise
+		//
+		ArpoiseLayer* nativeLayer = arpoiseLoadLayer(getAreaConfigValue(area, "PorpoiseConfigFile", ""), layerName);
+		if (nativeLayer)
+		{
+			PBL_CGI_TRACE("-------> Native Layer Request: '%s' '%s'\n", nativeLayer->source, layerName);
+
+			handleResponse(httpResponseFromBody(arpoiseLayerResponse(nativeLayer, queryString, 0)), latDifference, lonDifference);
+			arpoiseFreeLayer(nativeLayer);
+		}
+		else
+		{
+			PBL_CGI_TRACE("-------> Layer Request: '%s' '%s'\n", porpoiseUri, layerName);
+
+			char pid[PBL_CGI_INT_STRING_SIZE];
+			uri = pblCgiStrConcat(porpoiseUri, "?p=", pblCgiIntToStr(pid, getpid()), "&", queryString, NULL);
+			char* agent = pblCgiStrConcat("ArpoiseFilter/", getVersion(), NULL);
+			handleResponse(getBackendResponse(backends, uri, 16, agent), latDifference, lonDifference);
+		}
+	}
+
+	createStatisticsHits(layer, layerName, layerServed);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	int rc = arpoiseDirectory(argc, argv);
+	finishOutput();
+	traceDuration();
+	return rc;
+}
@@ -0,0 +1,379 @@
+/*
+ArpoiseGeo.c - geo kernels of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+/*
+* The range filter of a layer request.
+*
+* The distances sent to the clients have to be the ones porpoise computes, so they are always
+* computed with the haversine formula of porpoise's GeoUtil. The kernel here only decides which
+* POIs can be within range at all, so that the exact distance is computed for these POIs only.
+*
+* The kernel computes an equirectangular distance from the micro degree coordinates of the POIs,
+* using the cosine of the latitude farthest from the equator that a POI within range can have.
+* This distance is never longer than the great circle distance, so the filter never drops a POI
+* porpoise would return. Vector versions of the kernel exist for AVX2 and NEON.
+*
+* Setting arpoiseRangeMaskScalarOnly makes the kernel use its scalar version,
+* so that the vector versions can be checked against it.
+*
+* The spatial index of a layer puts each POI into one cell of the level whose cells are at least
+* as large as the visibility range of the POI. POIs reaching farther than the cells of the coarsest
+* level and POIs with invalid coordinates are put into the last level. The index is sorted by
+* the keys of the cells, the rows of cells around a location are intervals of keys.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ArpoiseGeo.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#define ARPOISE_AVX2
+#include <immintrin.h>
+
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+
+#define ARPOISE_NEON
+#include <arm_neon.h>
+
+#endif
+
+#define ARPOISE_MICRO_DEGREES_FULL_CIRCLE      360000000
+#define ARPOISE_MICRO_DEGREES_HALF_CIRCLE      180000000
+
+#define ARPOISE_GRID_KEY_MAX                   0xFFFFF
+#define ARPOISE_GRID_KEY(level, row, column)   (((unsigned long long)(level) << 40) | ((unsigned long long)(row) << 20) | (unsigned long long)(column))
+#define ARPOISE_GRID_MARGIN                    0.0001 /* degrees, for the truncation of the coordinates to micro degrees */
+
+int arpoiseRangeMaskScalarOnly = 0;
+
+/*
+* The great circle distance in meters of two points given in radians, as porpoise's GeoUtil computes it.
+*/
+double arpoiseGreatCircleDistance(double lat1, double lon1, double lat2, double lon2)
+{
+	double deltaLat = lat1 - lat2;
+	double deltaLon = lon1 - lon2;
+	return ARPOISE_EARTH_RADIUS * 2 * asin(sqrt(pow(sin(deltaLat / 2), 2) + cos(lat1) * cos(lat2) * pow(sin(deltaLon / 2), 2)));
+}
+
+typedef struct RangeFilter
+{
+	int latE6;
+	int lonE6;
+	int range;
+	float lonScale;  /* cosine of the latitude farthest from the equator a POI in range can have */
+	float scale;     /* micro degrees per meter, with a margin for float rounding */
+	float slack;     /* micro degrees, for the truncation of the coordinates to micro degrees */
+} RangeFilter;
+
+static void rangeMaskScalar(int from, int nPois, int* latE6, int* lonE6, int* visibilityRange,
+	RangeFilter* filter, unsigned long long* mask)
+{
+	for (int i = from; i < nPois; i++)
+	{
+		int range = visibilityRange[i] > filter->range ? visibilityRange[i] : filter->range;
+		if (range > ARPOISE_RANGE_FILTER_MAX)
+		{
+			mask[i >> 6] |= 1ULL << (i & 63);
+			continue;
+		}
+
+		int deltaLon = abs(lonE6[i] - filter->lonE6);
+		if (deltaLon > ARPOISE_MICRO_DEGREES_HALF_CIRCLE)
+		{
+			deltaLon = ARPOISE_MICRO_DEGREES_FULL_CIRCLE - deltaLon;
+		}
+		float y = (float)(latE6[i] - filter->latE6);
+		float x = (float)deltaLon * filter->lonScale;
+		float r = (float)range * filter->scale + filter->slack;
+		if (y * y + x * x <= r * r)
+		{
+			mask[i >> 6] |= 1ULL << (i & 63);
+		}
+	}
+}
+
+#ifdef ARPOISE_AVX2
+
+__attribute__((target("avx2")))
+static int rangeMaskAvx2(int nPois, int* latE6, int* lonE6, int* visibilityRange,
+	RangeFilter* filter, unsigned long long* mask)
+{
+	__m256i lat = _mm256_set1_epi32(filter->latE6);
+	__m256i lon = _mm256_set1_epi32(filter->lonE6);
+	__m256i range = _mm256_set1_epi32(filter->range);
+	__m256i maxRange = _mm256_set1_epi32(ARPOISE_RANGE_FILTER_MAX);
+	__m256i fullCircle = _mm256_set1_epi32(ARPOISE_MICRO_DEGREES_FULL_CIRCLE);
+	__m256 lonScale = _mm256_set1_ps(filter->lonScale);
+	__m256 scale = _mm256_set1_ps(filter->scale);
+	__m256 slack = _mm256_set1_ps(filter->slack);
+
+	int i = 0;
+	for (; i + 8 <= nPois; i += 8)
+	{
+		__m256i deltaLat = _mm256_sub_epi32(_mm256_loadu_si256((__m256i*)(latE6 + i)), lat);
+		__m256i deltaLon = _mm256_abs_epi32(_mm256_sub_epi32(_mm256_loadu_si256((__m256i*)(lonE6 + i)), lon));
+		deltaLon = _mm256_min_epi32(deltaLon, _mm256_sub_epi32(fullCircle, deltaLon));
+
+		__m256 y = _mm256_cvtepi32_ps(deltaLat);
+		__m256 x = _mm256_mul_ps(_mm256_cvtepi32_ps(deltaLon), lonScale);
+		__m256 distance2 = _mm256_add_ps(_mm256_mul_ps(y, y), _mm256_mul_ps(x, x));
+
+		__m256i poiRange = _mm256_max_epi32(range, _mm256_loadu_si256((__m256i*)(visibilityRange + i)));
+		__m256 r = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(poiRange), scale), slack);
+
+		__m256 inRange = _mm256_cmp_ps(distance2, _mm256_mul_ps(r, r), _CMP_LE_OQ);
+		__m256 unfiltered = _mm256_castsi256_ps(_mm256_cmpgt_epi32(poiRange, maxRange));
+		unsigned long long bits = (unsigned int)_mm256_movemask_ps(_mm256_or_ps(inRange, unfiltered));
+		mask[i >> 6] |= bits << (i & 63);
+	}
+	return i;
+}
+
+static int hasAvx2()
+{
+	static int result = -1;
+	if (result < 0)
+	{
+		__builtin_cpu_init();
+		result = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+	return result;
+}
+
+#endif
+
+#ifdef ARPOISE_NEON
+
+static int rangeMaskNeon(int nPois, int* latE6, int* lonE6, int* visibilityRange,
+	RangeFilter* filter, unsigned long long* mask)
+{
+	static const unsigned int bitValues[4] = { 1, 2, 4, 8 };
+
+	uint32x4_t bitValue = vld1q_u32(bitValues);
+	int32x4_t lat = vdupq_n_s32(filter->latE6);
+	int32x4_t lon = vdupq_n_s32(filter->lonE6);
+	int32x4_t range = vdupq_n_s32(filter->range);
+	int32x4_t maxRange = vdupq_n_s32(ARPOISE_RANGE_FILTER_MAX);
+	int32x4_t fullCircle = vdupq_n_s32(ARPOISE_MICRO_DEGREES_FULL_CIRCLE);
+	float32x4_t lonScale = vdupq_n_f32(filter->lonScale);
+	float32x4_t scale = vdupq_n_f32(filter->scale);
+	float32x4_t slack = vdupq_n_f32(filter->slack);
+
+	int i = 0;
+	for (; i + 4 <= nPois; i += 4)
+	{
+		int32x4_t deltaLat = vsubq_s32(vld1q_s32(latE6 + i), lat);
+		int32x4_t deltaLon = vabsq_s32(vsubq_s32(vld1q_s32(lonE6 + i), lon));
+		deltaLon = vminq_s32(deltaLon, vsubq_s32(fullCircle, deltaLon));
+
+		float32x4_t y = vcvtq_f32_s32(deltaLat);
+		float32x4_t x = vmulq_f32(vcvtq_f32_s32(deltaLon), lonScale);
+		float32x4_t distance2 = vaddq_f32(vmulq_f32(y, y), vmulq_f32(x, x));
+
+		int32x4_t poiRange = vmaxq_s32(range, vld1q_s32(visibilityRange + i));
+		float32x4_t r = vaddq_f32(vmulq_f32(vcvtq_f32_s32(poiRange), scale), slack);
+
+		uint32x4_t inRange = vorrq_u32(vcleq_f32(distance2, vmulq_f32(r, r)), vcgtq_s32(poiRange, maxRange));
+		unsigned long long bits = vaddvq_u32(vandq_u32(inRange, bitValue));
+		mask[i >> 6] |= bits << (i & 63);
+	}
+	return i;
+}
+
+#endif
+
+/*
+* The name of the kernel used on this machine.
+*/
+char* arpoiseRangeMaskKernel(void)
+{
+#if defined(ARPOISE_AVX2)
+	return !arpoiseRangeMaskScalarOnly && hasAvx2() ? "avx2" : "scalar";
+#elif defined(ARPOISE_NEON)
+	return !arpoiseRangeMaskScalarOnly ? "neon" : "scalar";
+#else
+	return "scalar";
+#endif
+}
+
+/*
+* Set the bit of each POI in the mask that can be within range of the location given in degrees.
+*
+* The range of a POI is the larger one of its visibility range and the range given,
+* the range of porpoise's filter is radius plus accuracy. The mask needs ARPOISE_RANGE_MASK_WORDS(nPois) words.
+*/
+void arpoiseRangeMask(int nPois, int* latE6, int* lonE6, int* visibilityRange,
+	double lat, double lon, int range, unsigned long long* mask)
+{
+	double metersPerMicroDegree = ARPOISE_EARTH_RADIUS * M_PI / 180 / 1000000;
+
+	// the latitude of a POI within range differs by at most the range
+	double band = fabs(lat) + 1.01 * ARPOISE_RANGE_FILTER_MAX / metersPerMicroDegree / 1000000;
+
+	RangeFilter filter;
+	filter.latE6 = (int)(lat * 1000000);
+	filter.lonE6 = (int)(lon * 1000000);
+	filter.range = range;
+	filter.lonScale = band >= 90 ? 0 : (float)cos(band / 180 * M_PI);
+	filter.scale = (float)(1.00001 / metersPerMicroDegree);
+	filter.slack = (float)(1 / metersPerMicroDegree + 4);
+
+	memset(mask, 0, ARPOISE_RANGE_MASK_WORDS(nPois) * sizeof(unsigned long long));
+
+	int i = 0;
+#if defined(ARPOISE_AVX2)
+	if (!arpoiseRangeMaskScalarOnly && hasAvx2())
+	{
+		i = rangeMaskAvx2(nPois, latE6, lonE6, visibilityRange, &filter, mask);
+	}
+#elif defined(ARPOISE_NEON)
+	if (!arpoiseRangeMaskScalarOnly)
+	{
+		i = rangeMaskNeon(nPois, latE6, lonE6, visibilityRange, &filter, mask);
+	}
+#endif
+	rangeMaskScalar(i, nPois, latE6, lonE6, visibilityRange, &filter, mask);
+}
+
+/*
+* The key of the cell of the spatial index a POI is put into.
+*/
+unsigned long long arpoiseGridKey(int latE6, int lonE6, int visibilityRange)
+{
+	int lastLevel = ARPOISE_GRID_LEVELS - 1;
+	if (latE6 < -ARPOISE_MICRO_DEGREES_HALF_CIRCLE / 2 || latE6 > ARPOISE_MICRO_DEGREES_HALF_CIRCLE / 2
+		|| lonE6 < -ARPOISE_MICRO_DEGREES_HALF_CIRCLE || lonE6 > ARPOISE_MICRO_DEGREES_HALF_CIRCLE)
+	{
+		return ARPOISE_GRID_KEY(lastLevel, 0, 0);
+	}
+
+	double metersPerMicroDegree = ARPOISE_EARTH_RADIUS * M_PI / 180 / 1000000;
+	for (int level = 0; level < lastLevel; level++)
+	{
+		int cellE6 = ARPOISE_GRID_CELL_E6 << level;
+		if (visibilityRange <= cellE6 * metersPerMicroDegree)
+		{
+			return ARPOISE_GRID_KEY(level, (latE6 + ARPOISE_MICRO_DEGREES_HALF_CIRCLE / 2) / cellE6,
+				(lonE6 + ARPOISE_MICRO_DEGREES_HALF_CIRCLE) / cellE6);
+		}
+	}
+	return ARPOISE_GRID_KEY(lastLevel, 0, 0);
+}
+
+static int gridCell(double degrees, double cellDegrees, int maxCell)
+{
+	int cell = (int)floor(degrees / cellDegrees);
+	return cell < 0 ? 0 : cell > maxCell ? maxCell : cell;
+}
+
+/*
+* Compute the intervals of keys of the spatial index that contain all POIs that can be
+* within range of the location given in degrees, see arpoiseRangeMask for the range.
+*
+* The lowest and the highest key of each interval are stored in the intervals given,
+* which need room for 2 * ARPOISE_GRID_MAX_INTERVALS keys. Returns the number of intervals.
+*/
+int arpoiseGridIntervals(double lat, double lon, int range, unsigned long long* intervals)
+{
+	double metersPerDegree = ARPOISE_EARTH_RADIUS * M_PI / 180;
+	int n = 0;
+
+	for (int level = 0; level < ARPOISE_GRID_LEVELS - 1; level++)
+	{
+		double cellDegrees = (ARPOISE_GRID_CELL_E6 << level) / 1000000.0;
+		int maxRow = (int)(180 / cellDegrees);
+		int maxColumn = (int)(360 / cellDegrees);
+
+		// the POIs of a level do not reach farther than the size of its cells
+		double reach = cellDegrees * metersPerDegree;
+		if (range > reach)
+		{
+			reach = range;
+		}
+
+		double deltaLat = reach * 1.00001 / metersPerDegree + ARPOISE_GRID_MARGIN;
+		int lowRow = gridCell(lat - deltaLat + 90, cellDegrees, maxRow);
+		int highRow = gridCell(lat + deltaLat + 90, cellDegrees, maxRow);
+
+		double band = fabs(lat) + deltaLat;
+		double deltaLon = band >= 90 ? 360 : deltaLat / cos(band / 180 * M_PI);
+		if (deltaLon >= 180 || highRow - lowRow >= ARPOISE_GRID_MAX_ROWS)
+		{
+			intervals[n++] = ARPOISE_GRID_KEY(level, lowRow, 0);
+			intervals[n++] = ARPOISE_GRID_KEY(level, highRow, ARPOISE_GRID_KEY_MAX);
+			continue;
+		}
+
+		// the range can wrap around the antimeridian on one side
+		int lowColumn = gridCell(lon - deltaLon + 180, cellDegrees, maxColumn);
+		int highColumn = gridCell(lon + deltaLon + 180, cellDegrees, maxColumn);
+		int wrapLow = -1;
+		int wrapHigh = -1;
+		if (lon - deltaLon < -180)
+		{
+			wrapLow = gridCell(lon - deltaLon + 540, cellDegrees, maxColumn);
+			wrapHigh = maxColumn;
+		}
+		else if (lon + deltaLon > 180)
+		{
+			wrapLow = 0;
+			wrapHigh = gridCell(lon + deltaLon - 180, cellDegrees, maxColumn);
+		}
+		if (wrapLow >= 0 && (wrapLow <= highColumn + 1 && wrapHigh + 1 >= lowColumn))
+		{
+			lowColumn = 0;
+			highColumn = maxColumn;
+			wrapLow = -1;
+		}
+
+		for (int row = lowRow; row <= highRow; row++)
+		{
+			intervals[n++] = ARPOISE_GRID_KEY(level, row, lowColumn);
+			intervals[n++] = ARPOISE_GRID_KEY(level, row, highColumn);
+			if (wrapLow >= 0)
+			{
+				intervals[n++] = ARPOISE_GRID_KEY(level, row, wrapLow);
+				intervals[n++] = ARPOISE_GRID_KEY(level, row, wrapHigh);
+			}
+		}
+	}
+
+	intervals[n++] = ARPOISE_GRID_KEY(ARPOISE_GRID_LEVELS - 1, 0, 0);
+	intervals[n++] = ARPOISE_GRID_KEY(ARPOISE_GRID_LEVELS - 1, ARPOISE_GRID_KEY_MAX, ARPOISE_GRID_KEY_MAX);
+	return n / 2;
+}
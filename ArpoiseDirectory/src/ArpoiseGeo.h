@@ -0,0 +1,81 @@
+#ifndef _ARPOISE_GEO_H_
+#define _ARPOISE_GEO_H_
+/*
+ArpoiseGeo.h - include file for the geo kernels of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	/*****************************************************************************/
+	/* #defines                                                                  */
+	/*****************************************************************************/
+
+#define ARPOISE_EARTH_RADIUS                   6371010 /* meters, as used by porpoise */
+
+#define ARPOISE_RANGE_MASK_WORDS(n)            (((n) + 63) / 64)
+
+	/*
+	* Ranges above this are not pre-filtered, the candidate band of the filter would get too wide.
+	*/
+#define ARPOISE_RANGE_FILTER_MAX               100000 /* meters */
+
+	/*
+	* The spatial index has levels of cells, the cells of level 0 are 1/64 degree wide,
+	* each level doubles the size of the cells. The last level has one cell for the whole globe.
+	*/
+#define ARPOISE_GRID_LEVELS                    14
+#define ARPOISE_GRID_CELL_E6                   15625  /* micro degrees, size of a cell of level 0 */
+#define ARPOISE_GRID_MAX_ROWS                  32     /* more rows of a level are queried as one interval */
+#define ARPOISE_GRID_MAX_INTERVALS             (ARPOISE_GRID_LEVELS * ARPOISE_GRID_MAX_ROWS * 2)
+
+	/*****************************************************************************/
+	/* Variable declarations                                                     */
+	/*****************************************************************************/
+
+	extern int arpoiseRangeMaskScalarOnly;
+
+	/*****************************************************************************/
+	/* Function declarations                                                     */
+	/*****************************************************************************/
+
+	extern double arpoiseGreatCircleDistance(double lat1, double lon1, double lat2, double lon2);
+	extern void arpoiseRangeMask(int nPois, int* latE6, int* lonE6, int* visibilityRange,
+		double lat, double lon, int range, unsigned long long* mask);
+	extern char* arpoiseRangeMaskKernel(void);
+	extern unsigned long long arpoiseGridKey(int latE6, int lonE6, int visibilityRange);
+	extern int arpoiseGridIntervals(double lat, double lon, int range, unsigned long long* intervals);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,477 @@
+/*
+ArpoiseHttp.c - HTTP response parser of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+/*
+* The parser of the responses of the porpoise back ends, its states are described in ArpoiseHttp.h.
+*
+* The head is collected up to its empty line, a head longer than ARPOISE_HTTP_MAX_HEAD is rejected.
+* The body is appended as it arrives, compressed bodies are inflated on the way.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "pblCgi.h"
+#include "ArpoiseHttp.h"
+
+/*
+* Build with ARPOISE_ZLIB defined and link with -lz to inflate gzip and deflate compressed bodies.
+*/
+#ifdef ARPOISE_ZLIB
+#include <zlib.h>
+#endif
+
+HttpResponse* arpoiseHttpResponseNew()
+{
+	static char* tag = "arpoiseHttpResponseNew";
+
+	HttpResponse* response = pbl_malloc0(tag, sizeof(HttpResponse));
+	if (!response)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	response->contentLength = -1;
+	return response;
+}
+
+void arpoiseHttpResponseFree(HttpResponse* response)
+{
+	if (response)
+	{
+#ifdef ARPOISE_ZLIB
+		if (response->inflater)
+		{
+			inflateEnd(response->inflater);
+			PBL_FREE(response->inflater);
+		}
+#endif
+		PBL_FREE(response->head);
+		PBL_FREE(response->body);
+		PBL_FREE(response->encodedBody);
+		PBL_FREE(response);
+	}
+}
+
+/*
+* Append bytes to a malloced buffer, the buffer is kept '\0' terminated.
+*/
+static void httpAppend(char** buffer, size_t* length, size_t* size, char* data, size_t n)
+{
+	static char* tag = "httpAppend";
+
+	if (*length + n + 1 > *size)
+	{
+		size_t newSize = *size ? *size : 1024;
+		while (*length + n + 1 > newSize)
+		{
+			newSize *= 2;
+		}
+		char* newBuffer = realloc(*buffer, newSize);
+		if (!newBuffer)
+		{
+			pblCgiExitOnError("%s: Out of memory\n", tag);
+		}
+		*buffer = newBuffer;
+		*size = newSize;
+	}
+	memcpy(*buffer + *length, data, n);
+	*length += n;
+	(*buffer)[*length] = '\0';
+}
+
+/*
+* Append bytes of the body, compressed bodies are inflated as they arrive.
+*/
+static int httpAppendBody(HttpResponse* response, char* data, size_t n)
+{
+#ifdef ARPOISE_ZLIB
+	if (response->inflater)
+	{
+		httpAppend(&response->encodedBody, &response->encodedBodyLength, &response->encodedBodySize, data, n);
+
+		z_stream* stream = response->inflater;
+		stream->next_in = (Bytef*)data;
+		stream->avail_in = (uInt)n;
+		while (stream->avail_in > 0)
+		{
+			char buffer[16 * 1024];
+			stream->next_out = (Bytef*)buffer;
+			stream->avail_out = sizeof(buffer);
+
+			int rc = inflate(stream, Z_NO_FLUSH);
+			if (rc != Z_OK && rc != Z_STREAM_END && rc != Z_BUF_ERROR)
+			{
+				PBL_CGI_TRACE("inflate error %d, %s", rc, stream->msg ? stream->msg : "");
+				return -1;
+			}
+			httpAppend(&response->body, &response->bodyLength, &response->bodySize, buffer, sizeof(buffer) - stream->avail_out);
+			if (rc == Z_STREAM_END || (rc == Z_BUF_ERROR && stream->avail_out == sizeof(buffer)))
+			{
+				break;
+			}
+		}
+		return 0;
+	}
+#endif
+	httpAppend(&response->body, &response->bodyLength, &response->bodySize, data, n);
+	return 0;
+}
+
+static int httpNameEquals(char* name, char* name2)
+{
+	while (*name && tolower((unsigned char)*name) == tolower((unsigned char)*name2))
+	{
+		name++;
+		name2++;
+	}
+	return !*name && !*name2;
+}
+
+/*
+* Get the value of a header, the search starts at the header with the index given.
+*
+* If indexPtr is given, it is set behind the header found, so that repeated
+* headers like Set-Cookie can be iterated. Returns NULL if there is no such header.
+*/
+char* arpoiseHttpResponseHeader(HttpResponse* response, char* name, int* indexPtr)
+{
+	for (int i = indexPtr ? *indexPtr : 0; i < response->nHeaders; i++)
+	{
+		if (httpNameEquals(response->headers[i].name, name))
+		{
+			if (indexPtr)
+			{
+				*indexPtr = i + 1;
+			}
+			return response->headers[i].value;
+		}
+	}
+	return NULL;
+}
+
+/*
+* Split the complete head into status and header table and decide how the body is framed.
+*
+* Returns 1 for an interim 1xx head, the final head of the response follows it.
+*/
+static int httpParseHead(HttpResponse* response)
+{
+	static char* tag = "httpParseHead";
+
+	char* ptr = response->head;
+	if (strncmp(ptr, "HTTP/", 5) || !(ptr = strchr(ptr, ' ')) || !isdigit((unsigned char)ptr[1]))
+	{
+		return -1;
+	}
+	response->status = atoi(ptr + 1);
+
+	ptr = strchr(ptr, '\n');
+	while (ptr && *++ptr && *ptr != '\r' && *ptr != '\n')
+	{
+		char* name = ptr;
+		char* end = strchr(ptr, '\n');
+		if (!end)
+		{
+			return -1;
+		}
+		*end = '\0';
+		if (end > ptr && end[-1] == '\r')
+		{
+			end[-1] = '\0';
+		}
+
+		char* value = strchr(name, ':');
+		if (value && response->nHeaders < ARPOISE_HTTP_MAX_HEADERS)
+		{
+			*value++ = '\0';
+			while (*value == ' ' || *value == '\t')
+			{
+				value++;
+			}
+			response->headers[response->nHeaders].name = name;
+			response->headers[response->nHeaders].value = value;
+			response->nHeaders++;
+		}
+		ptr = end;
+	}
+
+	// 100 Continue, 103 Early Hints and the like, 101 Switching Protocols ends the response
+	if (response->status / 100 == 1 && response->status != 101)
+	{
+		return 1;
+	}
+
+	char* value = arpoiseHttpResponseHeader(response, "Transfer-Encoding", NULL);
+	if (value && strstr(value, "chunked"))
+	{
+		response->chunked = 1;
+		response->state = ARPOISE_HTTP_CHUNK_SIZE;
+	}
+	else if ((value = arpoiseHttpResponseHeader(response, "Content-Length", NULL)))
+	{
+		response->contentLength = atol(value);
+		response->remaining = response->contentLength;
+		response->state = response->remaining > 0 ? ARPOISE_HTTP_BODY : ARPOISE_HTTP_DONE;
+	}
+	else
+	{
+		response->state = ARPOISE_HTTP_BODY;
+	}
+
+	if (response->status / 100 == 1 || response->status == 204 || response->status == 304)
+	{
+		response->state = ARPOISE_HTTP_DONE;
+	}
+
+	value = arpoiseHttpResponseHeader(response, "Content-Encoding", NULL);
+	if (value && *value && !httpNameEquals(value, "identity"))
+	{
+		if (httpNameEquals(value, "gzip") || httpNameEquals(value, "x-gzip"))
+		{
+			response->contentEncoding = ARPOISE_HTTP_GZIP;
+		}
+		else if (httpNameEquals(value, "deflate"))
+		{
+			response->contentEncoding = ARPOISE_HTTP_DEFLATE;
+		}
+		else
+		{
+			PBL_CGI_TRACE("Unsupported Content-Encoding %s", value);
+			return -1;
+		}
+#ifdef ARPOISE_ZLIB
+		response->inflater = pbl_malloc0(tag, sizeof(z_stream));
+		if (!response->inflater)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+
+		// 32 + MAX_WBITS detects gzip and zlib headers
+		if (inflateInit2(response->inflater, 32 + MAX_WBITS) != Z_OK)
+		{
+			pblCgiExitOnError("%s: inflateInit2 failed\n", tag);
+		}
+#else
+		PBL_CGI_TRACE("Content-Encoding %s needs a build with ARPOISE_ZLIB", value);
+		return -1;
+#endif
+	}
+
+	// Allocate the body in one piece if its length is known, a body longer than the limit grows as it arrives
+	response->bodySize = 0;
+	if (response->contentLength > 0 && !response->contentEncoding)
+	{
+		response->bodySize = response->contentLength < ARPOISE_HTTP_MAX_BODY_ALLOCATION ? response->contentLength + 1 : ARPOISE_HTTP_MAX_BODY_ALLOCATION;
+	}
+	response->body = pbl_malloc(tag, response->bodySize ? response->bodySize : 1);
+	if (!response->body)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	*response->body = '\0';
+	return 0;
+}
+
+/*
+* Collect a line of a chunked body, returns 1 once the line is complete.
+*/
+static int httpCollectLine(HttpResponse* response, char** dataPtr, size_t* lengthPtr)
+{
+	while (*lengthPtr > 0)
+	{
+		char c = **dataPtr;
+		(*dataPtr)++;
+		(*lengthPtr)--;
+
+		if (c == '\n')
+		{
+			if (response->lineLength > 0 && response->line[response->lineLength - 1] == '\r')
+			{
+				response->lineLength--;
+			}
+			response->line[response->lineLength] = '\0';
+			response->lineLength = 0;
+			return 1;
+		}
+		if (response->lineLength < ARPOISE_HTTP_MAX_LINE - 1)
+		{
+			response->line[response->lineLength++] = c;
+		}
+	}
+	return 0;
+}
+
+/*
+* Find the empty line ending the head, returns the pointer behind it or NULL.
+*/
+static char* httpHeadEnd(char* ptr, size_t length)
+{
+	char* limit = ptr + length;
+	for (char* lf = memchr(ptr, '\n', length); lf; lf = memchr(lf + 1, '\n', limit - lf - 1))
+	{
+		if (lf + 1 < limit && lf[1] == '\n')
+		{
+			return lf + 2;
+		}
+		if (lf + 2 < limit && lf[1] == '\r' && lf[2] == '\n')
+		{
+			return lf + 3;
+		}
+	}
+	return NULL;
+}
+
+/*
+* Feed bytes received to the parser.
+*
+* Returns the number of bytes consumed, bytes following a complete response are not consumed.
+* Returns -1 if the response is malformed.
+*/
+long arpoiseHttpResponseParse(HttpResponse* response, char* data, size_t length)
+{
+	char* ptr = data;
+	size_t n = length;
+
+	while (response->state == ARPOISE_HTTP_HEAD)
+	{
+		// Only the head is copied to the head buffer, not the body following it
+		char* dataEnd = httpHeadEnd(ptr, n);
+		size_t take = dataEnd ? (size_t)(dataEnd - ptr) : n;
+
+		size_t start = response->headLength > 2 ? response->headLength - 2 : 0;
+		httpAppend(&response->head, &response->headLength, &response->headSize, ptr, take);
+
+		char* end = httpHeadEnd(response->head + start, response->headLength - start);
+		if (!end)
+		{
+			if (response->headLength > ARPOISE_HTTP_MAX_HEAD)
+			{
+				PBL_CGI_TRACE("HTTP head longer than %d bytes", ARPOISE_HTTP_MAX_HEAD);
+				return -1;
+			}
+			return length;
+		}
+
+		size_t headLength = end - response->head;
+		size_t consumed = headLength - (response->headLength - take);
+		response->headLength = headLength;
+		*end = '\0';
+
+		int rc = httpParseHead(response);
+		if (rc < 0)
+		{
+			return -1;
+		}
+		ptr += consumed;
+		n -= consumed;
+		if (rc > 0)
+		{
+			// Skip the interim head, the final head is collected in the head buffer again
+			response->headLength = 0;
+			response->nHeaders = 0;
+		}
+	}
+
+	while (n > 0 && response->state != ARPOISE_HTTP_DONE)
+	{
+		switch (response->state)
+		{
+		case ARPOISE_HTTP_BODY:
+		case ARPOISE_HTTP_CHUNK_DATA:
+		{
+			size_t take = n;
+			if ((response->chunked || response->contentLength >= 0) && take > (size_t)response->remaining)
+			{
+				take = response->remaining;
+			}
+			if (httpAppendBody(response, ptr, take) < 0)
+			{
+				return -1;
+			}
+			ptr += take;
+			n -= take;
+
+			if (response->chunked || response->contentLength >= 0)
+			{
+				response->remaining -= take;
+				if (response->remaining == 0)
+				{
+					response->state = response->chunked ? ARPOISE_HTTP_CHUNK_END : ARPOISE_HTTP_DONE;
+				}
+			}
+			break;
+		}
+		case ARPOISE_HTTP_CHUNK_SIZE:
+			if (httpCollectLine(response, &ptr, &n))
+			{
+				char* end = NULL;
+				response->remaining = strtol(response->line, &end, 16);
+				if (end == response->line || response->remaining < 0)
+				{
+					return -1;
+				}
+				response->state = response->remaining ? ARPOISE_HTTP_CHUNK_DATA : ARPOISE_HTTP_TRAILER;
+			}
+			break;
+
+		case ARPOISE_HTTP_CHUNK_END:
+			if (httpCollectLine(response, &ptr, &n))
+			{
+				if (*response->line)
+				{
+					return -1;
+				}
+				response->state = ARPOISE_HTTP_CHUNK_SIZE;
+			}
+			break;
+
+		case ARPOISE_HTTP_TRAILER:
+			if (httpCollectLine(response, &ptr, &n) && !*response->line)
+			{
+				response->state = ARPOISE_HTTP_DONE;
+			}
+			break;
+		}
+	}
+	return ptr - data;
+}
+
+/*
+* Tell the parser the connection was closed, returns -1 if the response is incomplete.
+*/
+int arpoiseHttpResponseFinish(HttpResponse* response)
+{
+	if (response->state == ARPOISE_HTTP_BODY && response->contentLength < 0)
+	{
+		response->state = ARPOISE_HTTP_DONE;
+	}
+	return response->state == ARPOISE_HTTP_DONE ? 0 : -1;
+}
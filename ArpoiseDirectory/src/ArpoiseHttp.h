@@ -0,0 +1,119 @@
+#ifndef _ARPOISE_HTTP_H_
+#define _ARPOISE_HTTP_H_
+/*
+ArpoiseHttp.h - include file for the HTTP response parser of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+
+	/*****************************************************************************/
+	/* #defines                                                                  */
+	/*****************************************************************************/
+
+/*
+* Incremental HTTP/1.1 response parser.
+*
+* The bytes of a response are fed to the parser as they arrive, the parser keeps its state between calls.
+* Status line and headers are collected in the head buffer, once the head is complete
+* the headers are split into a flat table of name and value pointers into that buffer.
+* The body is decoded according to Transfer-Encoding chunked or Content-Length,
+* without either of them it runs to the end of the connection.
+*/
+#define ARPOISE_HTTP_MAX_HEADERS 32
+#define ARPOISE_HTTP_MAX_LINE 128
+#define ARPOISE_HTTP_MAX_HEAD (64 * 1024) /* a longer status line and headers are rejected */
+#define ARPOISE_HTTP_MAX_BODY_ALLOCATION (1024 * 1024) /* a longer Content-Length is not allocated up front */
+
+#define ARPOISE_HTTP_HEAD 0
+#define ARPOISE_HTTP_BODY 1
+#define ARPOISE_HTTP_CHUNK_SIZE 2
+#define ARPOISE_HTTP_CHUNK_DATA 3
+#define ARPOISE_HTTP_CHUNK_END 4
+#define ARPOISE_HTTP_TRAILER 5
+#define ARPOISE_HTTP_DONE 6
+
+#define ARPOISE_HTTP_IDENTITY 0
+#define ARPOISE_HTTP_GZIP 1
+#define ARPOISE_HTTP_DEFLATE 2
+
+typedef struct HttpHeader
+{
+	char* name;
+	char* value;
+} HttpHeader;
+
+typedef struct HttpResponse
+{
+	int state;
+	int status;
+	int chunked;
+	long contentLength;         /* -1 if the response has no Content-Length */
+	long remaining;             /* bytes left of the body or of the current chunk */
+
+	char* head;
+	size_t headLength;
+	size_t headSize;
+
+	int nHeaders;
+	HttpHeader headers[ARPOISE_HTTP_MAX_HEADERS];
+
+	char* body;                 /* always '\0' terminated, decompressed */
+	size_t bodyLength;
+	size_t bodySize;
+
+	int contentEncoding;        /* ARPOISE_HTTP_IDENTITY, _GZIP or _DEFLATE */
+	char* encodedBody;          /* the body as received if it is compressed */
+	size_t encodedBodyLength;
+	size_t encodedBodySize;
+	void* inflater;             /* the z_stream inflating a compressed body, built with ARPOISE_ZLIB */
+
+	char line[ARPOISE_HTTP_MAX_LINE];
+	int lineLength;
+} HttpResponse;
+
+	/*****************************************************************************/
+	/* Function declarations                                                     */
+	/*****************************************************************************/
+
+	extern HttpResponse* arpoiseHttpResponseNew();
+	extern void arpoiseHttpResponseFree(HttpResponse* response);
+	extern char* arpoiseHttpResponseHeader(HttpResponse* response, char* name, int* indexPtr);
+	extern long arpoiseHttpResponseParse(HttpResponse* response, char* data, size_t length);
+	extern int arpoiseHttpResponseFinish(HttpResponse* response);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
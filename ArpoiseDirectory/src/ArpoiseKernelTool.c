@@ -0,0 +1,1330 @@
+/*
+ArpoiseKernelTool.c - checks and benchmarks the string kernels and formatting used by the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+/*
+* Usage: ArpoiseKernelTool -c
+*        ArpoiseKernelTool -b [iterations]
+*        ArpoiseKernelTool -f [iterations]
+*        ArpoiseKernelTool -h [iterations]
+*        ArpoiseKernelTool -g [iterations]
+*        ArpoiseKernelTool -p [iterations]
+*
+* -c checks the vector versions of the string kernels of pblCgi against their scalar versions,
+* for all byte values at all positions of short strings, all escapes and random strings.
+* -b prints the time the scalar and the vector versions of the kernels take.
+* -f checks pblCgiStrConcat and pblCgiIntToStr against sprintf and prints the time the formats
+* of the request path take with the former pblCgiSprintf, with pblCgiSprintf and without printf.
+* -h checks the HTTP response parser on the framings of back end responses, fed at once and in segments,
+* and prints the time parsing a response takes against the former strstr search of its body.
+* -g checks the range filter kernel of layer requests against its scalar version and against
+* the distances of porpoise, and prints the time filtering a layer takes against computing every distance.
+* -p checks the streaming parser of POST input against the query parser and its limits,
+* and prints the time both take for a form.
+*/
+#ifdef __linux__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "pblCgi.h"
+#include "ArpoiseHttp.h"
+#include "ArpoiseGeo.h"
+
+#ifdef ARPOISE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MAX_LENGTH 320
+
+static long nCases = 0;
+static long nDifferences = 0;
+
+static void difference(char* kernel, const char* input, size_t length)
+{
+	if (nDifferences++ < 10)
+	{
+		fprintf(stderr, "%s differs for %lu bytes:", kernel, (unsigned long)length);
+		for (size_t i = 0; i < length; i++)
+		{
+			fprintf(stderr, " %02x", (unsigned char)input[i]);
+		}
+		fprintf(stderr, "\n");
+	}
+}
+
+static void checkDecode(const char* input, size_t length)
+{
+	char scalar[MAX_LENGTH];
+	char vector[MAX_LENGTH];
+	char inPlace[MAX_LENGTH];
+
+	pblCgiKernelScalarOnly = 1;
+	size_t scalarLength = pblCgiKernelDecode(scalar, input, length);
+	pblCgiKernelScalarOnly = 0;
+	size_t vectorLength = pblCgiKernelDecode(vector, input, length);
+	memcpy(inPlace, input, length);
+	size_t inPlaceLength = pblCgiKernelDecode(inPlace, inPlace, length);
+
+	nCases++;
+	if (scalarLength != vectorLength || inPlaceLength != vectorLength
+		|| memcmp(scalar, vector, scalarLength) || memcmp(scalar, inPlace, scalarLength))
+	{
+		difference("decode", input, length);
+	}
+}
+
+static void checkSpace(const char* input, size_t length)
+{
+	pblCgiKernelScalarOnly = 1;
+	size_t scalarSpan = pblCgiKernelSpaceSpan(input, length);
+	size_t scalarSpanEnd = pblCgiKernelSpaceSpanEnd(input, length);
+	pblCgiKernelScalarOnly = 0;
+
+	nCases++;
+	if (scalarSpan != pblCgiKernelSpaceSpan(input, length) || scalarSpanEnd != pblCgiKernelSpaceSpanEnd(input, length))
+	{
+		difference("space span", input, length);
+	}
+}
+
+static void checkHex(const char* input, size_t length)
+{
+	char scalar[2 * MAX_LENGTH];
+	char vector[2 * MAX_LENGTH];
+
+	pblCgiKernelScalarOnly = 1;
+	pblCgiKernelToHex(scalar, (const unsigned char*)input, length);
+	pblCgiKernelScalarOnly = 0;
+	pblCgiKernelToHex(vector, (const unsigned char*)input, length);
+
+	nCases++;
+	if (memcmp(scalar, vector, 2 * length))
+	{
+		difference("hex", input, length);
+	}
+}
+
+static void checkFind(const char* input, size_t length, const char* needle, size_t needleLength)
+{
+	pblCgiKernelScalarOnly = 1;
+	char* scalar = pblCgiKernelFind(input, length, needle, needleLength);
+	pblCgiKernelScalarOnly = 0;
+
+	nCases++;
+	if (scalar != pblCgiKernelFind(input, length, needle, needleLength))
+	{
+		difference("find", input, length);
+	}
+}
+
+static int check(void)
+{
+	static const char filler[] = "a%+< \t\r\n\x0b\x0c\x1f\x7f\x80\xff" "0Ff9gG";
+	char input[MAX_LENGTH];
+
+	// every byte value at every position
+	for (size_t length = 1; length <= 100; length++)
+	{
+		for (size_t position = 0; position < length; position++)
+		{
+			for (int c = 0; c < 256; c++)
+			{
+				memset(input, 'a', length);
+				input[position] = (char)c;
+				checkDecode(input, length);
+				checkHex(input, length);
+				checkFind(input, length, input + position, 1);
+				checkFind(input, length, input + position, length - position);
+
+				memset(input, ' ', length);
+				input[position] = (char)c;
+				checkSpace(input, length);
+				checkDecode(input, length);
+			}
+		}
+	}
+
+	// every escape at every position
+	for (size_t position = 0; position < 72; position++)
+	{
+		for (int high = 0; high < 256; high++)
+		{
+			for (int low = 0; low < 256; low++)
+			{
+				memset(input, 'x', 72);
+				input[position] = '%';
+				input[position + 1 < 72 ? position + 1 : 71] = (char)high;
+				input[position + 2 < 72 ? position + 2 : 71] = (char)low;
+				checkDecode(input, 72);
+			}
+		}
+	}
+
+	// random strings of the characters that matter
+	srand(1);
+	for (int n = 0; n < 2000000; n++)
+	{
+		size_t length = rand() % MAX_LENGTH;
+		for (size_t i = 0; i < length; i++)
+		{
+			input[i] = filler[rand() % (sizeof(filler) - 1)];
+		}
+		checkDecode(input, length);
+		checkSpace(input, length);
+		checkHex(input, length);
+
+		for (size_t i = 0; i < length; i++)
+		{
+			input[i] = "ab"[rand() % 2];
+		}
+		size_t needleLength = 1 + rand() % 40;
+		if (needleLength <= length && rand() % 2)
+		{
+			checkFind(input, length, input + rand() % (length - needleLength + 1), needleLength);
+		}
+		else
+		{
+			char needle[40];
+			for (size_t i = 0; i < needleLength; i++)
+			{
+				needle[i] = "ab"[rand() % 2];
+			}
+			checkFind(input, length, needle, needleLength);
+		}
+	}
+
+	printf("kernel %s: %ld cases checked, %ld differences\n", pblCgiKernelName(), nCases, nDifferences);
+	return nDifferences ? 1 : 0;
+}
+
+static double microSeconds(clock_t start, int iterations)
+{
+	return (double)(clock() - start) * 1000000.0 / CLOCKS_PER_SEC / iterations;
+}
+
+static volatile size_t sink;
+
+static int benchmark(int iterations)
+{
+	size_t length = 64 * 1024;
+	char* query = pbl_malloc("benchmark", length);
+	char* text = pbl_malloc("benchmark", length);
+	char* destination = pbl_malloc("benchmark", 2 * length);
+	if (!query || !text || !destination)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for (size_t i = 0; i < length; i++)
+	{
+		// a query with an escape every 40 bytes, a text with a few separators
+		query[i] = i % 40 == 0 ? '%' : i % 40 == 1 ? '2' : i % 40 == 2 ? 'C' : "layerName+lat"[i % 13];
+		text[i] = i % 4000 == 3999 ? ',' : "abcdefghijklmnopqrstuvwxyz "[i % 27];
+	}
+	memset(destination, ' ', length);
+
+	for (int scalarOnly = 1; scalarOnly >= 0; scalarOnly--)
+	{
+		pblCgiKernelScalarOnly = scalarOnly;
+
+		clock_t start = clock();
+		for (int i = 0; i < iterations; i++)
+		{
+			sink += pblCgiKernelDecode(destination + length, query, length);
+		}
+		double decode = microSeconds(start, iterations);
+
+		memset(destination, ' ', length);
+		start = clock();
+		for (int i = 0; i < iterations; i++)
+		{
+			sink += pblCgiKernelSpaceSpan(destination, length) + pblCgiKernelSpaceSpanEnd(destination, length);
+		}
+		double space = microSeconds(start, iterations);
+
+		start = clock();
+		for (int i = 0; i < iterations; i++)
+		{
+			pblCgiKernelToHex(destination, (unsigned char*)text, length);
+		}
+		double hex = microSeconds(start, iterations);
+
+		start = clock();
+		for (int i = 0; i < iterations; i++)
+		{
+			char* ptr = text;
+			while ((ptr = pblCgiKernelFind(ptr, text + length - ptr, ", ", 2)))
+			{
+				ptr += 2;
+			}
+			sink += pblCgiKernelFind(text, length, "zyx", 3) != NULL;
+		}
+		double find = microSeconds(start, iterations);
+
+		printf("%-6s 64 KB: decode %8.1f us, space span %8.1f us, hex %8.1f us, find %8.1f us\n",
+			pblCgiKernelName(), decode, space, hex, find);
+	}
+
+	PBL_FREE(query);
+	PBL_FREE(text);
+	PBL_FREE(destination);
+	return 0;
+}
+
+/*
+* pblCgiSprintf as it was, printing into a 64 KB buffer on the stack and copying the result.
+*/
+static char* formerSprintf(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+
+	char buffer[64 * 1024 + 1];
+	vsnprintf(buffer, sizeof(buffer) - 1, format, args);
+	va_end(args);
+
+	buffer[sizeof(buffer) - 1] = '\0';
+	return pblCgiStrDup(buffer);
+}
+
+static void checkFormat(char* kernel, char* result, char* expected)
+{
+	nCases++;
+	if (strcmp(result, expected))
+	{
+		difference(kernel, expected, strlen(expected));
+	}
+	PBL_FREE(result);
+}
+
+static int format(int iterations)
+{
+	char number[PBL_CGI_INT_STRING_SIZE];
+	char expected[64];
+
+	long values[] = { 0, 1, -1, 9, 10, -10, 99, 100, 2147483647L, -2147483647L - 1, LONG_MAX, LONG_MIN };
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+	{
+		snprintf(expected, sizeof(expected), "%ld", values[i]);
+		checkFormat("pblCgiIntToStr", pblCgiStrDup(pblCgiIntToStr(number, values[i])), expected);
+	}
+	srand(1);
+	for (int n = 0; n < 1000000; n++)
+	{
+		long value = (long)rand() - RAND_MAX / 2;
+		value = n % 2 ? value : value * rand();
+		snprintf(expected, sizeof(expected), "%ld", value);
+		checkFormat("pblCgiIntToStr", pblCgiStrDup(pblCgiIntToStr(number, value)), expected);
+	}
+	// pblCgiSprintf on simple formats, printed without printf, and on others
+	char* text = pbl_malloc("format", 1001);
+	if (!text)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	memset(text, 't', 1000);
+	text[1000] = '\0';
+	char large[2048];
+#define CHECK_SPRINTF(...) snprintf(large, sizeof(large), __VA_ARGS__); checkFormat("pblCgiSprintf", pblCgiSprintf(__VA_ARGS__), large)
+	CHECK_SPRINTF("%%");
+	CHECK_SPRINTF("100%% %s%%", "sure");
+	CHECK_SPRINTF("%s", "");
+	CHECK_SPRINTF("%s|%s", text, "b");
+	checkFormat("pblCgiSprintf", pblCgiSprintf("%s", NULL), "(null)");
+	CHECK_SPRINTF("%c%c%c", 'a', '%', 255);
+	CHECK_SPRINTF("%d %i %d %d", 0, -1, INT_MAX, INT_MIN);
+	CHECK_SPRINTF("%u %u", 0U, UINT_MAX);
+	CHECK_SPRINTF("%ld %li %ld", 0L, LONG_MAX, LONG_MIN);
+	CHECK_SPRINTF("%lu %lu", 0UL, ULONG_MAX);
+	CHECK_SPRINTF("%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d", 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16);
+	CHECK_SPRINTF("%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d%d", 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17);
+	CHECK_SPRINTF("%5d|%-3s|%.2s|%x|%08.3f", 42, "a", "abc", 255, 3.14159);
+	CHECK_SPRINTF("\"%016llx-%lx\"", 0x1234567890abcdefULL, 4096UL);
+	CHECK_SPRINTF("%.*s/%s", 3, "abcdef", text);
+	CHECK_SPRINTF("%s %lld", "long long", -1234567890123LL);
+	for (int n = 0; n < 1000; n++)
+	{
+		long value = (long)rand() - RAND_MAX / 2;
+		long product = value * rand();
+		char* string = text + rand() % 1001;
+		CHECK_SPRINTF("%s_%d:%ld/%u %lu", string, (int)value, product, (unsigned int)value, (unsigned long)product);
+		CHECK_SPRINTF("%s %x %d", string, (unsigned int)value, (int)value);
+	}
+#undef CHECK_SPRINTF
+	PBL_FREE(text);
+
+	checkFormat("pblCgiStrConcat", pblCgiStrConcat(NULL), "");
+	checkFormat("pblCgiStrConcat", pblCgiStrConcat("", "a", "", "bc", NULL), "abc");
+
+	// the formats of the request path, with a query string of a layer request and a long one
+	char* uri = "/php/porpoise/web/porpoise.php";
+	char* query = "layerName=Default-lotus-meditation&lat=48.158662&lon=11.580376&radius=1500&accuracy=5"
+		"&userId=0123456789abcdef&client=Arpoise&os=Android&bundle=200101&countryCode=DE&version=1";
+	size_t longLength = 100 * 1024;
+	char* longQuery = pbl_malloc("format", longLength + 1);
+	if (!longQuery)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	memset(longQuery, 'q', longLength);
+	longQuery[longLength] = '\0';
+
+	char* sprintfUri = pblCgiSprintf("%s?p=%d&%s", uri, 12345, longQuery);
+	char* formerUri = formerSprintf("%s?p=%d&%s", uri, 12345, longQuery);
+	checkFormat("pblCgiSprintf", pblCgiStrConcat(uri, "?p=", pblCgiIntToStr(number, 12345), "&", longQuery, NULL), sprintfUri);
+	printf("uri of a %lu byte query: %lu bytes, %lu bytes with the former pblCgiSprintf\n", (unsigned long)longLength,
+		(unsigned long)strlen(sprintfUri), (unsigned long)strlen(formerUri));
+	PBL_FREE(sprintfUri);
+	PBL_FREE(formerUri);
+
+	printf("format: %ld cases checked, %ld differences\n", nCases, nDifferences);
+
+	for (int method = 0; method < 3; method++)
+	{
+		clock_t start = clock();
+		for (int i = 0; i < iterations; i++)
+		{
+			char* ptr = method == 0 ? formerSprintf("%s?p=%d&%s", uri, 12345, query)
+				: method == 1 ? pblCgiSprintf("%s?p=%d&%s", uri, 12345, query)
+				: pblCgiStrConcat(uri, "?p=", pblCgiIntToStr(number, 12345), "&", query, NULL);
+			sink += strlen(ptr);
+			PBL_FREE(ptr);
+		}
+		double layerUri = microSeconds(start, iterations);
+
+		start = clock();
+		for (int i = 0; i < iterations; i++)
+		{
+			char* ptr = method == 0 ? formerSprintf("%s?p=%d&%s", uri, 12345, longQuery)
+				: method == 1 ? pblCgiSprintf("%s?p=%d&%s", uri, 12345, longQuery)
+				: pblCgiStrConcat(uri, "?p=", pblCgiIntToStr(number, 12345), "&", longQuery, NULL);
+			sink += strlen(ptr);
+			PBL_FREE(ptr);
+		}
+		double longUri = microSeconds(start, iterations);
+
+		start = clock();
+		for (int i = 0; i < iterations; i++)
+		{
+			char* ptr = method == 0 ? formerSprintf("%s_%d", "Area", i)
+				: method == 1 ? pblCgiSprintf("%s_%d", "Area", i)
+				: pblCgiStrConcat("Area", "_", pblCgiIntToStr(number, i), NULL);
+			sink += strlen(ptr);
+			PBL_FREE(ptr);
+		}
+		double key = microSeconds(start, iterations);
+
+		start = clock();
+		for (int i = 0; i < iterations; i++)
+		{
+			char* ptr = method == 0 ? formerSprintf("\"lat\":%d,", 48158662 + i)
+				: method == 1 ? pblCgiSprintf("\"lat\":%d,", 48158662 + i)
+				: pblCgiStrConcat("\"lat\":", pblCgiIntToStr(number, 48158662 + i), ",", NULL);
+			sink += strlen(ptr);
+			PBL_FREE(ptr);
+		}
+		double lat = microSeconds(start, iterations);
+
+		start = clock();
+		for (int i = 0; i < iterations; i++)
+		{
+			// the page key of a layer, printed with printf by pblCgiSprintf too
+			char* ptr = method == 0 ? formerSprintf("%s-%08x", "1-2a-3f", 0x1234abcd + i)
+				: pblCgiSprintf("%s-%08x", "1-2a-3f", 0x1234abcd + i);
+			sink += strlen(ptr);
+			PBL_FREE(ptr);
+		}
+		double pageKey = microSeconds(start, iterations);
+
+		printf("%-15s %%s?p=%%d&%%s %6.3f us, 100 KB query %8.3f us, %%s_%%d %6.3f us, \"lat\":%%d, %6.3f us, %%s-%%08x %6.3f us\n",
+			method == 0 ? "former sprintf" : method == 1 ? "pblCgiSprintf" : "without printf", layerUri, longUri, key, lat, pageKey);
+	}
+
+	PBL_FREE(longQuery);
+	return nDifferences ? 1 : 0;
+}
+
+/*
+* The former way of getting the body of a back end response: the bytes received were copied
+* into a string, the status, the cookie and the end of the head were searched with strstr.
+*/
+static char* formerResponseBody(char* data, size_t length, char** cookiePtr)
+{
+	char* response = pbl_malloc("formerResponseBody", length + 1);
+	if (!response)
+	{
+		return NULL;
+	}
+	memcpy(response, data, length);
+	response[length] = '\0';
+
+	char* cookie = strstr(response, "Set-Cookie: ");
+	if (cookie)
+	{
+		cookie += 12;
+		*cookiePtr = pblCgiStrRangeDup(cookie, strstr(cookie, "\r\n"));
+	}
+	char* ptr = strstr(response, "HTTP/");
+	if (!ptr || !(ptr = strstr(ptr, " ")) || strncmp(ptr + 1, "200", 3) || !(ptr = strstr(ptr, "\r\n\r\n")))
+	{
+		PBL_FREE(response);
+		return NULL;
+	}
+	return response;
+}
+
+/*
+* Feed a response to the parser in segments of the length given, 0 feeds it at once.
+*/
+static HttpResponse* parseResponse(char* data, size_t length, size_t segmentLength, int closed)
+{
+	HttpResponse* response = arpoiseHttpResponseNew();
+	size_t offset = 0;
+	while (offset < length && response->state != ARPOISE_HTTP_DONE)
+	{
+		size_t n = segmentLength && length - offset > segmentLength ? segmentLength : length - offset;
+		long consumed = arpoiseHttpResponseParse(response, data + offset, n);
+		if (consumed < 0)
+		{
+			arpoiseHttpResponseFree(response);
+			return NULL;
+		}
+		offset += consumed;
+		if (consumed < (long)n)
+		{
+			break;
+		}
+	}
+	if (closed && arpoiseHttpResponseFinish(response) < 0)
+	{
+		arpoiseHttpResponseFree(response);
+		return NULL;
+	}
+	return response;
+}
+
+static void checkResponse(char* kernel, char* data, size_t length, int closed, int status, char* body, size_t bodyLength)
+{
+	size_t segmentLengths[] = { 0, 1, 2, 3, 7, 100, 1448 };
+	for (size_t i = 0; i < sizeof(segmentLengths) / sizeof(segmentLengths[0]); i++)
+	{
+		nCases++;
+		HttpResponse* response = parseResponse(data, length, segmentLengths[i], closed);
+		if (!body ? response != NULL
+			: !response || response->status != status || response->state != ARPOISE_HTTP_DONE
+			|| response->bodyLength != bodyLength || memcmp(response->body, body, bodyLength))
+		{
+			difference(kernel, data, length < 64 ? length : 64);
+		}
+		arpoiseHttpResponseFree(response);
+	}
+}
+
+static char* httpBody(size_t length)
+{
+	char* body = pbl_malloc("httpBody", length + 1);
+	for (size_t i = 0; body && i < length; i++)
+	{
+		body[i] = "{\"hotspots\":[],\"layer\":\"Default\"}"[i % 34];
+	}
+	if (body)
+	{
+		body[length] = '\0';
+	}
+	return body;
+}
+
+/*
+* Check the HTTP response parser on the framings porpoise uses, fed at once and in segments,
+* and print the time it takes against the former strstr search of the body.
+*/
+static int http(int iterations)
+{
+	size_t bodyLength = 32 * 1024;
+	char* body = httpBody(bodyLength);
+	char* data = pbl_malloc("http", 2 * bodyLength + 2 * ARPOISE_HTTP_MAX_HEAD);
+	if (!body || !data)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	char* head = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nSet-Cookie: PHPSESSID=abc\r\n"
+		"Set-Cookie: second=2; path=/\r\n";
+
+	// Content-Length, the connection may stay open
+	int length = sprintf(data, "%sContent-Length: %lu\r\n\r\n", head, (unsigned long)bodyLength);
+	memcpy(data + length, body, bodyLength);
+	checkResponse("Content-Length", data, length + bodyLength, 0, 200, body, bodyLength);
+	memcpy(data + length + bodyLength, "HTTP/1.1", 8);
+	checkResponse("Content-Length, bytes following", data, length + bodyLength + 8, 0, 200, body, bodyLength);
+
+	// chunked with chunk extensions and a trailer
+	length = sprintf(data, "%sTransfer-Encoding: chunked\r\n\r\n", head);
+	for (size_t offset = 0; offset < bodyLength; offset += 1000)
+	{
+		size_t n = bodyLength - offset < 1000 ? bodyLength - offset : 1000;
+		length += sprintf(data + length, "%lx;ext=1\r\n", (unsigned long)n);
+		memcpy(data + length, body + offset, n);
+		length += n;
+		length += sprintf(data + length, "\r\n");
+	}
+	length += sprintf(data + length, "0\r\nX-Trailer: t\r\n\r\n");
+	checkResponse("chunked", data, length, 0, 200, body, bodyLength);
+	checkResponse("chunked, truncated", data, length - 10, 1, 200, NULL, 0);
+
+	// delimited by the end of the connection, with LF line ends
+	length = sprintf(data, "HTTP/1.0 200 OK\nContent-Type: application/json\n\n");
+	memcpy(data + length, body, bodyLength);
+	checkResponse("connection close", data, length + bodyLength, 1, 200, body, bodyLength);
+
+	// no body
+	length = sprintf(data, "HTTP/1.1 304 Not Modified\r\nETag: \"1\"\r\n\r\n");
+	checkResponse("304", data, length, 0, 304, "", 0);
+
+	// interim heads are skipped, the final head follows them
+	length = sprintf(data, "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 103 Early Hints\r\nLink: </s.css>; rel=preload\r\n\r\n"
+		"%sContent-Length: %lu\r\n\r\n", head, (unsigned long)bodyLength);
+	memcpy(data + length, body, bodyLength);
+	checkResponse("1xx", data, length + bodyLength, 0, 200, body, bodyLength);
+
+	// a Content-Length far beyond the bytes sent is not allocated up front
+	length = sprintf(data, "%sContent-Length: 1000000000000\r\n\r\n", head);
+	memcpy(data + length, body, 1000);
+	checkResponse("huge Content-Length", data, length + 1000, 1, 200, NULL, 0);
+
+	// a head without end is rejected once it is longer than ARPOISE_HTTP_MAX_HEAD
+	length = sprintf(data, "HTTP/1.1 200 OK\r\n");
+	while (length < ARPOISE_HTTP_MAX_HEAD + 1448)
+	{
+		length += sprintf(data + length, "X-Header-%d: value\r\n", length);
+	}
+	checkResponse("endless head", data, length, 0, 200, NULL, 0);
+
+	// malformed
+	checkResponse("status line", "HTTP1.1 200 OK\r\n\r\n", 18, 1, 200, NULL, 0);
+	checkResponse("chunk size", "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nxyz\r\n", 52, 0, 200, NULL, 0);
+
+#ifdef ARPOISE_ZLIB
+	// gzip, inflated as the bytes arrive
+	uLongf compressedLength = compressBound(bodyLength) + 32;
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+	length = sprintf(data, "%sContent-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n", head);
+	char* compressed = data + bodyLength;
+	stream.next_in = (Bytef*)body;
+	stream.avail_in = (uInt)bodyLength;
+	stream.next_out = (Bytef*)compressed;
+	stream.avail_out = (uInt)compressedLength;
+	deflate(&stream, Z_FINISH);
+	compressedLength = stream.total_out;
+	deflateEnd(&stream);
+	length += sprintf(data + length, "%lx\r\n", (unsigned long)compressedLength);
+	memmove(data + length, compressed, compressedLength);
+	length += compressedLength;
+	length += sprintf(data + length, "\r\n0\r\n\r\n");
+	checkResponse("gzip", data, length, 0, 200, body, bodyLength);
+#endif
+
+	printf("http: %ld cases checked, %ld differences\n", nCases, nDifferences);
+
+	// the response of a layer request, 32 KB body
+	length = sprintf(data, "%sContent-Length: %lu\r\n\r\n", head, (unsigned long)bodyLength);
+	memcpy(data + length, body, bodyLength);
+	length += bodyLength;
+
+	clock_t start = clock();
+	for (int i = 0; i < iterations; i++)
+	{
+		char* cookie = NULL;
+		char* response = formerResponseBody(data, length, &cookie);
+		sink += response != NULL;
+		PBL_FREE(cookie);
+		PBL_FREE(response);
+	}
+	double former = microSeconds(start, iterations);
+
+	start = clock();
+	for (int i = 0; i < iterations; i++)
+	{
+		HttpResponse* response = parseResponse(data, length, 0, 0);
+		sink += response->bodyLength;
+		arpoiseHttpResponseFree(response);
+	}
+	double whole = microSeconds(start, iterations);
+
+	start = clock();
+	for (int i = 0; i < iterations; i++)
+	{
+		HttpResponse* response = parseResponse(data, length, 1448, 0);
+		sink += response->bodyLength;
+		arpoiseHttpResponseFree(response);
+	}
+	double segments = microSeconds(start, iterations);
+
+	printf("32 KB response: former strstr %6.3f us, parser %6.3f us, parser in 1448 byte segments %6.3f us\n",
+		former, whole, segments);
+
+	PBL_FREE(body);
+	PBL_FREE(data);
+	return nDifferences ? 1 : 0;
+}
+
+/*
+* Distances of points given in degrees, as porpoise's GeoUtil::getGreatCircleDistance returns them.
+*/
+static struct
+{
+	double lat1;
+	double lon1;
+	double lat2;
+	double lon2;
+	double distance;
+} phpDistances[] =
+{
+	{ 48.158662, 11.580376, 48.158662, 11.580376, 0.000000 },
+	{ 48.158662, 11.580376, 48.159662, 11.580376, 111.195101 },
+	{ 48.158662, 11.580376, 48.158662, 11.590376, 741.749323 },
+	{ 48.137154, 11.576124, 52.520008, 13.404954, 504301.620567 },
+	{ 40.712776, -74.005974, 51.507351, -0.127758, 5570235.359230 },
+	{ -33.868820, 151.209296, -33.868820, -151.209296, 5242020.706623 },
+	{ 0.000000, 179.999000, 0.000000, -179.999000, 222.390202 },
+	{ 89.999900, 0.000000, 89.999900, 180.000000, 22.239020 },
+	{ -89.500000, 10.000000, -89.500000, -170.000000, 111195.101177 },
+	{ 0.000000, 0.000000, 0.000000, 180.000000, 20015118.211947 },
+	{ 35.689487, 139.691711, -22.906847, -43.172897, 18567077.808307 },
+	{ 0.000001, 0.000000, 0.000000, 0.000001, 0.157254 }
+};
+
+static double deg2rad(double degrees)
+{
+	return (degrees / 180.0) * M_PI;
+}
+
+static double phpDistance(double lat1, double lon1, double lat2, double lon2)
+{
+	return arpoiseGreatCircleDistance(deg2rad(lat1), deg2rad(lon1), deg2rad(lat2), deg2rad(lon2));
+}
+
+static double randomDouble(double from, double to)
+{
+	return from + (to - from) * rand() / RAND_MAX;
+}
+
+#define GEO_MAX_POIS 300
+
+static long nInRange = 0;
+static long nCandidates = 0;
+
+static void geoDifference(char* kernel, double lat, double lon, int range, double poiLat, double poiLon, int visibilityRange)
+{
+	if (nDifferences++ < 10)
+	{
+		fprintf(stderr, "%s differs at %f,%f range %d for the POI at %f,%f visibility range %d, distance %f\n",
+			kernel, lat, lon, range, poiLat, poiLon, visibilityRange, phpDistance(lat, lon, poiLat, poiLon));
+	}
+}
+
+/*
+* Check the range filter of a layer request for the location and the POIs given:
+* the vector version of the kernel has to set the same bits as the scalar version,
+* and each POI porpoise's filter lets through has to have its bit set and has to be in an interval of the spatial index.
+*/
+static void checkRange(double lat, double lon, int range, int nPois, double* poiLat, double* poiLon,
+	int* latE6, int* lonE6, int* visibilityRange)
+{
+	unsigned long long scalar[ARPOISE_RANGE_MASK_WORDS(GEO_MAX_POIS)];
+	unsigned long long vector[ARPOISE_RANGE_MASK_WORDS(GEO_MAX_POIS)];
+	unsigned long long intervals[2 * ARPOISE_GRID_MAX_INTERVALS];
+
+	arpoiseRangeMaskScalarOnly = 1;
+	arpoiseRangeMask(nPois, latE6, lonE6, visibilityRange, lat, lon, range, scalar);
+	arpoiseRangeMaskScalarOnly = 0;
+	arpoiseRangeMask(nPois, latE6, lonE6, visibilityRange, lat, lon, range, vector);
+	int nIntervals = arpoiseGridIntervals(lat, lon, range, intervals);
+
+	nCases++;
+	if (memcmp(scalar, vector, ARPOISE_RANGE_MASK_WORDS(nPois) * sizeof(unsigned long long)))
+	{
+		for (int i = 0; i < nPois; i++)
+		{
+			if ((scalar[i >> 6] ^ vector[i >> 6]) & (1ULL << (i & 63)))
+			{
+				geoDifference(arpoiseRangeMaskKernel(), lat, lon, range, poiLat[i], poiLon[i], visibilityRange[i]);
+				break;
+			}
+		}
+	}
+
+	for (int i = 0; i < nPois; i++)
+	{
+		int isCandidate = (vector[i >> 6] & (1ULL << (i & 63))) != 0;
+		nCandidates += isCandidate;
+
+		// the filter of porpoise without its bounding box, which only lets fewer POIs through
+		double distance = phpDistance(lat, lon, poiLat[i], poiLon[i]);
+		if (!(distance < range || (visibilityRange[i] > 0 && visibilityRange[i] >= distance)))
+		{
+			continue;
+		}
+		nInRange++;
+		nCases++;
+		if (!isCandidate)
+		{
+			geoDifference("range filter", lat, lon, range, poiLat[i], poiLon[i], visibilityRange[i]);
+		}
+
+		unsigned long long key = arpoiseGridKey(latE6[i], lonE6[i], visibilityRange[i]);
+		int k = 0;
+		while (k < nIntervals && (key < intervals[2 * k] || key > intervals[2 * k + 1]))
+		{
+			k++;
+		}
+		nCases++;
+		if (k == nIntervals)
+		{
+			geoDifference("spatial index", lat, lon, range, poiLat[i], poiLon[i], visibilityRange[i]);
+		}
+	}
+}
+
+/*
+* Put a POI at about the distance given from the location, in a random direction,
+* with a random visibility range. The coordinates have more digits than micro degrees,
+* they are truncated to micro degrees as the layer compiler does it.
+*/
+static void randomPoi(double lat, double lon, int range, double distance, double* poiLat, double* poiLon,
+	int* latE6, int* lonE6, int* visibilityRange)
+{
+	double metersPerDegree = ARPOISE_EARTH_RADIUS * M_PI / 180;
+	double bearing = randomDouble(0, 2 * M_PI);
+
+	*poiLat = lat + distance * cos(bearing) / metersPerDegree;
+	if (*poiLat > 90)
+	{
+		*poiLat = 180 - *poiLat;
+	}
+	else if (*poiLat < -90)
+	{
+		*poiLat = -180 - *poiLat;
+	}
+	double cosLat = cos(deg2rad(lat));
+	*poiLon = lon + (cosLat > 0.001 ? distance * sin(bearing) / metersPerDegree / cosLat : randomDouble(-180, 180));
+	while (*poiLon > 180)
+	{
+		*poiLon -= 360;
+	}
+	while (*poiLon < -180)
+	{
+		*poiLon += 360;
+	}
+	*poiLat = floor(*poiLat * 10000000) / 10000000;
+	*poiLon = floor(*poiLon * 10000000) / 10000000;
+	*latE6 = (int)(*poiLat * 1000000);
+	*lonE6 = (int)(*poiLon * 1000000);
+
+	switch (rand() % 8)
+	{
+	case 0:
+		*visibilityRange = (int)randomDouble(0, 3.0 * range + 100);
+		break;
+	case 1:
+		*visibilityRange = (int)(distance + randomDouble(-2, 2));
+		break;
+	case 2:
+		*visibilityRange = ARPOISE_RANGE_FILTER_MAX + 1 + rand() % 1000;
+		break;
+	default:
+		*visibilityRange = 0;
+		break;
+	}
+}
+
+/*
+* Check the range filter kernel against its scalar version and against the distances of porpoise,
+* and print the time filtering a layer takes against computing the distance of every POI.
+*/
+static int geo(int iterations)
+{
+	static const double locations[][2] =
+	{
+		{ 48.158662, 11.580376 }, { -33.868820, 151.209296 }, { 0.0000005, 179.9999995 }, { 0.5, -179.99 },
+		{ 89.9995, 0 }, { -89.98, 45.5 }, { 64.1, -21.9 }, { 0, 0 }
+	};
+	static const int ranges[] = { 0, 1, 20, 50, 1500, 20000, 99999, 100000, 150000, 3000000 };
+
+	for (size_t i = 0; i < sizeof(phpDistances) / sizeof(phpDistances[0]); i++)
+	{
+		double distance = phpDistance(phpDistances[i].lat1, phpDistances[i].lon1, phpDistances[i].lat2, phpDistances[i].lon2);
+		nCases++;
+		if (fabs(distance - phpDistances[i].distance) > 0.001)
+		{
+			geoDifference("great circle distance", phpDistances[i].lat1, phpDistances[i].lon1, 0,
+				phpDistances[i].lat2, phpDistances[i].lon2, 0);
+		}
+	}
+
+	double poiLat[GEO_MAX_POIS];
+	double poiLon[GEO_MAX_POIS];
+	int latE6[GEO_MAX_POIS];
+	int lonE6[GEO_MAX_POIS];
+	int visibilityRange[GEO_MAX_POIS];
+
+	srand(1);
+	for (int n = 0; n < 40000; n++)
+	{
+		double lat;
+		double lon;
+		if (n % 2)
+		{
+			lat = locations[(n / 2) % (sizeof(locations) / sizeof(locations[0]))][0];
+			lon = locations[(n / 2) % (sizeof(locations) / sizeof(locations[0]))][1];
+		}
+		else
+		{
+			lat = randomDouble(-90, 90);
+			lon = randomDouble(-180, 180);
+		}
+		int range = ranges[rand() % (sizeof(ranges) / sizeof(ranges[0]))];
+		int nPois = 1 + rand() % GEO_MAX_POIS;
+
+		for (int i = 0; i < nPois; i++)
+		{
+			// POIs around the location, a quarter of them close to the border of the range
+			double distance = rand() % 4 ? randomDouble(0, 2.0 * range + 200) : range + randomDouble(-2, 2);
+			randomPoi(lat, lon, range, distance < 0 ? 0 : distance, poiLat + i, poiLon + i, latE6 + i, lonE6 + i, visibilityRange + i);
+		}
+		checkRange(lat, lon, range, nPois, poiLat, poiLon, latE6, lonE6, visibilityRange);
+	}
+	printf("geo kernel %s: %ld cases checked, %ld differences, %ld POIs in range, %ld candidates\n",
+		arpoiseRangeMaskKernel(), nCases, nDifferences, nInRange, nCandidates);
+
+	// a layer of POIs within 50 km of the location, requested with a radius of 1500 meters
+	int nPois = 100000;
+	double* layerLat = pbl_malloc("geo", nPois * sizeof(double));
+	double* layerLon = pbl_malloc("geo", nPois * sizeof(double));
+	int* layerLatE6 = pbl_malloc("geo", nPois * sizeof(int));
+	int* layerLonE6 = pbl_malloc("geo", nPois * sizeof(int));
+	int* layerVisibilityRange = pbl_malloc("geo", nPois * sizeof(int));
+	unsigned long long* mask = pbl_malloc("geo", ARPOISE_RANGE_MASK_WORDS(nPois) * sizeof(unsigned long long));
+	if (!layerLat || !layerLon || !layerLatE6 || !layerLonE6 || !layerVisibilityRange || !mask)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	double lat = locations[0][0];
+	double lon = locations[0][1];
+	int range = 1500;
+	for (int i = 0; i < nPois; i++)
+	{
+		randomPoi(lat, lon, range, randomDouble(0, 50000), layerLat + i, layerLon + i, layerLatE6 + i, layerLonE6 + i, layerVisibilityRange + i);
+		layerVisibilityRange[i] = i % 100 ? 0 : 3000;
+	}
+
+	clock_t start = clock();
+	for (int n = 0; n < iterations; n++)
+	{
+		int nHits = 0;
+		for (int i = 0; i < nPois; i++)
+		{
+			double distance = phpDistance(lat, lon, layerLat[i], layerLon[i]);
+			nHits += distance < range || (layerVisibilityRange[i] > 0 && layerVisibilityRange[i] >= distance);
+		}
+		sink += nHits;
+	}
+	double haversine = microSeconds(start, iterations);
+
+	double filter[2];
+	double filtered[2];
+	for (int scalarOnly = 1; scalarOnly >= 0; scalarOnly--)
+	{
+		arpoiseRangeMaskScalarOnly = scalarOnly;
+
+		start = clock();
+		for (int n = 0; n < iterations; n++)
+		{
+			arpoiseRangeMask(nPois, layerLatE6, layerLonE6, layerVisibilityRange, lat, lon, range, mask);
+			sink += mask[0];
+		}
+		filter[scalarOnly] = microSeconds(start, iterations);
+
+		start = clock();
+		for (int n = 0; n < iterations; n++)
+		{
+			int nHits = 0;
+			arpoiseRangeMask(nPois, layerLatE6, layerLonE6, layerVisibilityRange, lat, lon, range, mask);
+			for (int i = 0; i < nPois; i++)
+			{
+				if (mask[i >> 6] & (1ULL << (i & 63)))
+				{
+					double distance = phpDistance(lat, lon, layerLat[i], layerLon[i]);
+					nHits += distance < range || (layerVisibilityRange[i] > 0 && layerVisibilityRange[i] >= distance);
+				}
+			}
+			sink += nHits;
+		}
+		filtered[scalarOnly] = microSeconds(start, iterations);
+	}
+
+	printf("%d POIs, range %d: haversine of all POIs %8.1f us, filter scalar %8.1f us, %s %8.1f us, "
+		"filter and haversine of the candidates scalar %8.1f us, %s %8.1f us\n",
+		nPois, range, haversine, filter[1], arpoiseRangeMaskKernel(), filter[0], filtered[1], arpoiseRangeMaskKernel(), filtered[0]);
+
+	PBL_FREE(layerLat);
+	PBL_FREE(layerLon);
+	PBL_FREE(layerLatE6);
+	PBL_FREE(layerLonE6);
+	PBL_FREE(layerVisibilityRange);
+	PBL_FREE(mask);
+	return nDifferences ? 1 : 0;
+}
+
+#define POST_MAX_PARAMETERS 4096
+
+typedef struct PostParameters
+{
+	int n;
+	char* keys[POST_MAX_PARAMETERS];
+	char* values[POST_MAX_PARAMETERS];
+} PostParameters;
+
+static void postHandler(char* key, char* value, void* context)
+{
+	PostParameters* parameters = (PostParameters*)context;
+	if (parameters->n < POST_MAX_PARAMETERS)
+	{
+		parameters->keys[parameters->n] = pblCgiStrDup(key);
+		parameters->values[parameters->n++] = value ? pblCgiStrDup(value) : NULL;
+	}
+}
+
+static char* postLimits[2][2];
+
+static char* postLimit(char* key)
+{
+	for (int i = 0; i < 2; i++)
+	{
+		if (postLimits[i][0] && !strcmp(key, postLimits[i][0]))
+		{
+			return postLimits[i][1];
+		}
+	}
+	return NULL;
+}
+
+/*
+* Put the input given on stdin as the input of a POST request.
+*/
+static void postInput(char* input, size_t length)
+{
+	FILE* file = tmpfile();
+	if (!file || fwrite(input, 1, length, file) != length || fflush(file) || dup2(fileno(file), STDIN_FILENO) < 0)
+	{
+		fprintf(stderr, "Cannot put the POST input on stdin\n");
+		exit(1);
+	}
+	fclose(file);
+	lseek(STDIN_FILENO, 0, SEEK_SET);
+
+	char contentLength[PBL_CGI_INT_STRING_SIZE];
+	setenv("REQUEST_METHOD", "POST", 1);
+	setenv("CONTENT_LENGTH", pblCgiIntToStr(contentLength, (long)length), 1);
+	unsetenv("QUERY_STRING");
+}
+
+/*
+* Parse the input with pblCgiParsePost and with pblCgiParseQuery, read from stdin if it is short enough,
+* otherwise given as a command line, each parameter has to have the value the query map has for its key.
+*/
+static void checkPost(char* input, size_t length)
+{
+	static PostParameters parameters;
+
+	postInput(input, length);
+	parameters.n = 0;
+	int nParameters = pblCgiParsePost(postHandler, &parameters);
+
+	int nExpected = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		nExpected += input[i] != '&' && (i + 1 == length || input[i + 1] == '&');
+	}
+
+	if (length < 1024 * 1024 - 1)
+	{
+		lseek(STDIN_FILENO, 0, SEEK_SET);
+		pblCgiParseQuery(0, NULL);
+	}
+	else
+	{
+		char* argv[2] = { "ArpoiseKernelTool", pblCgiStrRangeDup(input, input + length) };
+		unsetenv("REQUEST_METHOD");
+		pblCgiParseQuery(2, argv);
+	}
+
+	nCases++;
+	int isDifferent = nParameters != nExpected || nParameters != parameters.n;
+	for (int i = 0; i < parameters.n; i++)
+	{
+		// a key given more than once has the last value given
+		int isLast = 1;
+		for (int j = i + 1; j < parameters.n && isLast; j++)
+		{
+			isLast = strcmp(parameters.keys[i], parameters.keys[j]) != 0;
+		}
+		if (*parameters.keys[i] && isLast)
+		{
+			char* value = pblCgiQueryValue(parameters.keys[i]);
+			isDifferent |= strcmp(value ? value : "", parameters.values[i] ? parameters.values[i] : "") != 0;
+		}
+		PBL_FREE(parameters.keys[i]);
+		PBL_FREE(parameters.values[i]);
+	}
+	if (isDifferent)
+	{
+		difference("post", input, length < 64 ? length : 64);
+	}
+}
+
+/*
+* Run pblCgiParsePost in a child process with the limits given, returns the exit status of the child.
+*/
+static int postExitStatus(char* input, size_t length, char* maxStreamLength, char* maxParameterLength)
+{
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		freopen("/dev/null", "w", stdout);
+		postLimits[0][0] = PBL_CGI_MAX_POST_STREAM_LENGTH;
+		postLimits[0][1] = maxStreamLength;
+		postLimits[1][0] = PBL_CGI_MAX_POST_PARAMETER_LENGTH;
+		postLimits[1][1] = maxParameterLength;
+		pblCgiConfigLookup = postLimit;
+
+		static PostParameters parameters;
+		postInput(input, length);
+		pblCgiParsePost(postHandler, &parameters);
+		exit(0);
+	}
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*
+* Check the streaming parser of POST input against the query parser and its limits,
+* and print the time both take.
+*/
+static int post(int iterations)
+{
+	static const char filler[] = "ab%2B+==&&&%3d%26%zz%";
+	size_t maxLength = 4 * 1024 * 1024;
+	char* input = pbl_malloc("post", maxLength);
+	if (!input)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	// decoded keys and values
+	static PostParameters parameters;
+	char* form = "a%2Bb=c+d%3D&&key=value=rest&empty=&flag";
+	char* expected[] = { "a+b", "c d=", "key", "value", "empty", "", "flag", NULL };
+	postInput(form, strlen(form));
+	parameters.n = 0;
+	nCases++;
+	int isDifferent = pblCgiParsePost(postHandler, &parameters) != 4;
+	for (int i = 0; i < parameters.n; i++)
+	{
+		isDifferent |= strcmp(parameters.keys[i], expected[2 * i])
+			|| (expected[2 * i + 1] ? !parameters.values[i] || strcmp(parameters.values[i], expected[2 * i + 1]) : parameters.values[i] != NULL);
+		PBL_FREE(parameters.keys[i]);
+		PBL_FREE(parameters.values[i]);
+	}
+	if (isDifferent)
+	{
+		difference("post, decoding", form, strlen(form));
+	}
+
+	// short inputs of the characters that matter
+	srand(1);
+	for (int n = 0; n < 20000; n++)
+	{
+		size_t length = rand() % 200;
+		for (size_t i = 0; i < length; i++)
+		{
+			input[i] = filler[rand() % (sizeof(filler) - 1)];
+		}
+		checkPost(input, length);
+	}
+
+	// parameters crossing the chunks read and longer than a chunk, up to 4 MB of input
+	for (int n = 0; n < 40; n++)
+	{
+		size_t length = n < 20 ? 64 * 1024 + rand() % (256 * 1024) : 1024 * 1024 + rand() % (3 * 1024 * 1024);
+		size_t i = 0;
+		while (i < length)
+		{
+			size_t valueLength = rand() % 3 ? rand() % 2000 : rand() % (200 * 1024);
+			i += sprintf(input + i, "key%d=", rand() % 500);
+			for (size_t j = 0; j < valueLength && i < length; j++)
+			{
+				input[i++] = filler[rand() % 4];
+			}
+			if (i < length)
+			{
+				input[i++] = '&';
+			}
+		}
+		checkPost(input, length);
+	}
+
+	// the limits, the stream is not limited by MaxPostInputLength
+	memset(input, 'a', maxLength);
+	for (size_t i = 1000; i < maxLength; i += 1000)
+	{
+		input[i] = '&';
+	}
+	nCases += 4;
+	if (postExitStatus(input, maxLength, NULL, NULL) != 0)
+	{
+		difference("post, 4 MB", input, 16);
+	}
+	if (postExitStatus(input, maxLength, "1000000", NULL) == 0)
+	{
+		difference("post, MaxPostStreamLength", input, 16);
+	}
+	memset(input + maxLength / 2, 'a', 5000);
+	if (postExitStatus(input, maxLength, NULL, "1000") == 0)
+	{
+		difference("post, MaxPostParameterLength", input, 16);
+	}
+	memset(input, 'a', maxLength);
+	if (postExitStatus(input, maxLength, NULL, "100000") == 0)
+	{
+		difference("post, MaxPostParameterLength, no '&'", input, 16);
+	}
+
+	printf("post: %ld cases checked, %ld differences\n", nCases, nDifferences);
+
+	// a form of 512 KB, 64 parameters of 8 KB
+	size_t length = 0;
+	for (int n = 0; n < 64; n++)
+	{
+		length += sprintf(input + length, "%skey%d=", n ? "&" : "", n);
+		for (int j = 0; j < 8 * 1024; j++)
+		{
+			input[length++] = filler[j % 4];
+		}
+	}
+	postInput(input, length);
+
+	clock_t start = clock();
+	for (int i = 0; i < iterations; i++)
+	{
+		lseek(STDIN_FILENO, 0, SEEK_SET);
+		parameters.n = 0;
+		sink += pblCgiParsePost(postHandler, &parameters);
+		for (int j = 0; j < parameters.n; j++)
+		{
+			PBL_FREE(parameters.keys[j]);
+			PBL_FREE(parameters.values[j]);
+		}
+	}
+	double stream = microSeconds(start, iterations);
+
+	start = clock();
+	for (int i = 0; i < iterations; i++)
+	{
+		lseek(STDIN_FILENO, 0, SEEK_SET);
+		pblCgiParseQuery(0, NULL);
+		sink += strlen(pblCgiQueryValue("key63"));
+		PBL_FREE(pblCgiQueryString);
+	}
+	double query = microSeconds(start, iterations);
+
+	printf("512 KB form: pblCgiParsePost %8.1f us, pblCgiParseQuery %8.1f us\n", stream, query);
+
+	PBL_FREE(input);
+	return nDifferences ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc >= 2 && !strcmp(argv[1], "-c"))
+	{
+		return check();
+	}
+	if (argc >= 2 && !strcmp(argv[1], "-b"))
+	{
+		int iterations = argc >= 3 ? atoi(argv[2]) : 1000;
+		return benchmark(iterations > 0 ? iterations : 1);
+	}
+	if (argc >= 2 && !strcmp(argv[1], "-f"))
+	{
+		int iterations = argc >= 3 ? atoi(argv[2]) : 100000;
+		return format(iterations > 0 ? iterations : 1);
+	}
+	if (argc >= 2 && !strcmp(argv[1], "-h"))
+	{
+		int iterations = argc >= 3 ? atoi(argv[2]) : 10000;
+		return http(iterations > 0 ? iterations : 1);
+	}
+	if (argc >= 2 && !strcmp(argv[1], "-g"))
+	{
+		int iterations = argc >= 3 ? atoi(argv[2]) : 100;
+		return geo(iterations > 0 ? iterations : 1);
+	}
+	if (argc >= 2 && !strcmp(argv[1], "-p"))
+	{
+		int iterations = argc >= 3 ? atoi(argv[2]) : 1000;
+		return post(iterations > 0 ? iterations : 1);
+	}
+
+	fprintf(stderr, "Usage: %s -c\n       %s -b [iterations]\n       %s -f [iterations]\n       %s -h [iterations]\n"
+		"       %s -g [iterations]\n       %s -p [iterations]\n", argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+	return 1;
+}
@@ -0,0 +1,291 @@
+/*
+ArpoiseLayerCompiler.c - compiles porpoise layer xml files for the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+/*
+* Usage: ArpoiseLayerCompiler <layer xml> ...
+*        ArpoiseLayerCompiler -w <porpoise config xml> ...
+*
+* Each layer xml given is compiled to <layer xml>.bin, the file the directory service maps
+* instead of parsing the xml. Run it again whenever a layer xml changes, a compiled file
+* that is older than its layer xml is ignored by the directory service.
+*
+* The compiled file is written under a temporary name and renamed, so that processes
+* having the old file mapped keep a consistent view of it.
+*
+* With -w the compiler keeps running and watches the porpoise configurations given and the layer xml
+* files of their layers. Whenever one of the layer xml files is written, only that layer is compiled again.
+* When a configuration changes, the layers it lists are collected again. Watching needs inotify.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "ArpoisePoi.h"
+
+static int compileLayer(char* source)
+{
+	ArpoiseLayer* layer = arpoiseParseLayer(source, source);
+	if (!layer)
+	{
+		fprintf(stderr, "%s: cannot be compiled, it is not a layer xml the directory can serve\n", source);
+		return -1;
+	}
+
+	char* path = pblCgiStrCat(source, ARPOISE_LAYER_FILE_EXTENSION);
+	// the process id keeps compilers running at the same time from writing the same temporary file
+	char* temporaryPath = pblCgiSprintf("%s.%d", path, (int)getpid());
+
+	int rc = arpoiseWriteLayer(layer, temporaryPath);
+	if (rc)
+	{
+		fprintf(stderr, "%s: cannot write %s\n", source, temporaryPath);
+	}
+	else if (rename(temporaryPath, path))
+	{
+		fprintf(stderr, "%s: cannot rename %s to %s\n", source, temporaryPath, path);
+		rc = -1;
+	}
+	else
+	{
+		// make sure the directory service accepts the file
+		ArpoiseLayer* mappedLayer = arpoiseMapLayer(source, path, source);
+		if (!mappedLayer)
+		{
+			fprintf(stderr, "%s: the layer xml changed while it was compiled, run again\n", source);
+			rc = -1;
+		}
+		else
+		{
+			printf("%s: %d POIs, %u bytes of strings, written to %s\n", source, mappedLayer->pois.nPois,
+				mappedLayer->pois.stringsLength, path);
+			arpoiseFreeLayer(mappedLayer);
+		}
+	}
+	if (rc)
+	{
+		remove(temporaryPath);
+	}
+
+	PBL_FREE(temporaryPath);
+	PBL_FREE(path);
+	arpoiseFreeLayer(layer);
+	return rc;
+}
+
+#ifdef __linux__
+
+/*
+* A file watched, the watch is on the directory of the file, as editors replace files by renaming.
+*/
+typedef struct WatchedFile
+{
+	char* path;
+	char* directory;
+	char* name;
+	int isConfig;
+	int watch;
+} WatchedFile;
+
+static WatchedFile* watchedFileNew(int fd, char* path, int isConfig)
+{
+	WatchedFile* file = pbl_malloc0("watchedFileNew", sizeof(WatchedFile));
+	if (!file)
+	{
+		pblCgiExitOnError("watchedFileNew: pbl_errno = %d, message='%s'\n", pbl_errno, pbl_errstr);
+	}
+	file->path = pblCgiStrDup(path);
+	char* slash = strrchr(path, '/');
+	file->directory = slash ? pblCgiStrRangeDup(path, slash + (slash == path)) : pblCgiStrDup(".");
+	file->name = pblCgiStrDup(slash ? slash + 1 : path);
+	file->isConfig = isConfig;
+	file->watch = inotify_add_watch(fd, file->directory, IN_CLOSE_WRITE | IN_MOVED_TO);
+	if (file->watch < 0)
+	{
+		fprintf(stderr, "%s: cannot watch %s\n", path, file->directory);
+	}
+	return file;
+}
+
+static void watchedFileFree(WatchedFile* file)
+{
+	PBL_FREE(file->path);
+	PBL_FREE(file->directory);
+	PBL_FREE(file->name);
+	PBL_FREE(file);
+}
+
+/*
+* Compile a layer unless its compiled file is current.
+*/
+static int updateLayer(char* source)
+{
+	char* path = pblCgiStrCat(source, ARPOISE_LAYER_FILE_EXTENSION);
+	ArpoiseLayer* layer = arpoiseMapLayer(source, path, source);
+	PBL_FREE(path);
+	if (layer)
+	{
+		arpoiseFreeLayer(layer);
+		return 0;
+	}
+	return compileLayer(source);
+}
+
+/*
+* Watch the configurations given and the layer xml files of their layers, returns on errors only.
+*/
+static int watchLayers(int nConfigs, char** configs)
+{
+	for (;;)
+	{
+		int fd = inotify_init();
+		if (fd < 0)
+		{
+			fprintf(stderr, "Cannot initialize inotify\n");
+			return 1;
+		}
+
+		PblList* files = pblListNewArrayList();
+		if (!files)
+		{
+			pblCgiExitOnError("watchLayers: pbl_errno = %d, message='%s'\n", pbl_errno, pbl_errstr);
+		}
+		for (int i = 0; i < nConfigs; i++)
+		{
+			pblListAdd(files, watchedFileNew(fd, configs[i], 1));
+
+			PblList* sources = arpoiseLayerSources(configs[i]);
+			if (!sources)
+			{
+				fprintf(stderr, "%s: cannot be read\n", configs[i]);
+				continue;
+			}
+			for (int j = 0; j < pblListSize(sources); j++)
+			{
+				char* source = pblListGet(sources, j);
+				pblListAdd(files, watchedFileNew(fd, source, 0));
+				updateLayer(source);
+				PBL_FREE(source);
+			}
+			pblListFree(sources);
+		}
+		printf("Watching %d files\n", pblListSize(files));
+		fflush(stdout);
+
+		int configChanged = 0;
+		char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		while (!configChanged)
+		{
+			ssize_t length = read(fd, buffer, sizeof(buffer));
+			if (length <= 0)
+			{
+				fprintf(stderr, "Cannot read inotify events\n");
+				return 1;
+			}
+			for (char* ptr = buffer; ptr < buffer + length; ptr += sizeof(struct inotify_event) + ((struct inotify_event*)ptr)->len)
+			{
+				struct inotify_event* event = (struct inotify_event*)ptr;
+				if (event->mask & IN_Q_OVERFLOW)
+				{
+					// events were lost, collect all layers again, this compiles every layer that is not current
+					printf("Events were lost, checking all layers\n");
+					fflush(stdout);
+					configChanged = 1;
+					break;
+				}
+				for (int i = 0; event->len && i < pblListSize(files); i++)
+				{
+					WatchedFile* file = pblListGet(files, i);
+					if (file->watch != event->wd || strcmp(file->name, event->name))
+					{
+						continue;
+					}
+					if (file->isConfig)
+					{
+						printf("%s: changed\n", file->path);
+						configChanged = 1;
+					}
+					else
+					{
+						updateLayer(file->path);
+					}
+					fflush(stdout);
+				}
+			}
+		}
+
+		for (int i = 0; i < pblListSize(files); i++)
+		{
+			watchedFileFree(pblListGet(files, i));
+		}
+		pblListFree(files);
+		close(fd);
+	}
+}
+
+#endif
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2 || (argc < 3 && !strcmp(argv[1], "-w")))
+	{
+		fprintf(stderr, "Usage: %s <layer xml> ...\n       %s -w <porpoise config xml> ...\n", argv[0], argv[0]);
+		return 1;
+	}
+
+	if (!strcmp(argv[1], "-w"))
+	{
+#ifdef __linux__
+		return watchLayers(argc - 2, argv + 2);
+#else
+		fprintf(stderr, "%s: watching needs inotify, it is not available on this system\n", argv[0]);
+		return 1;
+#endif
+	}
+
+	int rc = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (compileLayer(argv[i]))
+		{
+			rc = 1;
+		}
+	}
+	return rc;
+}
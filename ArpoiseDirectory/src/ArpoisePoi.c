@@ -0,0 +1,2655 @@
+/*
+ArpoisePoi.c - native POI engine for the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+/*
+* The POI engine serves read only porpoise layers without the PHP hop.
+*
+* It reads the layer definitions from the porpoise config.xml, parses the layer xml
+* of an XMLPOIConnector layer into a struct of arrays store and answers layer requests
+* with the same hotspot json porpoise would send.
+*
+* Layers that cannot be served natively, e.g. layers using another connector,
+* make arpoiseLoadLayer() return NULL, the caller then asks porpoise.
+*/
+#include <stdio.h>
+#include <memory.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#endif
+
+#include "ArpoisePoi.h"
+#include "ArpoiseGeo.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*****************************************************************************/
+/* Memory and string helpers                                                 */
+/*****************************************************************************/
+
+static void* arpoiseMalloc(char* tag, size_t size)
+{
+	void* result = pbl_malloc0(tag, size);
+	if (!result)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	return result;
+}
+
+static void arpoiseAppend(char* tag, char** buffer, size_t* length, size_t* size, char* data, size_t n)
+{
+	if (*length + n + 1 > *size)
+	{
+		size_t newSize = *size ? 2 * *size : 256;
+		while (*length + n + 1 > newSize)
+		{
+			newSize *= 2;
+		}
+		char* newBuffer = realloc(*buffer, newSize);
+		if (!newBuffer)
+		{
+			pblCgiExitOnError("%s: Out of memory, %lu bytes\n", tag, (unsigned long)newSize);
+		}
+		*buffer = newBuffer;
+		*size = newSize;
+	}
+	memcpy(*buffer + *length, data, n);
+	*length += n;
+	(*buffer)[*length] = '\0';
+}
+
+/*
+* Return the modification time and the size of a file, -1 if the file does not exist.
+*/
+static int fileVersion(char* path, long* version, long* size)
+{
+	struct stat statBuffer;
+	if (stat(path, &statBuffer))
+	{
+		return -1;
+	}
+	*version = (long)statBuffer.st_mtime;
+	*size = (long)statBuffer.st_size;
+	return 0;
+}
+
+static char* readFile(char* path)
+{
+	FILE* stream = pblCgiTryFopen(path, "rb");
+	if (!stream)
+	{
+		PBL_CGI_TRACE("Failed to open '%s'", path);
+		return NULL;
+	}
+
+	char* data = NULL;
+	size_t length = 0;
+	size_t size = 0;
+	char buffer[16 * 1024];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), stream)) > 0)
+	{
+		arpoiseAppend("readFile", &data, &length, &size, buffer, n);
+	}
+	fclose(stream);
+	return data ? data : pblCgiStrDup("");
+}
+
+/*****************************************************************************/
+/* A minimal xml reader, enough for the porpoise config and layer files      */
+/*****************************************************************************/
+
+typedef struct XmlNode
+{
+	char* name;
+	char* text;             /* the direct text content, entities decoded */
+	size_t textLength;
+	size_t textSize;
+	char* events;           /* the value of the events attribute */
+	int nAttributes;
+	struct XmlNode* children;
+	struct XmlNode* lastChild;
+	struct XmlNode* next;
+} XmlNode;
+
+static void xmlFree(XmlNode* node)
+{
+	while (node)
+	{
+		XmlNode* next = node->next;
+		xmlFree(node->children);
+		PBL_FREE(node->name);
+		PBL_FREE(node->text);
+		PBL_FREE(node->events);
+		PBL_FREE(node);
+		node = next;
+	}
+}
+
+static void xmlAppendUtf8(XmlNode* node, unsigned long c)
+{
+	char buffer[4];
+	size_t n;
+
+	if (c < 0x80)
+	{
+		buffer[0] = (char)c;
+		n = 1;
+	}
+	else if (c < 0x800)
+	{
+		buffer[0] = (char)(0xC0 | (c >> 6));
+		buffer[1] = (char)(0x80 | (c & 0x3F));
+		n = 2;
+	}
+	else if (c < 0x10000)
+	{
+		buffer[0] = (char)(0xE0 | (c >> 12));
+		buffer[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+		buffer[2] = (char)(0x80 | (c & 0x3F));
+		n = 3;
+	}
+	else
+	{
+		buffer[0] = (char)(0xF0 | (c >> 18));
+		buffer[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+		buffer[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+		buffer[3] = (char)(0x80 | (c & 0x3F));
+		n = 4;
+	}
+	arpoiseAppend("xmlAppendUtf8", &node->text, &node->textLength, &node->textSize, buffer, n);
+}
+
+/*
+* Decode the entities of the text between start and end, append the result to the text of the node.
+*/
+static int xmlAppendText(XmlNode* node, char* start, char* end)
+{
+	while (start < end)
+	{
+		char* ampersand = memchr(start, '&', end - start);
+		if (!ampersand)
+		{
+			arpoiseAppend("xmlAppendText", &node->text, &node->textLength, &node->textSize, start, end - start);
+			break;
+		}
+		arpoiseAppend("xmlAppendText", &node->text, &node->textLength, &node->textSize, start, ampersand - start);
+
+		char* semicolon = memchr(ampersand, ';', end - ampersand);
+		if (!semicolon)
+		{
+			return -1;
+		}
+		char* entity = ampersand + 1;
+		size_t length = semicolon - entity;
+
+		if (length == 2 && !memcmp(entity, "lt", 2))
+		{
+			xmlAppendUtf8(node, '<');
+		}
+		else if (length == 2 && !memcmp(entity, "gt", 2))
+		{
+			xmlAppendUtf8(node, '>');
+		}
+		else if (length == 3 && !memcmp(entity, "amp", 3))
+		{
+			xmlAppendUtf8(node, '&');
+		}
+		else if (length == 4 && !memcmp(entity, "quot", 4))
+		{
+			xmlAppendUtf8(node, '"');
+		}
+		else if (length == 4 && !memcmp(entity, "apos", 4))
+		{
+			xmlAppendUtf8(node, '\'');
+		}
+		else if (length > 1 && *entity == '#')
+		{
+			char* endPtr = NULL;
+			unsigned long c = (entity[1] == 'x') ? strtoul(entity + 2, &endPtr, 16) : strtoul(entity + 1, &endPtr, 10);
+			if (endPtr != semicolon || c == 0 || c > 0x10FFFF)
+			{
+				return -1;
+			}
+			xmlAppendUtf8(node, c);
+		}
+		else
+		{
+			return -1;
+		}
+		start = semicolon + 1;
+	}
+	return 0;
+}
+
+static int xmlIsNameChar(char c)
+{
+	return c && !isspace((unsigned char)c) && c != '/' && c != '>' && c != '=' && c != '<';
+}
+
+/*
+* Skip declarations, processing instructions, comments and white space.
+*/
+static char* xmlSkipMisc(char* ptr)
+{
+	for (;;)
+	{
+		while (isspace((unsigned char)*ptr))
+		{
+			ptr++;
+		}
+		if (!strncmp(ptr, "<?", 2))
+		{
+			ptr = strstr(ptr, "?>");
+			if (!ptr)
+			{
+				return NULL;
+			}
+			ptr += 2;
+		}
+		else if (!strncmp(ptr, "<!--", 4))
+		{
+			ptr = strstr(ptr, "-->");
+			if (!ptr)
+			{
+				return NULL;
+			}
+			ptr += 3;
+		}
+		else if (!strncmp(ptr, "<!", 2))
+		{
+			ptr = strchr(ptr, '>');
+			if (!ptr)
+			{
+				return NULL;
+			}
+			ptr += 1;
+		}
+		else
+		{
+			return ptr;
+		}
+	}
+}
+
+/*
+* Parse the element starting at *ptrPtr, returns NULL if the xml is not well formed.
+*/
+static XmlNode* xmlParseElement(char** ptrPtr, int depth)
+{
+	static char* tag = "xmlParseElement";
+
+	char* ptr = *ptrPtr;
+	if (*ptr != '<' || depth > 64)
+	{
+		return NULL;
+	}
+	char* nameStart = ++ptr;
+	while (xmlIsNameChar(*ptr))
+	{
+		ptr++;
+	}
+	if (ptr == nameStart)
+	{
+		return NULL;
+	}
+
+	XmlNode* node = arpoiseMalloc(tag, sizeof(XmlNode));
+	node->name = pblCgiStrRangeDup(nameStart, ptr);
+	node->text = pblCgiStrDup("");
+	node->textSize = 1;
+
+	// attributes
+	for (;;)
+	{
+		while (isspace((unsigned char)*ptr))
+		{
+			ptr++;
+		}
+		if (*ptr == '>' || !strncmp(ptr, "/>", 2))
+		{
+			break;
+		}
+		char* attributeStart = ptr;
+		while (xmlIsNameChar(*ptr))
+		{
+			ptr++;
+		}
+		char* attributeEnd = ptr;
+		while (isspace((unsigned char)*ptr))
+		{
+			ptr++;
+		}
+		if (attributeStart == attributeEnd || *ptr++ != '=')
+		{
+			xmlFree(node);
+			return NULL;
+		}
+		while (isspace((unsigned char)*ptr))
+		{
+			ptr++;
+		}
+		char quote = *ptr++;
+		if (quote != '"' && quote != '\'')
+		{
+			xmlFree(node);
+			return NULL;
+		}
+		char* valueStart = ptr;
+		ptr = strchr(ptr, quote);
+		if (!ptr)
+		{
+			xmlFree(node);
+			return NULL;
+		}
+		node->nAttributes++;
+		if (attributeEnd - attributeStart == 6 && !memcmp(attributeStart, "events", 6))
+		{
+			XmlNode value;
+			memset(&value, 0, sizeof(value));
+			if (xmlAppendText(&value, valueStart, ptr))
+			{
+				PBL_FREE(value.text);
+				xmlFree(node);
+				return NULL;
+			}
+			PBL_FREE(node->events);
+			node->events = value.text ? value.text : pblCgiStrDup("");
+		}
+		ptr++;
+	}
+
+	if (*ptr == '/')
+	{
+		*ptrPtr = ptr + 2;
+		return node;
+	}
+	ptr++;
+
+	// content
+	for (;;)
+	{
+		if (!*ptr)
+		{
+			xmlFree(node);
+			return NULL;
+		}
+		if (*ptr != '<')
+		{
+			char* textEnd = strchr(ptr, '<');
+			if (!textEnd)
+			{
+				textEnd = ptr + strlen(ptr);
+			}
+			if (xmlAppendText(node, ptr, textEnd))
+			{
+				xmlFree(node);
+				return NULL;
+			}
+			ptr = textEnd;
+		}
+		else if (!strncmp(ptr, "</", 2))
+		{
+			ptr += 2;
+			size_t nameLength = strlen(node->name);
+			if (strncmp(ptr, node->name, nameLength) || xmlIsNameChar(ptr[nameLength]))
+			{
+				xmlFree(node);
+				return NULL;
+			}
+			ptr = strchr(ptr + nameLength, '>');
+			if (!ptr)
+			{
+				xmlFree(node);
+				return NULL;
+			}
+			*ptrPtr = ptr + 1;
+			return node;
+		}
+		else if (!strncmp(ptr, "<![CDATA[", 9))
+		{
+			char* cdataEnd = strstr(ptr + 9, "]]>");
+			if (!cdataEnd)
+			{
+				xmlFree(node);
+				return NULL;
+			}
+			arpoiseAppend(tag, &node->text, &node->textLength, &node->textSize, ptr + 9, cdataEnd - ptr - 9);
+			ptr = cdataEnd + 3;
+		}
+		else if (!strncmp(ptr, "<?", 2) || !strncmp(ptr, "<!", 2))
+		{
+			ptr = xmlSkipMisc(ptr);
+			if (!ptr)
+			{
+				xmlFree(node);
+				return NULL;
+			}
+		}
+		else
+		{
+			XmlNode* child = xmlParseElement(&ptr, depth + 1);
+			if (!child)
+			{
+				xmlFree(node);
+				return NULL;
+			}
+			if (node->lastChild)
+			{
+				node->lastChild->next = child;
+			}
+			else
+			{
+				node->children = child;
+			}
+			node->lastChild = child;
+		}
+	}
+}
+
+static XmlNode* xmlParse(char* data)
+{
+	char* ptr = xmlSkipMisc(data);
+	if (!ptr)
+	{
+		return NULL;
+	}
+	return xmlParseElement(&ptr, 0);
+}
+
+/*
+* The first child with the given name, as $node->name in SimpleXML.
+*/
+static XmlNode* xmlChild(XmlNode* node, char* name)
+{
+	for (XmlNode* child = node ? node->children : NULL; child; child = child->next)
+	{
+		if (!strcmp(child->name, name))
+		{
+			return child;
+		}
+	}
+	return NULL;
+}
+
+/*
+* The last child with the given name, porpoise assigns the children in order, so the last one wins.
+*/
+static XmlNode* xmlLastChild(XmlNode* node, char* name)
+{
+	XmlNode* result = NULL;
+	for (XmlNode* child = node ? node->children : NULL; child; child = child->next)
+	{
+		if (!strcmp(child->name, name))
+		{
+			result = child;
+		}
+	}
+	return result;
+}
+
+static char* xmlText(XmlNode* node)
+{
+	return node ? node->text : "";
+}
+
+/*
+* PHP's empty() for a SimpleXML element.
+*/
+static int xmlIsEmpty(XmlNode* node)
+{
+	return !node || (!node->children && (!*node->text || !strcmp(node->text, "0")));
+}
+
+/*****************************************************************************/
+/* PHP conversions                                                           */
+/*****************************************************************************/
+
+static double phpToDouble(char* string)
+{
+	if (!string)
+	{
+		return 0;
+	}
+	char* ptr = string;
+	while (*ptr == ' ' || *ptr == '\t' || *ptr == '\n' || *ptr == '\r' || *ptr == '\v' || *ptr == '\f')
+	{
+		ptr++;
+	}
+	char* digits = ptr;
+	if (*digits == '+' || *digits == '-')
+	{
+		digits++;
+	}
+	if (!isdigit((unsigned char)*digits) && !(*digits == '.' && isdigit((unsigned char)digits[1])))
+	{
+		return 0;
+	}
+	if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X'))
+	{
+		return 0;
+	}
+	return strtod(ptr, NULL);
+}
+
+/*
+* Whether a value is in the range of the values phpToInt returns.
+*/
+static int phpIsIntRange(double value)
+{
+	return value < 2147483647.0 * 2147483647.0 && value > -2147483647.0 * 2147483647.0;
+}
+
+static long phpToInt(char* string)
+{
+	double value = phpToDouble(string);
+	if (!phpIsIntRange(value))
+	{
+		return 0;
+	}
+	return (long)value;
+}
+
+static int phpToBool(char* string)
+{
+	return string && *string && strcmp(string, "0");
+}
+
+/*****************************************************************************/
+/* JSON output as PHP's json_encode writes it                                */
+/*****************************************************************************/
+
+static void jsonAppend(PblStringBuilder* stringBuilder, char* string)
+{
+	if (pblStringBuilderAppendStr(stringBuilder, string) == ((size_t)-1))
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", "jsonAppend", pbl_errno, pbl_errstr);
+	}
+}
+
+static void jsonAppendN(PblStringBuilder* stringBuilder, char* string, size_t n)
+{
+	if (n > 0 && pblStringBuilderAppendStrN(stringBuilder, n, string) == ((size_t)-1))
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", "jsonAppendN", pbl_errno, pbl_errstr);
+	}
+}
+
+/*
+* The malloced string of a string builder.
+*/
+static char* jsonToString(PblStringBuilder* stringBuilder)
+{
+	char* string = pblStringBuilderToString(stringBuilder);
+	if (!string)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", "jsonToString", pbl_errno, pbl_errstr);
+	}
+	return string;
+}
+
+static void jsonString(PblStringBuilder* stringBuilder, char* string)
+{
+	if (!string)
+	{
+		jsonAppend(stringBuilder, "null");
+		return;
+	}
+
+	unsigned char* ptr = (unsigned char*)string;
+	jsonAppend(stringBuilder, "\"");
+	while (*ptr)
+	{
+		unsigned char* start = ptr;
+		while (*ptr >= 0x20 && *ptr < 0x80 && *ptr != '"' && *ptr != '\\' && *ptr != '/')
+		{
+			ptr++;
+		}
+		jsonAppendN(stringBuilder, (char*)start, ptr - start);
+		if (!*ptr)
+		{
+			break;
+		}
+
+		char buffer[16];
+		unsigned long c = *ptr++;
+		switch (c)
+		{
+		case '"': jsonAppend(stringBuilder, "\\\""); continue;
+		case '\\': jsonAppend(stringBuilder, "\\\\"); continue;
+		case '/': jsonAppend(stringBuilder, "\\/"); continue;
+		case '\b': jsonAppend(stringBuilder, "\\b"); continue;
+		case '\f': jsonAppend(stringBuilder, "\\f"); continue;
+		case '\n': jsonAppend(stringBuilder, "\\n"); continue;
+		case '\r': jsonAppend(stringBuilder, "\\r"); continue;
+		case '\t': jsonAppend(stringBuilder, "\\t"); continue;
+		}
+
+		if (c >= 0x80)
+		{
+			int n = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : -1;
+			c &= (n == 3) ? 0x07 : (n == 2) ? 0x0F : 0x1F;
+			for (int i = 0; i < n; i++)
+			{
+				if ((ptr[i] & 0xC0) != 0x80)
+				{
+					n = -1;
+					break;
+				}
+				c = (c << 6) | (ptr[i] & 0x3F);
+			}
+			if (n < 0 || c > 0x10FFFF)
+			{
+				c = 0xFFFD;
+			}
+			else
+			{
+				ptr += n;
+			}
+		}
+		if (c >= 0x10000)
+		{
+			c -= 0x10000;
+			snprintf(buffer, sizeof(buffer), "\\u%04lx\\u%04lx", 0xD800 + (c >> 10), 0xDC00 + (c & 0x3FF));
+		}
+		else
+		{
+			snprintf(buffer, sizeof(buffer), "\\u%04lx", c);
+		}
+		jsonAppend(stringBuilder, buffer);
+	}
+	jsonAppend(stringBuilder, "\"");
+}
+
+/*
+* Write a double with the shortest digits that read back to the same value,
+* positional unless the exponent is below -4 or above 16, as PHP does with serialize_precision -1.
+*/
+static void jsonDouble(PblStringBuilder* stringBuilder, double value)
+{
+	char buffer[64];
+	char digits[32];
+	int nDigits = 0;
+	int decimalPoint = 0;
+
+	if (!isfinite(value))
+	{
+		value = 0;
+	}
+	if (value == 0)
+	{
+		jsonAppend(stringBuilder, signbit(value) ? "-0.0" : "0");
+		return;
+	}
+
+	char* ptr = buffer;
+	if (value < 0)
+	{
+		*ptr++ = '-';
+		value = -value;
+	}
+
+	for (int precision = 1; precision <= 17; precision++)
+	{
+		snprintf(digits, sizeof(digits), "%.*e", precision - 1, value);
+		if (strtod(digits, NULL) == value || precision == 17)
+		{
+			break;
+		}
+	}
+
+	// digits is d.ddde+xx, collect the mantissa digits
+	char* exponent = strchr(digits, 'e');
+	decimalPoint = atoi(exponent + 1) + 1;
+	*exponent = '\0';
+	for (char* source = digits; *source; source++)
+	{
+		if (isdigit((unsigned char)*source))
+		{
+			digits[nDigits++] = *source;
+		}
+	}
+	while (nDigits > 1 && digits[nDigits - 1] == '0')
+	{
+		nDigits--;
+	}
+	digits[nDigits] = '\0';
+
+	if (decimalPoint < -3 || decimalPoint > 17)
+	{
+		*ptr++ = digits[0];
+		*ptr++ = '.';
+		if (nDigits > 1)
+		{
+			memcpy(ptr, digits + 1, nDigits - 1);
+			ptr += nDigits - 1;
+		}
+		else
+		{
+			*ptr++ = '0';
+		}
+		sprintf(ptr, "e%c%d", decimalPoint - 1 < 0 ? '-' : '+', abs(decimalPoint - 1));
+	}
+	else if (decimalPoint <= 0)
+	{
+		*ptr++ = '0';
+		*ptr++ = '.';
+		for (int i = decimalPoint; i < 0; i++)
+		{
+			*ptr++ = '0';
+		}
+		strcpy(ptr, digits);
+	}
+	else
+	{
+		for (int i = 0; i < nDigits || i < decimalPoint; i++)
+		{
+			if (i == decimalPoint)
+			{
+				*ptr++ = '.';
+			}
+			*ptr++ = i < nDigits ? digits[i] : '0';
+		}
+		*ptr = '\0';
+	}
+	jsonAppend(stringBuilder, buffer);
+}
+
+static void jsonLong(PblStringBuilder* stringBuilder, long value)
+{
+	char buffer[32];
+	snprintf(buffer, sizeof(buffer), "%ld", value);
+	jsonAppend(stringBuilder, buffer);
+}
+
+static void jsonBool(PblStringBuilder* stringBuilder, int value)
+{
+	jsonAppend(stringBuilder, value ? "true" : "false");
+}
+
+static void jsonKey(PblStringBuilder* stringBuilder, int* first, char* key)
+{
+	if (!*first)
+	{
+		jsonAppend(stringBuilder, ",");
+	}
+	*first = 0;
+	jsonAppend(stringBuilder, "\"");
+	jsonAppend(stringBuilder, key);
+	jsonAppend(stringBuilder, "\":");
+}
+
+/*
+* A string member of a porpoise object, NULL if the element is missing.
+*/
+static char* xmlString(XmlNode* node)
+{
+	return node ? node->text : NULL;
+}
+
+/*
+* Write an action, POI actions are stripped of their default values, layer actions are not.
+*/
+static void jsonAction(PblStringBuilder* stringBuilder, XmlNode* node, int isPoiAction)
+{
+	char* uri = NULL;
+	char* label = NULL;
+	char* contentType = NULL;
+	char* method = "GET";
+	long activityType = 0;
+	int hasActivityType = 0;
+	char* params = NULL;
+	int closeBiw = 0;
+	int showActivity = 1;
+	char* activityMessage = NULL;
+	long autoTriggerRange = 0;
+	int autoTriggerOnly = 0;
+
+	if (!xmlIsEmpty(node) || node->nAttributes)
+	{
+		XmlNode* child;
+
+		label = xmlText(xmlChild(node, "label"));
+		uri = xmlText(xmlChild(node, "uri"));
+		if ((child = xmlChild(node, "contentType")))
+		{
+			contentType = child->text;
+		}
+		if ((child = xmlChild(node, "method")))
+		{
+			method = child->text;
+		}
+		if ((child = xmlChild(node, "activityType")))
+		{
+			activityType = phpToInt(child->text);
+			hasActivityType = 1;
+		}
+		if ((child = xmlChild(node, "params")) && *child->text && strcmp(child->text, "0"))
+		{
+			params = child->text;
+		}
+		if ((child = xmlChild(node, "closeBiw")))
+		{
+			closeBiw = phpToBool(child->text);
+		}
+		if ((child = xmlChild(node, "showActivity")))
+		{
+			showActivity = phpToBool(child->text);
+		}
+		if ((child = xmlChild(node, "activityMessage")))
+		{
+			activityMessage = child->text;
+		}
+		if (isPoiAction && !xmlIsEmpty(xmlChild(node, "autoTriggerRange")))
+		{
+			autoTriggerRange = phpToInt(xmlChild(node, "autoTriggerRange")->text);
+			autoTriggerOnly = phpToBool(xmlText(xmlChild(node, "autoTriggerOnly")));
+		}
+	}
+
+	int first = 1;
+	jsonAppend(stringBuilder, "{");
+	if (isPoiAction && autoTriggerRange)
+	{
+		jsonKey(stringBuilder, &first, "autoTriggerRange");
+		jsonLong(stringBuilder, autoTriggerRange);
+	}
+	if (isPoiAction && autoTriggerOnly)
+	{
+		jsonKey(stringBuilder, &first, "autoTriggerOnly");
+		jsonBool(stringBuilder, autoTriggerOnly);
+	}
+	jsonKey(stringBuilder, &first, "uri");
+	jsonString(stringBuilder, uri);
+	jsonKey(stringBuilder, &first, "label");
+	jsonString(stringBuilder, label);
+	if (!isPoiAction || (contentType && *contentType))
+	{
+		jsonKey(stringBuilder, &first, "contentType");
+		jsonString(stringBuilder, contentType);
+	}
+	if (!isPoiAction || strcmp(method, "GET"))
+	{
+		jsonKey(stringBuilder, &first, "method");
+		jsonString(stringBuilder, method);
+	}
+	if (!isPoiAction || activityType)
+	{
+		jsonKey(stringBuilder, &first, "activityType");
+		if (hasActivityType)
+		{
+			jsonLong(stringBuilder, activityType);
+		}
+		else
+		{
+			jsonAppend(stringBuilder, "null");
+		}
+	}
+	if (!isPoiAction || params)
+	{
+		jsonKey(stringBuilder, &first, "params");
+		jsonAppend(stringBuilder, "[");
+		if (params)
+		{
+			char* start = params;
+			for (;;)
+			{
+				char* comma = strchr(start, ',');
+				char* param = comma ? pblCgiStrRangeDup(start, comma) : start;
+				jsonString(stringBuilder, param);
+				if (!comma)
+				{
+					break;
+				}
+				PBL_FREE(param);
+				jsonAppend(stringBuilder, ",");
+				start = comma + 1;
+			}
+		}
+		jsonAppend(stringBuilder, "]");
+	}
+	if (!isPoiAction || closeBiw)
+	{
+		jsonKey(stringBuilder, &first, "closeBiw");
+		jsonBool(stringBuilder, closeBiw);
+	}
+	if (!isPoiAction || !showActivity)
+	{
+		jsonKey(stringBuilder, &first, "showActivity");
+		jsonBool(stringBuilder, showActivity);
+	}
+	if (!isPoiAction || (activityMessage && *activityMessage))
+	{
+		jsonKey(stringBuilder, &first, "activityMessage");
+		jsonString(stringBuilder, activityMessage);
+	}
+	jsonAppend(stringBuilder, "}");
+}
+
+/*
+* Write an animation stripped of its default values.
+*/
+static void jsonAnimation(PblStringBuilder* stringBuilder, XmlNode* node)
+{
+	char* name = xmlText(xmlChild(node, "name"));
+	char* interpolation = xmlText(xmlChild(node, "interpolation"));
+	char* followedBy = xmlText(xmlChild(node, "followedBy"));
+	double delay = phpToDouble(xmlText(xmlChild(node, "delay")));
+	double interpolationParam = phpToDouble(xmlText(xmlChild(node, "interpolationParam")));
+	double from = phpToDouble(xmlText(xmlChild(node, "from")));
+	double to = phpToDouble(xmlText(xmlChild(node, "to")));
+	int persist = phpToBool(xmlText(xmlChild(node, "persist")));
+	int repeat = phpToBool(xmlText(xmlChild(node, "repeat")));
+
+	double axis[3] = { 0, 0, 0 };
+	char* axisString = xmlText(xmlChild(node, "axis"));
+	char* firstComma = strchr(axisString, ',');
+	char* secondComma = firstComma ? strchr(firstComma + 1, ',') : NULL;
+	if (secondComma && !strchr(secondComma + 1, ','))
+	{
+		axis[0] = phpToDouble(axisString);
+		axis[1] = phpToDouble(firstComma + 1);
+		axis[2] = phpToDouble(secondComma + 1);
+	}
+
+	int first = 1;
+	jsonAppend(stringBuilder, "{");
+	if (*name)
+	{
+		jsonKey(stringBuilder, &first, "name");
+		jsonString(stringBuilder, name);
+	}
+	jsonKey(stringBuilder, &first, "type");
+	jsonString(stringBuilder, xmlText(xmlChild(node, "type")));
+	jsonKey(stringBuilder, &first, "length");
+	jsonDouble(stringBuilder, phpToDouble(xmlText(xmlChild(node, "length"))));
+	if (delay != 0)
+	{
+		jsonKey(stringBuilder, &first, "delay");
+		jsonDouble(stringBuilder, delay);
+	}
+	if (*interpolation)
+	{
+		jsonKey(stringBuilder, &first, "interpolation");
+		jsonString(stringBuilder, interpolation);
+	}
+	if (interpolationParam != 0)
+	{
+		jsonKey(stringBuilder, &first, "interpolationParam");
+		jsonDouble(stringBuilder, interpolationParam);
+	}
+	if (persist)
+	{
+		jsonKey(stringBuilder, &first, "persist");
+		jsonBool(stringBuilder, persist);
+	}
+	if (repeat)
+	{
+		jsonKey(stringBuilder, &first, "repeat");
+		jsonBool(stringBuilder, repeat);
+	}
+	if (from != 0)
+	{
+		jsonKey(stringBuilder, &first, "from");
+		jsonDouble(stringBuilder, from);
+	}
+	if (to != 0)
+	{
+		jsonKey(stringBuilder, &first, "to");
+		jsonDouble(stringBuilder, to);
+	}
+	if (*followedBy)
+	{
+		jsonKey(stringBuilder, &first, "followedBy");
+		jsonString(stringBuilder, followedBy);
+	}
+	if (axis[0] != 0 || axis[1] != 0 || axis[2] != 0)
+	{
+		jsonKey(stringBuilder, &first, "axis");
+		jsonAppend(stringBuilder, "{\"x\":");
+		jsonDouble(stringBuilder, axis[0]);
+		jsonAppend(stringBuilder, ",\"y\":");
+		jsonDouble(stringBuilder, axis[1]);
+		jsonAppend(stringBuilder, ",\"z\":");
+		jsonDouble(stringBuilder, axis[2]);
+		jsonAppend(stringBuilder, "}");
+	}
+	jsonAppend(stringBuilder, "}");
+}
+
+/*
+* Write the animations of a node for the given event order, returns 0 if the node has no animations.
+*
+* The legacy drop, spin and grow animation strings are not supported, -1 is returned for them.
+*/
+static int jsonAnimations(PblStringBuilder* stringBuilder, int* first, XmlNode* node, char** events, int nEvents)
+{
+	int nAnimations = 0;
+	for (XmlNode* child = node->children; child; child = child->next)
+	{
+		if (!strcmp(child->name, "animation"))
+		{
+			if (!strcmp(child->text, "drop") || !strcmp(child->text, "spin") || !strcmp(child->text, "grow"))
+			{
+				return -1;
+			}
+			nAnimations++;
+		}
+	}
+	if (!nAnimations)
+	{
+		return 0;
+	}
+
+	int firstEvent = 1;
+	for (int i = 0; i < nEvents; i++)
+	{
+		int firstAnimation = 1;
+		for (XmlNode* child = node->children; child; child = child->next)
+		{
+			if (strcmp(child->name, "animation") || !phpToBool(child->events) || !strstr(child->events, events[i]))
+			{
+				continue;
+			}
+			if (firstEvent)
+			{
+				jsonKey(stringBuilder, first, "animations");
+				jsonAppend(stringBuilder, "{");
+			}
+			if (firstAnimation)
+			{
+				jsonKey(stringBuilder, &firstEvent, events[i]);
+				jsonAppend(stringBuilder, "[");
+			}
+			else
+			{
+				jsonAppend(stringBuilder, ",");
+			}
+			firstAnimation = 0;
+			jsonAnimation(stringBuilder, child);
+		}
+		if (!firstAnimation)
+		{
+			jsonAppend(stringBuilder, "]");
+		}
+	}
+	if (!firstEvent)
+	{
+		jsonAppend(stringBuilder, "}");
+	}
+	return 0;
+}
+
+/*****************************************************************************/
+/* Loading a layer                                                           */
+/*****************************************************************************/
+
+static char* poiAnimationEvents[] = { "onCreate", "onFocus", "inFocus", "onClick", "onFollow" };
+static char* layerAnimationEvents[] = { "onCreate", "onFollow", "onFocus", "inFocus", "onClick" };
+
+/*
+* The string pool of a store while it is built, equal strings are interned.
+*/
+typedef struct StringPool
+{
+	ArpoisePoiStore* store;
+	size_t size;
+	PblMap* offsets;
+} StringPool;
+
+static unsigned int addString(StringPool* pool, char* string)
+{
+	static char* tag = "addString";
+
+	size_t length = strlen(string) + 1;
+	unsigned int* known = pblMapGet(pool->offsets, string, length, NULL);
+	if (known)
+	{
+		return *known;
+	}
+
+	ArpoisePoiStore* store = pool->store;
+	size_t stringsLength = store->stringsLength;
+	unsigned int offset = store->stringsLength;
+	arpoiseAppend(tag, &store->strings, &stringsLength, &pool->size, string, length);
+	store->stringsLength = (unsigned int)stringsLength;
+
+	if (pblMapAdd(pool->offsets, string, length, &offset, sizeof(offset)) < 0)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	return offset;
+}
+
+/*
+* Add a POI of the layer xml to the store, the json is prepared up to the distance, which depends on the request.
+*/
+static int addPoi(StringPool* pool, int index, XmlNode* node)
+{
+	PblStringBuilder* start = pblStringBuilderNew();
+	PblStringBuilder* end = pblStringBuilderNew();
+	if (!start || !end)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", "addPoi", pbl_errno, pbl_errstr);
+	}
+
+	XmlNode* dimensionNode = xmlChild(node, "dimension");
+	int isMultiDimensional = !xmlIsEmpty(dimensionNode) && phpToInt(dimensionNode->text) != 1;
+	long dimension = isMultiDimensional ? (phpToInt(dimensionNode->text) == 2 ? 2 : 3) : 1;
+	if ((dimensionNode = xmlLastChild(node, "dimension")))
+	{
+		dimension = phpToInt(dimensionNode->text);
+	}
+
+	XmlNode* child;
+	int first = 1;
+	jsonAppend(start, "{");
+	jsonKey(start, &first, "dimension");
+	jsonLong(start, dimension);
+
+	if (isMultiDimensional)
+	{
+		if ((child = xmlLastChild(node, "alt")) && phpToInt(child->text))
+		{
+			jsonKey(start, &first, "alt");
+			jsonLong(start, phpToInt(child->text));
+		}
+
+		child = xmlLastChild(node, "transform");
+		int isDefault = xmlIsEmpty(child) && !(child && child->nAttributes);
+		jsonKey(start, &first, "transform");
+		jsonAppend(start, "{\"rel\":");
+		jsonBool(start, isDefault ? 0 : phpToBool(xmlText(xmlChild(child, "rel"))));
+		jsonAppend(start, ",\"angle\":");
+		jsonDouble(start, isDefault ? 0 : phpToDouble(xmlText(xmlChild(child, "angle"))));
+		jsonAppend(start, ",\"scale\":");
+		jsonDouble(start, isDefault ? 1 : phpToDouble(xmlText(xmlChild(child, "scale"))));
+		jsonAppend(start, "}");
+
+		child = xmlLastChild(node, "object");
+		isDefault = xmlIsEmpty(child) && !(child && child->nAttributes);
+		char* objectFields[] = { "baseURL", "full", "poiLayerName", "relativeLocation", "icon" };
+		jsonKey(start, &first, "object");
+		jsonAppend(start, "{");
+		for (int i = 0; i < 5; i++)
+		{
+			XmlNode* field = isDefault ? NULL : xmlChild(child, objectFields[i]);
+			jsonAppend(start, i ? ",\"" : "\"");
+			jsonAppend(start, objectFields[i]);
+			jsonAppend(start, "\":");
+			jsonString(start, xmlIsEmpty(field) ? NULL : field->text);
+		}
+		jsonAppend(start, ",\"size\":");
+		if (isDefault)
+		{
+			jsonAppend(start, "null");
+		}
+		else
+		{
+			jsonDouble(start, phpToDouble(xmlText(xmlChild(child, "size"))));
+		}
+		jsonAppend(start, ",\"triggerImageURL\":");
+		XmlNode* field = isDefault ? NULL : xmlChild(child, "triggerImageURL");
+		jsonString(start, xmlIsEmpty(field) ? NULL : field->text);
+		jsonAppend(start, ",\"triggerImageWidth\":");
+		if (isDefault)
+		{
+			jsonAppend(start, "null");
+		}
+		else
+		{
+			jsonDouble(start, phpToDouble(xmlText(xmlChild(child, "triggerImageWidth"))));
+		}
+		jsonAppend(start, "}");
+
+		if ((child = xmlLastChild(node, "relativeAlt")) && phpToDouble(child->text) != 0)
+		{
+			jsonKey(start, &first, "relativeAlt");
+			jsonDouble(start, phpToDouble(child->text));
+		}
+	}
+
+	jsonKey(start, &first, "actions");
+	jsonAppend(start, "[");
+	int firstAction = 1;
+	for (child = node->children; child; child = child->next)
+	{
+		if (!strcmp(child->name, "action"))
+		{
+			if (!firstAction)
+			{
+				jsonAppend(start, ",");
+			}
+			firstAction = 0;
+			jsonAction(start, child, 1);
+		}
+	}
+	jsonAppend(start, "]");
+
+	if (jsonAnimations(start, &first, node, poiAnimationEvents, 5) < 0)
+	{
+		pblStringBuilderFree(start);
+		pblStringBuilderFree(end);
+		return -1;
+	}
+
+	jsonKey(start, &first, "attribution");
+	jsonString(start, xmlString(xmlLastChild(node, "attribution")));
+	jsonKey(start, &first, "distance");
+
+	long visibilityRange = 1500;
+	if ((child = xmlLastChild(node, "visibilityRange")))
+	{
+		visibilityRange = phpToInt(child->text);
+	}
+	if (visibilityRange != 1500)
+	{
+		jsonKey(end, &first, "visibilityRange");
+		jsonLong(end, visibilityRange);
+	}
+	jsonKey(end, &first, "id");
+	jsonString(end, xmlString(xmlLastChild(node, "id")));
+	jsonKey(end, &first, "imageURL");
+	jsonString(end, xmlString(xmlLastChild(node, "imageURL")));
+
+	double lat = phpToDouble(xmlText(xmlLastChild(node, "lat")));
+	double lon = phpToDouble(xmlText(xmlLastChild(node, "lon")));
+	jsonKey(end, &first, "lat");
+	jsonLong(end, (int)(lat * 1000000));
+	jsonKey(end, &first, "lon");
+	jsonLong(end, (int)(lon * 1000000));
+
+	char* lines[] = { "line1", "line2", "line3", "line4", "title" };
+	for (int i = 0; i < 5; i++)
+	{
+		jsonKey(end, &first, lines[i]);
+		jsonString(end, xmlString(xmlLastChild(node, lines[i])));
+	}
+	jsonKey(end, &first, "type");
+	jsonLong(end, phpToInt(xmlText(xmlLastChild(node, "type"))));
+
+	if ((child = xmlLastChild(node, "doNotIndex")) && phpToBool(child->text))
+	{
+		jsonKey(end, &first, "doNotIndex");
+		jsonBool(end, 1);
+	}
+	char* flags[] = { "showSmallBiw", "showBiwOnClick", "isVisible" };
+	int flagValues[] = { 1, 1, 1 };
+	for (int i = 0; i < 3; i++)
+	{
+		if ((child = xmlLastChild(node, flags[i])) && !phpToBool(child->text))
+		{
+			jsonKey(end, &first, flags[i]);
+			jsonBool(end, 0);
+			flagValues[i] = 0;
+		}
+	}
+	jsonAppend(end, "}");
+
+	ArpoisePoiStore* store = pool->store;
+	store->latE6[index] = (int)(lat * 1000000);
+	store->lonE6[index] = (int)(lon * 1000000);
+	store->lat[index] = lat;
+	store->lon[index] = lon;
+	store->visibilityRange[index] = (int)visibilityRange;
+	store->isVisible[index] = (unsigned char)flagValues[2];
+
+	child = xmlLastChild(node, "id");
+	store->id[index] = child ? addString(pool, child->text) : ARPOISE_NO_STRING;
+	char* json = jsonToString(start);
+	store->jsonStart[index] = addString(pool, json);
+	PBL_FREE(json);
+	json = jsonToString(end);
+	store->jsonEnd[index] = addString(pool, json);
+	PBL_FREE(json);
+
+	pblStringBuilderFree(start);
+	pblStringBuilderFree(end);
+	return 0;
+}
+
+/*
+* Collect the POIs of the layer, as porpoise's "//pois/poi" query in document order.
+*/
+static void collectPois(XmlNode* node, PblList* list)
+{
+	for (XmlNode* child = node->children; child; child = child->next)
+	{
+		if (!strcmp(node->name, "pois") && !strcmp(child->name, "poi"))
+		{
+			if (pblListAdd(list, child) < 0)
+			{
+				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", "collectPois", pbl_errno, pbl_errstr);
+			}
+		}
+		collectPois(child, list);
+	}
+}
+
+/*
+* Prepare the json of the layer properties, stripped of their default values as porpoise does.
+*/
+static int layerResponseFields(ArpoiseLayer* layer, XmlNode* root)
+{
+	long intValues[] = { 0, 300, 1500, 0, 0, 100 };
+	char* intNames[] = { "bleachingValue", "refreshInterval", "visibilityRange", "areaSize", "areaWidth", "refreshDistance" };
+	int boolValues[] = { 1, 1, 1, 0 };
+	char* boolNames[] = { "showMenuButton", "fullRefresh", "applyKalmanFilter", "isDefaultLayer" };
+	char* stringValues[] = { NULL, NULL, NULL, NULL, NULL };
+	char* stringNames[] = { "redirectionUrl", "redirectionLayer", "showMessage", "noPoisMessage", "layerTitle" };
+
+	for (XmlNode* child = root->children; child; child = child->next)
+	{
+		for (int i = 0; i < 6; i++)
+		{
+			if (!strcmp(child->name, intNames[i]))
+			{
+				intValues[i] = phpToInt(child->text);
+			}
+		}
+		for (int i = 0; i < 4; i++)
+		{
+			if (!strcmp(child->name, boolNames[i]))
+			{
+				boolValues[i] = phpToBool(child->text);
+			}
+		}
+		for (int i = 0; i < 5; i++)
+		{
+			if (!strcmp(child->name, stringNames[i]))
+			{
+				stringValues[i] = child->text;
+			}
+		}
+	}
+
+	PblStringBuilder* stringBuilder = pblStringBuilderNew();
+	if (!stringBuilder)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", "layerResponseFields", pbl_errno, pbl_errstr);
+	}
+
+	int first = 0;
+	long intDefaults[] = { 0, 300, 1500, 0, 0, 100 };
+	for (int i = 0; i < 6; i++)
+	{
+		if (intValues[i] != intDefaults[i])
+		{
+			jsonKey(stringBuilder, &first, intNames[i]);
+			jsonLong(stringBuilder, intValues[i]);
+		}
+	}
+	jsonKey(stringBuilder, &first, boolNames[0]);
+	jsonBool(stringBuilder, boolValues[0]);
+	int boolDefaults[] = { 1, 1, 1, 0 };
+	for (int i = 1; i < 4; i++)
+	{
+		if (boolValues[i] != boolDefaults[i])
+		{
+			jsonKey(stringBuilder, &first, boolNames[i]);
+			jsonBool(stringBuilder, boolValues[i]);
+		}
+	}
+	for (int i = 0; i < 5; i++)
+	{
+		if (stringValues[i] && *stringValues[i])
+		{
+			jsonKey(stringBuilder, &first, stringNames[i]);
+			jsonString(stringBuilder, stringValues[i]);
+		}
+	}
+
+	int firstAction = 1;
+	for (XmlNode* child = root->children; child; child = child->next)
+	{
+		if (!strcmp(child->name, "action"))
+		{
+			if (firstAction)
+			{
+				jsonKey(stringBuilder, &first, "actions");
+				jsonAppend(stringBuilder, "[");
+			}
+			else
+			{
+				jsonAppend(stringBuilder, ",");
+			}
+			firstAction = 0;
+			jsonAction(stringBuilder, child, 0);
+		}
+	}
+	if (!firstAction)
+	{
+		jsonAppend(stringBuilder, "]");
+	}
+
+	int rc = jsonAnimations(stringBuilder, &first, root, layerAnimationEvents, 5);
+	layer->responseFields = jsonToString(stringBuilder);
+	pblStringBuilderFree(stringBuilder);
+	return rc;
+}
+
+typedef struct GridEntry
+{
+	unsigned long long key;
+	unsigned int poi;
+} GridEntry;
+
+static int compareGridEntries(const void* left, const void* right)
+{
+	const GridEntry* leftEntry = left;
+	const GridEntry* rightEntry = right;
+
+	if (leftEntry->key != rightEntry->key)
+	{
+		return leftEntry->key < rightEntry->key ? -1 : 1;
+	}
+	return leftEntry->poi < rightEntry->poi ? -1 : leftEntry->poi > rightEntry->poi ? 1 : 0;
+}
+
+/*
+* Build the spatial index of the POIs of a store.
+*/
+static void buildGrid(ArpoisePoiStore* store)
+{
+	static char* tag = "buildGrid";
+
+	int n = store->nPois;
+	GridEntry* entries = arpoiseMalloc(tag, (n + 1) * sizeof(GridEntry));
+	for (int i = 0; i < n; i++)
+	{
+		entries[i].key = arpoiseGridKey(store->latE6[i], store->lonE6[i], store->visibilityRange[i]);
+		entries[i].poi = i;
+	}
+	qsort(entries, n, sizeof(GridEntry), compareGridEntries);
+
+	store->gridKey = arpoiseMalloc(tag, (n + 1) * sizeof(unsigned long long));
+	store->gridPoi = arpoiseMalloc(tag, (n + 1) * sizeof(unsigned int));
+	store->gridLatE6 = arpoiseMalloc(tag, (n + 1) * sizeof(int));
+	store->gridLonE6 = arpoiseMalloc(tag, (n + 1) * sizeof(int));
+	store->gridVisibilityRange = arpoiseMalloc(tag, (n + 1) * sizeof(int));
+	for (int i = 0; i < n; i++)
+	{
+		unsigned int poi = entries[i].poi;
+		store->gridKey[i] = entries[i].key;
+		store->gridPoi[i] = poi;
+		store->gridLatE6[i] = store->latE6[poi];
+		store->gridLonE6[i] = store->lonE6[poi];
+		store->gridVisibilityRange[i] = store->visibilityRange[poi];
+	}
+	PBL_FREE(entries);
+}
+
+/*
+* Parse a layer xml of an XMLPOIConnector, returns NULL if it cannot be served natively.
+*/
+ArpoiseLayer* arpoiseParseLayer(char* layerName, char* source)
+{
+	static char* tag = "arpoiseParseLayer";
+
+	long version = 0;
+	long size = 0;
+	char* data = readFile(source);
+	if (!data || fileVersion(source, &version, &size))
+	{
+		PBL_FREE(data);
+		return NULL;
+	}
+	XmlNode* root = xmlParse(data);
+	PBL_FREE(data);
+	if (!root || strcmp(root->name, "layer"))
+	{
+		PBL_CGI_TRACE("Layer file '%s' cannot be served natively", source);
+		xmlFree(root);
+		return NULL;
+	}
+
+	PblList* list = pblListNewArrayList();
+	if (!list)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	collectPois(root, list);
+
+	ArpoiseLayer* layer = arpoiseMalloc(tag, sizeof(ArpoiseLayer));
+	layer->name = pblCgiStrDup(layerName);
+	layer->source = pblCgiStrDup(source);
+	layer->version = version;
+	layer->size = size;
+
+	ArpoisePoiStore* store = &layer->pois;
+	int n = store->nPois = pblListSize(list);
+	store->latE6 = arpoiseMalloc(tag, (n + 1) * sizeof(int));
+	store->lonE6 = arpoiseMalloc(tag, (n + 1) * sizeof(int));
+	store->lat = arpoiseMalloc(tag, (n + 1) * sizeof(double));
+	store->lon = arpoiseMalloc(tag, (n + 1) * sizeof(double));
+	store->visibilityRange = arpoiseMalloc(tag, (n + 1) * sizeof(int));
+	store->isVisible = arpoiseMalloc(tag, (n + 1) * sizeof(unsigned char));
+	store->id = arpoiseMalloc(tag, (n + 1) * sizeof(unsigned int));
+	store->jsonStart = arpoiseMalloc(tag, (n + 1) * sizeof(unsigned int));
+	store->jsonEnd = arpoiseMalloc(tag, (n + 1) * sizeof(unsigned int));
+
+	StringPool pool;
+	pool.store = store;
+	pool.size = 0;
+	pool.offsets = pblMapNewHashMap();
+	if (!pool.offsets)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	int rc = layerResponseFields(layer, root);
+	for (int i = 0; rc == 0 && i < n; i++)
+	{
+		rc = addPoi(&pool, i, pblListGet(list, i));
+	}
+	pblMapFree(pool.offsets);
+	pblListFree(list);
+	xmlFree(root);
+	buildGrid(store);
+
+	if (rc)
+	{
+		PBL_CGI_TRACE("Layer file '%s' uses legacy animations, cannot be served natively", source);
+		arpoiseFreeLayer(layer);
+		return NULL;
+	}
+	PBL_CGI_TRACE("Loaded layer '%s' with %d POIs, %u bytes of strings", layerName, n, store->stringsLength);
+	return layer;
+}
+
+/*
+* The layer xml a layer definition of a porpoise configuration serves, NULL if it cannot be served natively.
+*/
+static char* layerSource(char* porpoiseConfigFile, XmlNode* definition)
+{
+	char* layerName = xmlText(xmlChild(definition, "name"));
+	XmlNode* connector = xmlChild(definition, "connector");
+	XmlNode* sourceNode = xmlChild(definition, "source");
+	char* connectorText = pblCgiStrDup(xmlText(connector));
+	char* connectorName = pblCgiStrTrim(connectorText);
+	char* source = NULL;
+
+	if (!pblCgiStrEquals("XMLPOIConnector", connectorName) || xmlChild(connector, "options"))
+	{
+		PBL_CGI_TRACE("Layer '%s' uses connector '%s', not served natively", layerName, connectorName);
+	}
+	else if (!sourceNode || xmlChild(sourceNode, "dsn") || !*sourceNode->text || strstr(sourceNode->text, "://"))
+	{
+		PBL_CGI_TRACE("Layer '%s' source cannot be served natively", layerName);
+	}
+	else if (*sourceNode->text == '/')
+	{
+		source = pblCgiStrDup(sourceNode->text);
+	}
+	else
+	{
+		// porpoise runs in its config directory, relative sources are relative to it
+		char* slash = strrchr(porpoiseConfigFile, '/');
+		source = slash ? pblCgiSprintf("%.*s/%s", (int)(slash - porpoiseConfigFile), porpoiseConfigFile, sourceNode->text)
+			: pblCgiStrDup(sourceNode->text);
+	}
+	PBL_FREE(connectorText);
+	return source;
+}
+
+static XmlNode* readConfig(char* porpoiseConfigFile)
+{
+	char* data = readFile(porpoiseConfigFile);
+	if (!data)
+	{
+		return NULL;
+	}
+	XmlNode* root = xmlParse(data);
+	PBL_FREE(data);
+	if (!root)
+	{
+		PBL_CGI_TRACE("Failed to parse '%s'", porpoiseConfigFile);
+	}
+	return root;
+}
+
+/*
+* The layer definition porpoise uses for a name, porpoise adds the layers by name, so the last definition of a name wins.
+*/
+static XmlNode* layerDefinition(XmlNode* root, char* layerName)
+{
+	XmlNode* definition = NULL;
+	for (XmlNode* layers = root->children; layers; layers = layers->next)
+	{
+		if (strcmp(layers->name, "layers"))
+		{
+			continue;
+		}
+		for (XmlNode* node = layers->children; node; node = node->next)
+		{
+			if (!strcmp(node->name, "layer") && !strcmp(xmlText(xmlChild(node, "name")), layerName))
+			{
+				definition = node;
+			}
+		}
+	}
+	return definition;
+}
+
+/*
+* Load a layer served by an XMLPOIConnector from the porpoise configuration,
+* returns NULL if the layer is not configured or cannot be served natively.
+*/
+ArpoiseLayer* arpoiseLoadLayer(char* porpoiseConfigFile, char* layerName)
+{
+	if (!porpoiseConfigFile || !*porpoiseConfigFile || !layerName || !*layerName)
+	{
+		return NULL;
+	}
+
+	XmlNode* root = readConfig(porpoiseConfigFile);
+	if (!root)
+	{
+		return NULL;
+	}
+	XmlNode* definition = layerDefinition(root, layerName);
+	char* source = definition ? layerSource(porpoiseConfigFile, definition) : NULL;
+	xmlFree(root);
+
+	if (!source)
+	{
+		return NULL;
+	}
+
+	// a compiled layer file is used as long as it is not older than the layer xml
+	char* compiledFile = pblCgiStrCat(source, ARPOISE_LAYER_FILE_EXTENSION);
+	ArpoiseLayer* layer = arpoiseMapLayer(layerName, compiledFile, source);
+	if (!layer)
+	{
+		layer = arpoiseParseLayer(layerName, source);
+	}
+	PBL_FREE(compiledFile);
+	PBL_FREE(source);
+	return layer;
+}
+
+/*
+* The layer xml files of all layers of a porpoise configuration that can be served natively,
+* returns NULL if the configuration cannot be read. Each file is listed once.
+*/
+PblList* arpoiseLayerSources(char* porpoiseConfigFile)
+{
+	static char* tag = "arpoiseLayerSources";
+
+	XmlNode* root = readConfig(porpoiseConfigFile);
+	if (!root)
+	{
+		return NULL;
+	}
+
+	PblList* sources = pblListNewArrayList();
+	if (!sources)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	for (XmlNode* layers = root->children; layers; layers = layers->next)
+	{
+		if (strcmp(layers->name, "layers"))
+		{
+			continue;
+		}
+		for (XmlNode* node = layers->children; node; node = node->next)
+		{
+			if (strcmp(node->name, "layer") || layerDefinition(root, xmlText(xmlChild(node, "name"))) != node)
+			{
+				continue;
+			}
+			char* source = layerSource(porpoiseConfigFile, node);
+			for (int i = 0; source && i < pblListSize(sources); i++)
+			{
+				if (!strcmp(source, pblListGet(sources, i)))
+				{
+					PBL_FREE(source);
+				}
+			}
+			if (source && pblListAdd(sources, source) < 0)
+			{
+				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+			}
+		}
+	}
+	xmlFree(root);
+	return sources;
+}
+
+/*****************************************************************************/
+/* Compiled layer files                                                      */
+/*****************************************************************************/
+
+#define ARPOISE_ALIGN8(n) (((n) + 7) & ~((long long)7))
+
+/*
+* Compute the offsets of the columns of a compiled layer file, returns the size of the file.
+*/
+static long long layerFileLayout(unsigned int nPois, unsigned int stringsLength, unsigned int* offsets)
+{
+	long long n = nPois;
+	long long sizes[ARPOISE_LAYER_FILE_COLUMNS] = {
+		n * sizeof(double), n * sizeof(double), n * sizeof(int), n * sizeof(int), n * sizeof(int),
+		n * sizeof(unsigned int), n * sizeof(unsigned int), n * sizeof(unsigned int), n * sizeof(unsigned char),
+		n * sizeof(unsigned long long), n * sizeof(unsigned int), n * sizeof(int), n * sizeof(int), n * sizeof(int),
+		stringsLength };
+
+	long long offset = ARPOISE_ALIGN8((long long)sizeof(ArpoiseLayerFileHeader));
+	for (int i = 0; i < ARPOISE_LAYER_FILE_COLUMNS; i++)
+	{
+		offsets[i] = (unsigned int)offset;
+		offset = ARPOISE_ALIGN8(offset + sizes[i]);
+	}
+	return offset;
+}
+
+/*
+* Check the columns of a compiled layer file that index other columns or the string pool,
+* so that a damaged file is rejected when it is mapped and not read out of bounds per request.
+*/
+static int layerFileIndexesValid(char* data, ArpoiseLayerFileHeader* header)
+{
+	if (header->nPois > INT_MAX)
+	{
+		return 0;
+	}
+	unsigned int* id = (unsigned int*)(data + header->offsets[5]);
+	unsigned int* jsonStart = (unsigned int*)(data + header->offsets[6]);
+	unsigned int* jsonEnd = (unsigned int*)(data + header->offsets[7]);
+	unsigned int* gridPoi = (unsigned int*)(data + header->offsets[10]);
+
+	// The strings are '\0' terminated, the pool ends with a '\0', so each offset into the pool is a valid string
+	for (unsigned int i = 0; i < header->nPois; i++)
+	{
+		if ((id[i] != ARPOISE_NO_STRING && id[i] >= header->stringsLength)
+			|| jsonStart[i] >= header->stringsLength || jsonEnd[i] >= header->stringsLength
+			|| gridPoi[i] >= header->nPois)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+* Write a layer as compiled layer file, returns 0 on success and -1 on error.
+*/
+int arpoiseWriteLayer(ArpoiseLayer* layer, char* path)
+{
+	ArpoisePoiStore* store = &layer->pois;
+	size_t responseFieldsLength = strlen(layer->responseFields) + 1;
+
+	ArpoiseLayerFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ARPOISE_LAYER_FILE_MAGIC, 4);
+	header.byteOrder = ARPOISE_LAYER_FILE_BYTE_ORDER;
+	header.formatVersion = ARPOISE_LAYER_FILE_VERSION;
+	header.headerSize = sizeof(header);
+	header.sourceVersion = layer->version;
+	header.sourceSize = layer->size;
+	header.nPois = store->nPois;
+	header.stringsLength = store->stringsLength + (unsigned int)responseFieldsLength;
+	header.responseFields = store->stringsLength;
+	header.fileSize = layerFileLayout(header.nPois, header.stringsLength, header.offsets);
+
+	FILE* stream = pblCgiTryFopen(path, "wb");
+	if (!stream)
+	{
+		return -1;
+	}
+
+	size_t n = store->nPois;
+	void* columns[ARPOISE_LAYER_FILE_COLUMNS] = { store->lat, store->lon, store->latE6, store->lonE6,
+		store->visibilityRange, store->id, store->jsonStart, store->jsonEnd, store->isVisible,
+		store->gridKey, store->gridPoi, store->gridLatE6, store->gridLonE6, store->gridVisibilityRange, store->strings };
+	size_t sizes[ARPOISE_LAYER_FILE_COLUMNS] = { n * sizeof(double), n * sizeof(double), n * sizeof(int), n * sizeof(int),
+		n * sizeof(int), n * sizeof(unsigned int), n * sizeof(unsigned int), n * sizeof(unsigned int), n * sizeof(unsigned char),
+		n * sizeof(unsigned long long), n * sizeof(unsigned int), n * sizeof(int), n * sizeof(int), n * sizeof(int),
+		store->stringsLength };
+
+	int rc = fwrite(&header, sizeof(header), 1, stream) == 1 ? 0 : -1;
+	long long offset = sizeof(header);
+	static char padding[8];
+	for (int i = 0; rc == 0 && i < ARPOISE_LAYER_FILE_COLUMNS; i++)
+	{
+		if (header.offsets[i] > offset && fwrite(padding, header.offsets[i] - offset, 1, stream) != 1)
+		{
+			rc = -1;
+			break;
+		}
+		if (sizes[i] > 0 && fwrite(columns[i], sizes[i], 1, stream) != 1)
+		{
+			rc = -1;
+			break;
+		}
+		offset = header.offsets[i] + sizes[i];
+	}
+	if (rc == 0 && fwrite(layer->responseFields, responseFieldsLength, 1, stream) != 1)
+	{
+		rc = -1;
+	}
+	offset += responseFieldsLength;
+	if (rc == 0 && header.fileSize > offset && fwrite(padding, header.fileSize - offset, 1, stream) != 1)
+	{
+		rc = -1;
+	}
+	if (fclose(stream))
+	{
+		rc = -1;
+	}
+	return rc;
+}
+
+/*
+* Map a compiled layer file read only, all processes serving the layer share the pages of the file.
+*
+* Returns NULL if the file does not exist, is not valid or is older than the layer xml given as source.
+*/
+ArpoiseLayer* arpoiseMapLayer(char* layerName, char* path, char* source)
+{
+	static char* tag = "arpoiseMapLayer";
+
+	long sourceVersion = 0;
+	long sourceSize = 0;
+	if (source && fileVersion(source, &sourceVersion, &sourceSize))
+	{
+		return NULL;
+	}
+
+	char* data = NULL;
+	size_t size = 0;
+
+#ifdef _WIN32
+
+	FILE* stream = pblCgiTryFopen(path, "rb");
+	if (!stream)
+	{
+		return NULL;
+	}
+	fseek(stream, 0, SEEK_END);
+	size = ftell(stream);
+	fseek(stream, 0, SEEK_SET);
+	data = arpoiseMalloc(tag, size + 1);
+	if (fread(data, 1, size, stream) != size)
+	{
+		size = 0;
+	}
+	fclose(stream);
+
+#else
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	struct stat statBuffer;
+	if (fstat(fd, &statBuffer) || statBuffer.st_size < (off_t)sizeof(ArpoiseLayerFileHeader))
+	{
+		close(fd);
+		PBL_CGI_TRACE("Compiled layer file '%s' is too short", path);
+		return NULL;
+	}
+	size = statBuffer.st_size;
+	data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		PBL_CGI_TRACE("Cannot map compiled layer file '%s', errno %d", path, errno);
+		return NULL;
+	}
+
+#endif
+
+	ArpoiseLayerFileHeader* header = (ArpoiseLayerFileHeader*)data;
+	unsigned int offsets[ARPOISE_LAYER_FILE_COLUMNS];
+	char* error = NULL;
+
+	if (size < sizeof(ArpoiseLayerFileHeader) || memcmp(header->magic, ARPOISE_LAYER_FILE_MAGIC, 4)
+		|| header->byteOrder != ARPOISE_LAYER_FILE_BYTE_ORDER || header->formatVersion != ARPOISE_LAYER_FILE_VERSION
+		|| header->headerSize != sizeof(ArpoiseLayerFileHeader))
+	{
+		error = "is not a compiled layer file of this version";
+	}
+	else if (header->fileSize != (long long)size
+		|| layerFileLayout(header->nPois, header->stringsLength, offsets) != header->fileSize
+		|| memcmp(offsets, header->offsets, sizeof(offsets))
+		|| header->stringsLength < 1 || header->responseFields >= header->stringsLength
+		|| data[header->offsets[ARPOISE_LAYER_FILE_COLUMNS - 1] + header->stringsLength - 1]
+		|| !layerFileIndexesValid(data, header))
+	{
+		error = "is damaged";
+	}
+	else if (source && (header->sourceVersion != sourceVersion || header->sourceSize != sourceSize))
+	{
+		error = "was not compiled from the current layer xml";
+	}
+	if (error)
+	{
+		PBL_CGI_TRACE("Compiled layer file '%s' %s", path, error);
+#ifdef _WIN32
+		PBL_FREE(data);
+#else
+		munmap(data, size);
+#endif
+		return NULL;
+	}
+
+	ArpoiseLayer* layer = arpoiseMalloc(tag, sizeof(ArpoiseLayer));
+	layer->name = pblCgiStrDup(layerName);
+	layer->source = pblCgiStrDup(path);
+	layer->version = (long)header->sourceVersion;
+	layer->size = (long)header->sourceSize;
+	layer->mapping = data;
+	layer->mappingSize = size;
+
+	ArpoisePoiStore* store = &layer->pois;
+	store->nPois = header->nPois;
+	store->lat = (double*)(data + header->offsets[0]);
+	store->lon = (double*)(data + header->offsets[1]);
+	store->latE6 = (int*)(data + header->offsets[2]);
+	store->lonE6 = (int*)(data + header->offsets[3]);
+	store->visibilityRange = (int*)(data + header->offsets[4]);
+	store->id = (unsigned int*)(data + header->offsets[5]);
+	store->jsonStart = (unsigned int*)(data + header->offsets[6]);
+	store->jsonEnd = (unsigned int*)(data + header->offsets[7]);
+	store->isVisible = (unsigned char*)(data + header->offsets[8]);
+	store->gridKey = (unsigned long long*)(data + header->offsets[9]);
+	store->gridPoi = (unsigned int*)(data + header->offsets[10]);
+	store->gridLatE6 = (int*)(data + header->offsets[11]);
+	store->gridLonE6 = (int*)(data + header->offsets[12]);
+	store->gridVisibilityRange = (int*)(data + header->offsets[13]);
+	store->strings = data + header->offsets[14];
+	store->stringsLength = header->stringsLength;
+	layer->responseFields = store->strings + header->responseFields;
+
+	PBL_CGI_TRACE("Mapped layer '%s' with %d POIs", layerName, store->nPois);
+	return layer;
+}
+
+void arpoiseFreeLayer(ArpoiseLayer* layer)
+{
+	if (layer && layer->mapping)
+	{
+#ifdef _WIN32
+		PBL_FREE(layer->mapping);
+#else
+		munmap(layer->mapping, layer->mappingSize);
+#endif
+		PBL_FREE(layer->name);
+		PBL_FREE(layer->source);
+		PBL_FREE(layer);
+	}
+	else if (layer)
+	{
+		PBL_FREE(layer->name);
+		PBL_FREE(layer->source);
+		PBL_FREE(layer->responseFields);
+		PBL_FREE(layer->pois.latE6);
+		PBL_FREE(layer->pois.lonE6);
+		PBL_FREE(layer->pois.lat);
+		PBL_FREE(layer->pois.lon);
+		PBL_FREE(layer->pois.visibilityRange);
+		PBL_FREE(layer->pois.isVisible);
+		PBL_FREE(layer->pois.id);
+		PBL_FREE(layer->pois.jsonStart);
+		PBL_FREE(layer->pois.jsonEnd);
+		PBL_FREE(layer->pois.gridKey);
+		PBL_FREE(layer->pois.gridPoi);
+		PBL_FREE(layer->pois.gridLatE6);
+		PBL_FREE(layer->pois.gridLonE6);
+		PBL_FREE(layer->pois.gridVisibilityRange);
+		PBL_FREE(layer->pois.strings);
+		PBL_FREE(layer);
+	}
+}
+
+/*****************************************************************************/
+/* Answering a request                                                       */
+/*****************************************************************************/
+
+/*
+* Return the url decoded value of a key in a query string, the last occurrence wins as in PHP.
+*/
+char* arpoiseQueryValue(char* queryString, char* key)
+{
+	size_t keyLength = strlen(key);
+	char* value = NULL;
+	char* valueEnd = NULL;
+
+	for (char* ptr = queryString; ptr && *ptr; )
+	{
+		char* end = strchr(ptr, '&');
+		if (!end)
+		{
+			end = ptr + strlen(ptr);
+		}
+		if (!strncmp(ptr, key, keyLength) && ptr[keyLength] == '=')
+		{
+			value = ptr + keyLength + 1;
+			valueEnd = end;
+		}
+		else if (!strncmp(ptr, key, keyLength) && ptr + keyLength == end)
+		{
+			value = valueEnd = end;
+		}
+		ptr = *end ? end + 1 : end;
+	}
+	if (!value)
+	{
+		return NULL;
+	}
+
+	char* result = arpoiseMalloc("arpoiseQueryValue", valueEnd - value + 1);
+	char* destination = result;
+	while (value < valueEnd)
+	{
+		if (*value == '+')
+		{
+			*destination++ = ' ';
+			value++;
+		}
+		else if (*value == '%' && value + 2 < valueEnd && isxdigit((unsigned char)value[1]) && isxdigit((unsigned char)value[2]))
+		{
+			char hex[3] = { value[1], value[2], '\0' };
+			*destination++ = (char)strtol(hex, NULL, 16);
+			value += 3;
+		}
+		else
+		{
+			*destination++ = *value++;
+		}
+	}
+	*destination = '\0';
+	return result;
+}
+
+static int phpIsEmpty(char* value)
+{
+	return !value || !*value || !strcmp(value, "0");
+}
+
+static int phpIsNumeric(char* value)
+{
+	char* end = NULL;
+	while (isspace((unsigned char)*value))
+	{
+		value++;
+	}
+	if (!*value)
+	{
+		return 0;
+	}
+	strtod(value, &end);
+	return end && !*end && phpToDouble(value) == strtod(value, NULL);
+}
+
+/*
+* PHP's loose == for two strings.
+*/
+static int phpStringEquals(char* left, char* right)
+{
+	if (phpIsNumeric(left) && phpIsNumeric(right))
+	{
+		return strtod(left, NULL) == strtod(right, NULL);
+	}
+	return !strcmp(left, right);
+}
+
+static char* errorResponse(char* layerName, char* errorString)
+{
+	PblStringBuilder* stringBuilder = pblStringBuilderNew();
+	if (!stringBuilder)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", "errorResponse", pbl_errno, pbl_errstr);
+	}
+	jsonAppend(stringBuilder, "{\"layer\":");
+	jsonString(stringBuilder, layerName ? layerName : "unspecified");
+	jsonAppend(stringBuilder, ",\"errorCode\":");
+	jsonLong(stringBuilder, ARPOISE_ERROR_CODE_DEFAULT);
+	jsonAppend(stringBuilder, ",\"errorString\":");
+	jsonString(stringBuilder, errorString);
+	jsonAppend(stringBuilder, ",\"hotspots\":[],\"nextPageKey\":null,\"morePages\":false}");
+
+	char* result = jsonToString(stringBuilder);
+	pblStringBuilderFree(stringBuilder);
+	return result;
+}
+
+static double deg2rad(double degrees)
+{
+	return (degrees / 180.0) * M_PI;
+}
+
+static int isRequestedPoi(ArpoisePoiStore* store, int i, char* requestedPoiId)
+{
+	return requestedPoiId && store->id[i] != ARPOISE_NO_STRING && phpStringEquals(requestedPoiId, store->strings + store->id[i]);
+}
+
+/*
+* The position of the first entry of the spatial index with a key not lower than the key given.
+*/
+static int gridLowerBound(ArpoisePoiStore* store, unsigned long long key)
+{
+	int low = 0;
+	int high = store->nPois;
+	while (low < high)
+	{
+		int middle = low + (high - low) / 2;
+		if (store->gridKey[middle] < key)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	return low;
+}
+
+typedef struct ArpoiseHit
+{
+	double distance;
+	int index;
+} ArpoiseHit;
+
+static int compareHits(const void* left, const void* right)
+{
+	const ArpoiseHit* leftHit = left;
+	const ArpoiseHit* rightHit = right;
+
+	if (leftHit->distance != rightHit->distance)
+	{
+		return leftHit->distance < rightHit->distance ? -1 : 1;
+	}
+	return leftHit->index - rightHit->index;
+}
+
+/*
+* A page key, porpoise keeps the POIs found for the first page in the session of the user,
+* a page key instead carries the version of the layer and the query of the first page,
+* so that each page is computed from the same layer and location without a session.
+*
+* The key is opaque to the clients. Its checksum is not keyed, it only rejects damaged keys,
+* a client can still create any key, so the values of a key are checked as the query parameters are.
+*/
+typedef struct ArpoisePageKey
+{
+	long long version;
+	long long size;
+	long offset;
+	double lat;
+	double lon;
+	long radius;
+	long accuracy;
+} ArpoisePageKey;
+
+static unsigned int pageKeyChecksum(char* string, size_t length)
+{
+	// FNV-1a
+	unsigned int hash = 2166136261U;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash = (hash ^ (unsigned char)string[i]) * 16777619U;
+	}
+	return hash;
+}
+
+static char* pageKeyString(ArpoisePageKey* key)
+{
+	unsigned long long latBits;
+	unsigned long long lonBits;
+	memcpy(&latBits, &key->lat, sizeof(latBits));
+	memcpy(&lonBits, &key->lon, sizeof(lonBits));
+
+	char* fields = pblCgiSprintf("%llx-%llx-%lx-%llx-%llx-%lx-%lx", (unsigned long long)key->version, (unsigned long long)key->size,
+		(unsigned long)key->offset, latBits, lonBits, (unsigned long)key->radius, (unsigned long)key->accuracy);
+	char* result = pblCgiSprintf("%s-%08x", fields, pageKeyChecksum(fields, strlen(fields)));
+	PBL_FREE(fields);
+	return result;
+}
+
+/*
+* Parse a page key, returns 0 on success and -1 if the string is not a valid page key.
+*/
+static int parsePageKey(char* string, ArpoisePageKey* key)
+{
+	char* checksum = strrchr(string, '-');
+	if (!checksum || strlen(checksum + 1) != 8 || strtoul(checksum + 1, NULL, 16) != pageKeyChecksum(string, checksum - string))
+	{
+		return -1;
+	}
+
+	unsigned long long version, size, latBits, lonBits;
+	unsigned long offset, radius, accuracy;
+	int length = 0;
+	if (sscanf(string, "%llx-%llx-%lx-%llx-%llx-%lx-%lx%n", &version, &size, &offset, &latBits, &lonBits, &radius, &accuracy, &length) != 7
+		|| string + length != checksum)
+	{
+		return -1;
+	}
+	key->version = (long long)version;
+	key->size = (long long)size;
+	key->offset = (long)offset;
+	memcpy(&key->lat, &latBits, sizeof(latBits));
+	memcpy(&key->lon, &lonBits, sizeof(lonBits));
+	key->radius = (long)radius;
+	key->accuracy = (long)accuracy;
+
+	if (!(key->lat >= -90 && key->lat <= 90) || !(key->lon >= -180 && key->lon <= 180)
+		|| !phpIsIntRange((double)key->radius) || !phpIsIntRange((double)key->accuracy)
+		|| key->offset < 0 || key->offset > INT_MAX)
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/*
+* The priority of a hit in the queue of the nearest hits, its distance in centimeters.
+*/
+static int hitPriority(double distance)
+{
+	double centimeters = distance * 100;
+	return centimeters >= INT_MAX ? INT_MAX : (int)centimeters;
+}
+
+/*
+* Keep the k nearest hits in the order of compareHits at the start of the hits, without sorting all hits.
+*
+* The priority queue is a max-heap of the hits kept, so its first hit is the farthest one.
+* A hit in the same centimeter as the farthest one is kept as well, the hits of that centimeter
+* are only dropped once k nearer hits are kept. Returns the number of hits kept.
+*/
+static int nearestHits(ArpoiseHit* hits, int nHits, int k)
+{
+	static char* tag = "nearestHits";
+
+	if (k <= 0)
+	{
+		return 0;
+	}
+
+	PblPriorityQueue* queue = pblPriorityQueueNew();
+	if (!queue)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	ArpoiseHit** farthest = arpoiseMalloc(tag, (nHits + 1) * sizeof(ArpoiseHit*));
+
+	for (int i = 0; i < nHits; i++)
+	{
+		int priority = hitPriority(hits[i].distance);
+		int farthestPriority = 0;
+		int isFull = pblPriorityQueueSize(queue) >= k;
+		if (isFull)
+		{
+			pblPriorityQueueGetFirst(queue, &farthestPriority);
+			if (priority > farthestPriority)
+			{
+				continue;
+			}
+		}
+		if (pblPriorityQueueInsert(queue, priority, hits + i) < 0)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		if (!isFull || priority == farthestPriority)
+		{
+			continue;
+		}
+
+		// drop the hits of the farthest centimeter if there are k nearer hits
+		int nFarthest = 0;
+		int firstPriority = 0;
+		while (pblPriorityQueueGetFirst(queue, &firstPriority) && firstPriority == farthestPriority)
+		{
+			farthest[nFarthest++] = pblPriorityQueueRemoveFirst(queue, NULL);
+		}
+		if (pblPriorityQueueSize(queue) < k)
+		{
+			for (int j = 0; j < nFarthest; j++)
+			{
+				if (pblPriorityQueueInsert(queue, farthestPriority, farthest[j]) < 0)
+				{
+					pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+				}
+			}
+		}
+	}
+
+	int nKept = pblPriorityQueueSize(queue);
+	ArpoiseHit* kept = arpoiseMalloc(tag, (nKept + 1) * sizeof(ArpoiseHit));
+	for (int i = 0; i < nKept; i++)
+	{
+		kept[i] = *(ArpoiseHit*)pblPriorityQueueGet(queue, i, NULL);
+	}
+	qsort(kept, nKept, sizeof(ArpoiseHit), compareHits);
+	if (nKept > k)
+	{
+		nKept = k;
+	}
+	memcpy(hits, kept, nKept * sizeof(ArpoiseHit));
+
+	PBL_FREE(kept);
+	PBL_FREE(farthest);
+	pblPriorityQueueFree(queue);
+	return nKept;
+}
+
+/*
+* Answer a layer request with the hotspot json porpoise would send for the same query string.
+*
+* If maxHotspots is positive, only that many of the nearest POIs are returned.
+*/
+char* arpoiseLayerResponse(ArpoiseLayer* layer, char* queryString, int maxHotspots)
+{
+	static char* tag = "arpoiseLayerResponse";
+
+	char* layerName = arpoiseQueryValue(queryString, "layerName");
+	char* required[] = { "userId", "layerName", "lat", "lon" };
+	for (int i = 0; i < 4; i++)
+	{
+		if (phpIsEmpty(arpoiseQueryValue(queryString, required[i])))
+		{
+			return errorResponse(layerName, pblCgiStrConcat("Missing parameter: ", required[i], NULL));
+		}
+	}
+
+	char* latString = arpoiseQueryValue(queryString, "lat");
+	char* lonString = arpoiseQueryValue(queryString, "lon");
+	double lat = phpToDouble(latString);
+	double lon = phpToDouble(lonString);
+	if (lat < -90 || lat > 90)
+	{
+		return errorResponse(layerName, pblCgiStrConcat("Invalid latitude in request: ", latString, NULL));
+	}
+	if (lon < -180 || lon > 180)
+	{
+		return errorResponse(layerName, pblCgiStrConcat("Invalid longitude in request: ", lonString, NULL));
+	}
+
+	long radius = phpToInt(arpoiseQueryValue(queryString, "radius"));
+	long accuracy = phpToInt(arpoiseQueryValue(queryString, "accuracy"));
+	char* requestedPoiId = arpoiseQueryValue(queryString, "requestedPoiId");
+	if (requestedPoiId && !strcmp(requestedPoiId, "None"))
+	{
+		requestedPoiId = NULL;
+	}
+	char* pageKey = arpoiseQueryValue(queryString, "pageKey");
+	long offset = 0;
+	ArpoisePageKey key;
+	if (pageKey && !parsePageKey(pageKey, &key))
+	{
+		if (key.version != layer->version || key.size != layer->size)
+		{
+			return errorResponse(layerName, "The layer changed since its first page was sent, request the first page again");
+		}
+		lat = key.lat;
+		lon = key.lon;
+		radius = key.radius;
+		accuracy = key.accuracy;
+		offset = key.offset;
+	}
+	else if (pageKey)
+	{
+		// a page number as sent by porpoise, a page after the last hit is empty
+		double pageOffset = phpToDouble(pageKey) * ARPOISE_POIS_PER_PAGE;
+		offset = pageOffset > INT_MAX ? INT_MAX : pageOffset > 0 ? (long)pageOffset : 0;
+	}
+	if (offset < 0)
+	{
+		offset = 0;
+	}
+
+	double range = (radius + accuracy) * 1.25;
+	double dlat = range / ((M_PI / 180) * ARPOISE_EARTH_RADIUS);
+	double dlon = range / ((M_PI / 180) * cos(deg2rad(lat)) * ARPOISE_EARTH_RADIUS);
+	double latRadians = deg2rad(lat);
+	double lonRadians = deg2rad(lon);
+
+	ArpoisePoiStore* store = &layer->pois;
+	ArpoiseHit* hits = arpoiseMalloc(tag, (store->nPois + 1) * sizeof(ArpoiseHit));
+	int nHits = 0;
+	int requestedIndex = -1;
+	double requestedDistance = 0;
+
+	// the requested POI is returned whether it is in range or not, all POIs with its id are left out of the hits
+	if (!phpIsEmpty(requestedPoiId))
+	{
+		for (int i = 0; i < store->nPois; i++)
+		{
+			if (isRequestedPoi(store, i, requestedPoiId))
+			{
+				requestedIndex = i;
+			}
+		}
+		if (requestedIndex >= 0)
+		{
+			requestedDistance = arpoiseGreatCircleDistance(latRadians, lonRadians,
+				deg2rad(store->lat[requestedIndex]), deg2rad(store->lon[requestedIndex]));
+		}
+	}
+	else
+	{
+		requestedPoiId = NULL;
+	}
+
+	if (!radius)
+	{
+		for (int i = 0; i < store->nPois; i++)
+		{
+			if (store->isVisible[i] && !isRequestedPoi(store, i, requestedPoiId))
+			{
+				hits[nHits].distance = arpoiseGreatCircleDistance(latRadians, lonRadians, deg2rad(store->lat[i]), deg2rad(store->lon[i]));
+				hits[nHits++].index = i;
+			}
+		}
+	}
+	else
+	{
+		// only the intervals of the spatial index around the location can hold POIs in range,
+		// within them only POIs the range filter lets through can be within radius plus accuracy or their visibility range
+		long filterRange = radius + accuracy;
+		int intRange = filterRange > INT_MAX ? INT_MAX : filterRange < INT_MIN ? INT_MIN : (int)filterRange;
+		unsigned long long* intervals = arpoiseMalloc(tag, 2 * ARPOISE_GRID_MAX_INTERVALS * sizeof(unsigned long long));
+		int nIntervals = arpoiseGridIntervals(lat, lon, intRange, intervals);
+		unsigned long long* rangeMask = arpoiseMalloc(tag, ARPOISE_RANGE_MASK_WORDS(store->nPois + 1) * sizeof(unsigned long long));
+		int nCandidates = 0;
+
+		for (int k = 0; k < nIntervals; k++)
+		{
+			int from = gridLowerBound(store, intervals[2 * k]);
+			int to = gridLowerBound(store, intervals[2 * k + 1] + 1);
+			if (from >= to)
+			{
+				continue;
+			}
+			nCandidates += to - from;
+			arpoiseRangeMask(to - from, store->gridLatE6 + from, store->gridLonE6 + from, store->gridVisibilityRange + from,
+				lat, lon, intRange, rangeMask);
+
+			for (int j = from; j < to; j++)
+			{
+				if (!(rangeMask[(j - from) >> 6] & (1ULL << ((j - from) & 63))))
+				{
+					continue;
+				}
+				int i = store->gridPoi[j];
+				if (!store->isVisible[i] || isRequestedPoi(store, i, requestedPoiId))
+				{
+					continue;
+				}
+
+				double poiLat = store->lat[i];
+				double poiLon = store->lon[i];
+				int visibilityRange = store->visibilityRange[i];
+				if (poiLat >= lat - dlat && poiLat <= lat + dlat && poiLon >= lon - dlon && poiLon <= lon + dlon)
+				{
+					double distance = arpoiseGreatCircleDistance(latRadians, lonRadians, deg2rad(poiLat), deg2rad(poiLon));
+					if (distance < radius + accuracy || (visibilityRange > 0 && visibilityRange >= distance))
+					{
+						hits[nHits].distance = distance;
+						hits[nHits++].index = i;
+					}
+				}
+				else if (visibilityRange > 0 && visibilityRange >= radius + accuracy)
+				{
+					double distance = arpoiseGreatCircleDistance(latRadians, lonRadians, deg2rad(poiLat), deg2rad(poiLon));
+					if (visibilityRange >= distance)
+					{
+						hits[nHits].distance = distance;
+						hits[nHits++].index = i;
+					}
+				}
+			}
+		}
+		PBL_CGI_TRACE("Spatial index: %d intervals, %d of %d POIs checked, range filter kernel %s",
+			nIntervals, nCandidates, store->nPois, arpoiseRangeMaskKernel());
+		PBL_FREE(rangeMask);
+		PBL_FREE(intervals);
+	}
+	if (maxHotspots > 0 && nHits + (requestedIndex >= 0) > maxHotspots)
+	{
+		int nAll = nHits;
+		nHits = nearestHits(hits, nHits, maxHotspots - (requestedIndex >= 0));
+		PBL_CGI_TRACE("Kept the %d nearest of %d POIs", nHits, nAll);
+	}
+	else
+	{
+		qsort(hits, nHits, sizeof(ArpoiseHit), compareHits);
+	}
+
+	// the requested POI is always returned at the top of the list
+	if (requestedIndex >= 0)
+	{
+		memmove(hits + 1, hits, nHits * sizeof(ArpoiseHit));
+		hits[0].distance = requestedDistance;
+		hits[0].index = requestedIndex;
+		nHits++;
+	}
+
+	double maxDistance = 0;
+	for (int i = 0; i < nHits; i++)
+	{
+		if (hits[i].distance > maxDistance)
+		{
+			maxDistance = hits[i].distance;
+		}
+	}
+
+	int morePages = nHits - offset > ARPOISE_POIS_PER_PAGE;
+	long limit = offset > nHits ? 0 : nHits - offset;
+	if (limit > ARPOISE_POIS_PER_PAGE)
+	{
+		limit = ARPOISE_POIS_PER_PAGE;
+	}
+
+	PblStringBuilder* stringBuilder = pblStringBuilderNew();
+	if (!stringBuilder)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	jsonAppend(stringBuilder, "{");
+	if (limit > 0)
+	{
+		jsonAppend(stringBuilder, "\"hotspots\":[");
+		for (long i = offset; i < offset + limit; i++)
+		{
+			if (i > offset)
+			{
+				jsonAppend(stringBuilder, ",");
+			}
+			jsonAppend(stringBuilder, store->strings + store->jsonStart[hits[i].index]);
+			jsonDouble(stringBuilder, hits[i].distance);
+			jsonAppend(stringBuilder, store->strings + store->jsonEnd[hits[i].index]);
+		}
+		jsonAppend(stringBuilder, "],");
+	}
+	jsonAppend(stringBuilder, "\"radius\":");
+	jsonLong(stringBuilder, (long)(1.25 * maxDistance));
+	jsonAppend(stringBuilder, ",\"numberOfHotspots\":");
+	jsonLong(stringBuilder, nHits);
+	jsonAppend(stringBuilder, layer->responseFields);
+	jsonAppend(stringBuilder, ",\"morePages\":");
+	jsonBool(stringBuilder, morePages);
+	jsonAppend(stringBuilder, ",\"nextPageKey\":\"");
+	if (morePages)
+	{
+		key.version = layer->version;
+		key.size = layer->size;
+		key.offset = offset + ARPOISE_POIS_PER_PAGE;
+		key.lat = lat;
+		key.lon = lon;
+		key.radius = radius;
+		key.accuracy = accuracy;
+		char* nextPageKey = pageKeyString(&key);
+		jsonAppend(stringBuilder, nextPageKey);
+		PBL_FREE(nextPageKey);
+	}
+	jsonAppend(stringBuilder, "\",\"layer\":");
+	jsonString(stringBuilder, layerName);
+	jsonAppend(stringBuilder, ",\"errorCode\":");
+	if (limit > 0)
+	{
+		jsonAppend(stringBuilder, "0,\"errorString\":\"ok\"}");
+	}
+	else
+	{
+		jsonLong(stringBuilder, ARPOISE_ERROR_CODE_NO_POIS);
+		jsonAppend(stringBuilder, ",\"errorString\":");
+		jsonString(stringBuilder, "No POIs found. Increase range or adjust filters to see POIs");
+		jsonAppend(stringBuilder, "}");
+	}
+
+	char* result = jsonToString(stringBuilder);
+	pblStringBuilderFree(stringBuilder);
+	PBL_FREE(hits);
+	return result;
+}
@@ -0,0 +1,148 @@
+#ifndef _ARPOISE_POI_H_
+#define _ARPOISE_POI_H_
+/*
+ArpoisePoi.h - include file for the native POI engine of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "pblCgi.h"
+
+	/*****************************************************************************/
+	/* #defines                                                                  */
+	/*****************************************************************************/
+
+#define ARPOISE_POIS_PER_PAGE                  256
+
+#define ARPOISE_ERROR_CODE_DEFAULT             20
+#define ARPOISE_ERROR_CODE_NO_POIS             21
+
+#define ARPOISE_NO_STRING                      0xFFFFFFFF /* string offset of a missing value */
+
+#define ARPOISE_LAYER_FILE_MAGIC               "ARPL"
+#define ARPOISE_LAYER_FILE_VERSION             2
+#define ARPOISE_LAYER_FILE_BYTE_ORDER          0x01020304
+#define ARPOISE_LAYER_FILE_EXTENSION           ".bin"     /* a compiled layer is stored next to its xml */
+#define ARPOISE_LAYER_FILE_COLUMNS             15
+
+	/*****************************************************************************/
+	/* Type definitions                                                          */
+	/*****************************************************************************/
+
+	/*
+	* The POIs of a layer as struct of arrays.
+	*
+	* All strings are offsets into the string pool, so that the store does not contain pointers.
+	*/
+	typedef struct ArpoisePoiStore
+	{
+		int nPois;
+
+		int* latE6;                 /* latitude in micro degrees, as in the hotspot json */
+		int* lonE6;                 /* longitude in micro degrees */
+		double* lat;                /* latitude in degrees as given in the layer xml */
+		double* lon;                /* longitude in degrees as given in the layer xml */
+		int* visibilityRange;
+		unsigned char* isVisible;
+
+		unsigned int* id;           /* id of the poi, ARPOISE_NO_STRING if it has none */
+		unsigned int* jsonStart;    /* json of the poi up to and including "distance": */
+		unsigned int* jsonEnd;      /* json of the poi following the distance value */
+
+		unsigned long long* gridKey; /* spatial index, the keys of the cells of the POIs in ascending order */
+		unsigned int* gridPoi;      /* the POI of each entry of the spatial index */
+		int* gridLatE6;             /* the coordinates and visibility ranges of the POIs in the order of the index */
+		int* gridLonE6;
+		int* gridVisibilityRange;
+
+		char* strings;              /* the string pool, equal strings are stored once */
+		unsigned int stringsLength;
+	} ArpoisePoiStore;
+
+	/*
+	* A porpoise layer served natively.
+	*/
+	typedef struct ArpoiseLayer
+	{
+		char* name;
+		char* source;               /* path of the layer xml */
+		long version;               /* modification time of the source */
+		long size;                  /* size of the source */
+		char* responseFields;       /* json of the layer properties, "bleachingValue" to "animations" */
+		ArpoisePoiStore pois;
+
+		void* mapping;              /* the compiled layer file if the layer was mapped */
+		size_t mappingSize;
+	} ArpoiseLayer;
+
+	/*
+	* Header of a compiled layer file.
+	*
+	* The header is followed by the columns of the POI store and the string pool,
+	* each starting 8 byte aligned at the offset given in the header. The order of the columns is
+	* lat, lon, latE6, lonE6, visibilityRange, id, jsonStart, jsonEnd, isVisible,
+	* gridKey, gridPoi, gridLatE6, gridLonE6, gridVisibilityRange, strings.
+	* The file is written for the byte order of the machine compiling it.
+	*/
+	typedef struct ArpoiseLayerFileHeader
+	{
+		char magic[4];
+		unsigned int byteOrder;
+		unsigned int formatVersion;
+		unsigned int headerSize;
+		long long fileSize;
+		long long sourceVersion;    /* modification time of the layer xml compiled */
+		long long sourceSize;       /* size of the layer xml compiled */
+		unsigned int nPois;
+		unsigned int stringsLength;
+		unsigned int responseFields; /* offset of the layer properties in the string pool */
+		unsigned int offsets[ARPOISE_LAYER_FILE_COLUMNS];
+	} ArpoiseLayerFileHeader;
+
+	/*****************************************************************************/
+	/* Function declarations                                                     */
+	/*****************************************************************************/
+
+	extern ArpoiseLayer* arpoiseLoadLayer(char* porpoiseConfigFile, char* layerName);
+	extern PblList* arpoiseLayerSources(char* porpoiseConfigFile);
+	extern ArpoiseLayer* arpoiseParseLayer(char* layerName, char* source);
+	extern ArpoiseLayer* arpoiseMapLayer(char* layerName, char* path, char* source);
+	extern int arpoiseWriteLayer(ArpoiseLayer* layer, char* path);
+	extern void arpoiseFreeLayer(ArpoiseLayer* layer);
+	extern char* arpoiseLayerResponse(ArpoiseLayer* layer, char* queryString, int maxHotspots);
+	extern char* arpoiseQueryValue(char* queryString, char* key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ArpoiseTraceTool.c - prints the binary trace of the Arpoise Directory front end service.
+
+Copyright (C) 2018, Tamiko Thiel and Peter Graf - All Rights Reserved
+
+ARPOISE - Augmented Reality Point Of Interest Service
+
+This file is part of Arpoise.
+
+	Arpoise is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	Arpoise is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with Arpoise.  If not, see <https://www.gnu.org/licenses/>.
+
+For more information on
+
+Tamiko Thiel, see www.TamikoThiel.com/
+Peter Graf, see www.mission-base.com/peter/
+Arpoise, see www.Arpoise.com/
+
+*/
+
+/*
+* Usage: ArpoiseTraceTool [<trace file> ...]
+*
+* The directory service writes its trace in binary, the tool prints the trace files given,
+* or the trace read from stdin, as text lines of time, process id and message.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pblCgi.h"
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		pblCgiTraceDecode(stdin, stdout);
+		return 0;
+	}
+
+	int rc = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-h"))
+		{
+			fprintf(stderr, "Usage: %s [<trace file> ...]\n", argv[0]);
+			return 1;
+		}
+		FILE* stream = fopen(argv[i], "rb");
+		if (!stream)
+		{
+			fprintf(stderr, "%s: cannot be read\n", argv[i]);
+			rc = 1;
+			continue;
+		}
+		pblCgiTraceDecode(stream, stdout);
+		fclose(stream);
+	}
+	return rc;
+}
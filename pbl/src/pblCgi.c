@@ -1,1989 +1,3413 @@
-/*
- pblCgi.c - C Common Gateway Interface functions.
-
- Copyright (c) 2018 Peter Graf. All rights reserved.
-
- This file is part of PBL - The Program Base Library.
- PBL is free software.
-
- This library is free software; you can redistribute it and/or
- modify it under the terms of the GNU Lesser General Public
- License as published by the Free Software Foundation; either
- version 2.1 of the License, or (at your option) any later version.
-
- This library is distributed in the hope that it will be useful,
- but WITHOUT ANY WARRANTY; without even the implied warranty of
- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
- Lesser General Public License for more details.
-
- You should have received a copy of the GNU Lesser General Public
- License along with this library; if not, write to the Free Software
- Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
-
- For more information on the Program Base Library or Peter Graf,
- please see: http://www.mission-base.com/.
-
- $Log: pblCgi.c,v $
- Revision 1.4  2019/07/13 18:41:42  peter
- Improved handling of append
-
- Revision 1.3  2019/02/07 21:15:35  peter
- Cleaning up after tests of ARpoise
-
- Revision 1.51  2019/02/07 21:11:57  peter
- Cleaning up after tests of ARpoise
-
- Revision 1.50  2019/01/26 15:11:14  peter
- Multiple lines are comma separated in pblCgiFileToMap
-
- Revision 1.49  2018/04/30 16:10:03  peter
- Linux port
-
- Revision 1.48  2018/04/30 14:21:40  peter
- Added try open and time to string with format
-
- Revision 1.47  2018/04/29 20:33:57  peter
- Changed error message
-
- Revision 1.46  2018/04/29 18:37:45  peter
- Added replace method
-
- Revision 1.45  2018/04/26 14:06:39  peter
- Added the cookie handling
-
- Revision 1.44  2018/04/16 14:18:00  peter
- Improved handling of start time
-
- Revision 1.43  2018/04/07 19:32:05  peter
- Re-added function that is needed
-
- Revision 1.42  2018/04/07 18:52:34  peter
- Cleanup
-
- Revision 1.41  2018/03/15 22:27:46  peter
- Working on cgi tests
-
- Revision 1.40  2018/03/11 00:23:25  peter
- Cleanup of split to list handling
-
- Revision 1.39  2018/03/10 21:49:21  peter
- Integration with ArvosDirectoryService
-
- Revision 1.38  2018/03/10 16:22:21  peter
- More work on cgi functions
-
- Revision 1.37  2018/02/23 23:20:24  peter
- Started to work on the cgi code
- */
-
- /*
-  * Make sure "strings <exe> | grep Id | sort -u" shows the source file versions
-  */
-char* pblCgi_c_id = "$Id: pblCgi.c,v 1.4 2019/07/13 18:41:42 peter Exp $";
-
-#include <stdio.h>
-#include <memory.h>
-
-#ifndef __APPLE__
-#include <malloc.h>
-#endif
-
-#include <stdlib.h>
-
-#include "pbl.h"
-#include "pblCgi.h"
-
-/*****************************************************************************/
-/* #defines                                                                  */
-/*****************************************************************************/
-#define PBL_CGI_MAX_SIZE_OF_BUFFER_ON_STACK		(64 * 1024)
-#define PBL_CGI_MAX_QUERY_PARAMETERS_COUNT		128
-#define PBL_CGI_MAX_POST_INPUT_LEN				(1024 * 1024)
-
-/*****************************************************************************/
-/* Variables                                                                 */
-/*****************************************************************************/
-
-PblMap * pblCgiConfigMap = NULL;
-
-struct timeval pblCgiStartTime;
-
-FILE * pblCgiTraceFile = NULL;
-char * pblCgiQueryString = NULL;
-
-char * pblCgiCookieKey = PBL_CGI_COOKIE;
-char * pblCgiCookieTag = PBL_CGI_COOKIE "=";
-
-static char * pblCgiMalloc(char * tag, size_t size)
-{
-	char * result = pbl_malloc(tag, size);
-	if (!result)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-	return result;
-}
-
-static char * contentType = NULL;
-static void pblCgiSetContentType(char * type)
-{
-	if (!contentType)
-	{
-		char * cookie = pblCgiValue(PBL_CGI_COOKIE);
-		char * cookiePath = pblCgiValue(PBL_CGI_COOKIE_PATH);
-		char * cookieDomain = pblCgiValue(PBL_CGI_COOKIE_DOMAIN);
-
-		contentType = type;
-
-		if (cookie && cookiePath && cookieDomain)
-		{
-			char * format = "Content-Type: %s\n";
-			printf(format, contentType);
-			PBL_CGI_TRACE(format, contentType);
-
-			format = "Set-Cookie: %s%s; Path=%s; DOMAIN=%s; HttpOnly\n\n";
-			printf(format, pblCgiCookieTag, cookie, cookiePath, cookieDomain);
-			PBL_CGI_TRACE(format, pblCgiCookieTag, cookie, cookiePath, cookieDomain);
-		}
-		else
-		{
-			printf("Content-Type: %s\n\n", contentType);
-			PBL_CGI_TRACE("Content-Type: %s\n", contentType);
-		}
-	}
-}
-
-static char pblCgiCheckChar(char c)
-{
-	if (c < ' ' || c == '<')
-	{
-		return ' ';
-	}
-	return c;
-}
-
-static char * pblCgiDecodeQueryString(char * source)
-{
-	static char * tag = "pblCgiDecodeQueryString";
-	char * sourcePtr = source;
-	char * destinationPtr;
-	char * destination;
-	char buffer[3];
-	int i;
-
-	destinationPtr = destination = pblCgiMalloc(tag, strlen(source) + 1);
-
-	while (*sourcePtr)
-	{
-		if (*sourcePtr == '+')
-		{
-			*destinationPtr++ = ' ';
-			sourcePtr++;
-		}
-		else if ((*sourcePtr == '%') && *(sourcePtr + 1) && *(sourcePtr + 2)
-			&& isxdigit((int)(*(sourcePtr + 1))) && isxdigit((int)(*(sourcePtr + 2))))
-		{
-			pblCgiStrNCpy(buffer, sourcePtr + 1, 3);
-			buffer[2] = '\0';
-#ifdef WIN32
-			sscanf_s(buffer, "%x", &i);
-#else
-			sscanf(buffer, "%x", &i);
-#endif
-			*destinationPtr++ = pblCgiCheckChar(i);
-			sourcePtr += 3;
-		}
-		else
-		{
-			*destinationPtr++ = pblCgiCheckChar(*sourcePtr++);
-		}
-	}
-	*destinationPtr = '\0';
-	return destination;
-}
-
-/**
-* Reads a two column file into a string map.
-*
-* The format is
-*
-*   # Comment
-*   key   value
-*
-*   If the parameter map is NULL, a new string map is created.
-*   The pointer to the map used is returned.
-*
-* @return PblMap * retPtr != NULL: The pointer to the map.
-*/
-PblMap * pblCgiFileToMap(PblMap * map, char * filePath)
-{
-	static char * tag = "pblCgiFileToMap";
-
-	if (!map)
-	{
-		map = pblCgiNewMap();
-	}
-
-	FILE * stream = pblCgiFopen(filePath, "r");
-	char line[PBL_CGI_MAX_LINE_LENGTH + 1];
-
-	while (fgets(line, sizeof(line) - 1, stream))
-	{
-		char * ptr = line;
-
-		while (isspace(*ptr))
-		{
-			ptr++;
-		}
-
-		if (!*ptr || *ptr == '#')
-		{
-			continue;
-		}
-
-		char * key = ptr;
-		while (*ptr && !isspace(*ptr))
-		{
-			ptr++;
-		}
-
-		if (*ptr)
-		{
-			*ptr++ = '\0';
-		}
-
-		char * value = pblCgiStrTrim(ptr);
-
-		if (pblMapGetStr(map, key))
-		{
-			// Multiple lines are comma separated
-			char * newValue = pbl_mem2dup(NULL, ", ", 2, value, strlen(value) + 1);
-			int rc = pblMapAppendStrStr(map, key, newValue);
-			PBL_FREE(newValue)
-			if (rc < 0)
-			{
-				pblCgiExitOnError("%s: Failed to append a string, pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-		}
- 		else if (pblMapAddStrStr(map, key, value) < 0)
-		{
-			pblCgiExitOnError("%s: Failed to append a string, pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-	}
-	fclose(stream);
-
-	return map;
-}
-
-/**
-* Get the value given for the key in the configuration.
-*/
-char * pblCgiConfigValue(char * key, char * defaultValue)
-{
-	static char * tag = "pblCgiConfigValue";
-
-	if (!pblCgiConfigMap)
-	{
-		pblCgiExitOnError("%s: The cgi-configuration file was never read!\n", tag);
-	}
-	if (!key || !*key)
-	{
-		pblCgiExitOnError("%s: Empty key not allowed in cgi-configuration file!\n", tag);
-	}
-	char * value = pblMapGetStr(pblCgiConfigMap, key);
-	if (!value)
-	{
-		return defaultValue;
-	}
-	return value;
-}
-
-void pblCgiInitTrace(struct timeval * startTime, char * traceFilePath)
-{
-	pblCgiStartTime = *startTime;
-
-	if (traceFilePath && *traceFilePath)
-	{
-		FILE * stream;
-
-#ifdef WIN32
-		errno_t err = fopen_s(&stream, traceFilePath, "r");
-		if (err != 0)
-		{
-			return;
-		}
-#else
-		if (!(stream = fopen(traceFilePath, "r")))
-		{
-			return;
-		}
-#endif
-
-		fclose(stream);
-
-		pblCgiTraceFile = pblCgiFopen(traceFilePath, "a");
-		fputs("\n", pblCgiTraceFile);
-		fputs("\n", pblCgiTraceFile);
-		PBL_CGI_TRACE("----------------------------------------> Started");
-
-		extern char **environ;
-		char ** envp = environ;
-
-		while (envp && *envp)
-		{
-			PBL_CGI_TRACE("ENV %s", *envp++);
-		}
-	}
-}
-
-static PblMap * queryMap = NULL;
-static void pblCgiSetQueryValue(char * key, char * value)
-{
-	static char * tag = "pblCgiSetQueryValue";
-
-	if (!queryMap)
-	{
-		queryMap = pblCgiNewMap();
-	}
-	if (!key || !*key)
-	{
-		return;
-	}
-	if (!value)
-	{
-		value = "";
-	}
-
-	if (pblMapAddStrStr(queryMap, key, value) < 0)
-	{
-		pblCgiExitOnError("%s: Failed to append a value, pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-	PBL_CGI_TRACE("In %s=%s", key, value);
-}
-
-/**
-* Get the value for an iteration given for the key in the query.
-*/
-char * pblCgiQueryValueForIteration(char * key, int iteration)
-{
-	static char * tag = "pblCgiQueryValueForIteration";
-
-	if (!queryMap)
-	{
-		return "";
-	}
-	if (!key || !*key)
-	{
-		pblCgiExitOnError("%s: Empty key not allowed!\n", tag, pbl_errstr);
-	}
-	if (iteration >= 0)
-	{
-		char * iterationKey = pblCgiSprintf("%s_%d", key, iteration);
-		char * value = pblMapGetStr(queryMap, iterationKey);
-		PBL_FREE(iterationKey);
-		return value ? value : "";
-	}
-	char * value = pblMapGetStr(queryMap, key);
-	return value ? value : "";
-}
-
-/**
-* Get the value given for the key in the query.
-*/
-char * pblCgiQueryValue(char * key)
-{
-	return pblCgiQueryValueForIteration(key, -1);
-}
-
-/**
-* Trace function
-*/
-void pblCgiTrace(const char * format, ...)
-{
-	static char * tag = "pblCgiTrace";
-
-	if (!pblCgiTraceFile)
-	{
-		return;
-	}
-
-	va_list args;
-	va_start(args, format);
-
-	char buffer[PBL_CGI_MAX_SIZE_OF_BUFFER_ON_STACK + 1];
-	int rc = vsnprintf(buffer, sizeof(buffer) - 1, format, args);
-	va_end(args);
-
-	if (rc < 0)
-	{
-		pblCgiExitOnError("%s: Printing of format '%s' and size %lu failed with errno=%d\n",
-		 tag, format, sizeof(buffer) - 1, errno);
-	}
-	buffer[sizeof(buffer) - 1] = '\0';
-
-	char * now = pblCgiStrFromTime(time((time_t*)NULL));
-	fputs(now, pblCgiTraceFile);
-	PBL_FREE(now);
-
-#ifndef _WIN32
-	fprintf(pblCgiTraceFile, " %d: ", getpid());
-#endif
-
-	fputs(" ", pblCgiTraceFile);
-	fputs(buffer, pblCgiTraceFile);
-	fputs("\n", pblCgiTraceFile);
-	fflush(pblCgiTraceFile);
-}
-
-/**
- * Print an error message and exit the program.
- */
-void pblCgiExitOnError(const char * format, ...)
-{
-	pblCgiSetContentType("text/html");
-
-	printf(
-		"<!DOCTYPE html>\n"
-		"<html>\n"
-		"<head>\n<title>Mission-Base PBL CGI Error</title>\n</head>\n"
-		"<body>\n"
-		"<h1>PBL CGI\n</h1>\n"
-		"<p><hr><p>\n"
-		"<h1>An error occurred</h1>\n");
-
-	char * scriptName = pblCgiGetEnv("SCRIPT_NAME");
-	if (!scriptName || !*scriptName)
-	{
-		scriptName = "unknown";
-	}
-
-	printf("<p>While accessing the script '%s'.\n", scriptName);
-	printf("<p><b>\n");
-
-	va_list args;
-	va_start(args, format);
-
-	char buffer[PBL_CGI_MAX_SIZE_OF_BUFFER_ON_STACK + 1];
-	int rc = vsnprintf(buffer, sizeof(buffer) - 1, format, args);
-	va_end(args);
-
-	if (rc < 0)
-	{
-		printf("Printing of format '%s' and size %lu failed with errno=%d\n", format, sizeof(buffer) - 1, errno);
-	}
-	else
-	{
-		buffer[sizeof(buffer) - 1] = '\0';
-		printf("%s", buffer);
-		PBL_CGI_TRACE("%s", buffer);
-	}
-
-	printf("</b>\n");
-	printf("<p>Please click your browser's back button to continue.\n");
-	printf("<p><hr><p>\n");
-	printf("<small>Copyright &copy; 2018 - Tamiko Thiel and Peter Graf</small>\n");
-	printf("</body></HTML>\n");
-
-	PBL_CGI_TRACE("%s exit(-1)", scriptName);
-	exit(-1);
-}
-
-/**
- * Like sprintf, copies the value to the heap.
- */
-char * pblCgiSprintf(const char * format, ...)
-{
-	va_list args;
-	va_start(args, format);
-
-	char buffer[PBL_CGI_MAX_SIZE_OF_BUFFER_ON_STACK + 1];
-	int rc = vsnprintf(buffer, sizeof(buffer) - 1, format, args);
-	va_end(args);
-
-	if (rc < 0)
-	{
-		pblCgiExitOnError("Printing of format '%s' and size %lu failed with errno=%d\n", format, sizeof(buffer) - 1,
-			errno);
-	}
-	buffer[sizeof(buffer) - 1] = '\0';
-	return pblCgiStrDup(buffer);
-}
-
-/**
- * Tests whether a NULL terminated string array contains a string
- */
-int pblCgiStrArrayContains(char ** array, char * string)
-{
-	for (int i = 0;; i++)
-	{
-		char * ptr = array[i];
-		if (!ptr)
-		{
-			break;
-		}
-		if (pblCgiStrEquals(ptr, string))
-		{
-			return i;
-		}
-	}
-	return -1;
-}
-
-/**
- * Copies at most n bytes, the result is always 0 terminated
- */
-char * pblCgiStrNCpy(char *dest, char *string, size_t n)
-{
-	char * ptr = dest;
-	while (--n && (*ptr++ = *string++))
-		;
-
-	if (*ptr)
-	{
-		*ptr = '\0';
-	}
-	return dest;
-}
-
-static char * pblCgiStrTrimStart(char * string)
-{
-	for (; *string; string++)
-	{
-		if (!isspace(*string))
-		{
-			return string;
-		}
-	}
-	return string;
-}
-
-static void pblCgiStrTrimEnd(char * string)
-{
-	if (!string)
-	{
-		return;
-	}
-
-	char * ptr = (string + strlen(string)) - 1;
-	while (ptr >= string)
-	{
-		if (isspace(*ptr))
-		{
-			*ptr-- = '\0';
-		}
-		else
-		{
-			return;
-		}
-	}
-}
-
-/**
- * Trim the string, remove blanks at start and end.
- */
-char * pblCgiStrTrim(char * string)
-{
-	pblCgiStrTrimEnd(string);
-	return pblCgiStrTrimStart(string);
-}
-
-/**
- * Test if a string is NULL or white space only
- */
-int pblCgiStrIsNullOrWhiteSpace(char * string)
-{
-	if (string)
-	{
-		for (; *string; string++)
-		{
-			if (!isspace(*string))
-			{
-				return 0;
-			}
-		}
-	}
-	return 1;
-}
-
-char * pblCgiStrRangeDup(char * start, char * end)
-{
-	static char * tag = "pblCgiStrRangeDup";
-
-	start = pblCgiStrTrimStart(start);
-	int length = end - start;
-	if (length > 0)
-	{
-		char * value = pbl_memdup(tag, start, length + 1);
-		if (!value)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-		value[length] = '\0';
-		pblCgiStrTrimEnd(value);
-		return value;
-	}
-	return pblCgiStrDup("");
-}
-
-/**
- * String equals, handles NULLs.
- */
-int pblCgiStrEquals(char * s1, char * s2)
-{
-	return !pblCgiStrCmp(s1, s2);
-}
-
-/**
- * Like strcmp, handles NULLs.
- */
-int pblCgiStrCmp(char * s1, char * s2)
-{
-	if (!s1)
-	{
-		if (!s2)
-		{
-			return 0;
-		}
-		return -1;
-	}
-	if (!s2)
-	{
-		return 1;
-	}
-	return strcmp(s1, s2);
-}
-
-/**
- * Like strdup.
- *
- * If an error occurs, the program exits with an error message.
- */
-char * pblCgiStrDup(char * string)
-{
-	static char * tag = "pblCgiStrDup";
-
-	if (!string)
-	{
-		string = "";
-	}
-	string = pbl_strdup(tag, string);
-	if (!string)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-	return string;
-}
-
-/**
- * Like strcat, but the memory for the target is allocated.
- *
- * If an error occurs, the program exits with an error message.
- */
-char * pblCgiStrCat(char * s1, char * s2)
-{
-	static char * tag = "pblCgiStrCat";
-	char * result = NULL;
-	size_t len1 = 0;
-	size_t len2 = 0;
-
-	if (!s1 || !(*s1))
-	{
-		if (!s2 || !(*s2))
-		{
-			return pblCgiStrDup("");
-		}
-		return pblCgiStrDup(s2);
-	}
-
-	if (!s2 || !(*s2))
-	{
-		return pblCgiStrDup(s1);
-	}
-
-	len1 = strlen(s1);
-	len2 = strlen(s2);
-	result = pblCgiMalloc(tag, len1 + len2 + 1);
-
-	memcpy(result, s1, len1);
-	memcpy(result + len1, s2, len2 + 1);
-	return result;
-}
-
-/*
- * Replace the oldValue with newValue. The result is a malloced string.
- */
-char * pblCgiStrReplace(char * string, char * oldValue, char * newValue)
-{
-	char * tag = "pblCgiStrReplace";
-	char * ptr = string;
-	int length = strlen(oldValue);
-
-	PblStringBuilder * stringBuilder = pblStringBuilderNew();
-	if (!stringBuilder)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-
-	for (;;)
-	{
-		char * ptr2 = strstr(ptr, oldValue);
-		if (!ptr2)
-		{
-			if (pblStringBuilderAppendStr(stringBuilder, ptr) == ((size_t)-1))
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-			break;
-		}
-
-		if (ptr2 > ptr)
-		{
-			if (pblStringBuilderAppendStrN(stringBuilder, ptr2 - ptr, ptr) == ((size_t)-1))
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-		}
-
-		if (pblStringBuilderAppendStr(stringBuilder, newValue) == ((size_t)-1))
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-		ptr = ptr2 + length;
-	}
-
-	char * result = pblStringBuilderToString(stringBuilder);
-	if (!result)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-	pblStringBuilderFree(stringBuilder);
-	return result;
-}
-
-/**
- * Return a malloced time string.
- *
- * If an error occurs, the program exits with an error message.
- */
-char * pblCgiStrFromTime(time_t t)
-{
-	return pblCgiStrFromTimeAndFormat(t, "%02d.%02d.%02d %02d:%02d:%02d");
-}
-
-/**
-* Return a malloced time string.
-*
-* If an error occurs, the program exits with an error message.
-*/
-char * pblCgiStrFromTimeAndFormat(time_t t, char * format)
-{
-	struct tm *tm;
-
-#ifdef _WIN32
-
-	struct tm windowsTm;
-	tm = &windowsTm;
-	localtime_s(tm, (time_t *) &(t));
-
-#else
-
-	tm = localtime((time_t *) &(t));
-
-#endif
-	return pblCgiSprintf(format, (tm->tm_year + 1900) % 100, tm->tm_mon + 1, tm->tm_mday,
-		tm->tm_hour, tm->tm_min, tm->tm_sec);
-}
-
-/**
- * Like split.
- *
- * If an error occurs, the program exits with an error message.
- *
- * The results should be defined as:
- *
- * 	char * results[size + 1];
- */
-int pblCgiStrSplit(char * string, char * splitString, size_t size, char * results[])
-{
-	unsigned int index = 0;
-	if (size < 1)
-	{
-		return index;
-	}
-
-	size_t length = strlen(splitString);
-	results[0] = NULL;
-
-	char * ptr = string;
-
-	for (;;)
-	{
-		if (index > size - 1)
-		{
-			return index;
-		}
-
-		char * ptr2 = strstr(ptr, splitString);
-		if (!ptr2)
-		{
-			char * value = pblCgiStrDup(ptr);
-			results[index] = pblCgiStrDup(pblCgiStrTrim(value));
-			results[++index] = NULL;
-			PBL_FREE(value);
-
-			return index;
-		}
-		char * value = pblCgiStrRangeDup(ptr, ptr2);
-		results[index] = pblCgiStrDup(pblCgiStrTrim(value));
-		results[++index] = NULL;
-		PBL_FREE(value);
-
-		ptr = ptr2 + length;
-	}
-	return index;
-}
-
-/**
-* Split a string to a list.
-*/
-PblList * pblCgiStrSplitToList(char * string, char * splitString)
-{
-	static char * tag = "pblCgiSplitToList";
-	PblList * list = pblListNewArrayList();
-	if (!list)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-
-	size_t length = strlen(splitString);
-	char * ptr = string;
-
-	for (;;)
-	{
-		char * ptr2 = strstr(ptr, splitString);
-		if (!ptr2)
-		{
-			char * value = pblCgiStrDup(ptr);
-			if (pblListAdd(list, pblCgiStrDup(pblCgiStrTrim(value))) < 0)
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-			PBL_FREE(value);
-			break;
-		}
-
-		char * value = pblCgiStrRangeDup(ptr, ptr2);
-		if (pblListAdd(list, pblCgiStrDup(pblCgiStrTrim(value))) < 0)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-		PBL_FREE(value);
-		ptr = ptr2 + length;
-	}
-	return list;
-}
-
-static const char *pblCgiHexDigits = "0123456789abcdef";
-
-/**
- * Convert a buffer to a hex byte string
- *
- * If an error occurs, the program exits with an error message.
- *
- * return The malloced hex string.
- */
-char * pblCgiStrToHexFromBuffer(unsigned char * buffer, size_t length)
-{
-	static char * tag = "pblCgiStrToHexFromBuffer";
-	char * hexString = pblCgiMalloc(tag, 2 * length + 1);
-
-	unsigned char c;
-	int stringIndex = 0;
-	for (unsigned int i = 0; i < length; i++)
-	{
-		hexString[stringIndex++] = pblCgiHexDigits[((c = buffer[i]) >> 4) & 0x0f];
-		hexString[stringIndex++] = pblCgiHexDigits[c & 0x0f];
-	}
-	hexString[stringIndex] = 0;
-
-	return hexString;
-}
-
-/**
- * Get the cookie, if any is given.
- */
-char * pblCgiGetCoockie(char * cookieKey, char * cookieTag)
-{
-	char * cookie = pblCgiStrDup(pblCgiGetEnv("HTTP_COOKIE"));
-	if (cookie && *cookie)
-	{
-		cookie = strstr(cookie, cookieTag);
-		if (cookie)
-		{
-			cookie += strlen(cookieTag);
-		}
-	}
-	else
-	{
-		cookie = pblCgiQueryValue(cookieKey);
-	}
-
-	if (!cookie || !*cookie)
-	{
-		return NULL;
-	}
-	for (char * ptr = cookie; *ptr; ptr++)
-	{
-		if (!strchr(pblCgiHexDigits, *ptr))
-		{
-			*ptr = '\0';
-			break;
-		}
-	}
-	return cookie;
-}
-
-/**
-* Like fopen, needed for Windows port
-*/
-FILE * pblCgiTryFopen(char * filePath, char * openType)
-{
-	FILE * stream;
-
-#ifdef WIN32
-
-	stream = _fsopen(filePath, openType, _SH_DENYWR);
-	if (!stream)
-	{
-		errno_t err = fopen_s(&stream, filePath, openType);
-		if (err != 0)
-		{
-			return NULL;
-		}
-	}
-
-#else
-
-	if (!(stream = fopen(filePath, openType)))
-	{
-		return NULL;
-	}
-
-#endif
-	return stream;
-}
-
-/**
-* Like fopen, needed for Windows port
-*/
-FILE * pblCgiFopen(char * filePath, char * openType)
-{
-	static char * tag = "pblCgiFopen";
-	FILE * stream = pblCgiTryFopen(filePath, openType);
-	if (stream)
-	{
-		return stream;
-	}
-
-#ifdef WIN32
-
-	stream = _fsopen(filePath, openType, _SH_DENYWR);
-	if (!stream)
-	{
-		errno_t err = fopen_s(&stream, filePath, openType);
-		if (err != 0)
-		{
-#ifdef WIN32
-			pblCgiExitOnError("%s: Cannot open file '%s', err=%d, errno=%d, cwd='%s'\n", tag,
-				filePath, err, errno, _getcwd(NULL, 1024));
-#else
-			pblCgiExitOnError("%s: Cannot open file '%s', err=%d, errno=%d\n", tag,
-				filePath, err, errno);
-#endif
-		}
-	}
-
-#else
-
-	if (!(stream = fopen(filePath, openType)))
-	{
-		pblCgiExitOnError("%s: Cannot open file '%s', errno=%d\n", tag, filePath, errno);
-	}
-
-#endif
-	return stream;
-}
-
-/**
- * Like getenv, needed for Windows port
- */
-char * pblCgiGetEnv(char * name)
-{
-#ifdef WIN32
-
-	char *value;
-	size_t len;
-	_dupenv_s(&value, &len, name);
-	return value;
-
-#else
-
-	return getenv(name);
-
-#endif
-}
-
-/**
- * Reads in GET or POST query data, converts it to non-escaped text,
- * and saves each parameter in the query map.
- *
- *  If there's no variables that indicates GET or POST, it is assumed
- *  that the CGI script was started from the command line, specifying
- *  the query string like
- *
- *      script 'key1=value1&key2=value2'
- *
- */
-void pblCgiParseQuery(int argc, char * argv[])
-{
-	static char * tag = "pblCgiParseQuery";
-	char * ptr = NULL;
-
-	pblCgiQueryString = "";
-
-	ptr = pblCgiGetEnv("REQUEST_METHOD");
-	if (!ptr || !*ptr)
-	{
-		if (argc < 2)
-		{
-			pblCgiExitOnError("%s: test usage: %s querystring\n", tag, argv[0]);
-		}
-		pblCgiQueryString = argv[1];
-	}
-	else if (!strcmp(ptr, "GET"))
-	{
-		ptr = pblCgiGetEnv("QUERY_STRING");
-		if (ptr && *ptr)
-		{
-			pblCgiQueryString = ptr;
-		}
-	}
-	else if (!strcmp(ptr, "POST"))
-	{
-		ptr = pblCgiGetEnv("QUERY_STRING");
-		if (!ptr || !*ptr)
-		{
-			pblCgiQueryString = pblCgiStrDup("");
-		}
-		else
-		{
-			pblCgiQueryString = pblCgiStrCat(ptr, "&");
-		}
-		size_t length = strlen(pblCgiQueryString);
-
-		ptr = pblCgiGetEnv("CONTENT_LENGTH");
-		if (ptr && *ptr)
-		{
-			int contentLength = atoi(ptr);
-			if (contentLength > 0)
-			{
-				if (length + contentLength >= PBL_CGI_MAX_POST_INPUT_LEN)
-				{
-					pblCgiExitOnError("%s: POST input too long, %d bytes\n", tag,
-						length + contentLength);
-				}
-
-				pblCgiQueryString = realloc(pblCgiQueryString, length + contentLength + 1);
-				if (!pblCgiQueryString)
-				{
-					pblCgiExitOnError("%s: Out of memory\n", tag);
-				}
-
-				int c;
-				ptr = pblCgiQueryString + length;
-				while (contentLength-- > 0)
-				{
-					if ((c = getchar()) == EOF)
-					{
-						break;
-					}
-					*ptr++ = c;
-				}
-				*ptr = '\0';
-			}
-		}
-	}
-	else
-	{
-		pblCgiExitOnError("%s: Unknown REQUEST_METHOD '%s'\n", tag, ptr);
-	}
-
-	PBL_CGI_TRACE("In %s", pblCgiQueryString);
-
-	char * keyValuePairs[PBL_CGI_MAX_QUERY_PARAMETERS_COUNT + 1];
-	char * keyValuePair[2 + 1];
-
-	pblCgiStrSplit(pblCgiQueryString, "&", PBL_CGI_MAX_QUERY_PARAMETERS_COUNT, keyValuePairs);
-	for (int i = 0; keyValuePairs[i]; i++)
-	{
-		pblCgiStrSplit(keyValuePairs[i], "=", 2, keyValuePair);
-		if (keyValuePair[0])
-		{
-			char * key = pblCgiDecodeQueryString(keyValuePair[0]);
-
-			if (keyValuePair[1])
-			{
-				char * value = pblCgiDecodeQueryString(keyValuePair[1]);
-				pblCgiSetQueryValue(pblCgiStrTrim(key), pblCgiStrTrim(value));
-				PBL_FREE(value);
-			}
-			else
-			{
-				pblCgiSetQueryValue(pblCgiStrTrim(key), NULL);
-			}
-			PBL_FREE(key);
-		}
-
-		PBL_FREE(keyValuePair[0]);
-		PBL_FREE(keyValuePair[1]);
-		PBL_FREE(keyValuePairs[i]);
-	}
-}
-
-static char * pblCgiReplaceLowerThan(char * string, char *ptr2)
-{
-	static char * tag = "pblCgiReplaceLowerThan";
-	char * ptr = string;
-
-	PblStringBuilder * stringBuilder = pblStringBuilderNew();
-	if (!stringBuilder)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-
-	for (int i = 0; i < 1000000; i++)
-	{
-		size_t length = ptr2 - ptr;
-		if (length > 0)
-		{
-			if (pblStringBuilderAppendStrN(stringBuilder, length, ptr) == ((size_t)-1))
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-		}
-
-		if (pblStringBuilderAppendStr(stringBuilder, "&lt;") == ((size_t)-1))
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-		ptr = ptr2 + 1;
-		ptr2 = strstr(ptr, "<");
-		if (!ptr2)
-		{
-			if (pblStringBuilderAppendStr(stringBuilder, ptr) == ((size_t)-1))
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-
-			char * result = pblStringBuilderToString(stringBuilder);
-			if (!result)
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-			pblStringBuilderFree(stringBuilder);
-			return result;
-		}
-	}
-	pblCgiExitOnError("%s: There are more than 1000000 '<' characters to be replaced in one string.\n", tag);
-	return NULL;
-}
-
-static char * pblCgiReplaceVariable(char * string, int iteration)
-{
-	static char * tag = "pblCgiReplaceVariable";
-	static char * startPattern = "<!--?";
-	static char * startPattern2 = "<?";
-
-	int startPatternLength;
-	char * endPattern;
-	int endPatternLength;
-
-	char * ptr = strchr(string, '<');
-	if (!ptr)
-	{
-		return string;
-	}
-
-	size_t length = ptr - string;
-
-	char * ptr2 = strstr(ptr, startPattern);
-	if (!ptr2)
-	{
-		ptr2 = strstr(ptr, startPattern2);
-		if (!ptr2)
-		{
-			return string;
-		}
-		else
-		{
-			startPatternLength = 2;
-			endPattern = ">";
-			endPatternLength = 1;
-		}
-	}
-	else
-	{
-		char * ptr3 = strstr(ptr, startPattern2);
-		if (ptr3 && ptr3 < ptr2)
-		{
-			ptr2 = ptr3;
-			startPatternLength = 2;
-			endPattern = ">";
-			endPatternLength = 1;
-		}
-		else
-		{
-			startPatternLength = 5;
-			endPattern = "-->";
-			endPatternLength = 3;
-		}
-	}
-
-	PblStringBuilder * stringBuilder = pblStringBuilderNew();
-	if (!stringBuilder)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-
-	if (length > 0)
-	{
-		if (pblStringBuilderAppendStrN(stringBuilder, length, string) == ((size_t)-1))
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-	}
-
-	char * result;
-
-	for (int i = 0; i < 1000000; i++)
-	{
-		length = ptr2 - ptr;
-		if (length > 0)
-		{
-			if (pblStringBuilderAppendStrN(stringBuilder, length, ptr) == ((size_t)-1))
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-		}
-
-		ptr = ptr2 + startPatternLength;
-		ptr2 = strstr(ptr, endPattern);
-		if (!ptr2)
-		{
-			result = pblStringBuilderToString(stringBuilder);
-			if (!result)
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-			pblStringBuilderFree(stringBuilder);
-			return result;
-		}
-
-		char * key = pblCgiStrRangeDup(ptr, ptr2);
-		char * value = NULL;
-		if (iteration >= 0)
-		{
-			value = pblCgiValueForIteration(key, iteration);
-		}
-		if (!value)
-		{
-			value = pblCgiValue(key);
-		}
-		PBL_FREE(key);
-
-		if (value && *value)
-		{
-			char * pointer = strstr(value, "<");
-			if (!pointer)
-			{
-				if (pblStringBuilderAppendStr(stringBuilder, value) == ((size_t)-1))
-				{
-					pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-				}
-			}
-			else
-			{
-				value = pblCgiReplaceLowerThan(value, pointer);
-				if (value && *value)
-				{
-					if (pblStringBuilderAppendStr(stringBuilder, value) == ((size_t)-1))
-					{
-						pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-					}
-				}
-				PBL_FREE(value);
-			}
-		}
-		ptr = ptr2 + endPatternLength;
-		ptr2 = strstr(ptr, startPattern);
-		if (!ptr2)
-		{
-			ptr2 = strstr(ptr, startPattern2);
-			if (!ptr2)
-			{
-				if (pblStringBuilderAppendStr(stringBuilder, ptr) == ((size_t)-1))
-				{
-					pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-				}
-				result = pblStringBuilderToString(stringBuilder);
-				if (!result)
-				{
-					pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-				}
-				pblStringBuilderFree(stringBuilder);
-				return result;
-			}
-			else
-			{
-				startPatternLength = 2;
-				endPattern = ">";
-				endPatternLength = 1;
-			}
-		}
-		else
-		{
-			char * ptr3 = strstr(ptr, startPattern2);
-			if (ptr3 && ptr3 < ptr2)
-			{
-				ptr2 = ptr3;
-				startPatternLength = 2;
-				endPattern = ">";
-				endPatternLength = 1;
-			}
-			else
-			{
-				startPatternLength = 5;
-				endPattern = "-->";
-				endPatternLength = 3;
-			}
-		}
-	}
-	pblCgiExitOnError("%s: There are more than 1000000 variables defined in one string.\n", tag);
-	return NULL;
-}
-
-static char * pblCgiPrintStr(char * string, FILE * outStream, int iteration);
-
-static char * pblCgiSkip(char * string, char * skipKey, FILE * outStream, int iteration)
-{
-	string = pblCgiReplaceVariable(string, -1);
-
-	for (;;)
-	{
-		char * ptr = strstr(string, "<!--#ENDIF");
-		if (!ptr)
-		{
-			return skipKey;
-		}
-		ptr += 10;
-
-		char *ptr2 = strstr(ptr, "-->");
-		if (ptr2)
-		{
-			char * key = pblCgiStrRangeDup(ptr, ptr2);
-			if (!strcmp(skipKey, key))
-			{
-				PBL_FREE(skipKey);
-				PBL_FREE(key);
-				return pblCgiPrintStr(ptr2 + 3, outStream, iteration);
-			}
-
-			PBL_FREE(key);
-			string = ptr2 + 3;
-			continue;
-		}
-		break;
-	}
-	return skipKey;
-}
-
-static char * pblCgiPrintStr(char * string, FILE * outStream, int iteration)
-{
-	string = pblCgiReplaceVariable(string, iteration);
-
-	for (;;)
-	{
-		char * ptr = strstr(string, "<!--#");
-		if (!ptr)
-		{
-			fputs(string, outStream);
-			return NULL;
-		}
-
-		while (string < ptr)
-		{
-			fputc(*string++, outStream);
-		}
-
-		if (!memcmp(string, "<!--#IFDEF", 10))
-		{
-			ptr += 10;
-
-			char *ptr2 = strstr(ptr, "-->");
-			if (ptr2)
-			{
-				char * key = pblCgiStrRangeDup(ptr, ptr2);
-				if (!pblCgiValue(key) && !pblCgiValueForIteration(key, iteration))
-				{
-					return pblCgiSkip(ptr2 + 1, key, outStream, iteration);
-				}
-				PBL_FREE(key);
-				string = ptr2 + 3;
-				continue;
-			}
-			return NULL;
-		}
-		if (!memcmp(string, "<!--#IFNDEF", 11))
-		{
-			ptr += 11;
-
-			char *ptr2 = strstr(ptr, "-->");
-			if (ptr2)
-			{
-				char * key = pblCgiStrRangeDup(ptr, ptr2);
-				if (pblCgiValue(key) || pblCgiValueForIteration(key, iteration))
-				{
-					return pblCgiSkip(ptr2 + 1, key, outStream, iteration);
-				}
-				PBL_FREE(key);
-				string = ptr2 + 3;
-				continue;
-			}
-			return NULL;
-		}
-		if (!memcmp(string, "<!--#ENDIF", 10))
-		{
-			ptr += 7;
-
-			char *ptr2 = strstr(ptr, "-->");
-			if (ptr2)
-			{
-				string = ptr2 + 3;
-				continue;
-			}
-			return NULL;
-		}
-		fputs(string, outStream);
-		break;
-	}
-	return NULL;
-}
-
-static char * pblCgiHandleFor(PblList * list, char * line, char * forKey)
-{
-	static char * tag = "pblCgiHandleFor";
-	char * ptr = strstr(line, "<!--#");
-	if (!ptr)
-	{
-		if (pblListAdd(list, pblCgiStrDup(line)) < 0)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-		return forKey;
-	}
-	if (!memcmp(ptr, "<!--#ENDFOR", 11))
-	{
-		if (ptr > line)
-		{
-			int length = ptr - line;
-			char * value = pbl_memdup(tag, line, length + 1);
-			if (!value)
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-			value[length] = '\0';
-
-			if (pblListAdd(list, value) < 0)
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-		}
-		ptr += 11;
-
-		char * ptr2 = strstr(ptr, "-->");
-		if (ptr2)
-		{
-			char * key = pblCgiStrRangeDup(ptr, ptr2);
-			if (!strcmp(forKey, key))
-			{
-				PBL_FREE(key);
-				return NULL;
-			}
-			PBL_FREE(key);
-		}
-	}
-	else
-	{
-		if (pblListAdd(list, pblCgiStrDup(line)) < 0)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-	}
-	return forKey;
-}
-
-static PblList * pblCgiReadFor(char * inputLine, char * forKey, FILE * stream)
-{
-	static char * tag = "pblCgiReadFor";
-	char line[PBL_CGI_MAX_LINE_LENGTH + 1];
-
-	PblList * list = pblListNewLinkedList();
-	if (!list)
-	{
-		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-	}
-
-	if (!pblCgiStrIsNullOrWhiteSpace(inputLine))
-	{
-		if (!pblCgiHandleFor(list, inputLine, forKey))
-		{
-			return list;
-		}
-	}
-
-	while ((fgets(line, sizeof(line) - 1, stream)))
-	{
-		if (!pblCgiHandleFor(list, line, forKey))
-		{
-			break;
-		}
-	}
-	return list;
-}
-
-static void pblCgiPrintFor(PblList * lines, char * forKey, FILE * outStream)
-{
-	static char * tag = "pblCgiPrintFor";
-	int hasNext;
-
-	for (unsigned long iteration = 0; 1; iteration++)
-	{
-		if (!pblCgiValueForIteration(forKey, iteration))
-		{
-			return;
-		}
-
-		char * skipKey = NULL;
-		PblIterator iteratorBuffer;
-		PblIterator * iterator = &iteratorBuffer;
-
-		if (pblIteratorInit((PblCollection *)lines, iterator) < 0)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-		while ((hasNext = pblIteratorHasNext(iterator)) > 0)
-		{
-			char * line = (char*)pblIteratorNext(iterator);
-			if (line == (void*)-1)
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-			if (line)
-			{
-				char * ptr = strstr(line, "<!--#");
-				if (!ptr)
-				{
-					if (!skipKey)
-					{
-						fputs(pblCgiReplaceVariable(line, iteration), outStream);
-					}
-					continue;
-				}
-
-				if (skipKey)
-				{
-					skipKey = pblCgiSkip(line, skipKey, outStream, iteration);
-					continue;
-				}
-				skipKey = pblCgiPrintStr(line, outStream, iteration);
-			}
-		}
-		if (hasNext < 0)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-	}
-}
-
-/**
-* Print a template
-*/
-void pblCgiPrint(char * directory, char * fileName, char * contentType)
-{
-	static char * tag = "pblCgiPrint";
-
-	PBL_CGI_TRACE("Directory=%s", directory);
-	PBL_CGI_TRACE("FileName=%s", fileName);
-	PBL_CGI_TRACE("ContentType=%s", contentType);
-
-	char * filePath = pblCgiStrCat(directory, fileName);
-	char * skipKey = NULL;
-	FILE * stream = pblCgiFopen(filePath, "r");
-	PBL_FREE(filePath);
-
-	if (contentType)
-	{
-		pblCgiSetContentType(contentType);
-	}
-
-	char line[PBL_CGI_MAX_LINE_LENGTH + 1];
-
-	while ((fgets(line, sizeof(line) - 1, stream)))
-	{
-		char * start = line;
-		char * ptr = strstr(line, "<!--#");
-		if (!ptr)
-		{
-			if (!skipKey)
-			{
-				fputs(pblCgiReplaceVariable(line, -1), stdout);
-			}
-			continue;
-		}
-
-		if (skipKey)
-		{
-			skipKey = pblCgiSkip(line, skipKey, stdout, -1);
-			continue;
-		}
-
-		if (!memcmp(ptr, "<!--#INCLUDE", 12))
-		{
-			while (start < ptr)
-			{
-				fputc(*start++, stdout);
-			}
-			ptr += 12;
-
-			char * ptr2 = strstr(ptr, "-->");
-			if (ptr2)
-			{
-				char * includeFileName = pblCgiStrRangeDup(ptr, ptr2);
-				pblCgiPrint(directory, includeFileName, NULL);
-				PBL_FREE(includeFileName);
-
-				skipKey = pblCgiPrintStr(ptr2 + 3, stdout, -1);
-			}
-			continue;
-		}
-		if (!memcmp(ptr, "<!--#FOR", 8))
-		{
-			while (start < ptr)
-			{
-				fputc(*start++, stdout);
-			}
-			ptr += 8;
-
-			char * ptr2 = strstr(ptr, "-->");
-			if (ptr2)
-			{
-				char * forKey = pblCgiStrRangeDup(ptr, ptr2);
-				PblList * lines = pblCgiReadFor(ptr2 + 3, forKey, stream);
-				if (lines)
-				{
-					pblCgiPrintFor(lines, forKey, stdout);
-					while (pblListSize(lines))
-					{
-						char * p = pblListPop(lines);
-						if ((void*)-1 == p)
-						{
-							pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-						}
-						PBL_FREE(p);
-					}
-					pblListFree(lines);
-				}
-				PBL_FREE(forKey);
-			}
-			continue;
-		}
-		while (start < ptr)
-		{
-			fputc(*start++, stdout);
-		}
-		skipKey = pblCgiPrintStr(ptr, stdout, -1);
-	}
-	fclose(stream);
-}
-
-/**
-* Create a new empty map
-*/
-PblMap * pblCgiNewMap(void)
-{
-	PblMap * map = pblMapNewHashMap();
-	if (!map)
-	{
-		pblCgiExitOnError("Failed to create a map, pbl_errno = %d\n", pbl_errno);
-	}
-	if (pblSetEnsureCapacity((PblSet *)map, 16) < 0)
-	{
-		pblCgiExitOnError("Failed to set initial capacity of map, pbl_errno = %d, message='%s'\n", pbl_errno, pbl_errstr);
-	}
-	return map;
-}
-
-/**
-* Test if a map is empty
-*/
-int pblCgiMapIsEmpty(PblMap * map)
-{
-	return 0 == pblMapSize(map);
-}
-
-/**
-* Release the memory used by a map
-*/
-void pblCgiMapFree(PblMap * map)
-{
-	if (map)
-	{
-		pblMapFree(map);
-	}
-}
-
-static PblMap * valueMap = NULL;
-
-PblMap * pblCgiValueMap()
-{
-	if (!valueMap)
-	{
-		valueMap = pblCgiNewMap();
-	}
-	return valueMap;
-}
-/**
-* Set a value for the given key.
-*/
-void pblCgiSetValue(char * key, char * value)
-{
-	pblCgiSetValueForIteration(key, value, -1);
-}
-
-/**
-* Set a value for the given key for a loop iteration.
-*/
-void pblCgiSetValueForIteration(char * key, char * value, int iteration)
-{
-	pblCgiSetValueToMap(key, value, iteration, pblCgiValueMap());
-}
-
-/**
-* Set a value for the given key for a loop iteration into a map.
-*/
-void pblCgiSetValueToMap(char * key, char * value, int iteration, PblMap * map)
-{
-	static char * tag = "pblCgiSetValueToMap";
-
-	if (!key || !*key)
-	{
-		return;
-	}
-	if (!value)
-	{
-		value = "";
-	}
-	if (iteration >= 0)
-	{
-		char * iteratedKey = pblCgiSprintf("%s_%d", key, iteration);
-
-		if (pblMapAddStrStr(map, iteratedKey, value) < 0)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-		if (map == valueMap)
-		{
-			PBL_CGI_TRACE("Out %s=%s", iteratedKey, value);
-		}
-
-		PBL_FREE(iteratedKey);
-
-		iteratedKey = pblCgiSprintf("IDX_%d", iteration);
-		char * index = pblMapGetStr(map, iteratedKey);
-		if (!index)
-		{
-			index = pblCgiSprintf("%d", iteration);
-			if (pblMapAddStrStr(map, iteratedKey, index) < 0)
-			{
-				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-			}
-			if (map == valueMap)
-			{
-				PBL_CGI_TRACE("Out %s=%s", iteratedKey, index);
-			}
-			PBL_FREE(index);
-		}
-		PBL_FREE(iteratedKey);
-	}
-	else
-	{
-		if (pblMapAddStrStr(map, key, value) < 0)
-		{
-			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
-		}
-		if (map == valueMap)
-		{
-			PBL_CGI_TRACE("Out %s=%s", key, value);
-		}
-	}
-}
-
-/**
-* Clear the value for the given key.
-*/
-void pblCgiUnSetValue(char * key)
-{
-	pblCgiUnSetValueForIteration(key, -1);
-}
-
-/**
-* Clear all values.
-*/
-void pblCgiClearValues()
-{
-	if (!valueMap)
-	{
-		return;
-	}
-
-	PBL_CGI_TRACE("Out cleared");
-	pblMapClear(valueMap);
-}
-
-/**
-* Clear the value for the given key for a loop iteration.
-*/
-void pblCgiUnSetValueForIteration(char * key, int iteration)
-{
-	if (!valueMap)
-	{
-		return;
-	}
-	pblCgiUnSetValueFromMap(key, iteration, valueMap);
-}
-
-/**
-* Clear the value for the given key for a loop iteration from a map.
-*/
-void pblCgiUnSetValueFromMap(char * key, int iteration, PblMap * map)
-{
-	if (!key || !*key)
-	{
-		return;
-	}
-
-	if (iteration >= 0)
-	{
-		char * iteratedKey = pblCgiSprintf("%s_%d", key, iteration);
-
-		pblMapUnmapStr(map, iteratedKey);
-		PBL_CGI_TRACE("Del %s=", iteratedKey);
-		PBL_FREE(iteratedKey);
-	}
-	else
-	{
-		pblMapUnmapStr(map, key);
-		PBL_CGI_TRACE("Del %s=", key);
-	}
-}
-
-/**
-* Get the value for the given key.
-*/
-char * pblCgiValue(char * key)
-{
-	return pblCgiValueForIteration(key, -1);
-}
-
-static char * pblCgiDurationKey = PBL_CGI_KEY_DURATION;
-
-/**
-* Get the value for the given key for a loop iteration.
-*/
-char * pblCgiValueForIteration(char * key, int iteration)
-{
-	if (*key && *key == *pblCgiDurationKey && !strcmp(pblCgiDurationKey, key))
-	{
-		return pblCgiValueFromMap(key, iteration, valueMap);
-	}
-
-	if (!valueMap)
-	{
-		return NULL;
-	}
-	return pblCgiValueFromMap(key, iteration, valueMap);
-}
-
-/**
-* Get the value for the given key for a loop iteration from a map.
-*/
-char * pblCgiValueFromMap(char * key, int iteration, PblMap * map)
-{
-	static char * tag = "pblCgiValueFromMap";
-
-	if (*key && *key == *pblCgiDurationKey && !strcmp(pblCgiDurationKey, key))
-	{
-		struct timeval now;
-		gettimeofday(&now, NULL);
-
-		unsigned long duration = now.tv_sec * 1000000 + now.tv_usec;
-		duration -= pblCgiStartTime.tv_sec * 1000000 + pblCgiStartTime.tv_usec;
-		char * string = pblCgiSprintf("%lu", duration);
-		PBL_CGI_TRACE("Duration=%s microseconds", string);
-		return string;
-	}
-
-	if (!key || !*key)
-	{
-		pblCgiExitOnError("%s: Empty key not allowed!\n", tag, pbl_errstr);
-	}
-	if (iteration >= 0)
-	{
-		char * iteratedKey = pblCgiSprintf("%s_%d", key, iteration);
-		char * value = pblMapGetStr(map, iteratedKey);
-		PBL_FREE(iteratedKey);
-		return value;
-	}
-	return pblMapGetStr(map, key);
-}
-
-#ifdef WIN32
-
-#define WIN32_LEAN_AND_MEAN
-#include <Windows.h>
-#include <stdint.h> // portable: uint64_t   MSVC: __int64 
-
-int gettimeofday(struct timeval * tp, struct timezone * tzp)
-{
-	// Note: some broken versions only have 8 trailing zero's, the correct epoch has 9 trailing zero's
-	// This magic number is the number of 100 nanosecond intervals since January 1, 1601 (UTC)
-	// until 00:00:00 January 1, 1970 
-	static const uint64_t EPOCH = ((uint64_t)116444736000000000ULL);
-
-	SYSTEMTIME  system_time;
-	FILETIME    file_time;
-	uint64_t    time;
-
-	GetSystemTime(&system_time);
-	SystemTimeToFileTime(&system_time, &file_time);
-	time = ((uint64_t)file_time.dwLowDateTime);
-	time += ((uint64_t)file_time.dwHighDateTime) << 32;
-
-	tp->tv_sec = (long)((time - EPOCH) / 10000000L);
-	tp->tv_usec = (long)(system_time.wMilliseconds * 1000);
-	return 0;
-}
-
-extern int getpid();
-
-#endif
+/*
+ pblCgi.c - C Common Gateway Interface functions.
+
+ Copyright (c) 2018 Peter Graf. All rights reserved.
+
+ This file is part of PBL - The Program Base Library.
+ PBL is free software.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+ For more information on the Program Base Library or Peter Graf,
+ please see: http://www.mission-base.com/.
+
+ $Log: pblCgi.c,v $
+ Revision 1.4  2019/07/13 18:41:42  peter
+ Improved handling of append
+
+ Revision 1.3  2019/02/07 21:15:35  peter
+ Cleaning up after tests of ARpoise
+
+ Revision 1.51  2019/02/07 21:11:57  peter
+ Cleaning up after tests of ARpoise
+
+ Revision 1.50  2019/01/26 15:11:14  peter
+ Multiple lines are comma separated in pblCgiFileToMap
+
+ Revision 1.49  2018/04/30 16:10:03  peter
+ Linux port
+
+ Revision 1.48  2018/04/30 14:21:40  peter
+ Added try open and time to string with format
+
+ Revision 1.47  2018/04/29 20:33:57  peter
+ Changed error message
+
+ Revision 1.46  2018/04/29 18:37:45  peter
+ Added replace method
+
+ Revision 1.45  2018/04/26 14:06:39  peter
+ Added the cookie handling
+
+ Revision 1.44  2018/04/16 14:18:00  peter
+ Improved handling of start time
+
+ Revision 1.43  2018/04/07 19:32:05  peter
+ Re-added function that is needed
+
+ Revision 1.42  2018/04/07 18:52:34  peter
+ Cleanup
+
+ Revision 1.41  2018/03/15 22:27:46  peter
+ Working on cgi tests
+
+ Revision 1.40  2018/03/11 00:23:25  peter
+ Cleanup of split to list handling
+
+ Revision 1.39  2018/03/10 21:49:21  peter
+ Integration with ArvosDirectoryService
+
+ Revision 1.38  2018/03/10 16:22:21  peter
+ More work on cgi functions
+
+ Revision 1.37  2018/02/23 23:20:24  peter
+ Started to work on the cgi code
+ */
+
+ /*
+  * Make sure "strings <exe> | grep Id | sort -u" shows the source file versions
+  */
+char* pblCgi_c_id = "$Id: pblCgi.c,v 1.4 2019/07/13 18:41:42 peter Exp $";
+
+#include <stdio.h>
+#include <memory.h>
+
+#ifndef __APPLE__
+#include <malloc.h>
+#endif
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <process.h>
+#else
+#include <sys/uio.h>
+#endif
+
+#include "pbl.h"
+#include "pblCgi.h"
+
+/*****************************************************************************/
+/* #defines                                                                  */
+/*****************************************************************************/
+#define PBL_CGI_MAX_SIZE_OF_BUFFER_ON_STACK		(64 * 1024)
+#define PBL_CGI_MAX_POST_INPUT_LEN				(1024 * 1024)
+#define PBL_CGI_MAX_POST_STREAM_LEN				(256 * 1024 * 1024)
+#define PBL_CGI_MAX_POST_PARAMETER_LEN			(1024 * 1024)
+#define PBL_CGI_POST_CHUNK_SIZE					(64 * 1024)
+#define PBL_CGI_SPRINTF_BUFFER_SIZE				256
+#define PBL_CGI_SPRINTF_MAX_CONVERSIONS			16
+#define PBL_CGI_MAX_INCLUDE_DEPTH				16
+#define PBL_CGI_MAX_OUTPUT_VECTORS				256
+#define PBL_CGI_MAX_ITERATED_KEY_LENGTH			256
+
+#define PBL_CGI_TEMPLATE_LITERAL				1
+#define PBL_CGI_TEMPLATE_VALUE					2
+#define PBL_CGI_TEMPLATE_IFDEF					3
+#define PBL_CGI_TEMPLATE_IFNDEF					4
+#define PBL_CGI_TEMPLATE_ENDIF					5
+#define PBL_CGI_TEMPLATE_INCLUDE				6
+#define PBL_CGI_TEMPLATE_FOR					7
+#define PBL_CGI_TEMPLATE_ENDFOR					8
+
+/*****************************************************************************/
+/* Variables                                                                 */
+/*****************************************************************************/
+
+PblMap * pblCgiConfigMap = NULL;
+
+/*
+* If set, configuration values are looked up by this function instead of in pblCgiConfigMap,
+* for applications keeping their configuration in a form of their own.
+*/
+char * (*pblCgiConfigLookup)(char * key) = NULL;
+
+struct timeval pblCgiStartTime;
+
+FILE * pblCgiTraceFile = NULL;
+char * pblCgiQueryString = NULL;
+
+char * pblCgiCookieKey = PBL_CGI_COOKIE;
+char * pblCgiCookieTag = PBL_CGI_COOKIE "=";
+
+static char * pblCgiMalloc(char * tag, size_t size)
+{
+	char * result = pbl_malloc(tag, size);
+	if (!result)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	return result;
+}
+
+static void * pblCgiGrowArray(char * tag, void * array, int * capacity, int count, size_t elementSize)
+{
+	if (count < *capacity)
+	{
+		return array;
+	}
+	int newCapacity = *capacity ? 2 * *capacity : 16;
+	void * newArray = pblCgiMalloc(tag, newCapacity * elementSize);
+	if (count > 0)
+	{
+		memcpy(newArray, array, count * elementSize);
+	}
+	PBL_FREE(array);
+	*capacity = newCapacity;
+	return newArray;
+}
+
+/*
+* The output to stdout is gathered as vectors pointing to the bytes written and written with writev
+* when the vectors are full or the output is flushed. The bytes are not copied.
+*/
+#ifdef WIN32
+typedef struct PblCgiOutputVector
+{
+	void * iov_base;
+	size_t iov_len;
+} PblCgiOutputVector;
+#else
+typedef struct iovec PblCgiOutputVector;
+#endif
+
+typedef struct PblCgiOutput
+{
+	PblCgiOutputVector vectors[PBL_CGI_MAX_OUTPUT_VECTORS];
+	int count;
+} PblCgiOutput;
+
+static PblCgiOutput pblCgiStdout;
+
+static void pblCgiOutputFlush(PblCgiOutput * output)
+{
+	PblCgiOutputVector * vector = output->vectors;
+	int count = output->count;
+	output->count = 0;
+
+	fflush(stdout);
+
+#ifdef WIN32
+
+	for (int i = 0; i < count; i++)
+	{
+		fwrite(vector[i].iov_base, 1, vector[i].iov_len, stdout);
+	}
+
+#else
+
+	while (count > 0)
+	{
+		ssize_t written = writev(STDOUT_FILENO, vector, count);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return;
+		}
+		while (count > 0 && (size_t)written >= vector->iov_len)
+		{
+			written -= vector->iov_len;
+			vector++;
+			count--;
+		}
+		if (count > 0)
+		{
+			vector->iov_base = (char*)vector->iov_base + written;
+			vector->iov_len -= written;
+		}
+	}
+
+#endif
+}
+
+static void pblCgiOutputAppend(PblCgiOutput * output, char * text, size_t length)
+{
+	if (length == 0)
+	{
+		return;
+	}
+	if (output->count == PBL_CGI_MAX_OUTPUT_VECTORS)
+	{
+		pblCgiOutputFlush(output);
+	}
+	output->vectors[output->count].iov_base = text;
+	output->vectors[output->count++].iov_len = length;
+}
+
+/**
+* Gather bytes for stdout, they must not change before the output is flushed.
+*/
+void pblCgiPut(char * data, size_t length)
+{
+	pblCgiOutputAppend(&pblCgiStdout, data, length);
+}
+
+/**
+* Gather a string for stdout, it must not change before the output is flushed.
+*/
+void pblCgiPutString(char * string)
+{
+	pblCgiOutputAppend(&pblCgiStdout, string, strlen(string));
+}
+
+/**
+* Write the output gathered for stdout.
+*/
+void pblCgiPutFlush(void)
+{
+	pblCgiOutputFlush(&pblCgiStdout);
+}
+
+static char * contentType = NULL;
+static void pblCgiSetContentType(char * type)
+{
+	if (!contentType)
+	{
+		char * cookie = pblCgiValue(PBL_CGI_COOKIE);
+		char * cookiePath = pblCgiValue(PBL_CGI_COOKIE_PATH);
+		char * cookieDomain = pblCgiValue(PBL_CGI_COOKIE_DOMAIN);
+
+		contentType = type;
+
+		pblCgiPutString("Content-Type: ");
+		pblCgiPutString(contentType);
+		PBL_CGI_TRACE("Content-Type: %s\n", contentType);
+
+		if (cookie && cookiePath && cookieDomain)
+		{
+			pblCgiPutString("\nSet-Cookie: ");
+			pblCgiPutString(pblCgiCookieTag);
+			pblCgiPutString(cookie);
+			pblCgiPutString("; Path=");
+			pblCgiPutString(cookiePath);
+			pblCgiPutString("; DOMAIN=");
+			pblCgiPutString(cookieDomain);
+			pblCgiPutString("; HttpOnly");
+			PBL_CGI_TRACE("Set-Cookie: %s%s; Path=%s; DOMAIN=%s; HttpOnly\n\n", pblCgiCookieTag, cookie, cookiePath, cookieDomain);
+		}
+		pblCgiPutString("\n\n");
+	}
+}
+
+/*
+* Decode a key or a value of the query in place and trim it, decoding never makes a string longer.
+*/
+static char * pblCgiDecodeQueryStringInPlace(char * string)
+{
+	string[pblCgiKernelDecode(string, string, strlen(string))] = '\0';
+	return pblCgiStrTrim(string);
+}
+
+/**
+* Reads a two column file into a string map.
+*
+* The format is
+*
+*   # Comment
+*   key   value
+*
+*   If the parameter map is NULL, a new string map is created.
+*   The pointer to the map used is returned.
+*
+* @return PblMap * retPtr != NULL: The pointer to the map.
+*/
+PblMap * pblCgiFileToMap(PblMap * map, char * filePath)
+{
+	static char * tag = "pblCgiFileToMap";
+
+	if (!map)
+	{
+		map = pblCgiNewMap();
+	}
+
+	FILE * stream = pblCgiFopen(filePath, "r");
+	char line[PBL_CGI_MAX_LINE_LENGTH + 1];
+
+	while (fgets(line, sizeof(line) - 1, stream))
+	{
+		char * ptr = line;
+
+		while (isspace(*ptr))
+		{
+			ptr++;
+		}
+
+		if (!*ptr || *ptr == '#')
+		{
+			continue;
+		}
+
+		char * key = ptr;
+		while (*ptr && !isspace(*ptr))
+		{
+			ptr++;
+		}
+
+		if (*ptr)
+		{
+			*ptr++ = '\0';
+		}
+
+		char * value = pblCgiStrTrim(ptr);
+
+		if (pblMapGetStr(map, key))
+		{
+			// Multiple lines are comma separated
+			char * newValue = pbl_mem2dup(NULL, ", ", 2, value, strlen(value) + 1);
+			int rc = pblMapAppendStrStr(map, key, newValue);
+			PBL_FREE(newValue)
+			if (rc < 0)
+			{
+				pblCgiExitOnError("%s: Failed to append a string, pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+			}
+		}
+ 		else if (pblMapAddStrStr(map, key, value) < 0)
+		{
+			pblCgiExitOnError("%s: Failed to append a string, pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+	}
+	fclose(stream);
+
+	return map;
+}
+
+/**
+* Get the value given for the key in the configuration.
+*/
+char * pblCgiConfigValue(char * key, char * defaultValue)
+{
+	static char * tag = "pblCgiConfigValue";
+
+	if (!pblCgiConfigMap && !pblCgiConfigLookup)
+	{
+		pblCgiExitOnError("%s: The cgi-configuration file was never read!\n", tag);
+	}
+	if (!key || !*key)
+	{
+		pblCgiExitOnError("%s: Empty key not allowed in cgi-configuration file!\n", tag);
+	}
+	char * value = pblCgiConfigLookup ? pblCgiConfigLookup(key) : pblMapGetStr(pblCgiConfigMap, key);
+	if (!value)
+	{
+		return defaultValue;
+	}
+	return value;
+}
+
+void pblCgiInitTrace(struct timeval * startTime, char * traceFilePath)
+{
+	pblCgiStartTime = *startTime;
+
+	if (traceFilePath && *traceFilePath)
+	{
+		FILE * stream;
+
+#ifdef WIN32
+		errno_t err = fopen_s(&stream, traceFilePath, "r");
+		if (err != 0)
+		{
+			return;
+		}
+#else
+		if (!(stream = fopen(traceFilePath, "r")))
+		{
+			return;
+		}
+#endif
+
+		fclose(stream);
+
+		pblCgiTraceFile = pblCgiFopen(traceFilePath, "ab");
+		setvbuf(pblCgiTraceFile, NULL, _IONBF, 0);
+		atexit(pblCgiTraceFlush);
+		PBL_CGI_TRACE("----------------------------------------> Started");
+
+		// The environment is only traced if TraceEnvironment is 1 in the configuration
+		if ((pblCgiConfigMap || pblCgiConfigLookup)
+			&& pblCgiStrEquals("1", pblCgiConfigValue(PBL_CGI_TRACE_ENVIRONMENT, "0")))
+		{
+			extern char **environ;
+			char ** envp = environ;
+
+			while (envp && *envp)
+			{
+				PBL_CGI_TRACE("ENV %s", *envp++);
+			}
+		}
+	}
+}
+
+/*
+* The parameters of the query.
+*
+* The query is decoded in place into one buffer, the keys and values of the parameters point into it.
+* An open addressing hash table of the keys makes looking up a value one probe in general.
+*/
+typedef struct PblCgiQueryParameter
+{
+	char * key;
+	char * value;
+	size_t keyLength;
+	unsigned int hash;
+} PblCgiQueryParameter;
+
+static PblCgiQueryParameter * queryParameters = NULL;
+static int queryParametersCount = 0;
+static int * querySlots = NULL; /* index of a parameter plus one, 0 for a free slot */
+static unsigned int querySlotsMask = 0;
+
+static unsigned int pblCgiQueryHash(char * key, size_t keyLength)
+{
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < keyLength; i++)
+	{
+		hash = (hash ^ (unsigned char)key[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/*
+* Find the slot of a key, the slot is free if the key is not in the query.
+*/
+static int * pblCgiQuerySlot(char * key, size_t keyLength, unsigned int hash)
+{
+	unsigned int i = hash & querySlotsMask;
+	for (; querySlots[i]; i = (i + 1) & querySlotsMask)
+	{
+		PblCgiQueryParameter * parameter = queryParameters + querySlots[i] - 1;
+		if (parameter->hash == hash && parameter->keyLength == keyLength && !memcmp(parameter->key, key, keyLength))
+		{
+			break;
+		}
+	}
+	return querySlots + i;
+}
+
+static void pblCgiSetQueryValue(char * key, char * value)
+{
+	if (!key || !*key)
+	{
+		return;
+	}
+	if (!value)
+	{
+		value = "";
+	}
+
+	// A key given more than once has the last value given
+	size_t keyLength = strlen(key);
+	unsigned int hash = pblCgiQueryHash(key, keyLength);
+	int * slot = pblCgiQuerySlot(key, keyLength, hash);
+	if (*slot)
+	{
+		queryParameters[*slot - 1].value = value;
+	}
+	else
+	{
+		PblCgiQueryParameter * parameter = queryParameters + queryParametersCount++;
+		parameter->key = key;
+		parameter->value = value;
+		parameter->keyLength = keyLength;
+		parameter->hash = hash;
+		*slot = queryParametersCount;
+	}
+	PBL_CGI_TRACE("In %s=%s", key, value);
+}
+
+/*
+* Format the key of a value for a loop iteration into the buffer given, allocates the key if the buffer is too small.
+*/
+static char * pblCgiIteratedKey(char * buffer, size_t size, char * key, int iteration)
+{
+	size_t length = strlen(key);
+	if (length + 1 + PBL_CGI_INT_STRING_SIZE > size)
+	{
+		char number[PBL_CGI_INT_STRING_SIZE];
+		return pblCgiStrConcat(key, "_", pblCgiIntToStr(number, iteration), NULL);
+	}
+	memcpy(buffer, key, length);
+	buffer[length] = '_';
+	pblCgiIntToStr(buffer + length + 1, iteration);
+	return buffer;
+}
+
+/**
+* Get the value for an iteration given for the key in the query.
+*/
+char * pblCgiQueryValueForIteration(char * key, int iteration)
+{
+	static char * tag = "pblCgiQueryValueForIteration";
+
+	if (!queryParameters)
+	{
+		return "";
+	}
+	if (!key || !*key)
+	{
+		pblCgiExitOnError("%s: Empty key not allowed!\n", tag, pbl_errstr);
+	}
+	if (iteration >= 0)
+	{
+		char buffer[PBL_CGI_MAX_ITERATED_KEY_LENGTH];
+		char * iteratedKey = pblCgiIteratedKey(buffer, sizeof(buffer), key, iteration);
+		char * value = pblCgiQueryValueForIteration(iteratedKey, -1);
+		if (iteratedKey != buffer)
+		{
+			PBL_FREE(iteratedKey);
+		}
+		return value;
+	}
+	size_t keyLength = strlen(key);
+	int * slot = pblCgiQuerySlot(key, keyLength, pblCgiQueryHash(key, keyLength));
+	return *slot ? queryParameters[*slot - 1].value : "";
+}
+
+/**
+* Get the value given for the key in the query.
+*/
+char * pblCgiQueryValue(char * key)
+{
+	return pblCgiQueryValueForIteration(key, -1);
+}
+
+/*
+* Trace records are collected in a buffer of the process and written with one write when the buffer is full,
+* when pblCgiTraceFlush is called and at exit. Each write is a chunk starting with a header giving the process id.
+*
+* The first time a format is traced by a process, a record defining an id for it is added.
+* A trace record is the time in nanoseconds, the id of the format and the arguments in binary,
+* formatting them is left to pblCgiTraceDecode.
+*/
+#define PBL_CGI_TRACE_MAGIC						"PBLT"
+#define PBL_CGI_TRACE_VERSION					1
+#define PBL_CGI_TRACE_HEADER_SIZE				16
+#define PBL_CGI_TRACE_BUFFER_SIZE				(256 * 1024)
+#define PBL_CGI_TRACE_CAPACITY					(PBL_CGI_TRACE_BUFFER_SIZE - PBL_CGI_TRACE_HEADER_SIZE)
+#define PBL_CGI_TRACE_MAX_FORMATS				4096 /* a power of 2 */
+#define PBL_CGI_TRACE_RECORD_HEADER_SIZE		8
+
+#define PBL_CGI_TRACE_RECORD_FORMAT				1
+#define PBL_CGI_TRACE_RECORD_EVENT				2
+#define PBL_CGI_TRACE_RECORD_TEXT				3
+
+#define PBL_CGI_TRACE_ARG_NONE					0
+#define PBL_CGI_TRACE_ARG_INT					1
+#define PBL_CGI_TRACE_ARG_UINT					2
+#define PBL_CGI_TRACE_ARG_DOUBLE				3
+#define PBL_CGI_TRACE_ARG_STRING				4
+#define PBL_CGI_TRACE_ARG_POINTER				5
+#define PBL_CGI_TRACE_ARG_COUNT					6
+#define PBL_CGI_TRACE_ARG_INVALID				7
+
+typedef struct PblCgiTraceFormat
+{
+	const char * format;
+	unsigned short id;
+	unsigned char isText;       /* the format has a conversion not known, it is traced as text */
+} PblCgiTraceFormat;
+
+typedef struct PblCgiTraceConversion
+{
+	const char * start;         /* the '%' */
+	const char * lengthStart;   /* the length modifier */
+	const char * lengthEnd;
+	int nStars;
+	int precision;              /* -1 if not given, -2 if given as argument */
+	int type;
+} PblCgiTraceConversion;
+
+static char pblCgiTraceBuffer[PBL_CGI_TRACE_BUFFER_SIZE];
+static size_t pblCgiTraceLength = 0; /* length of the complete records in the buffer */
+static int pblCgiTracePid = 0;      /* the process the buffer and the format ids belong to */
+static PblCgiTraceFormat pblCgiTraceFormats[PBL_CGI_TRACE_MAX_FORMATS];
+static int pblCgiTraceNFormats = 0;
+
+static int pblCgiGetPid()
+{
+#ifdef _WIN32
+	return _getpid();
+#else
+	return getpid();
+#endif
+}
+
+/*
+* Parse the conversion specification starting at ptr, returns the character following it.
+*/
+static const char * pblCgiTraceParseConversion(const char * ptr, PblCgiTraceConversion * conversion)
+{
+	conversion->start = ptr++;
+	conversion->nStars = 0;
+	conversion->precision = -1;
+
+	ptr += strspn(ptr, "-+ #0'");
+	if (*ptr == '*')
+	{
+		conversion->nStars++;
+		ptr++;
+	}
+	else
+	{
+		ptr += strspn(ptr, "0123456789");
+	}
+	if (*ptr == '.')
+	{
+		if (*++ptr == '*')
+		{
+			conversion->nStars++;
+			conversion->precision = -2;
+			ptr++;
+		}
+		else
+		{
+			conversion->precision = atoi(ptr);
+			ptr += strspn(ptr, "0123456789");
+		}
+	}
+	conversion->lengthStart = ptr;
+	ptr += strspn(ptr, "hlLqjzt");
+	conversion->lengthEnd = ptr;
+
+	switch (*ptr)
+	{
+	case '%':
+		conversion->type = PBL_CGI_TRACE_ARG_NONE;
+		break;
+	case 'd':
+	case 'i':
+	case 'c':
+		conversion->type = PBL_CGI_TRACE_ARG_INT;
+		break;
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		conversion->type = PBL_CGI_TRACE_ARG_UINT;
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		conversion->type = PBL_CGI_TRACE_ARG_DOUBLE;
+		break;
+	case 's':
+		conversion->type = PBL_CGI_TRACE_ARG_STRING;
+		break;
+	case 'p':
+		conversion->type = PBL_CGI_TRACE_ARG_POINTER;
+		break;
+	case 'n':
+		conversion->type = PBL_CGI_TRACE_ARG_COUNT;
+		break;
+	default:
+		conversion->type = PBL_CGI_TRACE_ARG_INVALID;
+		return ptr;
+	}
+	if (conversion->lengthEnd - conversion->lengthStart > 2
+		|| ((*ptr == 'c' || *ptr == 's') && conversion->lengthEnd > conversion->lengthStart))
+	{
+		// wide characters and strings are not supported
+		conversion->type = PBL_CGI_TRACE_ARG_INVALID;
+	}
+	return ptr + 1;
+}
+
+static int pblCgiTraceLengthIs(PblCgiTraceConversion * conversion, char * length)
+{
+	size_t n = strlen(length);
+	return (size_t)(conversion->lengthEnd - conversion->lengthStart) == n && !strncmp(conversion->lengthStart, length, n);
+}
+
+/**
+* Write the trace records buffered by the process.
+*
+* Call it before forking, the records buffered are discarded by a child process.
+*/
+void pblCgiTraceFlush(void)
+{
+	if (!pblCgiTraceFile || !pblCgiTraceLength)
+	{
+		return;
+	}
+	if (pblCgiTracePid != pblCgiGetPid())
+	{
+		pblCgiTraceLength = 0;
+		return;
+	}
+
+	unsigned int header[3] = { PBL_CGI_TRACE_VERSION, (unsigned int)pblCgiTracePid, (unsigned int)pblCgiTraceLength };
+	memcpy(pblCgiTraceBuffer, PBL_CGI_TRACE_MAGIC, 4);
+	memcpy(pblCgiTraceBuffer + 4, header, sizeof(header));
+
+	// the trace file is not buffered, the chunk is written at once, so that chunks of concurrent processes do not mix
+	fwrite(pblCgiTraceBuffer, 1, PBL_CGI_TRACE_HEADER_SIZE + pblCgiTraceLength, pblCgiTraceFile);
+	pblCgiTraceLength = 0;
+}
+
+/*
+* Make room for n more bytes of the record being added, it has recordLength bytes so far.
+*
+* Returns NULL if the record does not fit into the buffer.
+*/
+static char * pblCgiTraceSpace(size_t recordLength, size_t n)
+{
+	char * records = pblCgiTraceBuffer + PBL_CGI_TRACE_HEADER_SIZE;
+	if (pblCgiTraceLength + recordLength + n > PBL_CGI_TRACE_CAPACITY)
+	{
+		if (recordLength + n > PBL_CGI_TRACE_CAPACITY)
+		{
+			return NULL;
+		}
+		size_t length = pblCgiTraceLength;
+		pblCgiTraceFlush();
+		memmove(records, records + length, recordLength);
+	}
+	return records + pblCgiTraceLength + recordLength;
+}
+
+static int pblCgiTracePut(size_t * recordLength, const void * data, size_t n)
+{
+	char * ptr = pblCgiTraceSpace(*recordLength, n);
+	if (!ptr)
+	{
+		return -1;
+	}
+	memcpy(ptr, data, n);
+	*recordLength += n;
+	return 0;
+}
+
+static int pblCgiTracePutInteger(size_t * recordLength, long long value)
+{
+	return pblCgiTracePut(recordLength, &value, sizeof(value));
+}
+
+static int pblCgiTracePutString(size_t * recordLength, const char * string, size_t length)
+{
+	// as the text trace did, values are truncated to the buffer size on the stack
+	if (length > PBL_CGI_MAX_SIZE_OF_BUFFER_ON_STACK)
+	{
+		length = PBL_CGI_MAX_SIZE_OF_BUFFER_ON_STACK;
+	}
+	unsigned int stringLength = (unsigned int)length;
+	if (pblCgiTracePut(recordLength, &stringLength, sizeof(stringLength)))
+	{
+		return -1;
+	}
+	return pblCgiTracePut(recordLength, string, length);
+}
+
+/*
+* Start a record, returns its length so far.
+*/
+static size_t pblCgiTraceStartRecord(unsigned short type, unsigned short id)
+{
+	size_t recordLength = 0;
+	unsigned int length = 0;
+	pblCgiTracePut(&recordLength, &length, sizeof(length));
+	pblCgiTracePut(&recordLength, &type, sizeof(type));
+	pblCgiTracePut(&recordLength, &id, sizeof(id));
+	return recordLength;
+}
+
+static void pblCgiTraceEndRecord(size_t recordLength)
+{
+	unsigned int length = (unsigned int)recordLength;
+	memcpy(pblCgiTraceBuffer + PBL_CGI_TRACE_HEADER_SIZE + pblCgiTraceLength, &length, sizeof(length));
+	pblCgiTraceLength += recordLength;
+}
+
+static long long pblCgiTraceNow()
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000000000LL + now.tv_usec * 1000LL;
+}
+
+/*
+* Find the format in the formats of the process, define it if it is new.
+*
+* Returns NULL if there are too many formats.
+*/
+static PblCgiTraceFormat * pblCgiTraceFindFormat(const char * format)
+{
+	size_t index = ((size_t)format >> 3) * 2654435761u;
+	for (int i = 0; i < PBL_CGI_TRACE_MAX_FORMATS; i++)
+	{
+		PblCgiTraceFormat * traceFormat = &pblCgiTraceFormats[(index + i) & (PBL_CGI_TRACE_MAX_FORMATS - 1)];
+		if (traceFormat->format == format)
+		{
+			return traceFormat;
+		}
+		if (traceFormat->format)
+		{
+			continue;
+		}
+		if (pblCgiTraceNFormats >= PBL_CGI_TRACE_MAX_FORMATS / 2)
+		{
+			return NULL;
+		}
+
+		traceFormat->format = format;
+		traceFormat->id = (unsigned short)++pblCgiTraceNFormats;
+		for (const char * ptr = format; (ptr = strchr(ptr, '%'));)
+		{
+			PblCgiTraceConversion conversion;
+			ptr = pblCgiTraceParseConversion(ptr, &conversion);
+			if (conversion.type == PBL_CGI_TRACE_ARG_INVALID)
+			{
+				traceFormat->isText = 1;
+				return traceFormat;
+			}
+		}
+
+		size_t recordLength = pblCgiTraceStartRecord(PBL_CGI_TRACE_RECORD_FORMAT, traceFormat->id);
+		if (pblCgiTracePutString(&recordLength, format, strlen(format)))
+		{
+			traceFormat->isText = 1;
+			return traceFormat;
+		}
+		pblCgiTraceEndRecord(recordLength);
+		return traceFormat;
+	}
+	return NULL;
+}
+
+/*
+* Add a record with the arguments of the format, returns -1 if they do not fit into the buffer.
+*/
+static int pblCgiTraceEvent(PblCgiTraceFormat * traceFormat, va_list args)
+{
+	size_t recordLength = pblCgiTraceStartRecord(PBL_CGI_TRACE_RECORD_EVENT, traceFormat->id);
+	if (pblCgiTracePutInteger(&recordLength, pblCgiTraceNow()))
+	{
+		return -1;
+	}
+
+	for (const char * ptr = traceFormat->format; (ptr = strchr(ptr, '%'));)
+	{
+		PblCgiTraceConversion conversion;
+		ptr = pblCgiTraceParseConversion(ptr, &conversion);
+
+		int precision = conversion.precision;
+		for (int i = 0; i < conversion.nStars; i++)
+		{
+			int value = va_arg(args, int);
+			if (pblCgiTracePutInteger(&recordLength, value))
+			{
+				return -1;
+			}
+			if (conversion.precision == -2)
+			{
+				// the precision is the last of the arguments
+				precision = value;
+			}
+		}
+
+		int rc = 0;
+		switch (conversion.type)
+		{
+		case PBL_CGI_TRACE_ARG_INT:
+			if (pblCgiTraceLengthIs(&conversion, "l"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, va_arg(args, long));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "ll") || pblCgiTraceLengthIs(&conversion, "q"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, va_arg(args, long long));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "j"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, va_arg(args, intmax_t));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "z"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, (long long)va_arg(args, size_t));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "t"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, va_arg(args, ptrdiff_t));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "hh"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, (signed char)va_arg(args, int));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "h"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, (short)va_arg(args, int));
+			}
+			else
+			{
+				rc = pblCgiTracePutInteger(&recordLength, va_arg(args, int));
+			}
+			break;
+
+		case PBL_CGI_TRACE_ARG_UINT:
+			if (pblCgiTraceLengthIs(&conversion, "l"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, va_arg(args, unsigned long));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "ll") || pblCgiTraceLengthIs(&conversion, "q"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, va_arg(args, unsigned long long));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "j"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, va_arg(args, uintmax_t));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "z"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, va_arg(args, size_t));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "t"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, va_arg(args, ptrdiff_t));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "hh"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, (unsigned char)va_arg(args, unsigned int));
+			}
+			else if (pblCgiTraceLengthIs(&conversion, "h"))
+			{
+				rc = pblCgiTracePutInteger(&recordLength, (unsigned short)va_arg(args, unsigned int));
+			}
+			else
+			{
+				rc = pblCgiTracePutInteger(&recordLength, va_arg(args, unsigned int));
+			}
+			break;
+
+		case PBL_CGI_TRACE_ARG_DOUBLE:
+		{
+			double value = pblCgiTraceLengthIs(&conversion, "L") ? (double)va_arg(args, long double) : va_arg(args, double);
+			rc = pblCgiTracePut(&recordLength, &value, sizeof(value));
+			break;
+		}
+
+		case PBL_CGI_TRACE_ARG_STRING:
+		{
+			const char * value = va_arg(args, const char *);
+			if (!value)
+			{
+				value = "(null)";
+			}
+			if (precision < 0)
+			{
+				rc = pblCgiTracePutString(&recordLength, value, strlen(value));
+				break;
+			}
+
+			// only the characters printed are stored, the value does not need to be terminated
+			const char * end = memchr(value, '\0', precision);
+			rc = pblCgiTracePutString(&recordLength, value, end ? end - value : precision);
+			break;
+		}
+
+		case PBL_CGI_TRACE_ARG_POINTER:
+			rc = pblCgiTracePutInteger(&recordLength, (long long)(size_t)va_arg(args, void *));
+			break;
+
+		case PBL_CGI_TRACE_ARG_COUNT:
+			(void)va_arg(args, void *);
+			break;
+		}
+		if (rc)
+		{
+			return -1;
+		}
+	}
+	pblCgiTraceEndRecord(recordLength);
+	return 0;
+}
+
+/*
+* Add a record with the text of the trace, for formats that cannot be traced in binary.
+*/
+static void pblCgiTraceText(const char * format, va_list args)
+{
+	char buffer[PBL_CGI_MAX_SIZE_OF_BUFFER_ON_STACK + 1];
+	int rc = vsnprintf(buffer, sizeof(buffer) - 1, format, args);
+	if (rc < 0)
+	{
+		return;
+	}
+	buffer[sizeof(buffer) - 1] = '\0';
+
+	size_t recordLength = pblCgiTraceStartRecord(PBL_CGI_TRACE_RECORD_TEXT, 0);
+	if (!pblCgiTracePutInteger(&recordLength, pblCgiTraceNow()) && !pblCgiTracePutString(&recordLength, buffer, strlen(buffer)))
+	{
+		pblCgiTraceEndRecord(recordLength);
+	}
+}
+
+/**
+* Trace function
+*/
+void pblCgiTrace(const char * format, ...)
+{
+	if (!pblCgiTraceFile)
+	{
+		return;
+	}
+
+	int pid = pblCgiGetPid();
+	if (pid != pblCgiTracePid)
+	{
+		// a new process, it defines its formats again
+		pblCgiTracePid = pid;
+		pblCgiTraceLength = 0;
+		memset(pblCgiTraceFormats, 0, sizeof(pblCgiTraceFormats));
+		pblCgiTraceNFormats = 0;
+	}
+
+	PblCgiTraceFormat * traceFormat = pblCgiTraceFindFormat(format);
+
+	va_list args;
+	va_start(args, format);
+	if (!traceFormat || traceFormat->isText)
+	{
+		pblCgiTraceText(format, args);
+	}
+	else if (pblCgiTraceEvent(traceFormat, args))
+	{
+		// the arguments are too long for the buffer
+		va_end(args);
+		va_start(args, format);
+		pblCgiTraceText(format, args);
+	}
+	va_end(args);
+}
+
+/*
+* The rest of a trace record being decoded.
+*/
+typedef struct PblCgiTraceReader
+{
+	char * ptr;
+	char * end;
+} PblCgiTraceReader;
+
+static int pblCgiTraceRead(PblCgiTraceReader * reader, void * data, size_t n)
+{
+	if ((size_t)(reader->end - reader->ptr) < n)
+	{
+		return -1;
+	}
+	memcpy(data, reader->ptr, n);
+	reader->ptr += n;
+	return 0;
+}
+
+/*
+* Read a string of a trace record, the string is copied to the heap.
+*/
+static char * pblCgiTraceReadString(PblCgiTraceReader * reader)
+{
+	unsigned int length;
+	if (pblCgiTraceRead(reader, &length, sizeof(length)) || (size_t)(reader->end - reader->ptr) < length)
+	{
+		return NULL;
+	}
+	char * string = pblCgiStrRangeDup(reader->ptr, reader->ptr + length);
+	reader->ptr += length;
+	return string;
+}
+
+#define PBL_CGI_TRACE_PRINT(value) \
+	(nStars == 0 ? fprintf(out, spec, value) : \
+	 nStars == 1 ? fprintf(out, spec, stars[0], value) : fprintf(out, spec, stars[0], stars[1], value))
+
+/*
+* Print a trace record with the format it was traced with.
+*/
+static int pblCgiTracePrint(FILE * out, const char * format, PblCgiTraceReader * reader)
+{
+	for (const char * ptr = format; *ptr;)
+	{
+		const char * percent = strchr(ptr, '%');
+		if (!percent)
+		{
+			fputs(ptr, out);
+			break;
+		}
+		fwrite(ptr, 1, percent - ptr, out);
+
+		PblCgiTraceConversion conversion;
+		ptr = pblCgiTraceParseConversion(percent, &conversion);
+
+		int nStars = conversion.nStars;
+		int stars[2];
+		for (int i = 0; i < nStars; i++)
+		{
+			long long value;
+			if (pblCgiTraceRead(reader, &value, sizeof(value)))
+			{
+				return -1;
+			}
+			stars[i] = (int)value;
+		}
+
+		// the conversion with the length modifier of the value as it is stored
+		char spec[64];
+		size_t length = conversion.lengthStart - conversion.start;
+		if (length > sizeof(spec) - 4)
+		{
+			return -1;
+		}
+		memcpy(spec, conversion.start, length);
+		if (conversion.type == PBL_CGI_TRACE_ARG_INT || conversion.type == PBL_CGI_TRACE_ARG_UINT)
+		{
+			if (conversion.lengthEnd[0] != 'c')
+			{
+				spec[length++] = 'l';
+				spec[length++] = 'l';
+			}
+		}
+		spec[length++] = conversion.lengthEnd[0];
+		spec[length] = '\0';
+
+		switch (conversion.type)
+		{
+		case PBL_CGI_TRACE_ARG_NONE:
+			fputc('%', out);
+			break;
+
+		case PBL_CGI_TRACE_ARG_INT:
+		case PBL_CGI_TRACE_ARG_UINT:
+		{
+			long long value;
+			if (pblCgiTraceRead(reader, &value, sizeof(value)))
+			{
+				return -1;
+			}
+			if (conversion.lengthEnd[0] == 'c')
+			{
+				PBL_CGI_TRACE_PRINT((int)value);
+			}
+			else
+			{
+				PBL_CGI_TRACE_PRINT(value);
+			}
+			break;
+		}
+
+		case PBL_CGI_TRACE_ARG_DOUBLE:
+		{
+			double value;
+			if (pblCgiTraceRead(reader, &value, sizeof(value)))
+			{
+				return -1;
+			}
+			PBL_CGI_TRACE_PRINT(value);
+			break;
+		}
+
+		case PBL_CGI_TRACE_ARG_STRING:
+		{
+			char * value = pblCgiTraceReadString(reader);
+			if (!value)
+			{
+				return -1;
+			}
+			PBL_CGI_TRACE_PRINT(value);
+			PBL_FREE(value);
+			break;
+		}
+
+		case PBL_CGI_TRACE_ARG_POINTER:
+		{
+			long long value;
+			if (pblCgiTraceRead(reader, &value, sizeof(value)))
+			{
+				return -1;
+			}
+			PBL_CGI_TRACE_PRINT((void *)(size_t)value);
+			break;
+		}
+
+		case PBL_CGI_TRACE_ARG_COUNT:
+			break;
+
+		default:
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+* Print the time, the process id and the text of a trace line the way the text trace did.
+*/
+static void pblCgiTracePrintLine(FILE * out, long long nanoseconds, unsigned int pid)
+{
+	char * now = pblCgiStrFromTime((time_t)(nanoseconds / 1000000000LL));
+	fprintf(out, "%s %u:  ", now, pid);
+	PBL_FREE(now);
+}
+
+/**
+* Print a binary trace as text, one line per record.
+*
+* Chunks that are damaged are skipped. Returns the number of records printed.
+*/
+int pblCgiTraceDecode(FILE * in, FILE * out)
+{
+	static char * tag = "pblCgiTraceDecode";
+
+	PblMap * formats = pblMapNewHashMap();
+	if (!formats)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	int nRecords = 0;
+	char header[PBL_CGI_TRACE_HEADER_SIZE];
+	size_t headerLength = 0;
+	for (;;)
+	{
+		headerLength += fread(header + headerLength, 1, sizeof(header) - headerLength, in);
+		if (headerLength < sizeof(header))
+		{
+			break;
+		}
+
+		unsigned int values[3];
+		memcpy(values, header + 4, sizeof(values));
+		if (memcmp(header, PBL_CGI_TRACE_MAGIC, 4) || values[0] != PBL_CGI_TRACE_VERSION || values[2] > PBL_CGI_TRACE_CAPACITY)
+		{
+			// look for the next chunk
+			memmove(header, header + 1, --headerLength);
+			continue;
+		}
+		headerLength = 0;
+
+		unsigned int pid = values[1];
+		size_t chunkLength = values[2];
+		char * chunk = pbl_malloc(tag, chunkLength + 1);
+		if (!chunk)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		if (fread(chunk, 1, chunkLength, in) != chunkLength)
+		{
+			PBL_FREE(chunk);
+			break;
+		}
+
+		for (char * ptr = chunk; ptr + PBL_CGI_TRACE_RECORD_HEADER_SIZE <= chunk + chunkLength;)
+		{
+			unsigned int length;
+			unsigned short type;
+			unsigned short id;
+			memcpy(&length, ptr, sizeof(length));
+			memcpy(&type, ptr + 4, sizeof(type));
+			memcpy(&id, ptr + 6, sizeof(id));
+			if (length < PBL_CGI_TRACE_RECORD_HEADER_SIZE || length > (size_t)(chunk + chunkLength - ptr))
+			{
+				break;
+			}
+
+			PblCgiTraceReader reader = { ptr + PBL_CGI_TRACE_RECORD_HEADER_SIZE, ptr + length };
+			ptr += length;
+
+			unsigned int key[2] = { pid, id };
+			if (type == PBL_CGI_TRACE_RECORD_FORMAT)
+			{
+				char * format = pblCgiTraceReadString(&reader);
+				if (format && pblMapAdd(formats, key, sizeof(key), format, strlen(format) + 1) < 0)
+				{
+					pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+				}
+				PBL_FREE(format);
+				continue;
+			}
+
+			long long nanoseconds;
+			if (pblCgiTraceRead(&reader, &nanoseconds, sizeof(nanoseconds)))
+			{
+				continue;
+			}
+			if (type == PBL_CGI_TRACE_RECORD_TEXT)
+			{
+				char * text = pblCgiTraceReadString(&reader);
+				if (text)
+				{
+					pblCgiTracePrintLine(out, nanoseconds, pid);
+					fputs(text, out);
+					fputs("\n", out);
+					PBL_FREE(text);
+					nRecords++;
+				}
+			}
+			else if (type == PBL_CGI_TRACE_RECORD_EVENT)
+			{
+				char * format = pblMapGet(formats, key, sizeof(key), NULL);
+				pblCgiTracePrintLine(out, nanoseconds, pid);
+				if (!format)
+				{
+					fprintf(out, "format %u of the process is not in the trace\n", (unsigned int)id);
+				}
+				else if (pblCgiTracePrint(out, format, &reader))
+				{
+					fputs(" ... damaged trace record\n", out);
+				}
+				else
+				{
+					fputs("\n", out);
+				}
+				nRecords++;
+			}
+		}
+		PBL_FREE(chunk);
+	}
+	pblMapFree(formats);
+	return nRecords;
+}
+
+/**
+ * Print an error message and exit the program.
+ */
+void pblCgiExitOnError(const char * format, ...)
+{
+	static int isExiting = 0;
+	if (isExiting)
+	{
+		// Formatting the message failed, the format is all that is left to report
+		PBL_CGI_TRACE("%s", format);
+		pblCgiPutString((char *)format);
+		pblCgiPutFlush();
+		exit(-1);
+	}
+	isExiting = 1;
+
+	pblCgiSetContentType("text/html");
+
+	pblCgiPutString(
+		"<!DOCTYPE html>\n"
+		"<html>\n"
+		"<head>\n<title>Mission-Base PBL CGI Error</title>\n</head>\n"
+		"<body>\n"
+		"<h1>PBL CGI\n</h1>\n"
+		"<p><hr><p>\n"
+		"<h1>An error occurred</h1>\n");
+
+	char * scriptName = pblCgiGetEnv("SCRIPT_NAME");
+	if (!scriptName || !*scriptName)
+	{
+		scriptName = "unknown";
+	}
+
+	pblCgiPutString("<p>While accessing the script '");
+	pblCgiPutString(scriptName);
+	pblCgiPutString("'.\n<p><b>\n");
+
+	va_list args;
+	va_start(args, format);
+	char * message = pblCgiVsprintf(format, args);
+	va_end(args);
+
+	PBL_CGI_TRACE("%s", message);
+	pblCgiPutString(message);
+
+	pblCgiPutString(
+		"</b>\n"
+		"<p>Please click your browser's back button to continue.\n"
+		"<p><hr><p>\n"
+		"<small>Copyright &copy; 2018 - Tamiko Thiel and Peter Graf</small>\n"
+		"</body></HTML>\n");
+	pblCgiPutFlush();
+	PBL_FREE(message);
+
+	PBL_CGI_TRACE("%s exit(-1)", scriptName);
+	exit(-1);
+}
+
+/*
+* Print an unsigned integer in decimal into a buffer of at least PBL_CGI_INT_STRING_SIZE bytes, returns the buffer.
+*/
+static char * pblCgiUnsignedToStr(char * buffer, unsigned long value)
+{
+	char digits[PBL_CGI_INT_STRING_SIZE];
+	char * ptr = digits + sizeof(digits);
+
+	do
+	{
+		*--ptr = (char)('0' + value % 10);
+		value /= 10;
+	} while (value);
+
+	memcpy(buffer, ptr, digits + sizeof(digits) - ptr);
+	buffer[digits + sizeof(digits) - ptr] = '\0';
+	return buffer;
+}
+
+/**
+* Print an integer in decimal into a buffer of at least PBL_CGI_INT_STRING_SIZE bytes, returns the buffer.
+*/
+char * pblCgiIntToStr(char * buffer, long value)
+{
+	if (value < 0)
+	{
+		*buffer = '-';
+		pblCgiUnsignedToStr(buffer + 1, 0UL - (unsigned long)value);
+		return buffer;
+	}
+	return pblCgiUnsignedToStr(buffer, (unsigned long)value);
+}
+
+/*
+* Test whether a format only has the conversions %s, %c, %d, %i, %u, %ld, %li, %lu and %%,
+* without flags, width or precision, and at most PBL_CGI_SPRINTF_MAX_CONVERSIONS of them.
+*/
+static int pblCgiIsSimpleFormat(const char * format)
+{
+	int nConversions = 0;
+	for (const char * ptr = format; (ptr = strchr(ptr, '%')); ptr++)
+	{
+		ptr++;
+		if (*ptr == '%')
+		{
+			continue;
+		}
+		if (*ptr == 'l')
+		{
+			ptr++;
+			if (*ptr != 'd' && *ptr != 'i' && *ptr != 'u')
+			{
+				return 0;
+			}
+		}
+		else if (*ptr != 's' && *ptr != 'c' && *ptr != 'd' && *ptr != 'i' && *ptr != 'u')
+		{
+			return 0;
+		}
+		if (++nConversions > PBL_CGI_SPRINTF_MAX_CONVERSIONS)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+* Print a simple format without printf, the arguments are converted once, then the result is put together.
+*/
+static char * pblCgiSimpleVsprintf(const char * format, va_list args)
+{
+	char numbers[PBL_CGI_SPRINTF_MAX_CONVERSIONS][PBL_CGI_INT_STRING_SIZE];
+	const char * strings[PBL_CGI_SPRINTF_MAX_CONVERSIONS];
+	size_t lengths[PBL_CGI_SPRINTF_MAX_CONVERSIONS];
+	size_t length = 0;
+	int n = 0;
+
+	for (const char * ptr = format; *ptr; ptr++)
+	{
+		if (*ptr != '%')
+		{
+			length++;
+			continue;
+		}
+		ptr++;
+		switch (*ptr)
+		{
+		case '%':
+			length++;
+			continue;
+		case 's':
+			strings[n] = va_arg(args, char *);
+			if (!strings[n])
+			{
+				strings[n] = "(null)";
+			}
+			break;
+		case 'c':
+			numbers[n][0] = (char)va_arg(args, int);
+			numbers[n][1] = '\0';
+			strings[n] = numbers[n];
+			lengths[n] = 1;
+			length++;
+			n++;
+			continue;
+		case 'u':
+			strings[n] = pblCgiUnsignedToStr(numbers[n], va_arg(args, unsigned int));
+			break;
+		case 'l':
+			ptr++;
+			strings[n] = *ptr == 'u' ? pblCgiUnsignedToStr(numbers[n], va_arg(args, unsigned long))
+				: pblCgiIntToStr(numbers[n], va_arg(args, long));
+			break;
+		default:
+			strings[n] = pblCgiIntToStr(numbers[n], va_arg(args, int));
+			break;
+		}
+		lengths[n] = strlen(strings[n]);
+		length += lengths[n++];
+	}
+
+	char * result = pblCgiMalloc("pblCgiVsprintf", length + 1);
+	char * end = result;
+	n = 0;
+	for (const char * ptr = format; *ptr; ptr++)
+	{
+		if (*ptr != '%')
+		{
+			*end++ = *ptr;
+			continue;
+		}
+		ptr++;
+		if (*ptr == '%')
+		{
+			*end++ = '%';
+			continue;
+		}
+		if (*ptr == 'l')
+		{
+			ptr++;
+		}
+		memcpy(end, strings[n], lengths[n]);
+		end += lengths[n++];
+	}
+	*end = '\0';
+	return result;
+}
+
+/**
+* Print a format into a malloced string of the length needed, nothing is truncated.
+*
+* Simple formats, strings and integers put together, are printed without printf.
+* Other formats are printed directly into a malloced buffer of PBL_CGI_SPRINTF_BUFFER_SIZE bytes,
+* only longer strings are printed a second time, into a buffer of their length.
+*/
+char * pblCgiVsprintf(const char * format, va_list args)
+{
+	if (pblCgiIsSimpleFormat(format))
+	{
+		return pblCgiSimpleVsprintf(format, args);
+	}
+
+	char * result = pblCgiMalloc("pblCgiVsprintf", PBL_CGI_SPRINTF_BUFFER_SIZE);
+
+	va_list argsCopy;
+	va_copy(argsCopy, args);
+	int rc = vsnprintf(result, PBL_CGI_SPRINTF_BUFFER_SIZE, format, argsCopy);
+	va_end(argsCopy);
+
+	if (rc < 0)
+	{
+		pblCgiExitOnError("Printing of format '%s' failed with errno=%d\n", format, errno);
+	}
+	if ((size_t)rc >= PBL_CGI_SPRINTF_BUFFER_SIZE)
+	{
+		PBL_FREE(result);
+		result = pblCgiMalloc("pblCgiVsprintf", (size_t)rc + 1);
+		vsnprintf(result, (size_t)rc + 1, format, args);
+	}
+	return result;
+}
+
+/**
+ * Like sprintf, copies the value to the heap, nothing is truncated.
+ */
+char * pblCgiSprintf(const char * format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	char * result = pblCgiVsprintf(format, args);
+	va_end(args);
+	return result;
+}
+
+/**
+ * Tests whether a NULL terminated string array contains a string
+ */
+int pblCgiStrArrayContains(char ** array, char * string)
+{
+	for (int i = 0;; i++)
+	{
+		char * ptr = array[i];
+		if (!ptr)
+		{
+			break;
+		}
+		if (pblCgiStrEquals(ptr, string))
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Copies at most n bytes, the result is always 0 terminated
+ */
+char * pblCgiStrNCpy(char *dest, char *string, size_t n)
+{
+	char * ptr = dest;
+	while (--n && (*ptr++ = *string++))
+		;
+
+	if (*ptr)
+	{
+		*ptr = '\0';
+	}
+	return dest;
+}
+
+static char * pblCgiStrTrimStart(char * string)
+{
+	return string + pblCgiKernelSpaceSpan(string, strlen(string));
+}
+
+static void pblCgiStrTrimEnd(char * string)
+{
+	if (!string)
+	{
+		return;
+	}
+	string[pblCgiKernelSpaceSpanEnd(string, strlen(string))] = '\0';
+}
+
+/**
+ * Trim the string, remove blanks at start and end.
+ */
+char * pblCgiStrTrim(char * string)
+{
+	pblCgiStrTrimEnd(string);
+	return pblCgiStrTrimStart(string);
+}
+
+/**
+ * Test if a string is NULL or white space only
+ */
+int pblCgiStrIsNullOrWhiteSpace(char * string)
+{
+	if (string)
+	{
+		size_t length = strlen(string);
+		return pblCgiKernelSpaceSpan(string, length) == length;
+	}
+	return 1;
+}
+
+char * pblCgiStrRangeDup(char * start, char * end)
+{
+	static char * tag = "pblCgiStrRangeDup";
+
+	start = pblCgiStrTrimStart(start);
+	int length = end - start;
+	if (length > 0)
+	{
+		char * value = pbl_memdup(tag, start, length + 1);
+		if (!value)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		value[length] = '\0';
+		pblCgiStrTrimEnd(value);
+		return value;
+	}
+	return pblCgiStrDup("");
+}
+
+/**
+ * String equals, handles NULLs.
+ */
+int pblCgiStrEquals(char * s1, char * s2)
+{
+	return !pblCgiStrCmp(s1, s2);
+}
+
+/**
+ * Like strcmp, handles NULLs.
+ */
+int pblCgiStrCmp(char * s1, char * s2)
+{
+	if (!s1)
+	{
+		if (!s2)
+		{
+			return 0;
+		}
+		return -1;
+	}
+	if (!s2)
+	{
+		return 1;
+	}
+	return strcmp(s1, s2);
+}
+
+/**
+ * Like strdup.
+ *
+ * If an error occurs, the program exits with an error message.
+ */
+char * pblCgiStrDup(char * string)
+{
+	static char * tag = "pblCgiStrDup";
+
+	if (!string)
+	{
+		string = "";
+	}
+	string = pbl_strdup(tag, string);
+	if (!string)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	return string;
+}
+
+/**
+ * Like strcat, but the memory for the target is allocated.
+ *
+ * If an error occurs, the program exits with an error message.
+ */
+char * pblCgiStrCat(char * s1, char * s2)
+{
+	static char * tag = "pblCgiStrCat";
+	char * result = NULL;
+	size_t len1 = 0;
+	size_t len2 = 0;
+
+	if (!s1 || !(*s1))
+	{
+		if (!s2 || !(*s2))
+		{
+			return pblCgiStrDup("");
+		}
+		return pblCgiStrDup(s2);
+	}
+
+	if (!s2 || !(*s2))
+	{
+		return pblCgiStrDup(s1);
+	}
+
+	len1 = strlen(s1);
+	len2 = strlen(s2);
+	result = pblCgiMalloc(tag, len1 + len2 + 1);
+
+	memcpy(result, s1, len1);
+	memcpy(result + len1, s2, len2 + 1);
+	return result;
+}
+
+/**
+* Concatenate the strings given, the list ends with NULL. The result is a malloced string.
+*
+* Used instead of pblCgiSprintf for formats that only put strings together.
+*/
+char * pblCgiStrConcat(char * string, ...)
+{
+	va_list args;
+	size_t length = 0;
+
+	va_start(args, string);
+	for (char * ptr = string; ptr; ptr = va_arg(args, char *))
+	{
+		length += strlen(ptr);
+	}
+	va_end(args);
+
+	char * result = pblCgiMalloc("pblCgiStrConcat", length + 1);
+	char * end = result;
+
+	va_start(args, string);
+	for (char * ptr = string; ptr; ptr = va_arg(args, char *))
+	{
+		size_t n = strlen(ptr);
+		memcpy(end, ptr, n);
+		end += n;
+	}
+	va_end(args);
+
+	*end = '\0';
+	return result;
+}
+
+/*
+ * Replace the oldValue with newValue. The result is a malloced string.
+ */
+char * pblCgiStrReplace(char * string, char * oldValue, char * newValue)
+{
+	char * tag = "pblCgiStrReplace";
+	char * ptr = string;
+	char * end = string + strlen(string);
+	size_t length = strlen(oldValue);
+
+	PblStringBuilder * stringBuilder = pblStringBuilderNew();
+	if (!stringBuilder)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	for (;;)
+	{
+		char * ptr2 = pblCgiKernelFind(ptr, end - ptr, oldValue, length);
+		if (!ptr2)
+		{
+			if (pblStringBuilderAppendStr(stringBuilder, ptr) == ((size_t)-1))
+			{
+				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+			}
+			break;
+		}
+
+		if (ptr2 > ptr)
+		{
+			if (pblStringBuilderAppendStrN(stringBuilder, ptr2 - ptr, ptr) == ((size_t)-1))
+			{
+				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+			}
+		}
+
+		if (pblStringBuilderAppendStr(stringBuilder, newValue) == ((size_t)-1))
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		ptr = ptr2 + length;
+	}
+
+	char * result = pblStringBuilderToString(stringBuilder);
+	if (!result)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	pblStringBuilderFree(stringBuilder);
+	return result;
+}
+
+/*
+* The replace engine.
+*
+* The patterns of the rules are put into an Aho-Corasick automaton, so that a string is searched
+* for all patterns at once. Matches do not overlap, the leftmost match wins and of the matches
+* starting at the same position the longest one. Replacements are not searched again.
+*/
+typedef struct PblCgiReplacerNode
+{
+	int child;      /* the first child, 0 if there is none */
+	int sibling;    /* the next child of the parent, 0 if there is none */
+	int fail;       /* the node of the longest proper suffix that is a prefix of a pattern */
+	int output;     /* the node of the longest suffix that is a pattern, 0 if there is none */
+	int rule;       /* the rule of the pattern ending at the node, -1 if there is none */
+	int depth;
+	unsigned char c;
+} PblCgiReplacerNode;
+
+struct PblCgiReplacer
+{
+	int nRules;
+	size_t * patternLengths;
+	char ** replacements;
+	size_t * replacementLengths;
+	PblCgiReplacerNode * nodes;
+	int nNodes;
+	int rootNext[256];  /* the children of the root by character */
+};
+
+static int pblCgiReplacerChild(PblCgiReplacer * replacer, int node, unsigned char c)
+{
+	if (!node)
+	{
+		return replacer->rootNext[c];
+	}
+	for (int child = replacer->nodes[node].child; child; child = replacer->nodes[child].sibling)
+	{
+		if (replacer->nodes[child].c == c)
+		{
+			return child;
+		}
+	}
+	return 0;
+}
+
+static int pblCgiReplacerNext(PblCgiReplacer * replacer, int node, unsigned char c)
+{
+	for (;;)
+	{
+		int child = pblCgiReplacerChild(replacer, node, c);
+		if (child || !node)
+		{
+			return child;
+		}
+		node = replacer->nodes[node].fail;
+	}
+}
+
+/**
+* Create a replace engine for the rules given, the patterns are replaced by the replacements with the same index.
+*
+* Rules with empty patterns are ignored, of rules with the same pattern the first one is used.
+*/
+PblCgiReplacer * pblCgiReplacerNew(int nRules, char ** patterns, char ** replacements)
+{
+	static char * tag = "pblCgiReplacerNew";
+
+	int nNodes = 1;
+	for (int i = 0; i < nRules; i++)
+	{
+		nNodes += (int)strlen(patterns[i]);
+	}
+
+	PblCgiReplacer * replacer = (PblCgiReplacer *)pblCgiMalloc(tag, sizeof(PblCgiReplacer));
+	memset(replacer, 0, sizeof(PblCgiReplacer));
+	replacer->nRules = nRules;
+	replacer->patternLengths = (size_t *)pblCgiMalloc(tag, (nRules + 1) * sizeof(size_t));
+	replacer->replacements = (char **)pblCgiMalloc(tag, (nRules + 1) * sizeof(char *));
+	replacer->replacementLengths = (size_t *)pblCgiMalloc(tag, (nRules + 1) * sizeof(size_t));
+	replacer->nodes = (PblCgiReplacerNode *)pblCgiMalloc(tag, nNodes * sizeof(PblCgiReplacerNode));
+	memset(replacer->nodes, 0, sizeof(PblCgiReplacerNode));
+	replacer->nodes[0].rule = -1;
+	replacer->nNodes = 1;
+
+	for (int i = 0; i < nRules; i++)
+	{
+		replacer->patternLengths[i] = strlen(patterns[i]);
+		replacer->replacements[i] = replacements[i];
+		replacer->replacementLengths[i] = strlen(replacements[i]);
+
+		int node = 0;
+		for (unsigned char * ptr = (unsigned char *)patterns[i]; *ptr; ptr++)
+		{
+			int child = pblCgiReplacerChild(replacer, node, *ptr);
+			if (!child)
+			{
+				child = replacer->nNodes++;
+				PblCgiReplacerNode * newNode = replacer->nodes + child;
+				memset(newNode, 0, sizeof(PblCgiReplacerNode));
+				newNode->rule = -1;
+				newNode->depth = replacer->nodes[node].depth + 1;
+				newNode->c = *ptr;
+				if (node)
+				{
+					newNode->sibling = replacer->nodes[node].child;
+					replacer->nodes[node].child = child;
+				}
+				else
+				{
+					replacer->rootNext[*ptr] = child;
+				}
+			}
+			node = child;
+		}
+		if (node && replacer->nodes[node].rule < 0)
+		{
+			replacer->nodes[node].rule = i;
+		}
+	}
+
+	// the failure and output links, in breadth first order, so that the links of shorter prefixes are known
+	int * queue = (int *)pblCgiMalloc(tag, replacer->nNodes * sizeof(int));
+	int nQueued = 0;
+	for (int c = 0; c < 256; c++)
+	{
+		if (replacer->rootNext[c])
+		{
+			queue[nQueued++] = replacer->rootNext[c];
+		}
+	}
+	for (int i = 0; i < nQueued; i++)
+	{
+		PblCgiReplacerNode * node = replacer->nodes + queue[i];
+		node->output = node->rule >= 0 ? queue[i] : replacer->nodes[node->fail].output;
+
+		for (int child = node->child; child; child = replacer->nodes[child].sibling)
+		{
+			replacer->nodes[child].fail = pblCgiReplacerNext(replacer, node->fail, replacer->nodes[child].c);
+			queue[nQueued++] = child;
+		}
+	}
+	PBL_FREE(queue);
+
+	return replacer;
+}
+
+/**
+* Replace the patterns of the rules in one pass over the string. The result is a malloced string.
+*/
+char * pblCgiReplacerApply(PblCgiReplacer * replacer, char * string)
+{
+	static char * tag = "pblCgiReplacerApply";
+
+	size_t length = strlen(string);
+	size_t resultLength = length;
+
+	size_t * starts = NULL;
+	int * rules = NULL;
+	int nMatches = 0;
+	int startsCapacity = 0;
+	int rulesCapacity = 0;
+
+	size_t candidateStart = 0;
+	int candidate = 0; /* the node of the best match found so far, 0 if there is none */
+	int node = 0;
+
+	for (size_t i = 0; i < length || candidate;)
+	{
+		if (i < length)
+		{
+			node = pblCgiReplacerNext(replacer, node, (unsigned char)string[i++]);
+			for (int output = replacer->nodes[node].output; output; output = replacer->nodes[replacer->nodes[output].fail].output)
+			{
+				size_t start = i - replacer->nodes[output].depth;
+				if (!candidate || start < candidateStart
+					|| (start == candidateStart && replacer->nodes[output].depth > replacer->nodes[candidate].depth))
+				{
+					candidate = output;
+					candidateStart = start;
+				}
+			}
+
+			// a match starting at or before the candidate might still follow
+			if (!candidate || i - replacer->nodes[node].depth <= candidateStart)
+			{
+				continue;
+			}
+		}
+
+		starts = pblCgiGrowArray(tag, starts, &startsCapacity, nMatches, sizeof(size_t));
+		rules = pblCgiGrowArray(tag, rules, &rulesCapacity, nMatches, sizeof(int));
+		starts[nMatches] = candidateStart;
+		rules[nMatches++] = replacer->nodes[candidate].rule;
+
+		int rule = replacer->nodes[candidate].rule;
+		resultLength += replacer->replacementLengths[rule];
+		resultLength -= replacer->patternLengths[rule];
+
+		// the string following the match is searched again
+		i = candidateStart + replacer->nodes[candidate].depth;
+		candidate = 0;
+		node = 0;
+	}
+
+	char * result = pblCgiMalloc(tag, resultLength + 1);
+	char * ptr = result;
+	size_t position = 0;
+	for (int i = 0; i < nMatches; i++)
+	{
+		memcpy(ptr, string + position, starts[i] - position);
+		ptr += starts[i] - position;
+		memcpy(ptr, replacer->replacements[rules[i]], replacer->replacementLengths[rules[i]]);
+		ptr += replacer->replacementLengths[rules[i]];
+		position = starts[i] + replacer->patternLengths[rules[i]];
+	}
+	memcpy(ptr, string + position, length - position + 1);
+
+	PBL_FREE(starts);
+	PBL_FREE(rules);
+	return result;
+}
+
+void pblCgiReplacerFree(PblCgiReplacer * replacer)
+{
+	if (replacer)
+	{
+		PBL_FREE(replacer->patternLengths);
+		PBL_FREE(replacer->replacements);
+		PBL_FREE(replacer->replacementLengths);
+		PBL_FREE(replacer->nodes);
+		PBL_FREE(replacer);
+	}
+}
+
+/**
+* Replace the patterns of the rules given in one pass over the string. The result is a malloced string.
+*/
+char * pblCgiStrReplaceAll(char * string, int nRules, char ** patterns, char ** replacements)
+{
+	PblCgiReplacer * replacer = pblCgiReplacerNew(nRules, patterns, replacements);
+	char * result = pblCgiReplacerApply(replacer, string);
+	pblCgiReplacerFree(replacer);
+	return result;
+}
+
+/**
+ * Return a malloced time string.
+ *
+ * If an error occurs, the program exits with an error message.
+ */
+char * pblCgiStrFromTime(time_t t)
+{
+	return pblCgiStrFromTimeAndFormat(t, "%02d.%02d.%02d %02d:%02d:%02d");
+}
+
+/**
+* Return a malloced time string.
+*
+* If an error occurs, the program exits with an error message.
+*/
+char * pblCgiStrFromTimeAndFormat(time_t t, char * format)
+{
+	struct tm *tm;
+
+#ifdef _WIN32
+
+	struct tm windowsTm;
+	tm = &windowsTm;
+	localtime_s(tm, (time_t *) &(t));
+
+#else
+
+	tm = localtime((time_t *) &(t));
+
+#endif
+	return pblCgiSprintf(format, (tm->tm_year + 1900) % 100, tm->tm_mon + 1, tm->tm_mday,
+		tm->tm_hour, tm->tm_min, tm->tm_sec);
+}
+
+/**
+ * Like split.
+ *
+ * If an error occurs, the program exits with an error message.
+ *
+ * The results should be defined as:
+ *
+ * 	char * results[size + 1];
+ */
+int pblCgiStrSplit(char * string, char * splitString, size_t size, char * results[])
+{
+	unsigned int index = 0;
+	if (size < 1)
+	{
+		return index;
+	}
+
+	size_t length = strlen(splitString);
+	results[0] = NULL;
+
+	char * ptr = string;
+	char * end = string + strlen(string);
+
+	for (;;)
+	{
+		if (index > size - 1)
+		{
+			return index;
+		}
+
+		char * ptr2 = pblCgiKernelFind(ptr, end - ptr, splitString, length);
+		if (!ptr2)
+		{
+			char * value = pblCgiStrDup(ptr);
+			results[index] = pblCgiStrDup(pblCgiStrTrim(value));
+			results[++index] = NULL;
+			PBL_FREE(value);
+
+			return index;
+		}
+		char * value = pblCgiStrRangeDup(ptr, ptr2);
+		results[index] = pblCgiStrDup(pblCgiStrTrim(value));
+		results[++index] = NULL;
+		PBL_FREE(value);
+
+		ptr = ptr2 + length;
+	}
+	return index;
+}
+
+/**
+* Split a string to a list.
+*/
+PblList * pblCgiStrSplitToList(char * string, char * splitString)
+{
+	static char * tag = "pblCgiSplitToList";
+	PblList * list = pblListNewArrayList();
+	if (!list)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+
+	size_t length = strlen(splitString);
+	char * ptr = string;
+	char * end = string + strlen(string);
+
+	for (;;)
+	{
+		char * ptr2 = pblCgiKernelFind(ptr, end - ptr, splitString, length);
+		if (!ptr2)
+		{
+			char * value = pblCgiStrDup(ptr);
+			if (pblListAdd(list, pblCgiStrDup(pblCgiStrTrim(value))) < 0)
+			{
+				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+			}
+			PBL_FREE(value);
+			break;
+		}
+
+		char * value = pblCgiStrRangeDup(ptr, ptr2);
+		if (pblListAdd(list, pblCgiStrDup(pblCgiStrTrim(value))) < 0)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		PBL_FREE(value);
+		ptr = ptr2 + length;
+	}
+	return list;
+}
+
+static const char *pblCgiHexDigits = "0123456789abcdef";
+
+/**
+ * Convert a buffer to a hex byte string
+ *
+ * If an error occurs, the program exits with an error message.
+ *
+ * return The malloced hex string.
+ */
+char * pblCgiStrToHexFromBuffer(unsigned char * buffer, size_t length)
+{
+	static char * tag = "pblCgiStrToHexFromBuffer";
+	char * hexString = pblCgiMalloc(tag, 2 * length + 1);
+
+	pblCgiKernelToHex(hexString, buffer, length);
+	hexString[2 * length] = 0;
+
+	return hexString;
+}
+
+/**
+ * Get the cookie, if any is given.
+ */
+char * pblCgiGetCoockie(char * cookieKey, char * cookieTag)
+{
+	char * cookie = pblCgiStrDup(pblCgiGetEnv("HTTP_COOKIE"));
+	if (cookie && *cookie)
+	{
+		cookie = strstr(cookie, cookieTag);
+		if (cookie)
+		{
+			cookie += strlen(cookieTag);
+		}
+	}
+	else
+	{
+		cookie = pblCgiQueryValue(cookieKey);
+	}
+
+	if (!cookie || !*cookie)
+	{
+		return NULL;
+	}
+	for (char * ptr = cookie; *ptr; ptr++)
+	{
+		if (!strchr(pblCgiHexDigits, *ptr))
+		{
+			*ptr = '\0';
+			break;
+		}
+	}
+	return cookie;
+}
+
+/**
+* Like fopen, needed for Windows port
+*/
+FILE * pblCgiTryFopen(char * filePath, char * openType)
+{
+	FILE * stream;
+
+#ifdef WIN32
+
+	stream = _fsopen(filePath, openType, _SH_DENYWR);
+	if (!stream)
+	{
+		errno_t err = fopen_s(&stream, filePath, openType);
+		if (err != 0)
+		{
+			return NULL;
+		}
+	}
+
+#else
+
+	if (!(stream = fopen(filePath, openType)))
+	{
+		return NULL;
+	}
+
+#endif
+	return stream;
+}
+
+/**
+* Like fopen, needed for Windows port
+*/
+FILE * pblCgiFopen(char * filePath, char * openType)
+{
+	static char * tag = "pblCgiFopen";
+	FILE * stream = pblCgiTryFopen(filePath, openType);
+	if (stream)
+	{
+		return stream;
+	}
+
+#ifdef WIN32
+
+	stream = _fsopen(filePath, openType, _SH_DENYWR);
+	if (!stream)
+	{
+		errno_t err = fopen_s(&stream, filePath, openType);
+		if (err != 0)
+		{
+#ifdef WIN32
+			pblCgiExitOnError("%s: Cannot open file '%s', err=%d, errno=%d, cwd='%s'\n", tag,
+				filePath, err, errno, _getcwd(NULL, 1024));
+#else
+			pblCgiExitOnError("%s: Cannot open file '%s', err=%d, errno=%d\n", tag,
+				filePath, err, errno);
+#endif
+		}
+	}
+
+#else
+
+	if (!(stream = fopen(filePath, openType)))
+	{
+		pblCgiExitOnError("%s: Cannot open file '%s', errno=%d\n", tag, filePath, errno);
+	}
+
+#endif
+	return stream;
+}
+
+/**
+ * Like getenv, needed for Windows port
+ */
+char * pblCgiGetEnv(char * name)
+{
+#ifdef WIN32
+
+	char *value;
+	size_t len;
+	_dupenv_s(&value, &len, name);
+	return value;
+
+#else
+
+	return getenv(name);
+
+#endif
+}
+
+/*
+* Get a limit of the POST input, configured by the key given.
+*/
+static size_t pblCgiPostLimit(char * key, size_t defaultLimit)
+{
+	if (pblCgiConfigMap || pblCgiConfigLookup)
+	{
+		char * ptr = pblCgiConfigValue(key, NULL);
+		if (ptr && *ptr)
+		{
+			return strtoul(ptr, NULL, 10);
+		}
+	}
+	return defaultLimit;
+}
+
+/*
+* Get the length of the POST input, the request is rejected before anything is read
+* if the input is longer than the limit given.
+*/
+static size_t pblCgiPostContentLength(char * tag, size_t length, size_t maxLength)
+{
+	char * ptr = pblCgiGetEnv("CONTENT_LENGTH");
+	long contentLength = ptr && *ptr ? atol(ptr) : 0;
+	if (contentLength <= 0)
+	{
+		return 0;
+	}
+
+	if (length + contentLength >= maxLength)
+	{
+		pblCgiExitOnError("%s: POST input too long, %lu bytes\n", tag, (unsigned long)(length + contentLength));
+	}
+	return contentLength;
+}
+
+/*
+* Read up to length bytes of the input, returns the number of bytes read.
+*/
+static size_t pblCgiReadInput(char * buffer, size_t length)
+{
+	size_t nRead = 0;
+
+#ifdef WIN32
+
+	nRead = fread(buffer, 1, length, stdin);
+
+#else
+
+	while (nRead < length)
+	{
+		ssize_t rc = read(STDIN_FILENO, buffer + nRead, length - nRead);
+		if (rc < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (rc <= 0)
+		{
+			break;
+		}
+		nRead += rc;
+	}
+
+#endif
+	return nRead;
+}
+
+/*
+* Split a parameter of a query into its key and its value and decode both in place, returns the value.
+*/
+static char * pblCgiSplitParameter(char * pair, char ** key)
+{
+	// As always, a value ends at a second '='
+	char * value = strchr(pair, '=');
+	if (value)
+	{
+		*value++ = '\0';
+		char * end = strchr(value, '=');
+		if (end)
+		{
+			*end = '\0';
+		}
+		value = pblCgiDecodeQueryStringInPlace(value);
+	}
+	*key = pblCgiDecodeQueryStringInPlace(pair);
+	return value;
+}
+
+/**
+ * Reads in GET or POST query data, converts it to non-escaped text,
+ * and saves each parameter in the query map.
+ *
+ *  If there's no variables that indicates GET or POST, it is assumed
+ *  that the CGI script was started from the command line, specifying
+ *  the query string like
+ *
+ *      script 'key1=value1&key2=value2'
+ *
+ */
+void pblCgiParseQuery(int argc, char * argv[])
+{
+	static char * tag = "pblCgiParseQuery";
+	char * ptr = NULL;
+
+	pblCgiQueryString = "";
+
+	ptr = pblCgiGetEnv("REQUEST_METHOD");
+	if (!ptr || !*ptr)
+	{
+		if (argc < 2)
+		{
+			pblCgiExitOnError("%s: test usage: %s querystring\n", tag, argv[0]);
+		}
+		pblCgiQueryString = argv[1];
+	}
+	else if (!strcmp(ptr, "GET"))
+	{
+		ptr = pblCgiGetEnv("QUERY_STRING");
+		if (ptr && *ptr)
+		{
+			pblCgiQueryString = ptr;
+		}
+	}
+	else if (!strcmp(ptr, "POST"))
+	{
+		// The query string given is kept in front of the POST input
+		ptr = pblCgiGetEnv("QUERY_STRING");
+		size_t length = ptr && *ptr ? strlen(ptr) + 1 : 0;
+		size_t contentLength = pblCgiPostContentLength(tag, length,
+			pblCgiPostLimit(PBL_CGI_MAX_POST_INPUT_LENGTH, PBL_CGI_MAX_POST_INPUT_LEN));
+
+		pblCgiQueryString = pblCgiMalloc(tag, length + contentLength + 1);
+		if (length)
+		{
+			memcpy(pblCgiQueryString, ptr, length - 1);
+			pblCgiQueryString[length - 1] = '&';
+		}
+		length += pblCgiReadInput(pblCgiQueryString + length, contentLength);
+		pblCgiQueryString[length] = '\0';
+	}
+	else
+	{
+		pblCgiExitOnError("%s: Unknown REQUEST_METHOD '%s'\n", tag, ptr);
+	}
+
+	PBL_CGI_TRACE("In %s", pblCgiQueryString);
+
+	// One allocation holds the parameters, the hash table and the decoded query
+	size_t length = strlen(pblCgiQueryString);
+	int count = 1;
+	for (ptr = pblCgiQueryString; *ptr; ptr++)
+	{
+		if (*ptr == '&')
+		{
+			count++;
+		}
+	}
+	unsigned int nSlots = 16;
+	while (nSlots < 2 * (unsigned int)count)
+	{
+		nSlots *= 2;
+	}
+	size_t parametersSize = count * sizeof(PblCgiQueryParameter);
+	size_t slotsSize = nSlots * sizeof(int);
+
+	PBL_FREE(queryParameters);
+	char * memory = pblCgiMalloc(tag, parametersSize + slotsSize + length + 1);
+	memset(memory, 0, parametersSize + slotsSize);
+	queryParameters = (PblCgiQueryParameter *)memory;
+	querySlots = (int *)(memory + parametersSize);
+	querySlotsMask = nSlots - 1;
+	queryParametersCount = 0;
+
+	char * buffer = memory + parametersSize + slotsSize;
+	memcpy(buffer, pblCgiQueryString, length + 1);
+
+	for (ptr = buffer; ptr;)
+	{
+		char * pair = ptr;
+		ptr = strchr(ptr, '&');
+		if (ptr)
+		{
+			*ptr++ = '\0';
+		}
+
+		char * key = NULL;
+		char * value = pblCgiSplitParameter(pair, &key);
+		pblCgiSetQueryValue(key, value);
+	}
+}
+
+/*
+* Split a parameter of the POST input and call the handler for it,
+* the request is rejected if the parameter is longer than the limit given.
+*/
+static void pblCgiHandlePostParameter(char * tag, char * pair, size_t length, size_t maxLength,
+	void (*handler)(char * key, char * value, void * context), void * context)
+{
+	if (length > maxLength)
+	{
+		pblCgiExitOnError("%s: POST parameter too long, %lu bytes\n", tag, (unsigned long)length);
+	}
+	char * key = NULL;
+	char * value = pblCgiSplitParameter(pair, &key);
+	handler(key, value, context);
+}
+
+/**
+* Read the POST input of a form and call the handler for each parameter with its decoded key and value.
+*
+* The input is read in chunks, only the parameter parsed is kept in memory, so large form posts
+* can be handled without keeping the input. The query map and pblCgiQueryString are not set.
+*
+* The input is not limited by MaxPostInputLength, it has its own limit MaxPostStreamLength, 256 MB by default.
+* A single parameter is limited by MaxPostParameterLength, 1 MB by default. Returns the number of parameters.
+*/
+int pblCgiParsePost(void (*handler)(char * key, char * value, void * context), void * context)
+{
+	static char * tag = "pblCgiParsePost";
+
+	size_t remaining = pblCgiPostContentLength(tag, 0,
+		pblCgiPostLimit(PBL_CGI_MAX_POST_STREAM_LENGTH, PBL_CGI_MAX_POST_STREAM_LEN));
+	size_t maxParameterLength = pblCgiPostLimit(PBL_CGI_MAX_POST_PARAMETER_LENGTH, PBL_CGI_MAX_POST_PARAMETER_LEN);
+	size_t size = PBL_CGI_POST_CHUNK_SIZE;
+	char * buffer = pblCgiMalloc(tag, size + 1);
+	size_t used = 0;
+	int nParameters = 0;
+
+	for (;;)
+	{
+		if (used == size)
+		{
+			// a parameter longer than the buffer
+			char * newBuffer = pblCgiMalloc(tag, 2 * size + 1);
+			memcpy(newBuffer, buffer, used);
+			PBL_FREE(buffer);
+			buffer = newBuffer;
+			size *= 2;
+		}
+
+		size_t nRead = pblCgiReadInput(buffer + used, size - used < remaining ? size - used : remaining);
+		remaining -= nRead;
+		used += nRead;
+		int isEnd = nRead == 0 || remaining == 0;
+
+		char * start = buffer;
+		for (char * end; (end = memchr(start, '&', buffer + used - start)); start = end + 1)
+		{
+			*end = '\0';
+			if (*start)
+			{
+				pblCgiHandlePostParameter(tag, start, end - start, maxParameterLength, handler, context);
+				nParameters++;
+			}
+		}
+		used = buffer + used - start;
+		memmove(buffer, start, used);
+
+		if (isEnd)
+		{
+			buffer[used] = '\0';
+			if (*buffer)
+			{
+				pblCgiHandlePostParameter(tag, buffer, used, maxParameterLength, handler, context);
+				nParameters++;
+			}
+			break;
+		}
+		if (used > maxParameterLength)
+		{
+			// the rest of a parameter that is already too long is not read
+			pblCgiExitOnError("%s: POST parameter too long, more than %lu bytes\n", tag, (unsigned long)maxParameterLength);
+		}
+	}
+
+	PBL_FREE(buffer);
+	return nParameters;
+}
+
+/*
+* Templates are compiled once into a list of operations and cached by the path of the template.
+* A cached template is compiled again if the modification time or the size of the template
+* or of one of the files it includes changed.
+*
+* Literal text is not copied, the operations point into the text of the files read.
+* Includes are resolved when compiling, IFDEF, IFNDEF and FOR know the index of their ENDIF or ENDFOR.
+* Rendering walks the operations, gathers the output and writes it with writev.
+*/
+typedef struct PblCgiTemplateOp
+{
+	int type;
+	int file;                   /* index of the file the operation was compiled from */
+	char * text;                /* literal text or the key of a value or directive */
+	size_t length;
+	int end;                    /* IFDEF, IFNDEF and FOR: index of the matching ENDIF or ENDFOR */
+} PblCgiTemplateOp;
+
+typedef struct PblCgiTemplateFile
+{
+	char * path;
+	time_t modificationTime;
+	long long size;
+	char * text;
+} PblCgiTemplateFile;
+
+typedef struct PblCgiTemplate
+{
+	char * path;
+	PblCgiTemplateFile * files;
+	int nFiles;
+	int filesCapacity;
+	PblCgiTemplateOp * ops;
+	int nOps;
+	int opsCapacity;
+} PblCgiTemplate;
+
+static PblList * templateCache = NULL;
+
+static void pblCgiAddTemplateOp(PblCgiTemplate * compiled, int type, int file, char * text, size_t length)
+{
+	if (type == PBL_CGI_TEMPLATE_LITERAL && length == 0)
+	{
+		return;
+	}
+	compiled->ops = pblCgiGrowArray("pblCgiAddTemplateOp", compiled->ops, &compiled->opsCapacity,
+		compiled->nOps, sizeof(PblCgiTemplateOp));
+
+	PblCgiTemplateOp * op = compiled->ops + compiled->nOps++;
+	op->type = type;
+	op->file = file;
+	op->text = text;
+	op->length = length;
+	op->end = compiled->nOps;
+}
+
+static void pblCgiFreeTemplate(PblCgiTemplate * compiled)
+{
+	for (int i = 0; i < compiled->nOps; i++)
+	{
+		if (compiled->ops[i].type != PBL_CGI_TEMPLATE_LITERAL)
+		{
+			PBL_FREE(compiled->ops[i].text);
+		}
+	}
+	for (int i = 0; i < compiled->nFiles; i++)
+	{
+		PBL_FREE(compiled->files[i].path);
+		PBL_FREE(compiled->files[i].text);
+	}
+	PBL_FREE(compiled->ops);
+	PBL_FREE(compiled->files);
+	PBL_FREE(compiled->path);
+	PBL_FREE(compiled);
+}
+
+/*
+* Read a file of a template, returns the index of the file.
+*/
+static int pblCgiReadTemplateFile(PblCgiTemplate * compiled, char * filePath)
+{
+	static char * tag = "pblCgiReadTemplateFile";
+	struct stat fileStat;
+
+	FILE * stream = pblCgiFopen(filePath, "r");
+	if (stat(filePath, &fileStat))
+	{
+		pblCgiExitOnError("%s: Cannot stat file '%s', errno=%d\n", tag, filePath, errno);
+	}
+
+	char * text = pblCgiMalloc(tag, (size_t)fileStat.st_size + 1);
+	size_t length = fread(text, 1, (size_t)fileStat.st_size, stream);
+	text[length] = '\0';
+	fclose(stream);
+
+	compiled->files = pblCgiGrowArray(tag, compiled->files, &compiled->filesCapacity,
+		compiled->nFiles, sizeof(PblCgiTemplateFile));
+
+	PblCgiTemplateFile * file = compiled->files + compiled->nFiles;
+	file->path = pblCgiStrDup(filePath);
+	file->modificationTime = fileStat.st_mtime;
+	file->size = fileStat.st_size;
+	file->text = text;
+	return compiled->nFiles++;
+}
+
+/*
+* Find the end of a variable or directive, it has to be on the same line.
+*/
+static char * pblCgiFindOnLine(char * string, char * pattern)
+{
+	size_t length = strlen(pattern);
+	for (; *string && *string != '\n'; string++)
+	{
+		if (*string == *pattern && !strncmp(string, pattern, length))
+		{
+			return string;
+		}
+	}
+	return NULL;
+}
+
+static struct
+{
+	char * name;
+	int type;
+} pblCgiTemplateDirectives[] =
+{
+	{ "IFDEF", PBL_CGI_TEMPLATE_IFDEF },
+	{ "IFNDEF", PBL_CGI_TEMPLATE_IFNDEF },
+	{ "ENDIF", PBL_CGI_TEMPLATE_ENDIF },
+	{ "INCLUDE", PBL_CGI_TEMPLATE_INCLUDE },
+	{ "FOR", PBL_CGI_TEMPLATE_FOR },
+	{ "ENDFOR", PBL_CGI_TEMPLATE_ENDFOR },
+	{ NULL, 0 }
+};
+
+/*
+* Compile a file of a template and the files it includes, appends the operations to the template.
+*/
+static void pblCgiCompileTemplateFile(PblCgiTemplate * compiled, char * directory, char * fileName, int depth)
+{
+	static char * tag = "pblCgiCompileTemplateFile";
+
+	if (depth > PBL_CGI_MAX_INCLUDE_DEPTH)
+	{
+		pblCgiExitOnError("%s: Includes are nested deeper than %d at file '%s'\n", tag, PBL_CGI_MAX_INCLUDE_DEPTH, fileName);
+	}
+
+	char * filePath = pblCgiStrCat(directory, fileName);
+	int file = pblCgiReadTemplateFile(compiled, filePath);
+	PBL_FREE(filePath);
+
+	int first = compiled->nOps;
+	char * literal = compiled->files[file].text;
+	char * ptr = literal;
+
+	while ((ptr = strchr(ptr, '<')))
+	{
+		int type = 0;
+		char * key = NULL;
+		char * end = NULL;
+		size_t endLength = 0;
+
+		if (!strncmp(ptr, "<!--?", 5))
+		{
+			type = PBL_CGI_TEMPLATE_VALUE;
+			key = ptr + 5;
+			end = pblCgiFindOnLine(key, "-->");
+			endLength = 3;
+		}
+		else if (ptr[1] == '?')
+		{
+			type = PBL_CGI_TEMPLATE_VALUE;
+			key = ptr + 2;
+			end = pblCgiFindOnLine(key, ">");
+			endLength = 1;
+		}
+		else if (!strncmp(ptr, "<!--#", 5))
+		{
+			for (int i = 0; pblCgiTemplateDirectives[i].name; i++)
+			{
+				size_t length = strlen(pblCgiTemplateDirectives[i].name);
+				if (!strncmp(ptr + 5, pblCgiTemplateDirectives[i].name, length))
+				{
+					type = pblCgiTemplateDirectives[i].type;
+					key = ptr + 5 + length;
+					end = pblCgiFindOnLine(key, "-->");
+					endLength = 3;
+					break;
+				}
+			}
+		}
+		if (!type || !end)
+		{
+			ptr++;
+			continue;
+		}
+
+		pblCgiAddTemplateOp(compiled, PBL_CGI_TEMPLATE_LITERAL, file, literal, ptr - literal);
+		literal = ptr = end + endLength;
+
+		if (type == PBL_CGI_TEMPLATE_FOR || type == PBL_CGI_TEMPLATE_ENDFOR)
+		{
+			/*
+			* The line break following a loop directive is not part of the loop
+			*/
+			char * lineEnd = ptr + strspn(ptr, " \t\r");
+			if (*lineEnd == '\n' || !*lineEnd)
+			{
+				literal = ptr = lineEnd + (*lineEnd == '\n');
+			}
+		}
+
+		key = pblCgiStrRangeDup(key, end);
+		if (type == PBL_CGI_TEMPLATE_INCLUDE)
+		{
+			pblCgiCompileTemplateFile(compiled, directory, key, depth + 1);
+			PBL_FREE(key);
+		}
+		else if (type == PBL_CGI_TEMPLATE_VALUE && !*key)
+		{
+			PBL_FREE(key);
+		}
+		else
+		{
+			pblCgiAddTemplateOp(compiled, type, file, key, strlen(key));
+		}
+	}
+	pblCgiAddTemplateOp(compiled, PBL_CGI_TEMPLATE_LITERAL, file, literal, strlen(literal));
+
+	/*
+	* A directive without its ENDIF or ENDFOR extends to the end of the file
+	*/
+	int last = compiled->nOps;
+	for (int i = first; i < last; i++)
+	{
+		PblCgiTemplateOp * op = compiled->ops + i;
+		if (op->file != file)
+		{
+			continue;
+		}
+		int closingType;
+		if (op->type == PBL_CGI_TEMPLATE_IFDEF || op->type == PBL_CGI_TEMPLATE_IFNDEF)
+		{
+			closingType = PBL_CGI_TEMPLATE_ENDIF;
+		}
+		else if (op->type == PBL_CGI_TEMPLATE_FOR)
+		{
+			closingType = PBL_CGI_TEMPLATE_ENDFOR;
+		}
+		else
+		{
+			continue;
+		}
+
+		op->end = last;
+		for (int j = i + 1; j < last; j++)
+		{
+			PblCgiTemplateOp * closingOp = compiled->ops + j;
+			if (closingOp->file == file && closingOp->type == closingType && !strcmp(closingOp->text, op->text))
+			{
+				op->end = j;
+				break;
+			}
+		}
+	}
+}
+
+static int pblCgiTemplateIsCurrent(PblCgiTemplate * compiled)
+{
+	struct stat fileStat;
+
+	for (int i = 0; i < compiled->nFiles; i++)
+	{
+		PblCgiTemplateFile * file = compiled->files + i;
+		if (stat(file->path, &fileStat) || fileStat.st_mtime != file->modificationTime || fileStat.st_size != file->size)
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+* Get the compiled template from the cache, compile it if needed.
+*/
+static PblCgiTemplate * pblCgiGetTemplate(char * directory, char * fileName)
+{
+	static char * tag = "pblCgiGetTemplate";
+
+	if (!templateCache)
+	{
+		templateCache = pblListNewArrayList();
+		if (!templateCache)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+	}
+
+	char * filePath = pblCgiStrCat(directory, fileName);
+	for (int i = 0; i < pblListSize(templateCache); i++)
+	{
+		PblCgiTemplate * compiled = pblListGet(templateCache, i);
+		if (!strcmp(compiled->path, filePath))
+		{
+			if (pblCgiTemplateIsCurrent(compiled))
+			{
+				PBL_FREE(filePath);
+				return compiled;
+			}
+			pblListRemoveAt(templateCache, i);
+			pblCgiFreeTemplate(compiled);
+			break;
+		}
+	}
+
+	PblCgiTemplate * compiled = pbl_malloc0(tag, sizeof(PblCgiTemplate));
+	if (!compiled)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	compiled->path = filePath;
+	pblCgiCompileTemplateFile(compiled, directory, fileName, 0);
+
+	if (pblListAdd(templateCache, compiled) < 0)
+	{
+		pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+	}
+	PBL_CGI_TRACE("Compiled template %s, %d files, %d operations", filePath, compiled->nFiles, compiled->nOps);
+	return compiled;
+}
+
+/*
+* Append a value, '<' characters of the value are replaced by "&lt;".
+*/
+static void pblCgiOutputAppendValue(PblCgiOutput * output, char * value)
+{
+	for (char * ptr; (ptr = strchr(value, '<')); value = ptr + 1)
+	{
+		pblCgiOutputAppend(output, value, ptr - value);
+		pblCgiOutputAppend(output, "&lt;", 4);
+	}
+	pblCgiOutputAppend(output, value, strlen(value));
+}
+
+static int pblCgiTemplateIsDefined(char * key, int iteration)
+{
+	if (!*key)
+	{
+		return 0;
+	}
+	if (!strcmp(key, PBL_CGI_KEY_DURATION))
+	{
+		return 1;
+	}
+	return pblCgiValue(key) || (iteration >= 0 && pblCgiValueForIteration(key, iteration));
+}
+
+static void pblCgiRenderTemplate(PblCgiTemplate * compiled, PblCgiOutput * output, int from, int to, int iteration)
+{
+	for (int i = from; i < to; i++)
+	{
+		PblCgiTemplateOp * op = compiled->ops + i;
+		char * value = NULL;
+
+		switch (op->type)
+		{
+		case PBL_CGI_TEMPLATE_LITERAL:
+			pblCgiOutputAppend(output, op->text, op->length);
+			break;
+
+		case PBL_CGI_TEMPLATE_VALUE:
+			if (!strcmp(op->text, PBL_CGI_KEY_DURATION))
+			{
+				/*
+				* The duration is formatted into a new string, it is written right away
+				*/
+				value = pblCgiValue(op->text);
+				pblCgiOutputAppendValue(output, value);
+				pblCgiOutputFlush(output);
+				PBL_FREE(value);
+				break;
+			}
+			if (iteration >= 0)
+			{
+				value = pblCgiValueForIteration(op->text, iteration);
+			}
+			if (!value)
+			{
+				value = pblCgiValue(op->text);
+			}
+			if (value)
+			{
+				pblCgiOutputAppendValue(output, value);
+			}
+			break;
+
+		case PBL_CGI_TEMPLATE_IFDEF:
+			if (!pblCgiTemplateIsDefined(op->text, iteration))
+			{
+				i = op->end;
+			}
+			break;
+
+		case PBL_CGI_TEMPLATE_IFNDEF:
+			if (pblCgiTemplateIsDefined(op->text, iteration))
+			{
+				i = op->end;
+			}
+			break;
+
+		case PBL_CGI_TEMPLATE_FOR:
+			for (int j = 0; *op->text && pblCgiValueForIteration(op->text, j); j++)
+			{
+				pblCgiRenderTemplate(compiled, output, i + 1, op->end < to ? op->end : to, j);
+			}
+			i = op->end;
+			break;
+		}
+	}
+}
+
+/**
+* Print a template
+*/
+void pblCgiPrint(char * directory, char * fileName, char * contentType)
+{
+	PBL_CGI_TRACE("Directory=%s", directory);
+	PBL_CGI_TRACE("FileName=%s", fileName);
+	PBL_CGI_TRACE("ContentType=%s", contentType);
+
+	PblCgiTemplate * compiled = pblCgiGetTemplate(directory, fileName);
+
+	if (contentType)
+	{
+		pblCgiSetContentType(contentType);
+	}
+	pblCgiRenderTemplate(compiled, &pblCgiStdout, 0, compiled->nOps, -1);
+	pblCgiPutFlush();
+}
+
+/**
+* Create a new empty map
+*/
+PblMap * pblCgiNewMap(void)
+{
+	PblMap * map = pblMapNewHashMap();
+	if (!map)
+	{
+		pblCgiExitOnError("Failed to create a map, pbl_errno = %d\n", pbl_errno);
+	}
+	if (pblSetEnsureCapacity((PblSet *)map, 16) < 0)
+	{
+		pblCgiExitOnError("Failed to set initial capacity of map, pbl_errno = %d, message='%s'\n", pbl_errno, pbl_errstr);
+	}
+	return map;
+}
+
+/**
+* Test if a map is empty
+*/
+int pblCgiMapIsEmpty(PblMap * map)
+{
+	return 0 == pblMapSize(map);
+}
+
+/**
+* Release the memory used by a map
+*/
+void pblCgiMapFree(PblMap * map)
+{
+	if (map)
+	{
+		pblMapFree(map);
+	}
+}
+
+static PblMap * valueMap = NULL;
+
+PblMap * pblCgiValueMap()
+{
+	if (!valueMap)
+	{
+		valueMap = pblCgiNewMap();
+	}
+	return valueMap;
+}
+/**
+* Set a value for the given key.
+*/
+void pblCgiSetValue(char * key, char * value)
+{
+	pblCgiSetValueForIteration(key, value, -1);
+}
+
+/**
+* Set a value for the given key for a loop iteration.
+*/
+void pblCgiSetValueForIteration(char * key, char * value, int iteration)
+{
+	pblCgiSetValueToMap(key, value, iteration, pblCgiValueMap());
+}
+
+/**
+* Set a value for the given key for a loop iteration into a map.
+*/
+void pblCgiSetValueToMap(char * key, char * value, int iteration, PblMap * map)
+{
+	static char * tag = "pblCgiSetValueToMap";
+
+	if (!key || !*key)
+	{
+		return;
+	}
+	if (!value)
+	{
+		value = "";
+	}
+	if (iteration >= 0)
+	{
+		char * iteratedKey = pblCgiSprintf("%s_%d", key, iteration);
+
+		if (pblMapAddStrStr(map, iteratedKey, value) < 0)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		if (map == valueMap)
+		{
+			PBL_CGI_TRACE("Out %s=%s", iteratedKey, value);
+		}
+
+		PBL_FREE(iteratedKey);
+
+		iteratedKey = pblCgiSprintf("IDX_%d", iteration);
+		char * index = pblMapGetStr(map, iteratedKey);
+		if (!index)
+		{
+			index = pblCgiSprintf("%d", iteration);
+			if (pblMapAddStrStr(map, iteratedKey, index) < 0)
+			{
+				pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+			}
+			if (map == valueMap)
+			{
+				PBL_CGI_TRACE("Out %s=%s", iteratedKey, index);
+			}
+			PBL_FREE(index);
+		}
+		PBL_FREE(iteratedKey);
+	}
+	else
+	{
+		if (pblMapAddStrStr(map, key, value) < 0)
+		{
+			pblCgiExitOnError("%s: pbl_errno = %d, message='%s'\n", tag, pbl_errno, pbl_errstr);
+		}
+		if (map == valueMap)
+		{
+			PBL_CGI_TRACE("Out %s=%s", key, value);
+		}
+	}
+}
+
+/**
+* Clear the value for the given key.
+*/
+void pblCgiUnSetValue(char * key)
+{
+	pblCgiUnSetValueForIteration(key, -1);
+}
+
+/**
+* Clear all values.
+*/
+void pblCgiClearValues()
+{
+	if (!valueMap)
+	{
+		return;
+	}
+
+	PBL_CGI_TRACE("Out cleared");
+	pblMapClear(valueMap);
+}
+
+/**
+* Clear the value for the given key for a loop iteration.
+*/
+void pblCgiUnSetValueForIteration(char * key, int iteration)
+{
+	if (!valueMap)
+	{
+		return;
+	}
+	pblCgiUnSetValueFromMap(key, iteration, valueMap);
+}
+
+/**
+* Clear the value for the given key for a loop iteration from a map.
+*/
+void pblCgiUnSetValueFromMap(char * key, int iteration, PblMap * map)
+{
+	if (!key || !*key)
+	{
+		return;
+	}
+
+	if (iteration >= 0)
+	{
+		char * iteratedKey = pblCgiSprintf("%s_%d", key, iteration);
+
+		pblMapUnmapStr(map, iteratedKey);
+		PBL_CGI_TRACE("Del %s=", iteratedKey);
+		PBL_FREE(iteratedKey);
+	}
+	else
+	{
+		pblMapUnmapStr(map, key);
+		PBL_CGI_TRACE("Del %s=", key);
+	}
+}
+
+/**
+* Get the value for the given key.
+*/
+char * pblCgiValue(char * key)
+{
+	return pblCgiValueForIteration(key, -1);
+}
+
+static char * pblCgiDurationKey = PBL_CGI_KEY_DURATION;
+
+/**
+* Get the value for the given key for a loop iteration.
+*/
+char * pblCgiValueForIteration(char * key, int iteration)
+{
+	if (*key && *key == *pblCgiDurationKey && !strcmp(pblCgiDurationKey, key))
+	{
+		return pblCgiValueFromMap(key, iteration, valueMap);
+	}
+
+	if (!valueMap)
+	{
+		return NULL;
+	}
+	return pblCgiValueFromMap(key, iteration, valueMap);
+}
+
+/**
+* Get the value for the given key for a loop iteration from a map.
+*/
+char * pblCgiValueFromMap(char * key, int iteration, PblMap * map)
+{
+	static char * tag = "pblCgiValueFromMap";
+
+	if (*key && *key == *pblCgiDurationKey && !strcmp(pblCgiDurationKey, key))
+	{
+		struct timeval now;
+		gettimeofday(&now, NULL);
+
+		unsigned long duration = now.tv_sec * 1000000 + now.tv_usec;
+		duration -= pblCgiStartTime.tv_sec * 1000000 + pblCgiStartTime.tv_usec;
+		char * string = pblCgiSprintf("%lu", duration);
+		PBL_CGI_TRACE("Duration=%s microseconds", string);
+		return string;
+	}
+
+	if (!key || !*key)
+	{
+		pblCgiExitOnError("%s: Empty key not allowed!\n", tag, pbl_errstr);
+	}
+	if (iteration >= 0)
+	{
+		char buffer[PBL_CGI_MAX_ITERATED_KEY_LENGTH];
+		char * iteratedKey = pblCgiIteratedKey(buffer, sizeof(buffer), key, iteration);
+		char * value = pblMapGetStr(map, iteratedKey);
+		if (iteratedKey != buffer)
+		{
+			PBL_FREE(iteratedKey);
+		}
+		return value;
+	}
+	return pblMapGetStr(map, key);
+}
+
+#ifdef WIN32
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#include <stdint.h> // portable: uint64_t   MSVC: __int64 
+
+int gettimeofday(struct timeval * tp, struct timezone * tzp)
+{
+	// Note: some broken versions only have 8 trailing zero's, the correct epoch has 9 trailing zero's
+	// This magic number is the number of 100 nanosecond intervals since January 1, 1601 (UTC)
+	// until 00:00:00 January 1, 1970 
+	static const uint64_t EPOCH = ((uint64_t)116444736000000000ULL);
+
+	SYSTEMTIME  system_time;
+	FILETIME    file_time;
+	uint64_t    time;
+
+	GetSystemTime(&system_time);
+	SystemTimeToFileTime(&system_time, &file_time);
+	time = ((uint64_t)file_time.dwLowDateTime);
+	time += ((uint64_t)file_time.dwHighDateTime) << 32;
+
+	tp->tv_sec = (long)((time - EPOCH) / 10000000L);
+	tp->tv_usec = (long)(system_time.wMilliseconds * 1000);
+	return 0;
+}
+
+extern int getpid();
+
+#endif
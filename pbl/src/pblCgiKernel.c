@@ -0,0 +1,409 @@
+/*
+ pblCgiKernel.c - string kernels of the C Common Gateway Interface functions.
+
+ Copyright (c) 2018 Peter Graf. All rights reserved.
+
+ This file is part of PBL - The Program Base Library.
+ PBL is free software.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this library; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+ For more information on the Program Base Library or Peter Graf,
+ please see: http://www.mission-base.com/.
+ */
+ /*
+  * Make sure "strings <exe> | grep Id | sort -u" shows the source file versions
+  */
+char* pblCgiKernel_c_id = "$Id: pblCgiKernel.c,v 1.1 2019/07/20 12:00:00 peter Exp $";
+
+/*
+* The string kernels work on strings of a given length, so that they never read beyond the end
+* of a string. Each kernel has a scalar version and a version for AVX2, the AVX2 version is used
+* if the processor supports it. The vector versions handle 32 bytes at a time and leave the rest
+* to the scalar versions.
+*
+* Setting pblCgiKernelScalarOnly makes all kernels use their scalar versions,
+* so that the vector versions can be checked against them.
+*/
+#include <stdio.h>
+#include <string.h>
+
+#include "pblCgi.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#define PBL_CGI_KERNEL_AVX2
+#include <immintrin.h>
+
+#endif
+
+int pblCgiKernelScalarOnly = 0;
+
+static const char * pblCgiKernelHexDigits = "0123456789abcdef";
+
+static int pblCgiKernelHexValue(char c)
+{
+	if (c >= '0' && c <= '9')
+	{
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f')
+	{
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F')
+	{
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+/*
+* Control characters and '<' are not passed on from a query.
+*/
+static char pblCgiKernelCheckChar(char c)
+{
+	if (c < ' ' || c == '<')
+	{
+		return ' ';
+	}
+	return c;
+}
+
+static int pblCgiKernelIsSpace(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/*
+* Decode the character of the query at index i, returns the index of the next one.
+*/
+static size_t pblCgiKernelDecodeChar(char * destination, const char * source, size_t i, size_t length)
+{
+	if (source[i] == '+')
+	{
+		*destination = ' ';
+		return i + 1;
+	}
+	if (source[i] == '%' && i + 2 < length)
+	{
+		int high = pblCgiKernelHexValue(source[i + 1]);
+		int low = pblCgiKernelHexValue(source[i + 2]);
+		if (high >= 0 && low >= 0)
+		{
+			*destination = pblCgiKernelCheckChar((char)(high * 16 + low));
+			return i + 3;
+		}
+	}
+	*destination = pblCgiKernelCheckChar(source[i]);
+	return i + 1;
+}
+
+static size_t pblCgiKernelDecodeScalar(char * destination, const char * source, size_t i, size_t length, size_t n)
+{
+	while (i < length)
+	{
+		i = pblCgiKernelDecodeChar(destination + n++, source, i, length);
+	}
+	return n;
+}
+
+static size_t pblCgiKernelSpaceSpanScalar(const char * string, size_t i, size_t length)
+{
+	while (i < length && pblCgiKernelIsSpace(string[i]))
+	{
+		i++;
+	}
+	return i;
+}
+
+static size_t pblCgiKernelSpaceSpanEndScalar(const char * string, size_t length)
+{
+	while (length > 0 && pblCgiKernelIsSpace(string[length - 1]))
+	{
+		length--;
+	}
+	return length;
+}
+
+static void pblCgiKernelToHexScalar(char * destination, const unsigned char * source, size_t i, size_t length)
+{
+	for (; i < length; i++)
+	{
+		destination[2 * i] = pblCgiKernelHexDigits[source[i] >> 4];
+		destination[2 * i + 1] = pblCgiKernelHexDigits[source[i] & 0x0f];
+	}
+}
+
+static char * pblCgiKernelFindScalar(const char * string, size_t i, size_t length, const char * needle, size_t needleLength)
+{
+	while (i + needleLength <= length)
+	{
+		const char * ptr = memchr(string + i, needle[0], length - needleLength + 1 - i);
+		if (!ptr)
+		{
+			return NULL;
+		}
+		if (!memcmp(ptr, needle, needleLength))
+		{
+			return (char *)ptr;
+		}
+		i = ptr - string + 1;
+	}
+	return NULL;
+}
+
+#ifdef PBL_CGI_KERNEL_AVX2
+
+static int pblCgiKernelHasAvx2()
+{
+	static int result = -1;
+	if (result < 0)
+	{
+		__builtin_cpu_init();
+		result = __builtin_cpu_supports("avx2") ? 1 : 0;
+	}
+	return result;
+}
+
+__attribute__((target("avx2")))
+static size_t pblCgiKernelDecodeAvx2(char * destination, const char * source, size_t length)
+{
+	__m256i percent = _mm256_set1_epi8('%');
+	__m256i plus = _mm256_set1_epi8('+');
+	__m256i lessThan = _mm256_set1_epi8('<');
+	__m256i blank = _mm256_set1_epi8(' ');
+
+	size_t i = 0;
+	size_t n = 0;
+	while (i + 32 <= length)
+	{
+		__m256i bytes = _mm256_loadu_si256((const __m256i *)(source + i));
+		__m256i replaced = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, plus),
+			_mm256_or_si256(_mm256_cmpeq_epi8(bytes, lessThan), _mm256_cmpgt_epi8(blank, bytes)));
+		__m256i decoded = _mm256_blendv_epi8(bytes, blank, replaced);
+
+		unsigned int escapes = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, percent));
+		if (!escapes)
+		{
+			// when decoding in place, the bytes stored were read already
+			_mm256_storeu_si256((__m256i *)(destination + n), decoded);
+			i += 32;
+			n += 32;
+			continue;
+		}
+
+		// the bytes up to the escape are decoded, the escape may reach into the next block
+		size_t nBytes = __builtin_ctz(escapes);
+		char buffer[32];
+		_mm256_storeu_si256((__m256i *)buffer, decoded);
+		memcpy(destination + n, buffer, nBytes);
+		n += nBytes;
+		i = pblCgiKernelDecodeChar(destination + n++, source, i + nBytes, length);
+	}
+	return pblCgiKernelDecodeScalar(destination, source, i, length, n);
+}
+
+/*
+* A mask of the bytes that are white space.
+*/
+__attribute__((target("avx2")))
+static unsigned int pblCgiKernelSpaceMaskAvx2(const char * string)
+{
+	__m256i bytes = _mm256_loadu_si256((const __m256i *)string);
+	__m256i control = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+	__m256i isControl = _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8('\r' - '\t')), control);
+	__m256i isBlank = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '));
+	return (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(isControl, isBlank));
+}
+
+__attribute__((target("avx2")))
+static size_t pblCgiKernelSpaceSpanAvx2(const char * string, size_t length)
+{
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32)
+	{
+		unsigned int other = ~pblCgiKernelSpaceMaskAvx2(string + i);
+		if (other)
+		{
+			return i + __builtin_ctz(other);
+		}
+	}
+	return pblCgiKernelSpaceSpanScalar(string, i, length);
+}
+
+__attribute__((target("avx2")))
+static size_t pblCgiKernelSpaceSpanEndAvx2(const char * string, size_t length)
+{
+	for (; length >= 32; length -= 32)
+	{
+		unsigned int other = ~pblCgiKernelSpaceMaskAvx2(string + length - 32);
+		if (other)
+		{
+			return length - __builtin_clz(other);
+		}
+	}
+	return pblCgiKernelSpaceSpanEndScalar(string, length);
+}
+
+__attribute__((target("avx2")))
+static void pblCgiKernelToHexAvx2(char * destination, const unsigned char * source, size_t length)
+{
+	__m256i digits = _mm256_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f',
+		'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+	__m256i lowNibble = _mm256_set1_epi8(0x0f);
+
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32)
+	{
+		__m256i bytes = _mm256_loadu_si256((const __m256i *)(source + i));
+		__m256i high = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), lowNibble));
+		__m256i low = _mm256_shuffle_epi8(digits, _mm256_and_si256(bytes, lowNibble));
+
+		// the unpacks work per 128 bit lane, the permutes put the lanes in order
+		__m256i first = _mm256_unpacklo_epi8(high, low);
+		__m256i second = _mm256_unpackhi_epi8(high, low);
+		_mm256_storeu_si256((__m256i *)(destination + 2 * i), _mm256_permute2x128_si256(first, second, 0x20));
+		_mm256_storeu_si256((__m256i *)(destination + 2 * i + 32), _mm256_permute2x128_si256(first, second, 0x31));
+	}
+	pblCgiKernelToHexScalar(destination, source, i, length);
+}
+
+/*
+* Candidates are the positions where the first and the last byte of the needle match,
+* only they are compared with the needle.
+*/
+__attribute__((target("avx2")))
+static char * pblCgiKernelFindAvx2(const char * string, size_t length, const char * needle, size_t needleLength)
+{
+	__m256i first = _mm256_set1_epi8(needle[0]);
+	__m256i last = _mm256_set1_epi8(needle[needleLength - 1]);
+
+	size_t i = 0;
+	for (; i + needleLength - 1 + 32 <= length; i += 32)
+	{
+		__m256i firstBytes = _mm256_loadu_si256((const __m256i *)(string + i));
+		__m256i lastBytes = _mm256_loadu_si256((const __m256i *)(string + i + needleLength - 1));
+		unsigned int candidates = (unsigned int)_mm256_movemask_epi8(
+			_mm256_and_si256(_mm256_cmpeq_epi8(firstBytes, first), _mm256_cmpeq_epi8(lastBytes, last)));
+		while (candidates)
+		{
+			const char * ptr = string + i + __builtin_ctz(candidates);
+			if (!memcmp(ptr, needle, needleLength))
+			{
+				return (char *)ptr;
+			}
+			candidates &= candidates - 1;
+		}
+	}
+	return pblCgiKernelFindScalar(string, i, length, needle, needleLength);
+}
+
+#endif
+
+/**
+* The name of the kernels used on this machine.
+*/
+char * pblCgiKernelName(void)
+{
+#ifdef PBL_CGI_KERNEL_AVX2
+	if (!pblCgiKernelScalarOnly && pblCgiKernelHasAvx2())
+	{
+		return "avx2";
+	}
+#endif
+	return "scalar";
+}
+
+/**
+* Decode length bytes of a query, '+' and %xx escapes are decoded, control characters and '<' are replaced by blanks.
+*
+* The destination can be the source, decoding never makes a string longer. Returns the length decoded.
+*/
+size_t pblCgiKernelDecode(char * destination, const char * source, size_t length)
+{
+#ifdef PBL_CGI_KERNEL_AVX2
+	if (!pblCgiKernelScalarOnly && pblCgiKernelHasAvx2())
+	{
+		return pblCgiKernelDecodeAvx2(destination, source, length);
+	}
+#endif
+	return pblCgiKernelDecodeScalar(destination, source, 0, length, 0);
+}
+
+/**
+* Return the number of white space characters the string of the given length starts with.
+*/
+size_t pblCgiKernelSpaceSpan(const char * string, size_t length)
+{
+#ifdef PBL_CGI_KERNEL_AVX2
+	if (!pblCgiKernelScalarOnly && pblCgiKernelHasAvx2())
+	{
+		return pblCgiKernelSpaceSpanAvx2(string, length);
+	}
+#endif
+	return pblCgiKernelSpaceSpanScalar(string, 0, length);
+}
+
+/**
+* Return the length of the string of the given length without the white space it ends with.
+*/
+size_t pblCgiKernelSpaceSpanEnd(const char * string, size_t length)
+{
+#ifdef PBL_CGI_KERNEL_AVX2
+	if (!pblCgiKernelScalarOnly && pblCgiKernelHasAvx2())
+	{
+		return pblCgiKernelSpaceSpanEndAvx2(string, length);
+	}
+#endif
+	return pblCgiKernelSpaceSpanEndScalar(string, length);
+}
+
+/**
+* Write the 2 * length lower case hex digits of the bytes given, the destination is not terminated.
+*/
+void pblCgiKernelToHex(char * destination, const unsigned char * source, size_t length)
+{
+#ifdef PBL_CGI_KERNEL_AVX2
+	if (!pblCgiKernelScalarOnly && pblCgiKernelHasAvx2())
+	{
+		pblCgiKernelToHexAvx2(destination, source, length);
+		return;
+	}
+#endif
+	pblCgiKernelToHexScalar(destination, source, 0, length);
+}
+
+/**
+* Find the first occurrence of the needle in the string of the given length, like strstr.
+*/
+char * pblCgiKernelFind(const char * string, size_t length, const char * needle, size_t needleLength)
+{
+	if (!needleLength)
+	{
+		return (char *)string;
+	}
+	if (needleLength > length)
+	{
+		return NULL;
+	}
+#ifdef PBL_CGI_KERNEL_AVX2
+	if (!pblCgiKernelScalarOnly && pblCgiKernelHasAvx2())
+	{
+		return pblCgiKernelFindAvx2(string, length, needle, needleLength);
+	}
+#endif
+	return pblCgiKernelFindScalar(string, 0, length, needle, needleLength);
+}